@@ -0,0 +1,625 @@
+// Copyright 2023 Michael J Roberts
+// BSD 3-clause license - NO WARRANTY
+//
+// DCS Batch Encoder - main program entrypoint
+//
+// This program encodes a batch of audio files into raw DCS stream
+// files, in the "DCSa" format that DCS Explorer uses for raw stream
+// extraction.  The DCS Encoder script compiler imports those files
+// directly, without re-encoding them, so a sound library can be encoded
+// once, ahead of time, and the ROM build then only has to pack the
+// streams into place.  That's the expensive part of building a ROM
+// from thousands of clips, and it doesn't depend on the prototype ROM
+// or the script, so it's worth doing separately.
+//
+// The files are encoded in parallel on a pool of worker threads, each
+// with its own encoder instance.  A worker takes one file at a time,
+// from loading the source audio through writing the output file, and
+// the results are reported and discarded as each file finishes, so
+// the memory used depends on the number of threads and the size of the
+// largest single clip, not on the number of files in the batch.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include "../DCSEncoder/DCSEncoder.h"
+#include "../Utilities/BuildDate.h"
+
+#pragma comment(lib, "DCSDecoder")
+
+namespace fs = std::filesystem;
+
+
+// --------------------------------------------------------------------------
+//
+// Input file list
+//
+
+// Encoding job.  'output' is the raw DCS stream file to write.
+struct Job
+{
+	std::string input;
+	std::string output;
+};
+
+// Is the file one of the types that the encoder accepts?  This is used
+// to pick out the audio files when expanding a folder or a wildcard.
+static bool IsAudioFile(const fs::path &path)
+{
+	auto ext = path.extension().string();
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	return ext == ".wav" || ext == ".mp3" || ext == ".ogg" || ext == ".flac" || ext == ".dcs";
+}
+
+// Match a filename against a wildcard pattern, with '*' matching any
+// run of characters and '?' matching any single character.  Matching
+// is case-insensitive, as in the Windows file system.
+static bool MatchWildcard(const char *pat, const char *name)
+{
+	const char *starPat = nullptr, *starName = nullptr;
+	while (*name != 0)
+	{
+		if (*pat == '*')
+		{
+			// note the position, and try matching nothing at first
+			starPat = ++pat;
+			starName = name;
+		}
+		else if (*pat == '?' || tolower(static_cast<unsigned char>(*pat)) == tolower(static_cast<unsigned char>(*name)))
+		{
+			++pat, ++name;
+		}
+		else if (starPat != nullptr)
+		{
+			// mismatch after a '*' - let the '*' absorb one more character
+			pat = starPat;
+			name = ++starName;
+		}
+		else
+			return false;
+	}
+
+	// the rest of the pattern has to be all '*'s
+	while (*pat == '*')
+		++pat;
+	return *pat == 0;
+}
+
+// Input list builder
+class InputList
+{
+public:
+	InputList(const std::string &outDir, bool recurse) : outDir(outDir), recurse(recurse) { }
+
+	// Add a command-line input argument:
+	//
+	//   @file    - manifest file, listing one input per line
+	//   folder   - all of the audio files in the folder
+	//   pattern  - all of the audio files matching a wildcard pattern in
+	//              the last path element (e.g., "clips\*.wav")
+	//   file     - a single audio file
+	//
+	// Relative paths in a manifest are relative to the manifest's folder.
+	void Add(const std::string &arg, const fs::path &baseDir = fs::path())
+	{
+		if (arg.size() != 0 && arg[0] == '@')
+			AddManifest(baseDir / fs::path(arg.substr(1)));
+		else
+			AddPath(baseDir / fs::path(arg));
+	}
+
+	// jobs to run
+	std::vector<Job> jobs;
+
+	// number of errors found while building the list
+	int nErrors = 0;
+
+protected:
+	void AddManifest(const fs::path &manifest)
+	{
+		FILE *fp = nullptr;
+		if (fopen_s(&fp, manifest.string().c_str(), "r") != 0 || fp == nullptr)
+		{
+			printf("Unable to open manifest file %s\n", manifest.string().c_str());
+			++nErrors;
+			return;
+		}
+		std::unique_ptr<FILE, int(*)(FILE*)> fpHolder(fp, &fclose);
+
+		// read the lines, skipping blank lines and '#' comments
+		char buf[4096];
+		while (fgets(buf, sizeof(buf), fp) != nullptr)
+		{
+			char *p = buf;
+			while (isspace(static_cast<unsigned char>(*p)))
+				++p;
+			size_t len = strlen(p);
+			while (len != 0 && isspace(static_cast<unsigned char>(p[len - 1])))
+				p[--len] = 0;
+			if (len != 0 && *p != '#')
+				Add(p, manifest.parent_path());
+		}
+	}
+
+	void AddPath(const fs::path &path)
+	{
+		std::error_code ec;
+		auto name = path.filename().string();
+		if (name.find_first_of("*?") != std::string::npos)
+		{
+			// wildcard pattern - scan the parent folder for matching audio files
+			auto dir = path.parent_path();
+			std::vector<fs::path> files;
+			for (auto &entry : fs::directory_iterator(dir.empty() ? fs::path(".") : dir, ec))
+			{
+				if (entry.is_regular_file(ec) && IsAudioFile(entry.path())
+					&& MatchWildcard(name.c_str(), entry.path().filename().string().c_str()))
+					files.emplace_back(entry.path());
+			}
+			if (ec || files.size() == 0)
+			{
+				printf("No audio files match %s\n", path.string().c_str());
+				++nErrors;
+				return;
+			}
+			std::sort(files.begin(), files.end());
+			for (auto &f : files)
+				AddFile(f, fs::path());
+		}
+		else if (fs::is_directory(path, ec))
+		{
+			// Folder - add all of the audio files it contains.  When
+			// recursing into subfolders, the output files go into the
+			// same subfolder structure under the output folder.
+			std::vector<std::pair<fs::path, fs::path>> files;
+			auto Scan = [&files, &path, &ec](auto &iter)
+			{
+				for (auto &entry : iter)
+				{
+					if (entry.is_regular_file(ec) && IsAudioFile(entry.path()))
+						files.emplace_back(entry.path(), entry.path().parent_path().lexically_relative(path));
+				}
+			};
+			if (recurse)
+			{
+				fs::recursive_directory_iterator iter(path, ec);
+				Scan(iter);
+			}
+			else
+			{
+				fs::directory_iterator iter(path, ec);
+				Scan(iter);
+			}
+			std::sort(files.begin(), files.end());
+			for (auto &f : files)
+				AddFile(f.first, f.second);
+		}
+		else if (fs::is_regular_file(path, ec))
+		{
+			AddFile(path, fs::path());
+		}
+		else
+		{
+			printf("Input file %s not found\n", path.string().c_str());
+			++nErrors;
+		}
+	}
+
+	void AddFile(const fs::path &input, const fs::path &relDir)
+	{
+		// The output goes in the output folder, if there is one, otherwise
+		// alongside the input file, with the extension changed to .dcs.
+		fs::path output = ((outDir.size() != 0 ? fs::path(outDir) / relDir : input.parent_path())
+			/ input.filename().replace_extension(".dcs")).lexically_normal();
+
+		// Make sure that we're not overwriting the input, or an output
+		// from an earlier file in the batch.  Names are compared without
+		// regard to case, since the Windows file system is insensitive
+		// to case.  The same input file can turn up more than once when
+		// inputs overlap (a manifest entry that also matches a wildcard,
+		// say), so just drop repeats of the same input.
+		auto Key = [](const fs::path &p)
+		{
+			auto s = p.lexically_normal().string();
+			std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+			return s;
+		};
+		auto key = Key(output);
+		if (key == Key(input))
+		{
+			printf("%s: the output file would overwrite the input file; use --out to select an output folder\n",
+				input.string().c_str());
+			++nErrors;
+			return;
+		}
+		if (auto it = outputs.find(key); it != outputs.end())
+		{
+			if (Key(jobs[it->second].input) == Key(input))
+				return;
+
+			printf("%s: the output file %s is already used for %s\n",
+				input.string().c_str(), output.string().c_str(), jobs[it->second].input.c_str());
+			++nErrors;
+			return;
+		}
+
+		outputs.emplace(key, jobs.size());
+		jobs.emplace_back(Job{ input.string(), output.string() });
+	}
+
+	// output folder, or empty to write each output file alongside its input
+	std::string outDir;
+
+	// recurse into subfolders when expanding a folder argument
+	bool recurse;
+
+	// output files assigned so far, by normalized name, with the job index
+	std::unordered_map<std::string, size_t> outputs;
+};
+
+
+// --------------------------------------------------------------------------
+//
+// Encoding
+//
+
+// Statistics for the batch
+struct BatchStats
+{
+	int nOK = 0;
+	int nFailed = 0;
+	int nSkipped = 0;
+	uint64_t nFrames = 0;
+	uint64_t nBytes = 0;
+};
+
+// Get the format type description for an encoded stream, from the stream
+// header, which follows the 16-bit frame count.  Bit 7 of the first header
+// byte gives the major type.  For the 1994+ format, bit 7 of the second
+// byte selects subtype 0 or 3 (the decoder treats subtypes 1 and 2 the
+// same as 3, so the encoder only generates 0 and 3).
+static std::string FormatTypeName(const DCSEncoder::DCSAudio &dcsObj, uint16_t formatVersion)
+{
+	if (dcsObj.nBytes < 4)
+		return "?";
+	int type = (dcsObj.data.get()[2] & 0x80) != 0 ? 1 : 0;
+	if (formatVersion != 0x9400)
+		return DCSEncoder::format("%d", type);
+	int subType = (dcsObj.data.get()[3] & 0x80) != 0 ? 3 : 0;
+	return DCSEncoder::format("%d.%d", type, subType);
+}
+
+static int EncodeBatch(const std::vector<Job> &jobs, const DCSEncoder::CompressionParams &params,
+	const std::string &cacheDir, int nThreads, bool update, bool quiet)
+{
+	BatchStats stats;
+	std::mutex statsMutex;
+	size_t nDone = 0;
+
+	// Encode one file.  Runs on a worker thread, with the worker's
+	// private encoder.
+	auto ProcessFile = [&](DCSEncoder &encoder, const Job &job)
+	{
+		auto t0 = std::chrono::steady_clock::now();
+		std::error_code ec;
+
+		// In update mode, skip the file if the output is newer than the
+		// input.  This only considers the file times, so a change to the
+		// encoding parameters requires a full run.
+		if (update && fs::exists(job.output, ec)
+			&& fs::last_write_time(job.output, ec) >= fs::last_write_time(job.input, ec) && !ec)
+		{
+			std::lock_guard<std::mutex> lock(statsMutex);
+			++stats.nSkipped;
+			++nDone;
+			return;
+		}
+
+		// Encode the file, and write the result to a temporary file, which
+		// we rename into place when complete, so that an interrupted run
+		// can't leave a truncated output file that an update run would
+		// mistake for a finished one.
+		DCSEncoder::DCSAudio dcsObj;
+		std::string errorMessage;
+		std::string tmpFile = job.output + ".tmp";
+		bool ok = encoder.EncodeFile(job.input.c_str(), dcsObj, errorMessage);
+		if (ok)
+		{
+			if (auto dir = fs::path(job.output).parent_path(); !dir.empty())
+				fs::create_directories(dir, ec);
+			ok = DCSEncoder::SaveDCSFile(tmpFile.c_str(), dcsObj, params.formatVersion, errorMessage);
+		}
+		if (ok)
+		{
+			fs::rename(tmpFile, job.output, ec);
+			if (ec)
+			{
+				errorMessage = DCSEncoder::format("Unable to rename the temporary file to \"%s\": %s",
+					job.output.c_str(), ec.message().c_str());
+				fs::remove(tmpFile, ec);
+				ok = false;
+			}
+		}
+		else
+			fs::remove(tmpFile, ec);
+
+		double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+		// report the result
+		std::lock_guard<std::mutex> lock(statsMutex);
+		++nDone;
+		if (ok)
+		{
+			++stats.nOK;
+			stats.nFrames += dcsObj.nFrames;
+			stats.nBytes += dcsObj.nBytes;
+			if (!quiet)
+			{
+				double seconds = dcsObj.nFrames * 240.0 / 31250.0;
+				double ratio = dcsObj.nBytes != 0 ? dcsObj.nFrames * 480.0 / dcsObj.nBytes : 0.0;
+				printf("[%zu/%zu] %s -> %s: %.2f sec, %d frames, %zu bytes (%.1f:1, %.0f bps), type %s, %.2f sec to encode\n",
+					nDone, jobs.size(), job.input.c_str(), job.output.c_str(),
+					seconds, dcsObj.nFrames, dcsObj.nBytes, ratio,
+					seconds != 0.0 ? dcsObj.nBytes * 8.0 / seconds : 0.0,
+					FormatTypeName(dcsObj, params.formatVersion).c_str(), dt);
+			}
+		}
+		else
+		{
+			++stats.nFailed;
+			printf("[%zu/%zu] %s: error: %s\n", nDone, jobs.size(), job.input.c_str(), errorMessage.c_str());
+		}
+	};
+
+	// run the jobs
+	auto t0 = std::chrono::steady_clock::now();
+	if (nThreads <= 0)
+		nThreads = static_cast<int>(std::thread::hardware_concurrency());
+	if (nThreads <= 0)
+		nThreads = 1;
+	std::atomic<size_t> next(0);
+	std::vector<std::thread> workers;
+	for (int i = 0 ; i < nThreads && i < static_cast<int>(jobs.size()) ; ++i)
+	{
+		workers.emplace_back([&next, &jobs, &params, &cacheDir, &ProcessFile]()
+		{
+			DCSEncoder encoder;
+			encoder.compressionParams = params;
+			encoder.analysisCacheDir = cacheDir;
+			for (size_t n ; (n = next++) < jobs.size() ; )
+				ProcessFile(encoder, jobs[n]);
+		});
+	}
+	for (auto &t : workers)
+		t.join();
+	double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	// show the summary
+	double seconds = static_cast<double>(stats.nFrames) * 240.0 / 31250.0;
+	printf("\nEncoded %d file%s, %.1f seconds of audio, %llu bytes, in %.2f seconds (%.1fx real time, %zu thread%s)\n",
+		stats.nOK, stats.nOK == 1 ? "" : "s", seconds, static_cast<unsigned long long>(stats.nBytes),
+		dt, dt != 0.0 ? seconds / dt : 0.0, workers.size(), workers.size() == 1 ? "" : "s");
+	if (stats.nSkipped != 0)
+		printf("%d file%s already up to date\n", stats.nSkipped, stats.nSkipped == 1 ? "" : "s");
+	if (stats.nFailed != 0)
+		printf("%d file%s failed\n", stats.nFailed, stats.nFailed == 1 ? "" : "s");
+
+	return stats.nFailed == 0 ? 0 : 1;
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Main entrypoint
+//
+int main(int argc, char **argv)
+{
+	int nThreads = 0;
+	bool quiet = false;
+	bool recurse = false;
+	bool update = false;
+	std::string outDir;
+	std::string cacheDir;
+
+	// Encoding parameters.  As in the script compiler, the format type
+	// and subtype default to trying all options and keeping the smallest.
+	DCSEncoder::CompressionParams params;
+	params.streamFormatType = -1;
+	params.streamFormatSubType = -1;
+
+	auto Usage = []()
+	{
+		printf("DCS Batch Encoder  (build %s)\n"
+			"Usage: dcsbatchencoder [options] <input> ...\n"
+			"\n"
+			"Encodes audio files (WAV, MP3, Ogg, FLAC, or raw DCS streams) into raw DCS\n"
+			"stream files (.dcs), which the DCS Encoder script compiler can import without\n"
+			"re-encoding.  Each <input> can be:\n"
+			"\n"
+			"   <file>             a single audio file\n"
+			"   <folder>           all of the audio files in the folder\n"
+			"   <folder>\\<pattern> the audio files matching a wildcard pattern (* and ?)\n"
+			"   @<manifest>        a text file listing the inputs, one per line\n"
+			"\n"
+			"Options:\n"
+			"   --out=<folder>     output folder (default is each input file's folder)\n"
+			"   --recurse          include subfolders when an input is a folder; the output\n"
+			"                      files go into the same subfolders under --out\n"
+			"   --update           skip files whose output file is newer than the input\n"
+			"   --threads=<n>      number of worker threads (default is the number of\n"
+			"                      hardware threads)\n"
+			"   --analysis-cache=<folder>\n"
+			"                      cache the analyzed audio frames in <folder>, to speed\n"
+			"                      up re-encoding the same files with new parameters\n"
+			"   --format=<ver>     DCS format version: 94 (default), 93, 93a\n"
+			"   --type=<n>         stream format type: 0, 1, or * (default *)\n"
+			"   --subtype=<n>      stream format subtype: 0, 1, 2, 3, or * (default *)\n"
+			"   --bitrate=<n>      target bit rate, 48000 to 256000 (default 128000)\n"
+			"   --powercut=<pct>   power band cutoff percentage (default 97)\n"
+			"   --minrange=<n>     minimum band dynamic range (default 10)\n"
+			"   --maxerror=<n>     maximum quantization error (default 10)\n"
+			"   -q                 quiet mode; only show errors and the summary\n",
+			ProgramBuildDate().YYYYMMDD().c_str());
+		exit(1);
+	};
+
+	// parse options
+	int argi = 1;
+	for (; argi < argc && argv[argi][0] == '-' ; ++argi)
+	{
+		const char *argp = argv[argi];
+		if (strcmp(argp, "--") == 0)
+		{
+			// explicit last option
+			++argi;
+			break;
+		}
+		else if (strncmp(argp, "--out=", 6) == 0)
+		{
+			// output folder
+			outDir = argp + 6;
+		}
+		else if (strcmp(argp, "--recurse") == 0)
+		{
+			// include subfolders
+			recurse = true;
+		}
+		else if (strcmp(argp, "--update") == 0)
+		{
+			// skip up-to-date outputs
+			update = true;
+		}
+		else if (strncmp(argp, "--threads=", 10) == 0)
+		{
+			// worker thread count
+			nThreads = atoi(argp + 10);
+		}
+		else if (strncmp(argp, "--analysis-cache=", 17) == 0)
+		{
+			// analysis cache folder
+			cacheDir = argp + 17;
+		}
+		else if (strncmp(argp, "--format=", 9) == 0)
+		{
+			// format version
+			const char *v = argp + 9;
+			if (strcmp(v, "94") == 0)
+				params.formatVersion = 0x9400;
+			else if (strcmp(v, "93") == 0 || strcmp(v, "93b") == 0)
+				params.formatVersion = 0x9302;
+			else if (strcmp(v, "93a") == 0)
+				params.formatVersion = 0x9301;
+			else
+			{
+				printf("Invalid --format value \"%s\"; must be 94, 93, or 93a\n", v);
+				exit(1);
+			}
+		}
+		else if (strncmp(argp, "--type=", 7) == 0)
+		{
+			// stream format type
+			const char *v = argp + 7;
+			params.streamFormatType = strcmp(v, "*") == 0 ? -1 : atoi(v);
+			if (!(params.streamFormatType >= -1 && params.streamFormatType <= 1))
+			{
+				printf("Invalid --type value \"%s\"; must be 0, 1, or *\n", v);
+				exit(1);
+			}
+		}
+		else if (strncmp(argp, "--subtype=", 10) == 0)
+		{
+			// stream format subtype
+			const char *v = argp + 10;
+			params.streamFormatSubType = strcmp(v, "*") == 0 ? -1 : atoi(v);
+			if (!(params.streamFormatSubType >= -1 && params.streamFormatSubType <= 3))
+			{
+				printf("Invalid --subtype value \"%s\"; must be 0, 1, 2, 3, or *\n", v);
+				exit(1);
+			}
+		}
+		else if (strncmp(argp, "--bitrate=", 10) == 0)
+		{
+			// target bit rate
+			params.targetBitRate = atoi(argp + 10);
+			if (params.targetBitRate < 48000 || params.targetBitRate > 256000)
+			{
+				printf("Invalid --bitrate value; must be 48000 to 256000\n");
+				exit(1);
+			}
+		}
+		else if (strncmp(argp, "--powercut=", 11) == 0)
+		{
+			// power band cutoff, as a percentage
+			float pct = static_cast<float>(atof(argp + 11));
+			if (pct < 0.0f || pct > 100.0f)
+			{
+				printf("Invalid --powercut value; must be 0.0 to 100.0\n");
+				exit(1);
+			}
+			params.powerBandCutoff = pct / 100.0f;
+		}
+		else if (strncmp(argp, "--minrange=", 11) == 0)
+		{
+			// minimum dynamic range, in 16-bit sample units
+			float val = static_cast<float>(atof(argp + 11));
+			if (val < 0.0f || val > 65536.0f)
+			{
+				printf("Invalid --minrange value; must be 0 to 65536\n");
+				exit(1);
+			}
+			params.minimumDynamicRange = val / 32768.0f;
+		}
+		else if (strncmp(argp, "--maxerror=", 11) == 0)
+		{
+			// maximum quantization error, in 16-bit sample units
+			float val = static_cast<float>(atof(argp + 11));
+			if (val < 0.0f || val > 65536.0f)
+			{
+				printf("Invalid --maxerror value; must be 0 to 65536\n");
+				exit(1);
+			}
+			params.maximumQuantizationError = val / 32768.0f;
+		}
+		else if (strcmp(argp, "-q") == 0)
+		{
+			// quiet mode
+			quiet = true;
+		}
+		else
+			Usage();
+	}
+
+	// we need at least one input
+	if (argi >= argc)
+		Usage();
+
+	// build the job list
+	InputList inputs(outDir, recurse);
+	for (; argi < argc ; ++argi)
+		inputs.Add(argv[argi]);
+	if (inputs.nErrors != 0)
+	{
+		printf("\nNo files were encoded, due to errors in the input list\n");
+		return 2;
+	}
+	if (inputs.jobs.size() == 0)
+	{
+		printf("No files to encode\n");
+		return 2;
+	}
+
+	// encode the files
+	return EncodeBatch(inputs.jobs, params, cacheDir, nThreads, update, quiet);
+}
@@ -0,0 +1,700 @@
+// Copyright 2023 Michael J Roberts
+// BSD 3-clause license - NO WARRANTY
+//
+// DCS Benchmark - timing framework and main program entrypoint
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <string>
+#include <list>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
+#include "Benchmark.h"
+#include "../DCSDecoder/PlatformSpecific.h"
+#include "../Utilities/BuildDate.h"
+
+#pragma comment(lib, "DCSDecoder")
+
+// optimization barrier
+volatile uint32_t Benchmark::sink = 0;
+
+
+// --------------------------------------------------------------------------
+//
+// Measurement
+//
+
+bool Benchmark::IsSelected(const char *name) const
+{
+	return options.filter.size() == 0 || strstr(name, options.filter.c_str()) != nullptr;
+}
+
+const Benchmark::Result *Benchmark::Run(const char *name, const char *unit, double unitsPerOp,
+	std::function<void(uint64_t n)> fn)
+{
+	// skip it if it's filtered out
+	if (!IsSelected(name))
+		return nullptr;
+
+	// in list mode, just show the name
+	if (options.listOnly)
+	{
+		printf("%s\n", name);
+		return nullptr;
+	}
+
+	// time one batch of n iterations, in nanoseconds
+	using clock = std::chrono::steady_clock;
+	auto TimeBatch = [&fn](uint64_t n)
+	{
+		auto t0 = clock::now();
+		fn(n);
+		auto t1 = clock::now();
+		return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count());
+	};
+
+	// Calibrate the batch size.  Start with one iteration, and keep
+	// doubling until a batch takes at least the target time.  The
+	// calibration runs double as the start of the warm-up period.
+	auto warmupStart = clock::now();
+	const double batchTarget_ns = options.batch_ms * 1.0e6;
+	uint64_t n = 1;
+	for (;;)
+	{
+		double t = TimeBatch(n);
+		if (t >= batchTarget_ns || n >= (1ULL << 40))
+			break;
+
+		// Scale up towards the target, by at most 10x per step, so that
+		// one very fast first call doesn't make us overshoot wildly
+		double scale = t > 0.0 ? batchTarget_ns / t : 10.0;
+		scale = scale < 2.0 ? 2.0 : scale > 10.0 ? 10.0 : scale;
+		n = static_cast<uint64_t>(n * scale) + 1;
+	}
+
+	// finish the warm-up period with untimed batches
+	while (std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - warmupStart).count() < options.warmup_ms)
+		fn(n);
+
+	// run the timed batches
+	std::vector<double> samples;
+	samples.reserve(options.reps);
+	for (int i = 0 ; i < options.reps ; ++i)
+		samples.push_back(TimeBatch(n) / static_cast<double>(n));
+
+	// add the result
+	return AddResult(name, unit, unitsPerOp, n, samples);
+}
+
+const Benchmark::Result *Benchmark::AddResult(const char *name, const char *unit, double unitsPerOp,
+	uint64_t itersPerRep, std::vector<double> &samples)
+{
+	// there's nothing to report without any samples
+	if (samples.size() == 0)
+		return nullptr;
+
+	// figure the statistics
+	std::sort(samples.begin(), samples.end());
+	auto Percentile = [&samples](double p)
+	{
+		// nearest-rank percentile
+		size_t idx = static_cast<size_t>(ceil(p / 100.0 * samples.size()));
+		idx = idx == 0 ? 0 : idx - 1;
+		return samples[idx < samples.size() ? idx : samples.size() - 1];
+	};
+	double sum = 0.0, sumSq = 0.0;
+	for (double s : samples)
+	{
+		sum += s;
+		sumSq += s * s;
+	}
+
+	Result &r = results.emplace_back();
+	r.name = name;
+	r.unit = unit;
+	r.unitsPerOp = unitsPerOp;
+	r.itersPerRep = itersPerRep;
+	r.reps = static_cast<int>(samples.size());
+	r.min_ns = samples.front();
+	r.median_ns = Percentile(50.0);
+	r.p90_ns = Percentile(90.0);
+	r.p99_ns = Percentile(99.0);
+	r.max_ns = samples.back();
+	r.mean_ns = sum / samples.size();
+	double variance = sumSq / samples.size() - r.mean_ns * r.mean_ns;
+	r.stddev_ns = variance > 0.0 ? sqrt(variance) : 0.0;
+
+	// show it
+	if (!options.quiet)
+		PrintResult(r);
+
+	// return the new result
+	return &r;
+}
+
+void Benchmark::PrintHeader() const
+{
+	printf("%-44s %11s %11s %11s %11s %7s  %s\n",
+		"Benchmark", "min ns", "median ns", "p90 ns", "p99 ns", "cv%", "throughput");
+}
+
+void Benchmark::PrintResult(const Result &r) const
+{
+	// Figure the throughput in work units per second, scaling to
+	// thousands or millions for readability
+	double perSec = r.median_ns > 0.0 ? r.unitsPerOp * 1.0e9 / r.median_ns : 0.0;
+	const char *scale = "";
+	if (perSec >= 1.0e6)
+		perSec /= 1.0e6, scale = "M";
+	else if (perSec >= 1.0e4)
+		perSec /= 1.0e3, scale = "K";
+
+	printf("%-44s %11.1f %11.1f %11.1f %11.1f %7.2f  %.2f%s %ss/sec\n",
+		r.name.c_str(), r.min_ns, r.median_ns, r.p90_ns, r.p99_ns,
+		r.mean_ns > 0.0 ? r.stddev_ns * 100.0 / r.mean_ns : 0.0,
+		perSec, scale, r.unit.c_str());
+}
+
+
+// --------------------------------------------------------------------------
+//
+// JSON result files
+//
+
+bool Benchmark::WriteJSON(const char *filename, std::string &errorMessage) const
+{
+	FILE *fp = nullptr;
+	if (fopen_s(&fp, filename, "w") != 0 || fp == nullptr)
+	{
+		errorMessage = "Unable to open file for writing";
+		return false;
+	}
+
+	// get the current time, for the run timestamp
+	time_t now = time(nullptr);
+	struct tm tm;
+	localtime_s(&tm, &now);
+	char timestamp[64];
+	strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", &tm);
+
+	// write the run information
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"tool\": \"DCSBenchmark\",\n");
+	fprintf(fp, "  \"formatVersion\": 1,\n");
+	fprintf(fp, "  \"timestamp\": \"%s\",\n", timestamp);
+	fprintf(fp, "  \"build\": \"%s\",\n", ProgramBuildDate().YYYYMMDD().c_str());
+	fprintf(fp, "  \"options\": { \"warmup_ms\": %d, \"reps\": %d, \"batch_ms\": %.3f },\n",
+		options.warmup_ms, options.reps, options.batch_ms);
+
+	// Write the results, one object per line.  Benchmark names are
+	// restricted to plain identifier characters and dots, so they
+	// don't need any escaping.
+	fprintf(fp, "  \"results\": [\n");
+	size_t i = 0;
+	for (auto &r : results)
+	{
+		fprintf(fp, "    { \"name\": \"%s\", \"unit\": \"%s\", \"unitsPerOp\": %.6g, \"itersPerRep\": %llu, \"reps\": %d, "
+			"\"min_ns\": %.3f, \"median_ns\": %.3f, \"p90_ns\": %.3f, \"p99_ns\": %.3f, \"max_ns\": %.3f, "
+			"\"mean_ns\": %.3f, \"stddev_ns\": %.3f }%s\n",
+			r.name.c_str(), r.unit.c_str(), r.unitsPerOp, static_cast<unsigned long long>(r.itersPerRep), r.reps,
+			r.min_ns, r.median_ns, r.p90_ns, r.p99_ns, r.max_ns, r.mean_ns, r.stddev_ns,
+			++i < results.size() ? "," : "");
+	}
+	fprintf(fp, "  ]\n");
+	fprintf(fp, "}\n");
+
+	// check for write errors on close
+	if (fclose(fp) != 0)
+	{
+		errorMessage = "Error writing file";
+		return false;
+	}
+	return true;
+}
+
+// Minimal JSON reader.  This is just enough of a JSON parser to read
+// back the result files we write - it handles the full JSON value
+// syntax, but it only extracts the string and number fields of the
+// objects in the "results" array, and ignores everything else.
+namespace {
+	class JSONReader
+	{
+	public:
+		JSONReader(const char *p, const char *end) : p(p), end(end) { }
+
+		const char *p;
+		const char *end;
+		std::string error;
+
+		// parsed field values for the current object
+		std::unordered_map<std::string, std::string> strFields;
+		std::unordered_map<std::string, double> numFields;
+
+		void SkipSpace()
+		{
+			while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+				++p;
+		}
+
+		bool Expect(char c)
+		{
+			SkipSpace();
+			if (p < end && *p == c)
+			{
+				++p;
+				return true;
+			}
+			if (error.size() == 0)
+				error = std::string("Expected '") + c + "'";
+			return false;
+		}
+
+		bool ReadString(std::string &s)
+		{
+			if (!Expect('"'))
+				return false;
+			s.clear();
+			while (p < end && *p != '"')
+			{
+				if (*p == '\\' && p + 1 < end)
+				{
+					++p;
+					switch (*p)
+					{
+					case 'n': s += '\n'; break;
+					case 't': s += '\t'; break;
+					case 'r': s += '\r'; break;
+					case 'u': s += '?'; p += 4; break;
+					default: s += *p; break;
+					}
+					++p;
+				}
+				else
+					s += *p++;
+			}
+			return Expect('"');
+		}
+
+		// Parse a value.  'key' is the name of the field that the value
+		// belongs to, if it's an object member, and 'inResults' tells us
+		// if we're inside the "results" array.
+		bool ParseValue(const std::string &key, std::list<Benchmark::Result> *results, bool inResults)
+		{
+			SkipSpace();
+			if (p >= end)
+			{
+				error = "Unexpected end of file";
+				return false;
+			}
+
+			if (*p == '{')
+			{
+				// object - if it's a results array element, collect its fields
+				++p;
+				bool isResult = inResults;
+				if (isResult)
+				{
+					strFields.clear();
+					numFields.clear();
+				}
+				SkipSpace();
+				if (p < end && *p == '}')
+					++p;
+				else
+				{
+					for (;;)
+					{
+						std::string name;
+						if (!ReadString(name) || !Expect(':'))
+							return false;
+
+						// parse the member value; a member named "results" at
+						// the top level is the results array
+						if (!ParseValue(name, results, false) && error.size() != 0)
+							return false;
+
+						SkipSpace();
+						if (p < end && *p == ',')
+						{
+							++p;
+							continue;
+						}
+						if (!Expect('}'))
+							return false;
+						break;
+					}
+				}
+
+				// add the result
+				if (isResult && results != nullptr)
+				{
+					auto &r = results->emplace_back();
+					r.name = strFields["name"];
+					r.unit = strFields["unit"];
+					r.unitsPerOp = numFields["unitsPerOp"];
+					r.itersPerRep = static_cast<uint64_t>(numFields["itersPerRep"]);
+					r.reps = static_cast<int>(numFields["reps"]);
+					r.min_ns = numFields["min_ns"];
+					r.median_ns = numFields["median_ns"];
+					r.p90_ns = numFields["p90_ns"];
+					r.p99_ns = numFields["p99_ns"];
+					r.max_ns = numFields["max_ns"];
+					r.mean_ns = numFields["mean_ns"];
+					r.stddev_ns = numFields["stddev_ns"];
+				}
+				return true;
+			}
+			else if (*p == '[')
+			{
+				// array
+				++p;
+				bool elementsAreResults = (key == "results");
+				SkipSpace();
+				if (p < end && *p == ']')
+				{
+					++p;
+					return true;
+				}
+				for (;;)
+				{
+					if (!ParseValue("", results, elementsAreResults))
+						return false;
+					SkipSpace();
+					if (p < end && *p == ',')
+					{
+						++p;
+						continue;
+					}
+					return Expect(']');
+				}
+			}
+			else if (*p == '"')
+			{
+				std::string s;
+				if (!ReadString(s))
+					return false;
+				strFields[key] = s;
+				return true;
+			}
+			else if (strncmp(p, "true", 4) == 0 || strncmp(p, "null", 4) == 0)
+			{
+				p += 4;
+				return true;
+			}
+			else if (strncmp(p, "false", 5) == 0)
+			{
+				p += 5;
+				return true;
+			}
+			else
+			{
+				// number
+				char *numEnd = nullptr;
+				double d = strtod(p, &numEnd);
+				if (numEnd == p)
+				{
+					error = "Invalid value";
+					return false;
+				}
+				p = numEnd;
+				numFields[key] = d;
+				return true;
+			}
+		}
+	};
+}
+
+bool Benchmark::ReadJSON(const char *filename, std::list<Result> &results, std::string &errorMessage)
+{
+	// read the file
+	FILE *fp = nullptr;
+	if (fopen_s(&fp, filename, "rb") != 0 || fp == nullptr)
+	{
+		errorMessage = "Unable to open file";
+		return false;
+	}
+	std::string buf;
+	char tmp[4096];
+	for (size_t n ; (n = fread(tmp, 1, sizeof(tmp), fp)) != 0 ; )
+		buf.append(tmp, n);
+	fclose(fp);
+
+	// parse it
+	JSONReader reader(buf.data(), buf.data() + buf.size());
+	if (!reader.ParseValue("", &results, false))
+	{
+		errorMessage = "JSON syntax error: " + reader.error;
+		return false;
+	}
+	return true;
+}
+
+int Benchmark::CompareBaseline(const std::list<Result> &baseline, double threshold_pct) const
+{
+	// index the baseline by name
+	std::unordered_map<std::string, const Result*> baseMap;
+	for (auto &b : baseline)
+		baseMap.emplace(b.name, &b);
+
+	printf("\n%-44s %12s %12s %9s\n", "Benchmark", "base median", "new median", "change");
+	int nRegressions = 0, nImprovements = 0, nMissing = 0;
+	for (auto &r : results)
+	{
+		auto it = baseMap.find(r.name);
+		if (it == baseMap.end())
+		{
+			printf("%-44s %12s %12.1f %9s\n", r.name.c_str(), "-", r.median_ns, "(new)");
+			++nMissing;
+			continue;
+		}
+
+		// figure the change in median time; positive is slower
+		const Result &b = *it->second;
+		double change = b.median_ns > 0.0 ? (r.median_ns - b.median_ns) * 100.0 / b.median_ns : 0.0;
+
+		// classify it
+		const char *note = "";
+		if (change > threshold_pct && r.min_ns > b.median_ns)
+		{
+			note = "  ** REGRESSION **";
+			++nRegressions;
+		}
+		else if (change < -threshold_pct && r.median_ns < b.min_ns)
+		{
+			note = "  (faster)";
+			++nImprovements;
+		}
+
+		printf("%-44s %12.1f %12.1f %+8.1f%%%s\n", r.name.c_str(), b.median_ns, r.median_ns, change, note);
+	}
+
+	printf("\n%d regression%s, %d improvement%s (threshold %.1f%%)",
+		nRegressions, nRegressions == 1 ? "" : "s",
+		nImprovements, nImprovements == 1 ? "" : "s", threshold_pct);
+	if (nMissing != 0)
+		printf(", %d benchmark%s not in baseline", nMissing, nMissing == 1 ? "" : "s");
+	printf("\n");
+
+	return nRegressions;
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Main program entrypoint
+//
+int main(int argc, char **argv)
+{
+	Benchmark bench;
+	PlaybackOptions playbackOpts;
+	EncoderBenchOptions encoderOpts;
+	ScriptBenchOptions scriptOpts;
+	std::string suites = "kernel";
+	const char *jsonFile = nullptr;
+	const char *baselineFile = nullptr;
+	double threshold = 5.0;
+
+	// parse options
+	int argi = 1;
+	for (; argi < argc && argv[argi][0] == '-' ; ++argi)
+	{
+		const char *argp = argv[argi];
+		if (strcmp(argp, "--") == 0)
+		{
+			// explicit last option
+			++argi;
+			break;
+		}
+		else if (strncmp(argp, "--filter=", 9) == 0)
+		{
+			// select benchmarks by name
+			bench.options.filter = argp + 9;
+		}
+		else if (strcmp(argp, "--list") == 0)
+		{
+			// list the benchmarks without running them
+			bench.options.listOnly = true;
+		}
+		else if (strncmp(argp, "--suite=", 8) == 0)
+		{
+			// benchmark suites to run
+			suites = argp + 8;
+		}
+		else if (strncmp(argp, "--rom=", 6) == 0)
+		{
+			// ROM .zip file for recorded bitstreams and playback
+			playbackOpts.romFiles.emplace_back(argp + 6);
+		}
+		else if (strncmp(argp, "--track-time=", 13) == 0)
+		{
+			// playback time per track, in seconds
+			playbackOpts.trackTime = atof(argp + 13);
+		}
+		else if (strncmp(argp, "--instances=", 12) == 0)
+		{
+			// maximum concurrent instances for the playback scaling test
+			playbackOpts.maxInstances = atoi(argp + 12);
+		}
+		else if (strncmp(argp, "--signal-time=", 14) == 0)
+		{
+			// encoder test signal length, in seconds
+			encoderOpts.signalTime = atof(argp + 14);
+		}
+		else if (strncmp(argp, "--encode-reps=", 14) == 0)
+		{
+			// number of encoding runs per encoder test case
+			encoderOpts.reps = atoi(argp + 14);
+			if (encoderOpts.reps < 1)
+				encoderOpts.reps = 1;
+		}
+		else if (strncmp(argp, "--script-statements=", 20) == 0)
+		{
+			// number of statements in the generated script
+			scriptOpts.statements = atoi(argp + 20);
+		}
+		else if (strncmp(argp, "--json=", 7) == 0)
+		{
+			// JSON output file
+			jsonFile = argp + 7;
+		}
+		else if (strncmp(argp, "--baseline=", 11) == 0)
+		{
+			// JSON baseline file for comparison
+			baselineFile = argp + 11;
+		}
+		else if (strncmp(argp, "--threshold=", 12) == 0)
+		{
+			// regression threshold, in percent
+			threshold = atof(argp + 12);
+		}
+		else if (strncmp(argp, "--warmup=", 9) == 0)
+		{
+			// warm-up time, in milliseconds
+			bench.options.warmup_ms = atoi(argp + 9);
+		}
+		else if (strncmp(argp, "--reps=", 7) == 0)
+		{
+			// number of timed batches
+			bench.options.reps = atoi(argp + 7);
+			if (bench.options.reps < 1)
+				bench.options.reps = 1;
+		}
+		else if (strncmp(argp, "--batch=", 8) == 0)
+		{
+			// batch time target, in milliseconds
+			bench.options.batch_ms = atof(argp + 8);
+		}
+		else if (strcmp(argp, "-q") == 0)
+		{
+			// quiet mode
+			bench.options.quiet = true;
+		}
+		else
+		{
+			printf("DCS Benchmark  (build %s)\n"
+				"Usage: dcsbenchmark [options]\n"
+				"\n"
+				"Times the decoder and encoder, and optionally compares the results against\n"
+				"a saved baseline.\n"
+				"\n"
+				"Options:\n"
+				"   --suite=<list>       benchmark suites to run, separated by commas (default kernel):\n"
+				"                          kernel    - decoder and encoder inner loops\n"
+				"                          playback  - end-to-end decoder playback and scaling\n"
+				"                          encoder   - encoder pipeline stages over generated signals\n"
+				"                          script    - script tokenizer and parser over a generated script\n"
+				"   --filter=<text>      run only the benchmarks with names containing <text>\n"
+				"   --list               list the benchmark names, without running them\n"
+				"   --rom=<file>         ROM .zip file to use for recorded bitstreams (in addition\n"
+				"                        to the built-in synthetic streams), and as the playback\n"
+				"                        corpus; can be repeated to add more ROM sets\n"
+				"   --track-time=<sec>   playback time per track (default 1 second)\n"
+				"   --instances=<n>      maximum concurrent decoders for the playback scaling test\n"
+				"                        (default is the number of hardware threads)\n"
+				"   --signal-time=<sec>  length of each encoder test signal (default 2 seconds)\n"
+				"   --encode-reps=<n>    number of encoding runs per encoder test case (default 3)\n"
+				"   --script-statements=<n>\n"
+				"                        number of statements in the generated script (default 100000)\n"
+				"   --json=<file>        save the results to <file> in JSON format\n"
+				"   --baseline=<file>    compare the results against a JSON file saved earlier\n"
+				"   --threshold=<pct>    regression threshold for --baseline, in percent (default 5)\n"
+				"   --warmup=<ms>        warm-up time per benchmark (default 200 ms)\n"
+				"   --reps=<n>           number of timed batches per benchmark (default 30)\n"
+				"   --batch=<ms>         minimum time per batch (default 5 ms)\n"
+				"   -q                   quiet mode; don't show results as they're collected\n",
+				ProgramBuildDate().YYYYMMDD().c_str());
+			exit(1);
+		}
+	}
+
+	// load the baseline up front, so that we don't waste a whole run
+	// finding out that the file is bad
+	std::list<Benchmark::Result> baseline;
+	std::string errMsg;
+	if (baselineFile != nullptr && !Benchmark::ReadJSON(baselineFile, baseline, errMsg))
+	{
+		printf("Error loading baseline file %s: %s\n", baselineFile, errMsg.c_str());
+		exit(2);
+	}
+
+	// run the benchmarks
+	if (!bench.options.quiet && !bench.options.listOnly)
+		bench.PrintHeader();
+
+	auto SuiteSelected = [&suites](const char *name)
+	{
+		// check for the name as a comma-delimited element of the list
+		size_t len = strlen(name);
+		for (size_t pos = 0 ; pos < suites.size() ; )
+		{
+			size_t end = suites.find(',', pos);
+			if (end == std::string::npos)
+				end = suites.size();
+			if (end - pos == len && suites.compare(pos, len, name) == 0)
+				return true;
+			pos = end + 1;
+		}
+		return false;
+	};
+	if (SuiteSelected("kernel"))
+	{
+		RunKernelBenchmarks(bench,
+			playbackOpts.romFiles.size() != 0 ? playbackOpts.romFiles.front().c_str() : nullptr);
+	}
+	if (SuiteSelected("playback"))
+		RunPlaybackBenchmarks(bench, playbackOpts);
+	if (SuiteSelected("encoder"))
+		RunEncoderBenchmarks(bench, encoderOpts);
+	if (SuiteSelected("script"))
+		RunScriptBenchmarks(bench, scriptOpts);
+
+	// save the results
+	if (jsonFile != nullptr && !bench.options.listOnly)
+	{
+		if (!bench.WriteJSON(jsonFile, errMsg))
+		{
+			printf("Error writing results to %s: %s\n", jsonFile, errMsg.c_str());
+			exit(2);
+		}
+		if (!bench.options.quiet)
+			printf("\nResults saved to %s\n", jsonFile);
+	}
+
+	// compare against the baseline
+	if (baselineFile != nullptr && !bench.options.listOnly)
+	{
+		if (bench.CompareBaseline(baseline, threshold) != 0)
+			exit(3);
+	}
+
+	// success
+	return 0;
+}
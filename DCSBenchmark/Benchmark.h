@@ -0,0 +1,167 @@
+// Copyright 2023 Michael J Roberts
+// BSD 3-clause license - NO WARRANTY
+//
+// DCS Benchmark - timing framework
+//
+// This is the common measurement harness for the benchmark program.
+// Each benchmark case provides a function that runs its kernel N
+// times in a loop.  The harness calibrates N so that one timed batch
+// runs long enough to swamp the clock resolution and the call
+// overhead, runs untimed batches for a warm-up period to settle the
+// caches, branch predictors, and CPU clock, and then times a series
+// of batches.  Each batch yields one per-operation time sample, and
+// the report gives the distribution of the samples (minimum, median,
+// percentiles, maximum), since a single average is too easily skewed
+// by an interrupt or a context switch in the middle of a batch.
+//
+// Results can be saved to a JSON file, and compared against a JSON
+// file saved from an earlier run, to evaluate an optimization or to
+// catch a performance regression.
+//
+
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <list>
+#include <vector>
+#include <functional>
+
+class Benchmark
+{
+public:
+	// Measurement options
+	struct Options
+	{
+		// warm-up time per benchmark, in milliseconds
+		int warmup_ms = 200;
+
+		// number of timed batches (samples) per benchmark
+		int reps = 30;
+
+		// target time for one batch, in milliseconds; the iteration
+		// count per batch is calibrated to take at least this long
+		double batch_ms = 5.0;
+
+		// Name filter.  If this is non-empty, only benchmarks whose
+		// names contain this string are run.
+		std::string filter;
+
+		// list the benchmarks instead of running them
+		bool listOnly = false;
+
+		// quiet mode - don't print results as they're collected
+		bool quiet = false;
+	};
+	Options options;
+
+	// Benchmark result.  All times are per operation, in nanoseconds.
+	struct Result
+	{
+		std::string name;           // benchmark name, "group.kernel.variant"
+		std::string unit;           // work unit name, for throughput reporting ("frame", "bit", ...)
+		double unitsPerOp = 1.0;    // work units per operation
+		uint64_t itersPerRep = 0;   // operations per timed batch
+		int reps = 0;               // number of timed batches
+
+		double min_ns = 0.0;
+		double median_ns = 0.0;
+		double p90_ns = 0.0;
+		double p99_ns = 0.0;
+		double max_ns = 0.0;
+		double mean_ns = 0.0;
+		double stddev_ns = 0.0;
+	};
+	std::list<Result> results;
+
+	// Is the named benchmark selected by the filter?
+	bool IsSelected(const char *name) const;
+
+	// Run a benchmark.  'fn' runs the kernel 'n' times.  'unit' and
+	// 'unitsPerOp' describe the work done per operation, for the
+	// throughput column in the report; for example, a kernel that
+	// decodes one frame per call would use "frame" and 1.  Returns
+	// a pointer to the new result entry, or null if the benchmark
+	// isn't selected.
+	const Result *Run(const char *name, const char *unit, double unitsPerOp,
+		std::function<void(uint64_t n)> fn);
+
+	// Add a result from a set of per-operation time samples, in
+	// nanoseconds.  This is for benchmarks that collect their own
+	// samples rather than going through Run(), such as the playback
+	// benchmarks, which time each decoded frame individually.  The
+	// samples vector is sorted in place.  The result is printed unless
+	// we're in quiet mode.
+	const Result *AddResult(const char *name, const char *unit, double unitsPerOp,
+		uint64_t itersPerRep, std::vector<double> &samples);
+
+	// Print the report header and one result line
+	void PrintHeader() const;
+	void PrintResult(const Result &r) const;
+
+	// Save the results to a JSON file
+	bool WriteJSON(const char *filename, std::string &errorMessage) const;
+
+	// Load results from a JSON file saved with WriteJSON()
+	static bool ReadJSON(const char *filename, std::list<Result> &results, std::string &errorMessage);
+
+	// Compare the current results against a baseline.  Prints a report
+	// of the differences in median time.  A benchmark counts as a
+	// regression if its median slowed down by more than threshold_pct
+	// percent, AND its fastest batch was slower than the baseline's
+	// median; the second test keeps one noisy run from being reported
+	// as a regression.  Returns the number of regressions.
+	int CompareBaseline(const std::list<Result> &baseline, double threshold_pct) const;
+
+	// Optimization barrier.  Kernels that compute a result without
+	// storing it anywhere should fold it into the sink, so that the
+	// compiler can't discard the computation.
+	static volatile uint32_t sink;
+};
+
+// Kernel benchmark suite (KernelBench.cpp).  'romFile' is an optional
+// ROM .zip file to use as the source of recorded bitstreams for the
+// frame decompression kernels, in addition to the synthetic streams.
+void RunKernelBenchmarks(Benchmark &bench, const char *romFile);
+
+// Playback benchmark suite (PlaybackBench.cpp).  This runs each
+// registered decoder end to end, playing every track of each ROM in
+// 'romFiles' for a fixed time per track, and then repeats the run with
+// 1 to maxInstances decoders playing concurrently, one per thread.
+struct PlaybackOptions
+{
+	// ROM .zip files making up the test corpus
+	std::list<std::string> romFiles;
+
+	// playback time per track, in seconds
+	double trackTime = 1.0;
+
+	// Maximum number of concurrent instances for the scaling test; zero
+	// selects the number of hardware threads available.
+	int maxInstances = 0;
+};
+void RunPlaybackBenchmarks(Benchmark &bench, const PlaybackOptions &opts);
+
+// Encoder benchmark suite (EncoderBench.cpp).  This encodes a corpus of
+// generated test signals at several sample rates in each DCS format
+// version, timing the pipeline stages separately.
+struct EncoderBenchOptions
+{
+	// length of each test signal, in seconds
+	double signalTime = 2.0;
+
+	// number of encoding runs per case
+	int reps = 3;
+};
+void RunEncoderBenchmarks(Benchmark &bench, const EncoderBenchOptions &opts);
+
+// Script compiler benchmark suite (ScriptBench.cpp).  This times the
+// encoder's script tokenizer and parser on a large generated script.
+struct ScriptBenchOptions
+{
+	// number of statements in the generated script
+	int statements = 100000;
+
+	// number of parsing runs
+	int reps = 5;
+};
+void RunScriptBenchmarks(Benchmark &bench, const ScriptBenchOptions &opts);
@@ -0,0 +1,799 @@
+// Copyright 2023 Michael J Roberts
+// BSD 3-clause license - NO WARRANTY
+//
+// DCS Benchmark - encoder throughput benchmarks
+//
+// This runs a corpus of generated test signals through the encoder,
+// at several input sample rates and for each DCS format version, and
+// times each stage of the encoding pipeline separately:
+//
+//   resample  - conversion from the input rate to the DCS native
+//               31250 Hz rate
+//   transform - windowing and time-to-frequency transform of each frame
+//   trials    - the format search in CloseStream(), which compresses
+//               the whole stream in every eligible format type and
+//               subtype to find the smallest result
+//   compress  - compression of the stream in the single winning format,
+//               which is the cost of the actual bit stream generation
+//               without the search
+//   total     - the whole pipeline through the public interface
+//               (OpenStream, WriteStream, CloseStream)
+//
+// A separate set of cases compares the encoder's polyphase resampler
+// with the libsamplerate sinc converters, for speed and accuracy, at the
+// source rates where the polyphase filter applies.
+//
+// The signals are all generated deterministically, so the results are
+// repeatable, and they don't require any game audio.  They're chosen to
+// push the encoder's band encoding decisions in different directions:
+// silence takes the zero-bit paths, noise needs wide encodings in every
+// band, the sweep moves its energy across the bands over time, and the
+// transients and the speech-like signal mix loud and quiet frames.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <list>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include "Benchmark.h"
+#include "../DCSDecoder/DCSDecoder.h"
+#include "../DCSDecoder/DCSDecoderNative.h"
+#include "../DCSEncoder/DCSEncoder.h"
+
+#if defined(_WIN32)
+#include <Windows.h>
+#include <Psapi.h>
+#pragma comment(lib, "Psapi")
+#else
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+	using Clock = std::chrono::steady_clock;
+
+	double ElapsedNs(Clock::time_point t0, Clock::time_point t1)
+	{
+		return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count());
+	}
+
+	// Get the process peak memory usage, in bytes
+	uint64_t GetPeakMemoryUsage()
+	{
+#if defined(_WIN32)
+		PROCESS_MEMORY_COUNTERS pmc;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+			return pmc.PeakWorkingSetSize;
+		return 0;
+#else
+		struct rusage ru;
+		if (getrusage(RUSAGE_SELF, &ru) == 0)
+			return static_cast<uint64_t>(ru.ru_maxrss) * 1024;
+		return 0;
+#endif
+	}
+
+	// Test signal types
+	enum class Signal
+	{
+		Silence,     // digital silence
+		Sweep,       // exponential sine sweep, 20 Hz to 15 kHz
+		WhiteNoise,  // uniform white noise
+		PinkNoise,   // 1/f noise
+		Transients,  // drum-like hits: clicks with decaying noise and a pitched thump
+		Speech       // speech-like: formant-shaped harmonics with syllable-rate AM
+	};
+	struct SignalDesc
+	{
+		Signal signal;
+		const char *name;
+	};
+	static const SignalDesc signals[] ={
+		{ Signal::Silence, "silence" },
+		{ Signal::Sweep, "sweep" },
+		{ Signal::WhiteNoise, "white" },
+		{ Signal::PinkNoise, "pink" },
+		{ Signal::Transients, "transients" },
+		{ Signal::Speech, "speech" },
+	};
+
+	// Generate a test signal at the given sample rate.  Samples are in
+	// the encoder's float range, -1 to +1.
+	void GenerateSignal(Signal signal, int rate, double seconds, std::vector<float> &pcm)
+	{
+		const double twoPi = 6.283185307179586;
+		const int nSamples = static_cast<int>(seconds * rate);
+		pcm.resize(nSamples);
+
+		// noise source (32-bit xorshift), returning -1..+1
+		uint32_t rng = 0x2545F491;
+		auto Noise = [&rng]()
+		{
+			rng ^= rng << 13;
+			rng ^= rng >> 17;
+			rng ^= rng << 5;
+			return static_cast<double>(rng) / 2147483648.0 - 1.0;
+		};
+
+		// Pink noise filter state.  This uses Paul Kellet's "economy"
+		// three-pole filter, which is accurate to within about 0.5 dB
+		// above 10 Hz - plenty for our purposes.
+		double b0 = 0.0, b1 = 0.0, b2 = 0.0;
+
+		// Speech-like signal parameters.  The voice is a 120 Hz buzz
+		// whose harmonics are weighted by three formant peaks, roughly
+		// those of an open vowel.
+		const double f0 = 120.0;
+		std::vector<double> harmonicLevel;
+		for (double f = f0 ; f < 7000.0 && f < rate / 2.0 ; f += f0)
+		{
+			auto Formant = [f](double center, double width, double gain) {
+				return gain * exp(-((f - center) * (f - center)) / (2.0 * width * width));
+			};
+			harmonicLevel.push_back(Formant(700.0, 130.0, 1.0) + Formant(1200.0, 150.0, 0.5) + Formant(2600.0, 250.0, 0.25) + 0.01);
+		}
+
+		double phase = 0.0;
+		for (int i = 0 ; i < nSamples ; ++i)
+		{
+			double t = static_cast<double>(i) / rate;
+			double s = 0.0;
+			switch (signal)
+			{
+			case Signal::Silence:
+				s = 0.0;
+				break;
+
+			case Signal::Sweep:
+				{
+					// exponential sweep, tracking the phase in cycles
+					double f = 20.0 * pow(15000.0 / 20.0, t / seconds);
+					s = 0.5 * sin(twoPi * phase);
+					phase += f / rate;
+					phase -= floor(phase);
+				}
+				break;
+
+			case Signal::WhiteNoise:
+				s = 0.5 * Noise();
+				break;
+
+			case Signal::PinkNoise:
+				{
+					double white = Noise();
+					b0 = 0.99765 * b0 + white * 0.0990460;
+					b1 = 0.96300 * b1 + white * 0.2965164;
+					b2 = 0.57000 * b2 + white * 1.0526913;
+					s = 0.15 * (b0 + b1 + b2 + white * 0.1848);
+				}
+				break;
+
+			case Signal::Transients:
+				{
+					// a hit every 300ms: an impulse, a burst of noise with a
+					// fast decay, and a 60 Hz thump with a slower decay
+					double dt = fmod(t, 0.3);
+					int sinceHit = static_cast<int>(dt * rate);
+					double click = sinceHit == 0 ? 0.9 : 0.0;
+					s = click + 0.5 * Noise() * exp(-dt * 60.0) + 0.4 * sin(twoPi * 60.0 * dt) * exp(-dt * 12.0);
+				}
+				break;
+
+			case Signal::Speech:
+				{
+					// Syllable-rate envelope: about four syllables per second,
+					// with a short gap between them, and a slow pitch vibrato.
+					double syl = fmod(t * 4.0, 1.0);
+					double env = syl < 0.8 ? sin(3.141592653589793 * syl / 0.8) : 0.0;
+					double pitch = 1.0 + 0.05 * sin(twoPi * 0.7 * t);
+					phase += pitch * f0 / rate;
+					phase -= floor(phase);
+					double v = 0.0;
+					for (size_t h = 0 ; h < harmonicLevel.size() ; ++h)
+						v += harmonicLevel[h] * sin(twoPi * phase * (h + 1));
+					s = 0.25 * env * v + 0.02 * env * Noise();
+				}
+				break;
+			}
+			pcm[i] = static_cast<float>(s);
+		}
+	}
+
+	// Stage timing results for one encoding run, in nanoseconds
+	struct StageTimes
+	{
+		double resample = 0.0;
+		double transform = 0.0;
+		double trials = 0.0;
+		double compress = 0.0;
+		double total = 0.0;
+		size_t nFrames = 0;
+		size_t nBytes = 0;
+		size_t analysisBytes = 0;
+	};
+
+	// Encoder subclass for driving the pipeline stages individually
+	class StageEncoder : public DCSEncoder
+	{
+	public:
+		// Run the analysis stages (resampling and transform) on a new
+		// stream, adding the times to 'times'.  Returns the stream, ready
+		// for CloseStream().
+		Stream *Analyze(const std::vector<float> &pcm, int rate, StageTimes &times, std::string &errorMessage)
+		{
+			std::unique_ptr<Stream> stream(OpenStream(rate, errorMessage));
+			if (stream == nullptr)
+				return nullptr;
+
+			// Resample to the DCS rate, collecting the output in a buffer
+			// rather than sending it to the transform, so that we can time
+			// the two stages separately
+			std::vector<float> dcsRate;
+			auto t0 = Clock::now();
+			if (!ResampleAll(stream.get(), pcm, dcsRate, errorMessage))
+				return nullptr;
+			auto t1 = Clock::now();
+
+			// Transform the frames.  This follows the frame assembly in
+			// WriteStream() and the final partial frame handling in
+			// CloseStream().
+			for (float s : dcsRate)
+			{
+				stream->inputBuf[stream->nInputBuf++] = s;
+				if (stream->nInputBuf == 256)
+					TransformFrame(stream.get());
+			}
+			if (stream->nInputBuf != 16)
+			{
+				while (stream->nInputBuf < 256)
+					stream->inputBuf[stream->nInputBuf++] = 0;
+				TransformFrame(stream.get());
+			}
+			stream->analysisComplete = true;
+			auto t2 = Clock::now();
+
+			times.resample += ElapsedNs(t0, t1);
+			times.transform += ElapsedNs(t1, t2);
+			times.nFrames = stream->frames.size();
+			times.analysisBytes = stream->frames.size() * sizeof(Stream::Frame) + dcsRate.size() * sizeof(float);
+			return stream.release();
+		}
+
+		// Resample a whole signal to the DCS rate.  This mirrors the
+		// processing in WriteStream(), including its small input blocks.
+		bool ResampleAll(Stream *stream, const std::vector<float> &pcm, std::vector<float> &dcsRate, std::string &errorMessage)
+		{
+			dcsRate.clear();
+			dcsRate.reserve(static_cast<size_t>(pcm.size() * stream->sampleRateRatio) + 1024);
+			const float *p = pcm.data();
+			size_t remaining = pcm.size();
+			bool eof = true;
+			while (remaining != 0 || eof)
+			{
+				float inbuf[16];
+				SRC_DATA d;
+				d.data_in = inbuf;
+				d.src_ratio = stream->sampleRateRatio;
+				size_t curSize = remaining < _countof(inbuf) ? remaining : _countof(inbuf);
+				d.input_frames = static_cast<long>(curSize);
+				memcpy(inbuf, p, curSize * sizeof(float));
+				p += curSize;
+				remaining -= curSize;
+				d.end_of_input = (remaining == 0);
+				if (remaining == 0)
+					eof = false;
+
+				float outbuf[512];
+				d.data_out = outbuf;
+				d.output_frames = static_cast<long>(_countof(outbuf));
+				d.output_frames_gen = 0;
+				d.input_frames_used = 0;
+				if (!Resample(stream, d))
+				{
+					errorMessage = "resampler error";
+					return false;
+				}
+				dcsRate.insert(dcsRate.end(), outbuf, outbuf + d.output_frames_gen);
+			}
+			return true;
+		}
+
+		// Run one full measurement for a signal, rate, and format version
+		bool RunCase(const std::vector<float> &pcm, int rate, uint16_t formatVersion, StageTimes &times, std::string &errorMessage)
+		{
+			// format trials: compress with wildcard type and subtype, so
+			// that CloseStream() tries every eligible format
+			compressionParams.formatVersion = formatVersion;
+			compressionParams.streamFormatType = -1;
+			compressionParams.streamFormatSubType = -1;
+			std::unique_ptr<Stream> stream(Analyze(pcm, rate, times, errorMessage));
+			if (stream == nullptr)
+				return false;
+
+			DCSAudio obj;
+			auto t0 = Clock::now();
+			if (!CloseStream(stream.get(), obj, errorMessage))
+				return false;
+			times.trials += ElapsedNs(t0, Clock::now());
+			times.nBytes = obj.nBytes;
+
+			// Figure out which format won, from the stream header that
+			// follows the two-byte frame count: the high bit of the first
+			// header byte gives the major type, and for the 1994+ format,
+			// the high bit of the second byte gives the subtype.
+			const uint8_t *hdr = obj.data.get() + 2;
+			compressionParams.streamFormatType = (hdr[0] & 0x80) != 0 ? 1 : 0;
+			compressionParams.streamFormatSubType = (formatVersion == 0x9400 && (hdr[1] & 0x80) != 0) ? 3 : 0;
+
+			// Compress again in the winning format only.  This needs a
+			// fresh analysis, since the frame list is only good for one
+			// pass, but we don't count the analysis time twice.
+			StageTimes scratch;
+			stream.reset(Analyze(pcm, rate, scratch, errorMessage));
+			if (stream == nullptr)
+				return false;
+			t0 = Clock::now();
+			if (!CloseStream(stream.get(), obj, errorMessage))
+				return false;
+			times.compress += ElapsedNs(t0, Clock::now());
+			stream.reset();
+
+			// Finally, the whole pipeline through the public interface,
+			// with the wildcard format search, writing the input in
+			// 4096-sample blocks as a file reader would
+			compressionParams.streamFormatType = -1;
+			compressionParams.streamFormatSubType = -1;
+			t0 = Clock::now();
+			stream.reset(OpenStream(rate, errorMessage));
+			if (stream == nullptr)
+				return false;
+			for (size_t ofs = 0 ; ofs < pcm.size() ; ofs += 4096)
+				WriteStream(stream.get(), pcm.data() + ofs, pcm.size() - ofs < 4096 ? pcm.size() - ofs : 4096);
+			if (!CloseStream(stream.get(), obj, errorMessage))
+				return false;
+			times.total += ElapsedNs(t0, Clock::now());
+
+			return true;
+		}
+	};
+
+	// Encode a signal at the DCS rate as a source stream for the
+	// transcoding cases, letting the encoder pick the stream format
+	bool EncodeSource(const std::vector<float> &pcm, uint16_t formatVersion, DCSEncoder::DCSAudio &obj, std::string &errorMessage)
+	{
+		DCSEncoder encoder;
+		encoder.compressionParams.formatVersion = formatVersion;
+		encoder.compressionParams.streamFormatType = -1;
+		encoder.compressionParams.streamFormatSubType = -1;
+		std::unique_ptr<DCSEncoder::Stream> stream(encoder.OpenStream(31250, errorMessage));
+		if (stream == nullptr)
+			return false;
+		encoder.WriteStream(stream.get(), pcm.data(), pcm.size());
+		return encoder.CloseStream(stream.get(), obj, errorMessage);
+	}
+
+	// Render an encoded stream to PCM, with a stand-alone decoder for
+	// its format version
+	void RenderDCS(const DCSEncoder::DCSAudio &obj, uint16_t formatVersion, std::vector<int16_t> &pcm)
+	{
+		DCSDecoder::MinHost host;
+		DCSDecoderNative decoder(&host);
+		decoder.InitStandalone(formatVersion == 0x9301 ? DCSDecoder::OSVersion::OS93a :
+			formatVersion == 0x9302 ? DCSDecoder::OSVersion::OS93b : DCSDecoder::OSVersion::OS94);
+		decoder.SoftBoot();
+		pcm.clear();
+		decoder.RenderStream(DCSDecoder::ROMPointer(0, obj.data.get()), [&pcm](int, const int16_t *p) {
+			pcm.insert(pcm.end(), p, p + 240); });
+	}
+
+	// Figure the signal-to-noise ratio of a transcoded stream's PCM
+	// against the source stream's PCM, in dB.  The two paths don't
+	// necessarily produce identically aligned output (the PCM round trip
+	// goes through the encoder's input framing again), so we try each
+	// offset up to maxLag samples in either direction and take the best.
+	// We also try both polarities, since the 1993 and 1994 decoders
+	// produce opposite output polarities from the same spectrum.
+	double SignalToNoise(const std::vector<int16_t> &ref, const std::vector<int16_t> &test, int maxLag = 32)
+	{
+		double sig = 0.0;
+		for (auto r : ref)
+			sig += static_cast<double>(r) * r;
+		if (sig == 0.0)
+			return INFINITY;
+
+		double bestNoise = -1.0;
+		for (int polarity = -1 ; polarity <= 1 ; polarity += 2)
+		{
+			for (int lag = -maxLag ; lag <= maxLag ; ++lag)
+			{
+				double noise = 0.0;
+				for (size_t i = 0 ; i < ref.size() ; ++i)
+				{
+					long j = static_cast<long>(i) + lag;
+					double t = j >= 0 && j < static_cast<long>(test.size()) ? polarity * test[j] : 0.0;
+					noise += (ref[i] - t) * (ref[i] - t);
+				}
+				if (bestNoise < 0.0 || noise < bestNoise)
+					bestNoise = noise;
+			}
+		}
+		return bestNoise == 0.0 ? INFINITY : 10.0 * log10(sig / bestNoise);
+	}
+
+	// Measure a resampler's response to a sine tone, in dB.  This converts
+	// a tone at 'freq' from the source rate, and compares the result with
+	// the ideal tone at the DCS rate, skipping the filter ramps at the
+	// ends.  For a tone below the DCS Nyquist frequency, 'snr' is the
+	// signal-to-noise ratio against the ideal tone and 'level' is the
+	// output level relative to the input; for a tone above it, which
+	// should be filtered out entirely, 'level' is the level of whatever
+	// aliases through.
+	bool MeasureTone(DCSEncoder::Resampler method, int rate, double freq, double seconds,
+		double &snr, double &level, std::string &errorMessage)
+	{
+		const double twoPi = 6.283185307179586;
+		std::vector<float> pcm(static_cast<size_t>(seconds * rate));
+		for (size_t i = 0 ; i < pcm.size() ; ++i)
+			pcm[i] = static_cast<float>(0.5 * sin(twoPi * freq * i / rate));
+
+		StageEncoder encoder;
+		encoder.resampler = method;
+		std::unique_ptr<DCSEncoder::Stream> stream(encoder.OpenStream(rate, errorMessage));
+		std::vector<float> out;
+		if (stream == nullptr || !encoder.ResampleAll(stream.get(), pcm, out, errorMessage))
+			return false;
+
+		double sig = 0.0, noise = 0.0, power = 0.0;
+		for (size_t i = 256 ; i + 256 < out.size() ; ++i)
+		{
+			double ref = 0.5 * sin(twoPi * freq * i / 31250.0);
+			sig += ref * ref;
+			noise += (out[i] - ref) * (out[i] - ref);
+			power += static_cast<double>(out[i]) * out[i];
+		}
+		snr = noise == 0.0 ? INFINITY : 10.0 * log10(sig / noise);
+		level = power == 0.0 ? -INFINITY : 10.0 * log10(power / sig);
+		return true;
+	}
+
+	// Run the resampler comparison cases.  Each case times the conversion
+	// of the pink noise signal to the DCS rate with one resampler (with the
+	// speedup shown relative to libsamplerate's best sinc converter), and
+	// measures its accuracy with test tones: the SNR for tones at 1 kHz
+	// and 10 kHz, the response at 14 kHz (near the top of the passband),
+	// and the worst alias level from tones at 17 kHz and 20 kHz (which
+	// would alias to 14.25 kHz and 11.25 kHz).
+	void RunResampleBenchmarks(Benchmark &bench, const EncoderBenchOptions &opts)
+	{
+		struct MethodDesc
+		{
+			const char *name;
+			DCSEncoder::Resampler method;
+		};
+		static const MethodDesc methods[] ={
+			{ "best", DCSEncoder::Resampler::SincBest },
+			{ "medium", DCSEncoder::Resampler::SincMedium },
+			{ "poly", DCSEncoder::Resampler::Auto },
+		};
+		static const int rates[] = { 44100, 48000 };
+
+		if (!bench.options.quiet && !bench.options.listOnly)
+		{
+			printf("\nResampling: output samples/sec, and accuracy in dB\n");
+			printf("%-28s %12s %8s %8s %8s %8s %8s\n",
+				"Case", "samples/sec", "speedup", "1k SNR", "10k SNR", "14k dB", "alias");
+		}
+
+		std::vector<float> pcm, out;
+		for (int rate : rates)
+		{
+			double bestTime = 0.0;
+			for (auto &m : methods)
+			{
+				std::string name = std::string("resample.") + std::to_string(rate) + "." + m.name;
+				if (!bench.IsSelected(name.c_str()))
+					continue;
+				if (bench.options.listOnly)
+				{
+					printf("%s\n", name.c_str());
+					continue;
+				}
+
+				// time the conversion
+				GenerateSignal(Signal::PinkNoise, rate, opts.signalTime, pcm);
+				std::vector<double> samples;
+				std::string errorMessage;
+				bool ok = true;
+				for (int rep = 0 ; rep < opts.reps && ok ; ++rep)
+				{
+					StageEncoder encoder;
+					encoder.resampler = m.method;
+					std::unique_ptr<DCSEncoder::Stream> stream(encoder.OpenStream(rate, errorMessage));
+					auto t0 = Clock::now();
+					ok = stream != nullptr && encoder.ResampleAll(stream.get(), pcm, out, errorMessage);
+					if (ok)
+						samples.push_back(ElapsedNs(t0, Clock::now()) / (out.size() != 0 ? out.size() : 1));
+				}
+
+				// measure the accuracy
+				double snr1k, snr10k, level14k, alias17k, alias20k, dummy;
+				ok = ok && MeasureTone(m.method, rate, 1000.0, opts.signalTime, snr1k, dummy, errorMessage)
+					&& MeasureTone(m.method, rate, 10000.0, opts.signalTime, snr10k, dummy, errorMessage)
+					&& MeasureTone(m.method, rate, 14000.0, opts.signalTime, dummy, level14k, errorMessage)
+					&& MeasureTone(m.method, rate, 17000.0, opts.signalTime, dummy, alias17k, errorMessage)
+					&& MeasureTone(m.method, rate, 20000.0, opts.signalTime, dummy, alias20k, errorMessage);
+				if (!ok)
+				{
+					printf("%s: %s\n", name.c_str(), errorMessage.c_str());
+					continue;
+				}
+
+				// add the result, quietly, since we print our own table line
+				bool quiet = bench.options.quiet;
+				bench.options.quiet = true;
+				const Benchmark::Result *r = bench.AddResult(name.c_str(), "sample", 1.0, out.size(), samples);
+				bench.options.quiet = quiet;
+				if (m.method == DCSEncoder::Resampler::SincBest)
+					bestTime = r->median_ns;
+
+				if (!quiet)
+				{
+					double sps = r->median_ns > 0.0 ? 1.0e9 / r->median_ns : 0.0;
+					char speedup[16] = "";
+					if (bestTime > 0.0 && r->median_ns > 0.0)
+						sprintf_s(speedup, "%.1fx", bestTime / r->median_ns);
+					printf("%-28s %12.0f %8s %8.1f %8.1f %8.2f %8.1f\n",
+						name.c_str() + 9, sps, speedup, snr1k, snr10k, level14k,
+						alias17k > alias20k ? alias17k : alias20k);
+				}
+			}
+		}
+	}
+
+	// Run the transcoding cases.  Each case encodes a test signal in
+	// the source format, then transcodes the result to the target format,
+	// once in the frequency domain and once with the full round trip
+	// through PCM, and compares the speed and the fidelity of the two
+	// methods.  The fidelity is the signal-to-noise ratio of the decoded
+	// result against the decoded source stream, so it only counts the
+	// losses from the transcoding itself, not from the original encoding.
+	void RunTranscodeBenchmarks(Benchmark &bench, const EncoderBenchOptions &opts)
+	{
+		struct PairDesc
+		{
+			const char *name;
+			uint16_t from;
+			uint16_t to;
+		};
+		static const PairDesc pairs[] ={
+			{ "94x-93", 0x9400, 0x9302 },
+			{ "94x-93a", 0x9400, 0x9301 },
+			{ "93-94x", 0x9302, 0x9400 },
+			{ "93a-94x", 0x9301, 0x9400 },
+		};
+		static const char *const methodNames[] = { "freq", "pcm" };
+
+		if (!bench.options.quiet && !bench.options.listOnly)
+		{
+			printf("\nTranscoding: frames/sec and SNR (dB) against the decoded source, by method\n");
+			printf("%-28s %10s %10s %8s %10s %10s\n",
+				"Case", "freq", "pcm", "speedup", "freq SNR", "pcm SNR");
+		}
+
+		std::vector<float> pcm;
+		std::vector<int16_t> refPCM, testPCM;
+		for (auto &p : pairs)
+		{
+			for (auto &sig : signals)
+			{
+				std::string caseName = std::string("transcode.") + p.name + "." + sig.name;
+				bool selected = false;
+				for (auto method : methodNames)
+					selected |= bench.IsSelected((caseName + "." + method).c_str());
+				if (!selected)
+					continue;
+
+				if (bench.options.listOnly)
+				{
+					for (auto method : methodNames)
+					{
+						std::string name = caseName + "." + method;
+						if (bench.IsSelected(name.c_str()))
+							printf("%s\n", name.c_str());
+					}
+					continue;
+				}
+
+				// encode the source stream, and decode it for the reference
+				GenerateSignal(sig.signal, 31250, opts.signalTime, pcm);
+				DCSEncoder::DCSAudio src;
+				std::string errorMessage;
+				if (!EncodeSource(pcm, p.from, src, errorMessage))
+				{
+					printf("%s: %s\n", caseName.c_str(), errorMessage.c_str());
+					continue;
+				}
+				RenderDCS(src, p.from, refPCM);
+
+				// transcode with each method
+				std::vector<double> samples[_countof(methodNames)];
+				double snr[_countof(methodNames)];
+				bool ok = true;
+				for (size_t m = 0 ; m < _countof(methodNames) && ok ; ++m)
+				{
+					DCSEncoder encoder;
+					encoder.compressionParams.formatVersion = p.to;
+					encoder.compressionParams.streamFormatType = -1;
+					encoder.compressionParams.streamFormatSubType = -1;
+					encoder.transcodeViaPCM = (m == 1);
+					DCSEncoder::DCSAudio obj;
+					for (int rep = 0 ; rep < opts.reps ; ++rep)
+					{
+						auto t0 = Clock::now();
+						if (!encoder.EncodeDCSStream(src.data.get(), src.nBytes, p.from, obj, errorMessage))
+						{
+							printf("%s.%s: %s\n", caseName.c_str(), methodNames[m], errorMessage.c_str());
+							ok = false;
+							break;
+						}
+						samples[m].push_back(ElapsedNs(t0, Clock::now()) / (src.nFrames != 0 ? src.nFrames : 1));
+					}
+					if (ok)
+					{
+						RenderDCS(obj, p.to, testPCM);
+						snr[m] = SignalToNoise(refPCM, testPCM);
+					}
+				}
+				if (!ok)
+					continue;
+
+				// add the results, quietly, since we print our own table line
+				double fps[_countof(methodNames)];
+				bool quiet = bench.options.quiet;
+				bench.options.quiet = true;
+				for (size_t i = 0 ; i < _countof(methodNames) ; ++i)
+				{
+					std::string name = caseName + "." + methodNames[i];
+					const Benchmark::Result *r = nullptr;
+					if (bench.IsSelected(name.c_str()))
+						r = bench.AddResult(name.c_str(), "frame", 1.0, src.nFrames, samples[i]);
+					else
+						std::sort(samples[i].begin(), samples[i].end());
+					double median = r != nullptr ? r->median_ns : samples[i][samples[i].size() / 2];
+					fps[i] = median > 0.0 ? 1.0e9 / median : 0.0;
+				}
+				bench.options.quiet = quiet;
+
+				if (!quiet)
+				{
+					printf("%-28s %10.0f %10.0f %7.1fx %10.1f %10.1f\n",
+						caseName.c_str() + 10, fps[0], fps[1], fps[1] > 0.0 ? fps[0] / fps[1] : 0.0, snr[0], snr[1]);
+				}
+			}
+		}
+	}
+}
+
+void RunEncoderBenchmarks(Benchmark &bench, const EncoderBenchOptions &opts)
+{
+	struct FormatDesc
+	{
+		const char *name;
+		uint16_t formatVersion;
+	};
+	static const FormatDesc formats[] ={
+		{ "94x", 0x9400 },
+		{ "93", 0x9302 },
+		{ "93a", 0x9301 },
+	};
+	static const int rates[] = { 22050, 31250, 44100, 48000 };
+	static const char *const stageNames[] = { "resample", "transform", "trials", "compress", "total" };
+
+	if (!bench.options.quiet && !bench.options.listOnly)
+	{
+		printf("\nEncoder pipeline: %.2f seconds per signal, %d repetition%s; figures are frames/sec\n",
+			opts.signalTime, opts.reps, opts.reps == 1 ? "" : "s");
+		printf("%-28s %10s %10s %10s %10s %10s %10s %9s\n",
+			"Case", "resample", "transform", "trials", "compress", "total", "bytes/sec", "buf KB");
+	}
+
+	std::vector<float> pcm;
+	for (auto &f : formats)
+	{
+		for (auto &sig : signals)
+		{
+			for (int rate : rates)
+			{
+				// build the case name, and check if any of its stages are selected
+				std::string caseName = std::string("encode.") + f.name + "." + sig.name + "." + std::to_string(rate);
+				bool selected = false;
+				for (auto stage : stageNames)
+					selected |= bench.IsSelected((caseName + "." + stage).c_str());
+				if (!selected)
+					continue;
+
+				if (bench.options.listOnly)
+				{
+					for (auto stage : stageNames)
+					{
+						std::string name = caseName + "." + stage;
+						if (bench.IsSelected(name.c_str()))
+							printf("%s\n", name.c_str());
+					}
+					continue;
+				}
+
+				// generate the signal and run the repetitions, collecting
+				// a per-frame time sample for each stage on each run
+				GenerateSignal(sig.signal, rate, opts.signalTime, pcm);
+				std::vector<double> samples[_countof(stageNames)];
+				StageTimes last;
+				bool ok = true;
+				for (int rep = 0 ; rep < opts.reps ; ++rep)
+				{
+					StageEncoder encoder;
+					StageTimes t;
+					std::string errorMessage;
+					if (!encoder.RunCase(pcm, rate, f.formatVersion, t, errorMessage))
+					{
+						printf("%s: %s\n", caseName.c_str(), errorMessage.c_str());
+						ok = false;
+						break;
+					}
+
+					double n = static_cast<double>(t.nFrames != 0 ? t.nFrames : 1);
+					const double stageTimes[] = { t.resample, t.transform, t.trials, t.compress, t.total };
+					for (size_t i = 0 ; i < _countof(stageNames) ; ++i)
+						samples[i].push_back(stageTimes[i] / n);
+					last = t;
+				}
+				if (!ok)
+					continue;
+
+				// add the results, quietly, since we print our own table line
+				double fps[_countof(stageNames)];
+				bool quiet = bench.options.quiet;
+				bench.options.quiet = true;
+				for (size_t i = 0 ; i < _countof(stageNames) ; ++i)
+				{
+					std::string name = caseName + "." + stageNames[i];
+					const Benchmark::Result *r = nullptr;
+					if (bench.IsSelected(name.c_str()))
+						r = bench.AddResult(name.c_str(), "frame", 1.0, last.nFrames, samples[i]);
+					else
+						std::sort(samples[i].begin(), samples[i].end());
+					double median = r != nullptr ? r->median_ns : samples[i][samples[i].size() / 2];
+					fps[i] = median > 0.0 ? 1.0e9 / median : 0.0;
+				}
+				bench.options.quiet = quiet;
+
+				// Show the table line.  Bytes/sec is the size of the encoded
+				// stream per second of audio, which is the figure that
+				// determines how much material fits in the ROM space.
+				if (!quiet)
+				{
+					printf("%-28s %10.0f %10.0f %10.0f %10.0f %10.0f %10.0f %9.0f\n",
+						caseName.c_str() + 7, fps[0], fps[1], fps[2], fps[3], fps[4],
+						static_cast<double>(last.nBytes) / opts.signalTime,
+						static_cast<double>(last.analysisBytes) / 1024.0);
+				}
+			}
+		}
+	}
+
+	// resampler comparisons
+	RunResampleBenchmarks(bench, opts);
+
+	// transcoding between format versions
+	RunTranscodeBenchmarks(bench, opts);
+
+	if (!bench.options.quiet && !bench.options.listOnly)
+		printf("\nPeak process memory: %.1f MB\n", static_cast<double>(GetPeakMemoryUsage()) / (1024.0 * 1024.0));
+}
@@ -0,0 +1,620 @@
+// Copyright 2023 Michael J Roberts
+// BSD 3-clause license - NO WARRANTY
+//
+// DCS Benchmark - kernel microbenchmarks
+//
+// This times the individual inner loops of the decoder and encoder in
+// isolation: frame decompression, the frequency-to-time transform,
+// the bit reader, the mixing level update, the encoder's transform,
+// the band encoding search, and the bit writer.  Most of these are
+// protected members of the decoder and encoder classes, so we reach
+// them through small subclasses that expose just enough to drive the
+// kernels directly, without going through the main loop.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <list>
+#include <vector>
+#include <memory>
+#include "Benchmark.h"
+#include "../DCSDecoder/DCSDecoder.h"
+#include "../DCSDecoder/DCSDecoderNative.h"
+#include "../DCSEncoder/DCSEncoder.h"
+
+namespace {
+
+	// Encoded test stream.  The stream data is copied into a padded
+	// buffer, since the bit reader's lookahead can read a few bytes
+	// past the end of the last frame.
+	struct TestStream
+	{
+		std::string name;
+		DCSDecoder::OSVersion osVersion;
+		std::vector<uint8_t> data;
+		int nFrames = 0;
+	};
+
+	// Decoder subclass for driving the decoder kernels directly
+	class KernelDecoder : public DCSDecoderNative
+	{
+	public:
+		KernelDecoder() : DCSDecoderNative(&host) { }
+
+		// set up in standalone mode for the given OS version
+		void InitKernel(OSVersion ver)
+		{
+			InitStandalone(ver);
+			Initialize();
+		}
+
+		// Time frame decompression over a stream, looping back to the
+		// start of the stream when we reach the end
+		void BenchDecompress(Benchmark &bench, const std::string &name, ROMPointer streamPtr)
+		{
+			Channel ch;
+			uint16_t buf[0x200];
+			memset(buf, 0, sizeof(buf));
+			auto Restart = [this, &ch, streamPtr]()
+			{
+				InitChannelStream(ch, streamPtr);
+				InitStreamPlayback(ch);
+			};
+			Restart();
+			if (ch.audioStream.numFrames == 0)
+				return;
+
+			bench.Run(name.c_str(), "frame", 1.0, [this, &ch, &buf, &Restart](uint64_t n)
+			{
+				for (uint64_t i = 0 ; i < n ; ++i)
+				{
+					decoderImpl->DecompressFrame(ch, 0x7FFF, buf);
+					if (--ch.audioStream.frameCounter == 0)
+						Restart();
+				}
+				Benchmark::sink += buf[0];
+			});
+		}
+
+		// Time frame decompression over all of the streams in the loaded
+		// ROM set.  We cycle through the streams in address order, playing
+		// each one through to the end before moving on to the next.
+		void BenchROMStreams(Benchmark &bench)
+		{
+			// set up the decoder implementation for the ROM's OS version
+			Initialize();
+
+			std::vector<ROMPointer> ptrs;
+			for (auto addr : ListStreams())
+				ptrs.emplace_back(MakeROMPointer(addr));
+			if (ptrs.size() == 0)
+				return;
+
+			Channel ch;
+			uint16_t buf[0x200];
+			memset(buf, 0, sizeof(buf));
+			size_t cur = 0;
+			auto Next = [this, &ch, &ptrs, &cur]()
+			{
+				// advance to the next stream with a non-zero frame count
+				for (size_t tries = 0 ; tries < ptrs.size() ; ++tries)
+				{
+					cur = (cur + 1) % ptrs.size();
+					InitChannelStream(ch, ptrs[cur]);
+					if (ch.audioStream.numFrames != 0)
+					{
+						InitStreamPlayback(ch);
+						return true;
+					}
+				}
+				return false;
+			};
+			if (!Next())
+				return;
+
+			bench.Run("decoder.DecompressFrame.rom", "frame", 1.0, [this, &ch, &buf, &Next](uint64_t n)
+			{
+				for (uint64_t i = 0 ; i < n ; ++i)
+				{
+					decoderImpl->DecompressFrame(ch, 0x7FFF, buf);
+					if (--ch.audioStream.frameCounter == 0)
+						Next();
+				}
+				Benchmark::sink += buf[0];
+			});
+		}
+
+		// Time the frequency-to-time transform.  We decompress one frame
+		// from the stream to get realistic frame buffer contents, then
+		// restore that snapshot before each transform, since the transform
+		// works in place.  The restore is a 1K memcpy, which is small
+		// next to the transform itself.
+		void BenchTransform(Benchmark &bench, const char *name, ROMPointer streamPtr)
+		{
+			Channel ch;
+			InitChannelStream(ch, streamPtr);
+			InitStreamPlayback(ch);
+			memset(frameBuffer, 0, sizeof(frameBuffer));
+			for (int i = 0 ; i < 8 && i < ch.audioStream.numFrames ; ++i)
+			{
+				memset(frameBuffer, 0, sizeof(frameBuffer));
+				decoderImpl->DecompressFrame(ch, 0x7FFF, frameBuffer);
+			}
+
+			uint16_t snapshot[_countof(frameBuffer)];
+			memcpy(snapshot, frameBuffer, sizeof(snapshot));
+			bench.Run(name, "frame", 1.0, [this, &snapshot](uint64_t n)
+			{
+				for (uint64_t i = 0 ; i < n ; ++i)
+				{
+					memcpy(frameBuffer, snapshot, sizeof(frameBuffer));
+					decoderImpl->TransformFrame(0);
+				}
+				Benchmark::sink += outputBuffer[17];
+			});
+		}
+
+		// Time the mixing level update.  We set up fades in progress on
+		// every cell of the mixing matrix, with step counts long enough
+		// that they stay active for a whole batch, so that every cell
+		// takes the fade path through the update.
+		void BenchMixingLevels(Benchmark &bench)
+		{
+			auto SetFades = [this]()
+			{
+				for (int i = 0 ; i < MAX_CHANNELS ; ++i)
+				{
+					for (int j = 0 ; j < MAX_CHANNELS ; ++j)
+					{
+						mixer.curLevel[i][j] = -2000 + 97 * (i * MAX_CHANNELS + j);
+						mixer.fadeTargetLevel[i][j] = (i + j) % 2 == 0 ? 3000 : -3000;
+						mixer.fadeDelta[i][j] = (i + j) % 2 == 0 ? 1 : -1;
+						mixer.fadeSteps[i][j] = 0x3FFFFFFF;
+					}
+				}
+			};
+			bench.Run("decoder.UpdateMixingLevels", "update", 1.0, [this, &SetFades](uint64_t n)
+			{
+				SetFades();
+				for (uint64_t i = 0 ; i < n ; ++i)
+					UpdateMixingLevels();
+				Benchmark::sink += mixingMultiplier[3];
+			});
+		}
+
+		// Time the bit reader.  This reads a repeating pattern of mixed
+		// field widths, similar to the mix of Huffman codes and sample
+		// fields in a typical frame, from a buffer of random bits.
+		static void BenchBitReader(Benchmark &bench)
+		{
+			// fill the buffer with pseudo-random bits, with some padding
+			// at the end for the lookahead
+			const size_t bufSize = 65536;
+			std::vector<uint8_t> buf(bufSize + 16);
+			uint32_t rng = 12345;
+			for (auto &b : buf)
+			{
+				rng ^= rng << 13;
+				rng ^= rng >> 17;
+				rng ^= rng << 5;
+				b = static_cast<uint8_t>(rng);
+			}
+
+			// the width pattern adds up to 128 bits per pass
+			static const int widths[] = { 3, 7, 2, 5, 11, 1, 4, 9, 6, 16, 3, 8, 2, 13, 5, 1, 24, 8 };
+			const int bitsPerPass = 128;
+			const size_t maxPasses = bufSize * 8 / bitsPerPass;
+			bench.Run("decoder.ROMBitPointer.Get", "bit", bitsPerPass, [&buf, maxPasses](uint64_t n)
+			{
+				ROMBitPointer p(ROMPointer(0, buf.data()));
+				uint32_t acc = 0;
+				size_t pass = 0;
+				for (uint64_t i = 0 ; i < n ; ++i)
+				{
+					for (int w : widths)
+						acc += p.Get(w);
+
+					if (++pass == maxPasses)
+					{
+						p = ROMBitPointer(ROMPointer(0, buf.data()));
+						pass = 0;
+					}
+				}
+				Benchmark::sink += acc;
+			});
+		}
+
+	protected:
+		MinHost host;
+	};
+
+	// Encoder subclass for driving the encoder kernels directly
+	class KernelEncoder : public DCSEncoder
+	{
+	public:
+		// Generate the benchmark test signal.  This is meant to be
+		// roughly music-like, so that the band-by-band encoding decisions
+		// exercise a realistic mix of code paths: a three-note chord with
+		// a slow tremolo, plus short decaying noise bursts on the beat.
+		// The generator is deterministic, so every run encodes the same
+		// input.
+		static void GenerateSignal(std::vector<float> &pcm, int nSamples)
+		{
+			pcm.resize(nSamples);
+			const double rate = 31250.0, twoPi = 6.283185307179586;
+			uint32_t rng = 1;
+			for (int i = 0 ; i < nSamples ; ++i)
+			{
+				double t = i / rate;
+				double chord = sin(twoPi * 220.0 * t) + 0.7 * sin(twoPi * 277.18 * t) + 0.5 * sin(twoPi * 329.63 * t);
+				double tremolo = 0.75 + 0.25 * sin(twoPi * 3.0 * t);
+
+				rng ^= rng << 13;
+				rng ^= rng >> 17;
+				rng ^= rng << 5;
+				double noise = static_cast<double>(rng) / 2147483648.0 - 1.0;
+				double beat = fmod(t, 0.25);
+				double burst = exp(-beat * 40.0);
+
+				pcm[i] = static_cast<float>(0.2 * chord * tremolo + 0.3 * noise * burst);
+			}
+		}
+
+		// Encode the test signal in the given format
+		bool EncodeTestStream(TestStream &ts, const std::vector<float> &pcm, uint16_t formatVersion, int formatType, std::string &errorMessage)
+		{
+			compressionParams.formatVersion = formatVersion;
+			compressionParams.streamFormatType = formatType;
+			std::unique_ptr<Stream> stream(OpenStream(31250, errorMessage));
+			if (stream == nullptr)
+				return false;
+
+			WriteStream(stream.get(), pcm.data(), pcm.size());
+			DCSAudio obj;
+			if (!CloseStream(stream.get(), obj, errorMessage))
+				return false;
+
+			ts.data.assign(obj.data.get(), obj.data.get() + obj.nBytes);
+			ts.data.resize(obj.nBytes + 16, 0);
+			ts.nFrames = obj.nFrames;
+			return true;
+		}
+
+		// Time the encoder's transform, including the windowing and the
+		// frame list append.  The frame list is cleared at the end of each
+		// batch to keep memory use flat.
+		void BenchTransform(Benchmark &bench, const std::vector<float> &pcm)
+		{
+			std::string errorMessage;
+			std::unique_ptr<Stream> stream(OpenStream(31250, errorMessage));
+			if (stream == nullptr)
+				return;
+
+			const size_t nWindows = (pcm.size() - 256) / 240;
+			bench.Run("encoder.TransformFrame", "frame", 1.0, [this, &stream, &pcm, nWindows](uint64_t n)
+			{
+				for (uint64_t i = 0 ; i < n ; ++i)
+				{
+					memcpy(stream->inputBuf, &pcm[(i % nWindows) * 240], sizeof(stream->inputBuf));
+					stream->nInputBuf = 256;
+					TransformFrame(stream.get());
+				}
+				stream->frames.clear();
+			});
+		}
+
+		// Time the bare DFT
+		void BenchDFT(Benchmark &bench, const std::vector<float> &pcm)
+		{
+			std::string errorMessage;
+			std::unique_ptr<Stream> stream(OpenStream(31250, errorMessage));
+			if (stream == nullptr)
+				return;
+
+			memcpy(stream->inputBuf, &pcm[4800], sizeof(stream->inputBuf));
+			bench.Run("encoder.DFTAlgorithmOrig", "frame", 1.0, [this, &stream](uint64_t n)
+			{
+				float fbuf[258];
+				for (uint64_t i = 0 ; i < n ; ++i)
+					DFTAlgorithmOrig(fbuf, stream.get());
+				Benchmark::sink += static_cast<uint32_t>(fbuf[5]);
+			});
+		}
+
+		// Time the band encoding search, using the OS94 band type code
+		// interpretation for bands 6-15 on a band of transformed samples
+		void BenchBandSearch(Benchmark &bench, const std::vector<float> &pcm)
+		{
+			std::string errorMessage;
+			std::unique_ptr<Stream> stream(OpenStream(31250, errorMessage));
+			if (stream == nullptr)
+				return;
+
+			// transform a few frames to get realistic frequency-domain data
+			for (int i = 0 ; i < 8 ; ++i)
+			{
+				memcpy(stream->inputBuf, &pcm[(20 + i) * 240], sizeof(stream->inputBuf));
+				stream->nInputBuf = 256;
+				TransformFrame(stream.get());
+			}
+			std::vector<float> samples(stream->frames.back().f, stream->frames.back().f + 256);
+
+			auto Interpret = [](int band, int bandTypeCode)
+			{
+				static const uint16_t xlat6F[0x0010] ={
+					0x0000, 0x0100, 0x0200, 0x0300, 0x0302, 0x0402, 0x0407, 0x040b,
+					0x050b, 0x050f, 0x0513, 0x0517, 0x0617, 0x061b, 0x061f, 0x0723
+				};
+				int bitWidth = xlat6F[bandTypeCode] >> 8;
+				int refVal = (bitWidth >= 1 && bitWidth <= 6) ? (1 << (bitWidth - 1)) : 0;
+				return BandEncoding{ bitWidth, 0x10 + (xlat6F[bandTypeCode] & 0xFF), refVal };
+			};
+
+			// bands 6 and up hold 16 samples each, starting at sample 64
+			const int nBands = 10, bandSize = 16;
+			bench.Run("encoder.FindBestBandEncoding", "band", 1.0, [this, &samples, &Interpret](uint64_t n)
+			{
+				int acc = 0;
+				for (uint64_t i = 0 ; i < n ; ++i)
+				{
+					int band = 6 + static_cast<int>(i % nBands);
+					acc += FindBestBandEncoding(compressionParams, Interpret, -16, 30, band,
+						&samples[64 + (band - 6) * bandSize], bandSize).bandTypeCode;
+				}
+				Benchmark::sink += acc;
+			});
+		}
+
+		// Time the bit writer, with the same width mix as the bit reader
+		static void BenchBitWriter(Benchmark &bench)
+		{
+			static const int widths[] = { 3, 7, 2, 5, 11, 1, 4, 9, 6, 16, 3, 8, 2, 13, 5, 1, 24, 8 };
+			bench.Run("encoder.BitWriter.Write", "bit", 128, [](uint64_t n)
+			{
+				BitWriter w;
+				uint32_t val = 0x9E3779B9;
+				for (uint64_t i = 0 ; i < n ; ++i)
+				{
+					for (int wid : widths)
+					{
+						w.Write(val, wid);
+						val = val * 1664525 + 1013904223;
+					}
+				}
+				Benchmark::sink += static_cast<uint32_t>(w.chunks.size());
+			});
+		}
+	};
+
+	// Build a synthetic 1993a Type 1 stream.  The encoder can't produce
+	// this format (it only appears in a few Judge Dredd tracks), so we
+	// pack the frames directly.  Each frame codes all 18 bands, with a
+	// pseudo-random mix of sample bit widths, tapering from wide samples
+	// in the low bands to narrow ones at the top, as in real audio.  The
+	// sample values are random.  The decompressor's work depends on the
+	// band widths, not on the sample values, so this exercises the same
+	// code path as a recorded stream.
+	static void BuildStream93aType1(TestStream &ts, int nFrames)
+	{
+		// Band bit-width prefix codes for widths 0-5, from the decoder's
+		// codebook for header bits $60 == $00, as { code, length }
+		static const struct { uint32_t code; int nBits; } widthCodes[] ={
+			{ 0x0, 3 }, { 0x2, 3 }, { 0x3, 3 }, { 0x2, 2 }, { 0x3, 2 }, { 0x3, 4 }
+		};
+
+		// scale code deltas -1, 0, and +1 from the previous band
+		static const struct { uint32_t code; int nBits; } scaleCodes[] ={
+			{ 0x0, 2 }, { 0x1, 2 }, { 0xA, 4 }
+		};
+
+		// stream inputs per band, from the decoder
+		static const int inputsPerBand[] ={ 2, 2, 2, 2, 3, 4, 5, 6, 5, 6, 7, 9, 11, 14, 12, 12, 12, 13 };
+		const int nBands = static_cast<int>(_countof(inputsPerBand));
+
+		// frame count prefix, and the one-byte header: Type 1, codebook 0, band count
+		ts.data.clear();
+		ts.data.push_back(static_cast<uint8_t>((nFrames >> 8) & 0xFF));
+		ts.data.push_back(static_cast<uint8_t>(nFrames & 0xFF));
+		ts.data.push_back(static_cast<uint8_t>(0x80 | nBands));
+
+		// pack bits, most significant bit first, as the bit reader expects
+		uint32_t acc = 0;
+		int accBits = 0;
+		auto Put = [&ts, &acc, &accBits](uint32_t val, int nBits)
+		{
+			for (int i = nBits - 1 ; i >= 0 ; --i)
+			{
+				acc = (acc << 1) | ((val >> i) & 1);
+				if (++accBits == 8)
+				{
+					ts.data.push_back(static_cast<uint8_t>(acc));
+					acc = 0;
+					accBits = 0;
+				}
+			}
+		};
+
+		uint32_t rng = 1;
+		auto Rand = [&rng]() { rng = rng * 1664525 + 1013904223; return rng >> 8; };
+		for (int frame = 0 ; frame < nFrames ; ++frame)
+		{
+			// the decoder starts each frame from the same base scale code,
+			// so keep our running delta within a few steps of it
+			int scale = 0;
+			for (int band = 0 ; band < nBands ; ++band)
+			{
+				// pick a width, up to 5 bits in bands 0-3, down to 1 bit in 16-17
+				int maxWidth = 5 - band/4;
+				int width = static_cast<int>(Rand() % (maxWidth + 1));
+				Put(widthCodes[width].code, widthCodes[width].nBits);
+				if (width == 0)
+					continue;
+
+				// scale delta
+				int delta = static_cast<int>(Rand() % 3) - 1;
+				if (scale + delta < -4 || scale + delta > 4)
+					delta = 0;
+				scale += delta;
+				Put(scaleCodes[delta + 1].code, scaleCodes[delta + 1].nBits);
+
+				// samples
+				for (int i = 0 ; i < inputsPerBand[band] ; ++i)
+					Put(Rand(), width);
+			}
+		}
+
+		// flush the last partial byte, and pad for the bit reader's lookahead
+		if (accBits != 0)
+			ts.data.push_back(static_cast<uint8_t>(acc << (8 - accBits)));
+		ts.data.resize(ts.data.size() + 16, 0);
+		ts.nFrames = nFrames;
+	}
+}
+
+void RunKernelBenchmarks(Benchmark &bench, const char *romFile)
+{
+	// Generate the test signal and encode it in each stream format that
+	// the encoder supports, plus a directly generated 1993a Type 1 stream
+	// for the one format it doesn't.  Each format exercises a different
+	// decompression path in the decoder.
+	std::vector<float> pcm;
+	KernelEncoder::GenerateSignal(pcm, 31250 * 2);
+
+	struct FormatDesc
+	{
+		const char *name;
+		DCSDecoder::OSVersion osVersion;
+		uint16_t formatVersion;
+		int formatType;
+	};
+	static const FormatDesc formats[] ={
+		{ "94x.type1", DCSDecoder::OSVersion::OS95, 0x9400, 1 },
+		{ "94x.type0", DCSDecoder::OSVersion::OS95, 0x9400, 0 },
+		{ "93.type1", DCSDecoder::OSVersion::OS93b, 0x9302, 1 },
+		{ "93.type0", DCSDecoder::OSVersion::OS93b, 0x9302, 0 },
+		{ "93a.type1", DCSDecoder::OSVersion::OS93a, 0x9301, 1 },
+		{ "93a.type0", DCSDecoder::OSVersion::OS93a, 0x9301, 0 },
+	};
+
+	std::list<TestStream> streams;
+	if (!bench.options.listOnly)
+	{
+		for (auto &f : formats)
+		{
+			// skip the encoding work if nothing will use the stream
+			std::string name = std::string("decoder.DecompressFrame.") + f.name;
+			bool needed = bench.IsSelected(name.c_str())
+				|| (strcmp(f.name, "94x.type1") == 0 && bench.IsSelected("decoder.TransformFrame.94x"))
+				|| (strcmp(f.name, "93.type1") == 0 && bench.IsSelected("decoder.TransformFrame.93"));
+			if (!needed)
+				continue;
+
+			TestStream &ts = streams.emplace_back();
+			ts.name = f.name;
+			ts.osVersion = f.osVersion;
+			if (f.formatVersion == 0x9301 && f.formatType == 1)
+			{
+				BuildStream93aType1(ts, static_cast<int>(pcm.size() / 240));
+				continue;
+			}
+
+			KernelEncoder encoder;
+			std::string errorMessage;
+			if (!encoder.EncodeTestStream(ts, pcm, f.formatVersion, f.formatType, errorMessage))
+			{
+				printf("Error encoding %s test stream: %s\n", f.name, errorMessage.c_str());
+				streams.pop_back();
+			}
+		}
+	}
+	auto FindStream = [&streams](const char *name) -> const TestStream*
+	{
+		for (auto &s : streams)
+		{
+			if (s.name == name)
+				return &s;
+		}
+		return nullptr;
+	};
+
+	// frame decompression, one benchmark per synthetic stream format
+	for (auto &f : formats)
+	{
+		std::string name = std::string("decoder.DecompressFrame.") + f.name;
+		if (bench.options.listOnly)
+		{
+			bench.Run(name.c_str(), "frame", 1.0, nullptr);
+			continue;
+		}
+		if (auto *ts = FindStream(f.name); ts != nullptr)
+		{
+			KernelDecoder dec;
+			dec.InitKernel(ts->osVersion);
+			dec.BenchDecompress(bench, name, DCSDecoder::ROMPointer(0, ts->data.data()));
+		}
+	}
+
+	// Frame decompression on recorded ROM streams.  This cycles through
+	// every stream in the ROM, so it reflects the real mix of stream
+	// types in a released title.
+	if (romFile != nullptr && bench.IsSelected("decoder.DecompressFrame.rom"))
+	{
+		if (bench.options.listOnly)
+			bench.Run("decoder.DecompressFrame.rom", "frame", 1.0, nullptr);
+		else
+		{
+			KernelDecoder dec;
+			std::list<DCSDecoder::ZipFileData> zipData;
+			std::string errorDetails;
+			if (dec.LoadROMFromZipFile(romFile, zipData, nullptr, &errorDetails) != DCSDecoder::ZipLoadStatus::Success)
+				printf("Error loading ROM file %s: %s\n", romFile, errorDetails.c_str());
+			else if (dec.CheckROMs() != 1)
+				printf("ROM file %s: ROM checksum or catalog error\n", romFile);
+			else
+				dec.BenchROMStreams(bench);
+		}
+	}
+
+	// transform kernels
+	if (bench.options.listOnly)
+	{
+		bench.Run("decoder.TransformFrame.94x", "frame", 1.0, nullptr);
+		bench.Run("decoder.TransformFrame.93", "frame", 1.0, nullptr);
+	}
+	else
+	{
+		if (auto *ts = FindStream("94x.type1"); ts != nullptr)
+		{
+			KernelDecoder dec;
+			dec.InitKernel(ts->osVersion);
+			dec.BenchTransform(bench, "decoder.TransformFrame.94x", DCSDecoder::ROMPointer(0, ts->data.data()));
+		}
+		if (auto *ts = FindStream("93.type1"); ts != nullptr)
+		{
+			KernelDecoder dec;
+			dec.InitKernel(ts->osVersion);
+			dec.BenchTransform(bench, "decoder.TransformFrame.93", DCSDecoder::ROMPointer(0, ts->data.data()));
+		}
+	}
+
+	// bit reader and mixer
+	KernelDecoder::BenchBitReader(bench);
+	{
+		KernelDecoder dec;
+		dec.InitKernel(DCSDecoder::OSVersion::OS95);
+		dec.BenchMixingLevels(bench);
+	}
+
+	// encoder kernels
+	{
+		KernelEncoder encoder;
+		encoder.BenchTransform(bench, pcm);
+		encoder.BenchDFT(bench, pcm);
+		encoder.BenchBandSearch(bench, pcm);
+		KernelEncoder::BenchBitWriter(bench);
+	}
+}
@@ -0,0 +1,516 @@
+// Copyright 2023 Michael J Roberts
+// BSD 3-clause license - NO WARRANTY
+//
+// DCS Benchmark - end-to-end playback benchmarks
+//
+// This measures the decoders the way a host program actually uses them:
+// boot the decoder on a ROM set, send track commands, and pull PCM
+// samples out through GetNextSample().  Each registered decoder plays
+// every playable track in the corpus for a fixed time, and we time each
+// 240-sample frame individually, so that the report can show the
+// latency distribution and the single worst frame, not just the
+// average throughput.  The worst frame is the number that matters for
+// sizing an audio buffer: a host that renders just ahead of the audio
+// device needs every frame, not just the typical one, to finish within
+// the 7.68ms that the frame takes to play.
+//
+// The scaling test then runs 1 to N decoders at once, one per thread,
+// all playing the corpus from different starting points.  On a machine
+// with N cores, ideal scaling would give N times the single-instance
+// throughput; the shortfall shows where the decoders start competing
+// for shared caches and memory bandwidth.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <list>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "Benchmark.h"
+#include "../DCSDecoder/DCSDecoder.h"
+#include "../DCSDecoder/DCSDecoderNative.h"
+#include "../DCSDecoder/DCSDecoderEmu.h"
+
+namespace {
+
+	using Clock = std::chrono::steady_clock;
+
+	// Loaded ROM set.  The ROM data is loaded once per Zip file, and
+	// shared by all of the decoder instances, since the decoder only
+	// keeps pointers to the ROM data.
+	struct ROMSet
+	{
+		std::string filename;
+		std::list<DCSDecoder::ZipFileData> zipData;
+
+		// playable (type 1) track numbers
+		std::vector<uint16_t> tracks;
+	};
+
+	// Worst frame information
+	struct WorstFrame
+	{
+		double ns = 0.0;
+		const ROMSet *romSet = nullptr;
+		uint16_t track = 0;
+		int frame = 0;
+
+		void Update(const WorstFrame &w)
+		{
+			if (w.ns > ns)
+				*this = w;
+		}
+	};
+
+	// Decoder instance, playing through the corpus
+	class Player
+	{
+	public:
+		Player(const DCSDecoder::Registration &reg) : reg(reg) { }
+
+		// Create and boot the decoder on a ROM set.  Returns false on
+		// failure, with a message in errorMessage.
+		bool Boot(const ROMSet &romSet, std::string &errorMessage)
+		{
+			// create a fresh decoder, deleting any previous one first,
+			// since the emulator can only exist as a singleton
+			decoder.reset();
+			try
+			{
+				decoder.reset(reg.factory(&host));
+			}
+			catch (const char *msg)
+			{
+				errorMessage = msg;
+				return false;
+			}
+			if (decoder == nullptr)
+			{
+				errorMessage = "Unable to create decoder";
+				return false;
+			}
+
+			// add the ROMs
+			for (auto &zd : romSet.zipData)
+			{
+				if (zd.chipNum >= 2)
+					decoder->AddROM(zd.chipNum, zd.data.get(), zd.dataSize);
+			}
+			decoder->CheckROMs();
+
+			// Boot it, and run until the boot process completes.  We use
+			// fast boot mode, and the boot time isn't counted in the
+			// results, since we're only interested in steady-state playback.
+			decoder->SetFastBootMode(true);
+			decoder->HardBoot();
+			decoder->StartSelfTests();
+			for (int i = 0 ; i < 31250 * 30 && !decoder->IsRunning() && decoder->IsOK() ; ++i)
+				decoder->GetNextSample();
+
+			if (!decoder->IsOK())
+			{
+				errorMessage = decoder->GetErrorMessage();
+				return false;
+			}
+			if (!decoder->IsRunning())
+			{
+				errorMessage = "Decoder didn't finish booting";
+				return false;
+			}
+			return true;
+		}
+
+		// Warm up by playing through the tracks, untimed, for the given
+		// time.  This gets the decoder's tables and the ROM data into the
+		// caches before the timed run starts.
+		void WarmUp(const ROMSet &romSet, int ms)
+		{
+			auto t0 = Clock::now();
+			for (size_t i = 0 ; std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - t0).count() < ms ; ++i)
+			{
+				uint16_t track = romSet.tracks[i % romSet.tracks.size()];
+				decoder->WriteDataPort(static_cast<uint8_t>(track >> 8));
+				decoder->WriteDataPort(static_cast<uint8_t>(track & 0xFF));
+				for (int j = 0 ; j < 240 * 16 ; ++j)
+					checksum += static_cast<uint16_t>(decoder->GetNextSample());
+			}
+		}
+
+		// Play the tracks of a ROM set, starting at the given index in
+		// the track list and wrapping around, for framesPerTrack frames
+		// each.  Each frame's decoding time is appended to 'samples'.
+		void Play(const ROMSet &romSet, size_t startIndex, int framesPerTrack, std::vector<double> &samples)
+		{
+			int16_t buf[240];
+			size_t nTracks = romSet.tracks.size();
+			for (size_t i = 0 ; i < nTracks ; ++i)
+			{
+				// start the track
+				uint16_t track = romSet.tracks[(startIndex + i) % nTracks];
+				decoder->WriteDataPort(static_cast<uint8_t>(track >> 8));
+				decoder->WriteDataPort(static_cast<uint8_t>(track & 0xFF));
+
+				// decode and time the frames
+				for (int frame = 0 ; frame < framesPerTrack ; ++frame)
+				{
+					auto t0 = Clock::now();
+					for (int j = 0 ; j < 240 ; ++j)
+						buf[j] = decoder->GetNextSample();
+					auto t1 = Clock::now();
+
+					double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count());
+					samples.push_back(ns);
+					if (ns > worst.ns)
+						worst = { ns, &romSet, track, frame };
+
+					checksum += static_cast<uint16_t>(buf[frame % 240]);
+				}
+			}
+		}
+
+		const DCSDecoder::Registration &reg;
+		DCSDecoder::MinHost host;
+		std::unique_ptr<DCSDecoder> decoder;
+
+		// worst frame seen
+		WorstFrame worst;
+
+		// output checksum, folded into the benchmark sink when done
+		uint32_t checksum = 0;
+	};
+
+	// Load a ROM set from a Zip file
+	bool LoadROMSet(ROMSet &romSet, const char *filename, std::string &errorMessage)
+	{
+		// use a temporary native decoder to load and scan the ROMs
+		DCSDecoder::MinHost host;
+		DCSDecoderNative decoder(&host);
+		romSet.filename = filename;
+		if (decoder.LoadROMFromZipFile(filename, romSet.zipData, nullptr, &errorMessage) != DCSDecoder::ZipLoadStatus::Success)
+			return false;
+		if (int code = decoder.CheckROMs(); code != 1)
+		{
+			errorMessage = "ROM checksum or catalog error in U" + std::to_string(code);
+			return false;
+		}
+
+		// Make a list of the playable tracks.  Only type 1 tracks play on
+		// their own; the deferred types just load a program that waits to
+		// be triggered by another track.
+		for (int i = 0, maxTrack = decoder.GetMaxTrackNumber() ; i <= maxTrack ; ++i)
+		{
+			DCSDecoder::TrackInfo ti;
+			if (decoder.GetTrackInfo(static_cast<uint16_t>(i), ti) && ti.type == 1)
+				romSet.tracks.push_back(static_cast<uint16_t>(i));
+		}
+		return true;
+	}
+
+	// Figure the realtime multiple for a number of frames decoded in a
+	// given time.  Each frame is 7.68ms of audio.
+	double RealtimeMultiple(double nFrames, double ns)
+	{
+		return ns > 0.0 ? nFrames * 7.68e6 / ns : 0.0;
+	}
+}
+
+void RunPlaybackBenchmarks(Benchmark &bench, const PlaybackOptions &opts)
+{
+	// figure the frames per track
+	int framesPerTrack = static_cast<int>(opts.trackTime * 31250.0 / 240.0 + 0.5);
+	if (framesPerTrack < 1)
+		framesPerTrack = 1;
+
+	// figure the maximum instance count for the scaling test
+	int maxInstances = opts.maxInstances;
+	if (maxInstances <= 0)
+		maxInstances = static_cast<int>(std::thread::hardware_concurrency());
+	if (maxInstances <= 0)
+		maxInstances = 1;
+
+	// Figure the instance counts for the scaling test: 1, 2, 4, ... up
+	// to and including the maximum.  Stepping by powers of two keeps the
+	// run time reasonable on machines with many cores, while still
+	// showing the shape of the scaling curve.
+	std::vector<int> instanceCounts;
+	for (int k = 1 ; k < maxInstances ; k *= 2)
+		instanceCounts.push_back(k);
+	instanceCounts.push_back(maxInstances);
+
+	// In list mode, just show the names.  The scaling results are only
+	// generated for decoders that can run multiple instances, which we
+	// can't determine without creating one, so list the native decoder
+	// only.
+	auto &regMap = DCSDecoder::GetRegistrationMap();
+	if (bench.options.listOnly)
+	{
+		for (auto &r : regMap)
+		{
+			std::string name = "playback." + r.first;
+			if (bench.IsSelected(name.c_str()))
+				printf("%s\n", name.c_str());
+		}
+		for (int k : instanceCounts)
+		{
+			std::string name = "scaling.native.x" + std::to_string(k);
+			if (bench.IsSelected(name.c_str()))
+				printf("%s\n", name.c_str());
+		}
+		return;
+	}
+
+	// load the corpus
+	if (opts.romFiles.size() == 0)
+	{
+		printf("The playback benchmarks require at least one ROM set (--rom=<file>)\n");
+		return;
+	}
+	std::list<ROMSet> corpus;
+	size_t nCorpusTracks = 0;
+	for (auto &f : opts.romFiles)
+	{
+		ROMSet &romSet = corpus.emplace_back();
+		std::string errorMessage;
+		if (!LoadROMSet(romSet, f.c_str(), errorMessage))
+		{
+			printf("Error loading ROM set %s: %s\n", f.c_str(), errorMessage.c_str());
+			corpus.pop_back();
+			continue;
+		}
+		nCorpusTracks += romSet.tracks.size();
+	}
+	if (nCorpusTracks == 0)
+	{
+		printf("No playable tracks found in the ROM sets\n");
+		return;
+	}
+	if (!bench.options.quiet)
+	{
+		printf("\nPlayback corpus: %d ROM set%s, %d tracks, %.2f seconds per track\n",
+			static_cast<int>(corpus.size()), corpus.size() == 1 ? "" : "s",
+			static_cast<int>(nCorpusTracks), framesPerTrack * 0.00768);
+	}
+
+	auto PrintWorst = [](const WorstFrame &w)
+	{
+		if (w.romSet != nullptr)
+		{
+			printf("    worst frame: %.1f us (%s, track $%04X, frame %d)\n",
+				w.ns / 1000.0, w.romSet->filename.c_str(), w.track, w.frame);
+		}
+	};
+
+	for (auto &r : regMap)
+	{
+		const DCSDecoder::Registration &reg = r.second;
+		std::string name = "playback." + r.first;
+		std::string scalingPrefix = "scaling." + r.first + ".x";
+		bool runSingle = bench.IsSelected(name.c_str());
+		bool runScaling = false;
+		for (int k : instanceCounts)
+			runScaling |= bench.IsSelected((scalingPrefix + std::to_string(k)).c_str());
+		if (!runSingle && !runScaling)
+			continue;
+
+		// Single instance.  This is also the reference for the scaling
+		// efficiency figures, so we always run it, even if it's filtered
+		// out of the report.
+		std::vector<double> samples;
+		samples.reserve(nCorpusTracks * framesPerTrack);
+		WorstFrame worst;
+		bool singleton = false;
+		uint32_t checksum = 0;
+		bool ok = true;
+		for (auto &romSet : corpus)
+		{
+			Player player(reg);
+			std::string errorMessage;
+			if (!player.Boot(romSet, errorMessage))
+			{
+				printf("%s: error booting decoder on %s: %s\n", name.c_str(), romSet.filename.c_str(), errorMessage.c_str());
+				ok = false;
+				break;
+			}
+
+			// the emulator can't run multiple instances
+			singleton = dynamic_cast<DCSDecoderEmulated*>(player.decoder.get()) != nullptr;
+
+			if (&romSet == &corpus.front())
+				player.WarmUp(romSet, bench.options.warmup_ms);
+			player.Play(romSet, 0, framesPerTrack, samples);
+			worst.Update(player.worst);
+			checksum += player.checksum;
+		}
+		if (!ok)
+			continue;
+
+		double totalNs = 0.0;
+		for (double s : samples)
+			totalNs += s;
+		double singleRealtime = RealtimeMultiple(static_cast<double>(samples.size()), totalNs);
+		Benchmark::sink += checksum;
+		if (runSingle)
+		{
+			bench.AddResult(name.c_str(), "frame", 1.0, 1, samples);
+			if (!bench.options.quiet)
+			{
+				printf("    %.1fx realtime\n", singleRealtime);
+				PrintWorst(worst);
+			}
+		}
+
+		// scaling test
+		if (!runScaling)
+			continue;
+		if (singleton)
+		{
+			if (!bench.options.quiet)
+				printf("    (%s is a singleton; skipping the multi-instance scaling test)\n", r.first.c_str());
+			continue;
+		}
+
+		if (!bench.options.quiet)
+		{
+			printf("\n  %s scaling:\n", r.first.c_str());
+			printf("  %9s %14s %14s %11s %12s %12s\n",
+				"instances", "aggregate xRT", "slowest xRT", "efficiency", "p99 ns", "worst us");
+		}
+
+		for (int k : instanceCounts)
+		{
+			// Set up the instances.  Each one runs on its own thread, which
+			// boots its decoders and then waits for the starting signal, so
+			// that all of the instances decode concurrently.  An instance
+			// has a separate player for each ROM set in the corpus, all
+			// booted before the start, so that the timed run only covers
+			// playback, the same as the single-instance reference, which
+			// times the frames individually.
+			struct Instance
+			{
+				Instance(const DCSDecoder::Registration &reg) : reg(reg) { }
+				const DCSDecoder::Registration &reg;
+				std::list<Player> players;
+				std::vector<double> samples;
+				double elapsed_ns = 0.0;
+				bool ok = true;
+			};
+			std::list<Instance> instances;
+			for (int i = 0 ; i < k ; ++i)
+				instances.emplace_back(reg);
+
+			std::atomic<int> nReady = 0;
+			std::atomic<bool> go = false;
+			std::vector<std::thread> threads;
+			int warmup_ms = bench.options.warmup_ms;
+			int idx = 0;
+			for (auto &inst : instances)
+			{
+				threads.emplace_back([&inst, &corpus, &nReady, &go, idx, k, framesPerTrack, warmup_ms]()
+				{
+					// boot a player for each ROM set
+					for (auto &romSet : corpus)
+					{
+						std::string errorMessage;
+						if (!inst.players.emplace_back(inst.reg).Boot(romSet, errorMessage))
+						{
+							inst.ok = false;
+							break;
+						}
+					}
+
+					// if we failed, count ourselves as ready anyway so that
+					// the others aren't left waiting
+					if (!inst.ok)
+					{
+						++nReady;
+						return;
+					}
+
+					// warm up on the first ROM set, then wait for all of the
+					// instances to be ready
+					inst.players.front().WarmUp(corpus.front(), warmup_ms);
+					++nReady;
+					while (!go)
+						std::this_thread::yield();
+
+					// play the whole corpus, starting each ROM set at a
+					// different point in the track list per instance, so
+					// that the instances aren't decoding the same material
+					// in lockstep
+					auto t0 = Clock::now();
+					auto player = inst.players.begin();
+					for (auto &romSet : corpus)
+					{
+						size_t start = romSet.tracks.size() * idx / k;
+						(player++)->Play(romSet, start, framesPerTrack, inst.samples);
+					}
+					inst.elapsed_ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t0).count());
+				});
+				++idx;
+			}
+
+			// wait for everyone to boot, then start them all at once
+			while (nReady < k)
+				std::this_thread::yield();
+			auto t0 = Clock::now();
+			go = true;
+			for (auto &t : threads)
+				t.join();
+			double wall_ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t0).count());
+
+			// collect the results
+			std::vector<double> pooled;
+			WorstFrame kWorst;
+			double slowest = 0.0;
+			bool kOk = true;
+			for (auto &inst : instances)
+			{
+				if (!inst.ok)
+					kOk = false;
+				pooled.insert(pooled.end(), inst.samples.begin(), inst.samples.end());
+				for (auto &player : inst.players)
+				{
+					kWorst.Update(player.worst);
+					Benchmark::sink += player.checksum;
+				}
+				double rt = RealtimeMultiple(static_cast<double>(inst.samples.size()), inst.elapsed_ns);
+				if (slowest == 0.0 || rt < slowest)
+					slowest = rt;
+			}
+			if (!kOk)
+			{
+				printf("  %9d   (error booting decoder instances)\n", k);
+				break;
+			}
+
+			// The aggregate throughput is the total audio decoded across
+			// all instances divided by the wall clock time.  The
+			// efficiency compares that to k times the single-instance
+			// throughput.
+			double aggregate = RealtimeMultiple(static_cast<double>(pooled.size()), wall_ns);
+			double efficiency = singleRealtime > 0.0 ? aggregate * 100.0 / (k * singleRealtime) : 0.0;
+
+			// add the result, quietly, since we print our own table line
+			std::string kName = scalingPrefix + std::to_string(k);
+			if (bench.IsSelected(kName.c_str()))
+			{
+				bool quiet = bench.options.quiet;
+				bench.options.quiet = true;
+				auto *res = bench.AddResult(kName.c_str(), "frame", 1.0, k, pooled);
+				bench.options.quiet = quiet;
+
+				if (!quiet && res != nullptr)
+				{
+					printf("  %9d %13.1fx %13.1fx %10.1f%% %12.1f %12.1f\n",
+						k, aggregate, slowest, efficiency, res->p99_ns, kWorst.ns / 1000.0);
+				}
+			}
+		}
+	}
+}
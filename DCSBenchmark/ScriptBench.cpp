@@ -0,0 +1,234 @@
+// Copyright 2023 Michael J Roberts
+// BSD 3-clause license - NO WARRANTY
+//
+// DCS Benchmark - script compiler front end
+//
+// This times the encoder's script tokenizer and parser on a large
+// generated script, of the sort that a tool might write when it
+// converts a whole sound library into a DCS ROM.  The script defines a
+// handful of tiny synthesized streams (so that the stream encoding
+// doesn't swamp the measurement), followed by thousands of track
+// programs exercising the common statements.  Keywords are written in
+// a mix of upper and lower case, since the tokenizer has to treat them
+// case-insensitively.
+//
+//   script.tokenize - reading every token in the file, from memory
+//   script.parse    - the whole ParseScript() pass, including loading
+//                     the file and running the track optimizer
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <filesystem>
+#include "Benchmark.h"
+#include "../DCSEncoder/DCSTokenizer.h"
+#include "../DCSEncoder/DCSCompiler.h"
+
+namespace {
+
+	using Clock = std::chrono::steady_clock;
+
+	double ElapsedNs(Clock::time_point t0, Clock::time_point t1)
+	{
+		return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count());
+	}
+
+	// Error logger that keeps quiet.  The generated script should
+	// compile without any messages, so we just count them, and keep
+	// the first error to report if the parse fails.
+	class QuietLogger : public DCSTokenizer::ErrorLogger
+	{
+	public:
+		virtual void Log(Level level, const char *where, const char *msg) override
+		{
+			if (level == Level::Warning)
+				++warnings;
+			else if (level == Level::Fatal || level == Level::Error)
+			{
+				++errors;
+				fatal += (level == Level::Fatal ? 1 : 0);
+				if (firstError.size() == 0)
+					firstError = std::string(where) + ": " + msg;
+			}
+		}
+		virtual void Status(const char *, bool) override { }
+
+		std::string firstError;
+	};
+
+	// Generate the test script.  Each track has four steps, and the
+	// track declaration counts as a statement of its own, so the script
+	// has five statements per track.  Returns the number of statements.
+	int GenerateScript(int nStatements, std::string &script)
+	{
+		static const char *const streamDefs[] ={
+			"Stream Sine synth(Wave=Sine, Freq=440, Time=0.05);\n",
+			"stream Square SYNTH(wave=Square, freq=220, time=0.05, level=30);\n",
+			"STREAM Noise Synth(Wave=Noise, Time=0.05, Level=20, Seed=12345);\n",
+			"Stream Sweep synth(Wave=Sweep, Freq=100, Freq2=2000, Time=0.05);\n",
+		};
+		static const char *const streamNames[] = { "Sine", "Square", "Noise", "Sweep" };
+
+		script = "// DCS Benchmark generated script\n\n";
+		for (auto s : streamDefs)
+			script += s;
+		script += "\n";
+
+		int nTracks = nStatements / 5;
+		if (nTracks < 1)
+			nTracks = 1;
+		char buf[512];
+		for (int i = 0 ; i < nTracks ; ++i)
+		{
+			int trackNum = i + 1;
+			int next = (i + 1) % nTracks + 1;
+			const char *stream = streamNames[i % _countof(streamNames)];
+			switch (i % 3)
+			{
+			case 0:
+				sprintf_s(buf, "Track $%04X channel %d {\n"
+					"   SetMixingLevel($%02X);\n"
+					"   Play(%s);\n"
+					"   Wait(%d);\n"
+					"   Queue(track $%04X);\n"
+					"};\n\n",
+					trackNum, i % 4, 0x40 + (i % 0x30), stream, 10 + (i % 50), next);
+				break;
+
+			case 1:
+				sprintf_s(buf, "track $%04X CHANNEL %d {\n"
+					"   setmixinglevel(level $%02X, steps 0.25 sec);\n"
+					"   play(%s);\n"
+					"   wait(stream);\n"
+					"   setvariable(var %d, value %d);\n"
+					"};\n\n",
+					trackNum, i % 4, 0x20 + (i % 0x40), stream, i % 8, i & 0xFF);
+				break;
+
+			case 2:
+				sprintf_s(buf, "TRACK $%04X Channel %d {\n"
+					"   Play(%s);\n"
+					"   WAIT(%d ms);\n"
+					"   WriteDataPort(byte $%02X);\n"
+					"   Stop(channel %d);\n"
+					"};\n\n",
+					trackNum, i % 4, stream, 20 + (i % 200), i & 0xFF, (i + 1) % 4);
+				break;
+			}
+			script += buf;
+		}
+		return nTracks * 5;
+	}
+}
+
+void RunScriptBenchmarks(Benchmark &bench, const ScriptBenchOptions &opts)
+{
+	bool doTokenize = bench.IsSelected("script.tokenize");
+	bool doParse = bench.IsSelected("script.parse");
+	if (!doTokenize && !doParse)
+		return;
+
+	if (bench.options.listOnly)
+	{
+		if (doTokenize)
+			printf("script.tokenize\n");
+		if (doParse)
+			printf("script.parse\n");
+		return;
+	}
+
+	// generate the script, and write it to a temporary file, since the
+	// compiler reads its input from a file
+	std::string script;
+	int nStatements = GenerateScript(opts.statements, script);
+	std::error_code ec;
+	auto path = std::filesystem::temp_directory_path(ec) / "DCSBenchmark-script.txt";
+	std::string filename = path.string();
+	FILE *fp = nullptr;
+	if (ec || fopen_s(&fp, filename.c_str(), "w") != 0 || fp == nullptr)
+	{
+		printf("script: unable to create temporary file %s\n", filename.c_str());
+		return;
+	}
+	fwrite(script.data(), 1, script.size(), fp);
+	fclose(fp);
+
+	if (!bench.options.quiet)
+	{
+		printf("\nScript compiler: %d statements, %.1f KB\n",
+			nStatements, static_cast<double>(script.size()) / 1024.0);
+	}
+
+	// Tokenizer pass.  Load the file once, and rewind to the start for
+	// each pass, so that we're only timing the tokenizer itself.
+	if (doTokenize)
+	{
+		QuietLogger logger;
+		DCSTokenizer tokenizer(logger);
+		std::string errorMessage;
+		if (!tokenizer.LoadFile(filename.c_str(), errorMessage))
+		{
+			printf("script.tokenize: %s\n", errorMessage.c_str());
+		}
+		else
+		{
+			// count the tokens, for the throughput figure
+			auto start = tokenizer.Save();
+			int nTokens = 0;
+			while (tokenizer.Read().type != DCSTokenizer::TokType::End)
+				++nTokens;
+
+			bench.Run("script.tokenize", "token", nTokens, [&tokenizer, start](uint64_t n)
+			{
+				for (uint64_t i = 0 ; i < n ; ++i)
+				{
+					tokenizer.Restore(start);
+					for (;;)
+					{
+						auto tok = tokenizer.Read();
+						if (tok.type == DCSTokenizer::TokType::End)
+							break;
+						Benchmark::sink += static_cast<uint32_t>(tok.kw);
+					}
+				}
+			});
+		}
+	}
+
+	// Full parse.  Each run needs a fresh compiler with a fresh prototype
+	// ROM, which we set up outside of the timed section.
+	if (doParse)
+	{
+		std::vector<double> samples;
+		std::string errorMessage;
+		for (int rep = 0 ; rep < opts.reps ; ++rep)
+		{
+			DCSCompiler compiler;
+			if (!compiler.CreateSyntheticPrototypeROM(DCSDecoder::OSVersion::OS94, 0, errorMessage))
+				break;
+
+			QuietLogger logger;
+			auto t0 = Clock::now();
+			compiler.ParseScript(filename.c_str(), logger);
+			auto t1 = Clock::now();
+			if (logger.errors != 0 || logger.fatal != 0)
+			{
+				errorMessage = logger.firstError;
+				break;
+			}
+			samples.push_back(ElapsedNs(t0, t1) / nStatements);
+		}
+
+		if (samples.size() == static_cast<size_t>(opts.reps))
+			bench.AddResult("script.parse", "stmt", 1.0, nStatements, samples);
+		else
+			printf("script.parse: %s\n", errorMessage.c_str());
+	}
+
+	std::filesystem::remove(path, ec);
+}
@@ -1528,6 +1528,10 @@ void DCSDecoder::SoftBoot()
 
 void DCSDecoder::WriteDataPort(uint8_t data)
 {
+	// pass the byte to the recorder, if there is one
+	if (dataPortRecorder != nullptr)
+		dataPortRecorder->RecordDataPortWrite(sampleCounter, data);
+
 	// During the first 250ms of a hard boot, any data port input
 	// from the host cancels the self test and soft-boots into the
 	// main decoder program.
@@ -1565,6 +1569,9 @@ uint8_t DCSDecoder::ReadDataPort()
 
 int16_t DCSDecoder::GetNextSample()
 {
+	// count the sample
+	++sampleCounter;
+
 	// get samples from the appropriate source for the current decoder state
 	switch (state)
 	{
@@ -282,12 +282,83 @@ public:
 		OpenFileError,   // can't open the Zip file
 		ExtractError,    // error extracting entry from Zip file
 		NoU2,            // can't identify a valid U2 ROM image file
+		PatchFileError,  // can't read the delta patch file, or it's not a valid patch
+		PatchMismatch,   // the delta patch doesn't match the loaded ROMs
 	};
 	ZipLoadStatus LoadROMFromZipFile(const char *zipFileName, 
 		std::list<ZipFileData> &zipFileData,
 		const char *explicitU2 = nullptr,
 		std::string *errorDetails = nullptr);
 
+	// Apply a delta patch to a ROM set loaded with LoadROMFromZipFile().
+	// A delta patch is a compact description of a new set of sound ROM
+	// images in terms of an original set, as generated by the DCS Encoder
+	// with its --delta option.  It's meant for distributing a modified
+	// ROM set without distributing the whole ROM set: the user loads the
+	// original ROM set, and the patch rebuilds the modified chips in
+	// memory.
+	//
+	// The patch records the size and CRC-32 of each original chip it was
+	// made against, and the size and CRC-32 of each new chip, so we can
+	// tell if the patch is being applied to the wrong ROM set, or if the
+	// result doesn't come out right.  On success, the new chip images
+	// are added to 'zipFileData' (with their chip numbers set, and the
+	// chip numbers of the original images they replace cleared to -1),
+	// and they replace the original images in the ROM[] array.  On
+	// failure, the ROM set is left as it was.  Non-DCS files in the Zip
+	// data aren't affected.
+	//
+	// The same lifetime rules apply as for LoadROMFromZipFile(): the
+	// caller owns the data in 'zipFileData', and must keep it valid as
+	// long as the decoder exists.
+	ZipLoadStatus ApplyROMPatch(const char *patchFileName,
+		std::list<ZipFileData> &zipFileData,
+		std::string *errorDetails = nullptr);
+
+	// Delta patch file format.  All integers are big-endian.
+	//
+	//   Header:
+	//     char[8]   signature "DCSDelta"
+	//     UINT16    format version (currently 1)
+	//     UINT8     number of original chips
+	//     UINT8     number of new chips
+	//
+	//   For each original chip:
+	//     UINT8     chip number (2-9)
+	//     UINT32    size in bytes
+	//     UINT32    CRC-32 of the chip data
+	//
+	//   For each new chip:
+	//     UINT8     chip number (2-9)
+	//     UINT8     filename length
+	//     char[]    filename (not null-terminated)
+	//     UINT32    size in bytes
+	//     UINT32    CRC-32 of the chip data
+	//     ops...    build operations, ending with End
+	//
+	// The build operations fill in the new chip sequentially from the
+	// start.  Each one starts with an opcode byte:
+	//
+	//   End     no operands; the chip must be exactly filled
+	//   Copy    UINT8 original chip index (in the original chip list),
+	//           UINT32 offset, UINT32 length; copies bytes from the
+	//           original chip
+	//   Insert  UINT32 length, followed by the literal bytes
+	//   Fill    UINT32 length, UINT8 byte value
+	struct DeltaPatchFormat
+	{
+		static constexpr const char *signature = "DCSDelta";
+		static const size_t signatureLen = 8;
+		static const uint16_t version = 1;
+		enum Op : uint8_t
+		{
+			End = 0x00,
+			Copy = 0x01,
+			Insert = 0x02,
+			Fill = 0x03,
+		};
+	};
+
 	// Find the catalog in a ROM U2 image.  The catalog contains
 	// a list of the game's ROMs, with their sizes and checksums,
 	// and the nubmer of tracks.  The different DCS versions place
@@ -666,6 +737,29 @@ public:
 	// Clear any pending bytes on the data port
 	void ClearDataPort();
 
+	// Data port recorder.  This is an optional hook for capturing the
+	// command stream from the host, for later playback (see the
+	// DCSDecoderSession class).  When a recorder is installed, each byte
+	// written through WriteDataPort() is passed to the recorder, along
+	// with the decoder's sample counter at the time of the write.  The
+	// call is made on the thread calling WriteDataPort(), so it should
+	// return quickly.
+	class DataPortRecorder
+	{
+	public:
+		virtual ~DataPortRecorder() { }
+		virtual void RecordDataPortWrite(uint64_t sampleCounter, uint8_t data) = 0;
+	};
+
+	// Install or remove (with nullptr) the data port recorder
+	void SetDataPortRecorder(DataPortRecorder *recorder) { dataPortRecorder = recorder; }
+
+	// Get the sample counter.  This is the total number of samples
+	// returned from GetNextSample() since the decoder was created.  It
+	// isn't affected by resets, so it serves as a timeline for the whole
+	// session.
+	uint64_t GetSampleCounter() const { return sampleCounter; }
+
 	// ROM chips, U2-U9
 	struct ROMInfo
 	{
@@ -1282,6 +1376,12 @@ protected:
 	// in the mode elapses.
 	int modeSampleCounter = 0;
 
+	// total samples generated, for GetSampleCounter()
+	uint64_t sampleCounter = 0;
+
+	// data port recorder, if any
+	DataPortRecorder *dataPortRecorder = nullptr;
+
 	// Bong count remaining.  When in State::Bong mode, this
 	// tracks how many more bong iterations are to be played,
 	// including the current one.
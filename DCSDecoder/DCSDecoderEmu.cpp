@@ -20,6 +20,7 @@
 #include <list>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 #include "DCSDecoderEmu.h"
 #include "adsp2100/adsp2100.h"
 
@@ -346,10 +347,20 @@ bool DCSDecoderEmulated::Initialize()
 	// put the default volume into effect
 	SetMasterVolume(defaultVolume);
 
+	// start the first profiled frame after the initialization code
+	lastFrameCycleCounter = adsp2100_total_cycles;
+
 	// success
 	return true;
 }
 
+void DCSDecoderEmulated::EnableCycleProfile(bool enable)
+{
+	// start counting from the current point
+	cycleProfileEnabled = enable;
+	lastFrameCycleCounter = adsp2100_total_cycles;
+}
+
 void DCSDecoderEmulated::IRQ2Handler()
 {
 	// diretcly invoke the IRQ2 handler via a recursive call to the interpreter
@@ -392,6 +403,15 @@ void DCSDecoderEmulated::MainLoop()
 			break;
 		}
 	}
+
+	// If profiling, count the cycles for the frame.  This includes any
+	// data port interrupts since the last frame, since those come out
+	// of the same time budget on the real hardware.
+	if (cycleProfileEnabled)
+	{
+		cycleProfile.AddFrame(static_cast<uint32_t>(adsp2100_total_cycles - lastFrameCycleCounter));
+		lastFrameCycleCounter = adsp2100_total_cycles;
+	}
 }
 
 // Original DCS (1993) board memory map
@@ -36,6 +36,7 @@
 #pragma once
 #include <unordered_map>
 #include <string>
+#include <algorithm>
 #include "DCSDecoder.h"
 
 // include ADSP-2101 and ADSP-2105 sub-implementations
@@ -73,6 +74,62 @@ public:
 	// break into the ADSP-2105 debugger mode, if available
 	void DebugBreak();
 
+	// is the speedup patch enabled?
+	bool IsSpeedupEnabled() const { return enableSpeedup; }
+
+	// Frame cycle budget.  The original boards ran the ADSP-2105 at
+	// 10 MHz, executing one instruction per cycle, and the decoder has
+	// to finish each 240-sample frame within the time it takes to play
+	// the previous one, 7.68ms.  That gives it 76800 cycles per frame.
+	static const uint32_t FrameCycleBudget = 76800;
+
+	// Cycle profile.  When profiling is enabled, the decoder counts the
+	// ADSP-2105 instruction cycles it executes for each frame - one pass
+	// through the ROM's main decoding loop, plus any data port interrupts
+	// serviced since the previous pass - and collects the counts in a
+	// histogram.  With the speedup patch enabled, the cycles in the
+	// patched section of the ROM code aren't counted, since that section
+	// runs as native code instead, so comparing the strict and speedup
+	// profiles shows how much of the load is in the patched section.
+	struct CycleProfile
+	{
+		// Histogram bucket size, as 5% of the frame budget, and the
+		// number of buckets.  The last bucket collects everything at
+		// 150% of the budget and above.
+		static const uint32_t BucketSize = FrameCycleBudget / 20;
+		static const int NumBuckets = 31;
+
+		// add a frame
+		void AddFrame(uint32_t cycles)
+		{
+			nFrames += 1;
+			totalCycles += cycles;
+			minCycles = std::min(minCycles, cycles);
+			maxCycles = std::max(maxCycles, cycles);
+			buckets[std::min(cycles / BucketSize, static_cast<uint32_t>(NumBuckets - 1))] += 1;
+		}
+
+		// clear the profile
+		void Clear() { *this = CycleProfile(); }
+
+		// worst frame as a fraction of the budget
+		double MaxLoad() const { return static_cast<double>(maxCycles) / FrameCycleBudget; }
+
+		uint64_t nFrames = 0;
+		uint64_t totalCycles = 0;
+		uint32_t minCycles = UINT32_MAX;
+		uint32_t maxCycles = 0;
+		uint64_t buckets[NumBuckets] ={ 0 };
+	};
+
+	// Enable or disable cycle profiling.  Profiling is off by default.
+	void EnableCycleProfile(bool enable);
+
+	// Get the cycle profile for the frames decoded since profiling was
+	// enabled or last cleared.  The caller can clear it at any time
+	// with CycleProfile::Clear(), to start a new profile.
+	CycleProfile &GetCycleProfile() { return cycleProfile; }
+
 protected:
 	// friend functions
 	friend uint32_t adsp2100_host_read_dm(uint32_t);
@@ -140,4 +197,11 @@ protected:
 	
 	// Address of master volume setting in DM() space
 	int masterVolumeAddr = -1;
+
+	// cycle profiling
+	bool cycleProfileEnabled = false;
+	CycleProfile cycleProfile;
+
+	// ADSP-2105 cycle counter at the end of the last frame
+	uint64_t lastFrameCycleCounter = 0;
 };
@@ -0,0 +1,375 @@
+// Copyright 2023 Michael J Roberts
+// BSD 3-clause license - NO WARRANTY
+//
+// DCS Universal Decoder - loudness and peak level scanner
+//
+// This is the part of the native decoder that estimates stream levels
+// from the frequency-domain frame data, without generating PCM output.
+// See ScanStreamLevels() in DCSDecoderNative.h for an overview.  This
+// module also has DecompressStream(), which gives the caller the same
+// frequency-domain frame data for its own processing, and
+// ScanStreamFrames(), which adds the frame layout details needed to
+// edit a stream without recompressing it.
+//
+
+#include <string.h>
+#include <math.h>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include "DCSDecoderNative.h"
+
+// --------------------------------------------------------------------------
+//
+// Set up the level scan tables on first use.  Initialize() clears the
+// ready flag whenever it selects a decoder implementation, so this
+// builds them at most once per boot, and only for hosts that scan.
+//
+void DCSDecoderNative::PrepareLevelScan()
+{
+    std::lock_guard<std::mutex> lock(levelScanMutex);
+    if (!levelScanReady)
+    {
+        InitLevelScan();
+        levelScanReady = true;
+    }
+}
+
+// --------------------------------------------------------------------------
+//
+// Build the level scan tables for the current decoder implementation
+//
+void DCSDecoderNative::InitLevelScan()
+{
+    // Measure the transform's response to each coefficient, by running
+    // the actual transform on a frame containing that coefficient alone.
+    // The transform is linear (apart from rounding), so this gives us
+    // the exact weight of each coefficient in the PCM output, for the
+    // particular transform algorithm that the ROM version uses.  The
+    // transform works in place on the decoder's frame, output, and
+    // overlap buffers, so save and restore them around the test.
+    uint16_t saveFrame[0x200], saveOutput[240], saveOverlap[0x10];
+    memcpy(saveFrame, frameBuffer, sizeof(frameBuffer));
+    memcpy(saveOutput, outputBuffer, sizeof(outputBuffer));
+    memcpy(saveOverlap, overlapBuffer, sizeof(overlapBuffer));
+
+    // Use a test amplitude well below full scale, so that nothing in the
+    // intermediate calculations saturates, but large enough that the
+    // rounding errors are negligible.
+    const float amplitude = 8192.0f;
+    for (int i = 0 ; i < 256 ; ++i)
+    {
+        // transform a frame with only coefficient i set, with no overlap
+        // carried in from a prior frame
+        memset(frameBuffer, 0, sizeof(frameBuffer));
+        memset(overlapBuffer, 0, sizeof(overlapBuffer));
+        frameBuffer[i] = static_cast<uint16_t>(amplitude);
+        decoderImpl->TransformFrame(0);
+
+        // Collect the output power and peak.  Include the overlap tail
+        // that the transform saved for the next frame, since that's
+        // part of the coefficient's contribution to the PCM stream.
+        float sumSq = 0.0f, peak = 0.0f;
+        auto Add = [&sumSq, &peak](uint16_t s)
+        {
+            float f = static_cast<float>(SIGNED(s));
+            sumSq += f*f;
+            peak = fabsf(f) > peak ? fabsf(f) : peak;
+        };
+        for (int j = 0 ; j < 240 ; ++j)
+            Add(outputBuffer[j]);
+        for (int j = 0 ; j < 16 ; ++j)
+            Add(overlapBuffer[j]);
+
+        levelScan.power[i] = sumSq / (amplitude * amplitude);
+        levelScan.gain[i] = peak / amplitude;
+    }
+
+    // restore the buffers
+    memcpy(frameBuffer, saveFrame, sizeof(frameBuffer));
+    memcpy(outputBuffer, saveOutput, sizeof(outputBuffer));
+    memcpy(overlapBuffer, saveOverlap, sizeof(overlapBuffer));
+
+    // K-weighting power gain per coefficient.  The coefficients come in
+    // real/imaginary pairs, one pair per frequency bin, with 128 bins
+    // spanning 0 to the 15625 Hz Nyquist frequency.  BS.1770 defines
+    // the K-weighting filter as two biquad stages at 48 kHz (a high-shelf
+    // "head" filter and a high-pass), so evaluate the combined magnitude
+    // response of the biquads at each bin's center frequency.
+    for (int i = 0 ; i < 256 ; ++i)
+    {
+        double f = (i >> 1) * 31250.0 / 256.0;
+        double w = 2.0 * 3.14159265358979323846 * f / 48000.0;
+        auto BiquadPower = [w](double b0, double b1, double b2, double a1, double a2)
+        {
+            // |H(e^jw)|^2 = |b0 + b1 z^-1 + b2 z^-2|^2 / |1 + a1 z^-1 + a2 z^-2|^2
+            double nr = b0 + b1*cos(w) + b2*cos(2*w), ni = -b1*sin(w) - b2*sin(2*w);
+            double dr = 1.0 + a1*cos(w) + a2*cos(2*w), di = -a1*sin(w) - a2*sin(2*w);
+            return (nr*nr + ni*ni) / (dr*dr + di*di);
+        };
+        levelScan.kWeight[i] = static_cast<float>(
+            BiquadPower(1.53512485958697, -2.69169618940638, 1.19839281085285, -1.69065929318241, 0.73248077421585)
+            * BiquadPower(1.0, -2.0, 1.0, -1.99004745483398, 0.99007225036621));
+    }
+
+    // Band assignments.  These follow the band layout of the stream
+    // format: the 1993 formats use 16 bands of 16 coefficients each,
+    // and the 1994+ format uses narrower bands at the low end and a
+    // double-width band at the top.  (The 1994+ decoder starts filling
+    // its first band at coefficient 1; we include coefficient 0 in the
+    // first band here so that every coefficient is accounted for.)
+    static const int bandSizes93[] ={ 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 };
+    static const int bandSizes94[] ={ 8, 8, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 32 };
+    const int *bandSizes = (osVersion == OSVersion::OS93a || osVersion == OSVersion::OS93b) ? bandSizes93 : bandSizes94;
+    for (int band = 0, i = 0 ; band < 16 ; ++band)
+    {
+        for (int j = 0 ; j < bandSizes[band] ; ++j)
+            levelScan.band[i++] = static_cast<uint8_t>(band);
+    }
+}
+
+// --------------------------------------------------------------------------
+//
+// Scan a stream's levels
+//
+void DCSDecoderNative::ScanStreamLevels(ROMPointer streamPtr, StreamLevels &levels, bool perFrame)
+{
+    // make sure the tables are set up for the current implementation
+    PrepareLevelScan();
+
+    // set up a temporary channel object, and load the stream into it
+    Channel ch;
+    InitChannelStream(ch, streamPtr);
+    InitStreamPlayback(ch);
+
+    // set up the result
+    int nFrames = ch.audioStream.numFrames;
+    levels = StreamLevels();
+    levels.nFrames = nFrames;
+    if (perFrame)
+        levels.frames.resize(nFrames);
+
+    // Scale factors from the raw coefficient figures to full-scale PCM
+    // units.  Each frame produces 240 new PCM samples, so the mean-square
+    // level is the frame's total power divided by 240.
+    const float powerScale = 1.0f / (240.0f * 32768.0f * 32768.0f);
+    const float peakScale = 1.0f / 32768.0f;
+
+    // Decompress each frame, at the full mixing level, and add up the
+    // power and peak contributions of its coefficients
+    std::vector<float> weightedPower(nFrames);
+    double sumPower = 0.0;
+    for (int frame = 0 ; frame < nFrames ; ++frame)
+    {
+        // decompress the frame
+        uint16_t buf[0x200];
+        memset(buf, 0, sizeof(buf));
+        decoderImpl->DecompressFrame(ch, 0x7FFF, buf);
+
+        // sum the contributions
+        float bandPower[16] ={ 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+        float weighted = 0.0f, peak = 0.0f;
+        for (int i = 0 ; i < 256 ; ++i)
+        {
+            float c = static_cast<float>(SIGNED(buf[i]));
+            float p = c * c * levelScan.power[i];
+            bandPower[levelScan.band[i]] += p;
+            weighted += p * levelScan.kWeight[i];
+            peak += fabsf(c) * levelScan.gain[i];
+        }
+
+        // figure the frame totals
+        float framePower = 0.0f;
+        for (int band = 0 ; band < 16 ; ++band)
+            framePower += (bandPower[band] *= powerScale);
+        weighted *= powerScale;
+        peak *= peakScale;
+
+        sumPower += framePower;
+        weightedPower[frame] = weighted;
+        if (peak > levels.peakBound)
+        {
+            levels.peakBound = peak;
+            levels.peakFrame = frame;
+        }
+
+        // store the per-frame results if desired
+        if (perFrame)
+        {
+            auto &f = levels.frames[frame];
+            memcpy(f.bandPower, bandPower, sizeof(f.bandPower));
+            f.weightedPower = weighted;
+            f.peakBound = peak;
+        }
+    }
+
+    // figure the overall RMS level
+    if (nFrames != 0)
+        levels.rms = sqrt(sumPower / nFrames);
+
+    // Build the gating blocks.  BS.1770 uses 400ms blocks at 100ms steps,
+    // which is 52 frames at 13-frame steps.  If the whole stream is
+    // shorter than one block, use the whole stream as a single block.
+    const int blockFrames = 52, stepFrames = 13;
+    auto AddBlock = [&levels, &weightedPower](int start, int n)
+    {
+        double sum = 0.0;
+        for (int i = start ; i < start + n ; ++i)
+            sum += weightedPower[i];
+        levels.blockPower.push_back(static_cast<float>(sum / n));
+    };
+    if (nFrames < blockFrames)
+    {
+        if (nFrames != 0)
+            AddBlock(0, nFrames);
+    }
+    else
+    {
+        for (int start = 0 ; start + blockFrames <= nFrames ; start += stepFrames)
+            AddBlock(start, blockFrames);
+    }
+
+    // figure the integrated loudness
+    levels.loudness = IntegratedLoudness(levels.blockPower);
+}
+
+// Scan a list of streams in parallel
+void DCSDecoderNative::ScanStreamLevels(const std::vector<ROMPointer> &streams, std::vector<StreamLevels> &levels,
+    bool perFrame, int nThreads)
+{
+    // size the result vector to match the stream list
+    levels.clear();
+    levels.resize(streams.size());
+
+    // set up the tables before starting the threads, so that the
+    // workers don't all queue up on the setup lock
+    PrepareLevelScan();
+
+    // use one thread per hardware thread if the caller didn't specify,
+    // but there's no point in using more threads than streams
+    if (nThreads <= 0)
+        nThreads = static_cast<int>(std::thread::hardware_concurrency());
+    if (nThreads > static_cast<int>(streams.size()))
+        nThreads = static_cast<int>(streams.size());
+    if (nThreads <= 1)
+    {
+        // just do the work directly on the calling thread
+        for (size_t i = 0 ; i < streams.size() ; ++i)
+            ScanStreamLevels(streams[i], levels[i], perFrame);
+        return;
+    }
+
+    // Launch the workers.  Each worker takes the next unclaimed stream
+    // from the list until they're all done.  Stream lengths vary widely,
+    // so this balances the load better than dividing the list up front.
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (int i = 0 ; i < nThreads ; ++i)
+    {
+        workers.emplace_back([this, &streams, &levels, &next, perFrame]()
+        {
+            for (size_t n ; (n = next++) < streams.size() ; )
+                ScanStreamLevels(streams[n], levels[n], perFrame);
+        });
+    }
+
+    // wait for the workers to finish
+    for (auto &t : workers)
+        t.join();
+}
+
+// Decompress a stream's frames for spectral processing
+void DCSDecoderNative::DecompressStream(ROMPointer streamPtr, std::function<void(int frameNum, const int16_t *coefficients)> callback)
+{
+    // set up a temporary channel object, and load the stream into it
+    Channel ch;
+    InitChannelStream(ch, streamPtr);
+    InitStreamPlayback(ch);
+
+    // decompress the frames
+    for (int frame = 0, nFrames = ch.audioStream.numFrames ; frame < nFrames ; ++frame)
+    {
+        uint16_t buf[0x200];
+        memset(buf, 0, sizeof(buf));
+        decoderImpl->DecompressFrame(ch, 0x7FFF, buf);
+        callback(frame, reinterpret_cast<const int16_t*>(buf));
+    }
+}
+
+// Scan a stream's frames for compressed-domain editing
+void DCSDecoderNative::ScanStreamFrames(ROMPointer streamPtr, std::function<bool(const StreamFrameInfo &info)> callback)
+{
+    // set up a temporary channel object, and load the stream into it
+    Channel ch;
+    InitChannelStream(ch, streamPtr);
+    InitStreamPlayback(ch);
+
+    // The bit position in the stream is the bit reader's byte position,
+    // less the bits it has read ahead into its buffer
+    auto &stream = ch.audioStream;
+    auto BitPos = [&stream]() {
+        return static_cast<uint32_t>((stream.playbackBitPtr.p.p - stream.startPtr.p) * 8 - stream.playbackBitPtr.nBits);
+    };
+
+    // decompress the frames
+    StreamFrameInfo info;
+    for (int frame = 0, nFrames = stream.numFrames ; frame < nFrames ; ++frame)
+    {
+        uint16_t buf[0x200];
+        memset(buf, 0, sizeof(buf));
+        info.bitOffset = BitPos();
+        decoderImpl->DecompressFrame(ch, 0x7FFF, buf);
+
+        info.frameNum = frame;
+        info.coefficients = reinterpret_cast<const int16_t*>(buf);
+        info.nBits = BitPos() - info.bitOffset;
+        memcpy(info.bandType, stream.bandTypeBuf, sizeof(info.bandType));
+        if (!callback(info))
+            break;
+    }
+}
+
+// Figure the gated integrated loudness from a set of block power levels
+double DCSDecoderNative::IntegratedLoudness(const std::vector<float> &blockPower)
+{
+    // BS.1770 loudness of a mean-square power level
+    auto LKFS = [](double power) { return -0.691 + 10.0 * log10(power); };
+
+    // Apply the absolute gate at -70 LKFS, and figure the mean of the
+    // remaining blocks
+    const double absGate = -70.0;
+    double sum = 0.0;
+    int n = 0;
+    for (float p : blockPower)
+    {
+        if (p > 0.0f && LKFS(p) > absGate)
+        {
+            sum += p;
+            ++n;
+        }
+    }
+    if (n == 0)
+        return -HUGE_VAL;
+
+    // the relative gate is 10 LU below the absolute-gated loudness
+    double relGate = LKFS(sum / n) - 10.0;
+
+    // figure the mean of the blocks that pass both gates
+    sum = 0.0;
+    n = 0;
+    for (float p : blockPower)
+    {
+        if (p > 0.0f)
+        {
+            double l = LKFS(p);
+            if (l > absGate && l > relGate)
+            {
+                sum += p;
+                ++n;
+            }
+        }
+    }
+    return n == 0 ? -HUGE_VAL : LKFS(sum / n);
+}
@@ -232,13 +232,13 @@ void DCSDecoderNative::MainLoop()
         // channel isn't playing)
         if (channel[i].maxMixingLevelOverride)
         {
-            mixingSum += static_cast<uint64_t>(static_cast<uint64_t>(channel[i].mixingMultiplier) * 0x7FFE);
+            mixingSum += static_cast<uint64_t>(static_cast<uint64_t>(mixingMultiplier[i]) * 0x7FFE);
             continue;
         }
 
         // if the channel is in use, add its mixing level
         if (!channel[i].audioStream.playbackBitPtr.IsNull())
-            mixingSum += static_cast<uint64_t>(static_cast<uint64_t>(channel[i].mixingMultiplier) * volumeMultiplier);
+            mixingSum += static_cast<uint64_t>(static_cast<uint64_t>(mixingMultiplier[i]) * volumeMultiplier);
     }
 
     // We now have a 5.30 fractional value.  Shift right 2 bits to get it into
@@ -265,8 +265,8 @@ void DCSDecoderNative::MainLoop()
     for (int i = 0 ; i < MAX_CHANNELS ; ++i)
     {
         uint16_t v = channel[i].maxMixingLevelOverride ? 0x7FFE : volumeMultiplier;
-        auto m = (static_cast<uint64_t>(static_cast<uint64_t>(channel[i].mixingMultiplier) * v) << 1);
-        channel[i].mixingMultiplier = static_cast<uint16_t>((m << volShift) >> 16);
+        auto m = (static_cast<uint64_t>(static_cast<uint64_t>(mixingMultiplier[i]) * v) << 1);
+        mixingMultiplier[i] = static_cast<uint16_t>((m << volShift) >> 16);
     }
 
     // Decompress the next frame from each active stream
@@ -833,7 +833,7 @@ void DCSDecoderNative::LoadTrack(int ch, ROMPointer trackPtr)
     channel[ch].audioStream.playbackBitPtr.Clear();
 
     // reset all of the track counters
-    channel[ch].trackCounter = 0;
+    trackCounter[ch] = 0;
     channel[ch].hostEventTimer.Clear();
     channel[ch].loopStack.clear();
 
@@ -861,7 +861,7 @@ void DCSDecoderNative::ExecTrack(int curChannel)
         // execution of the track, leaving the track read pointer at
         // the current position.
         uint16_t countPrefix = p.GetU16();
-        if (countPrefix == 0xFFFF || channel[curChannel].trackCounter != countPrefix)
+        if (countPrefix == 0xFFFF || trackCounter[curChannel] != countPrefix)
         {
             // Un-get the last U16, and update the channel with the
             // next track read position
@@ -871,7 +871,7 @@ void DCSDecoderNative::ExecTrack(int curChannel)
         }
 
         // clear the iteration counter
-        channel[curChannel].trackCounter = 0;
+        trackCounter[curChannel] = 0;
 
         // read and interpret the next opcode
         uint16_t opcode = p.GetU8();
@@ -1304,13 +1304,13 @@ void DCSDecoderNative::MixingLevelOp(int curChannel, ROMPointer &p, int mode, bo
     // if it's a fade, get the number of steps
     int steps = fade ? static_cast<int>(p.GetU16()) : 0;
 
-    // Get the mixing array entry.  The mixing level applies to the
-    // mixer array for the target channel, and goes into the slot
+    // Get the mixing matrix cell.  The mixing level applies to the
+    // target channel's row of the matrix, and goes into the column
     // for the current channel.
-    auto &mixer = channel[targetChannel].mixer[curChannel];
+    int &curLevel = mixer.curLevel[targetChannel][curChannel];
 
     // save the fade step counter
-    mixer.fadeSteps = steps;
+    mixer.fadeSteps[targetChannel][curChannel] = steps;
 
     // Get the old level.  Note that we use the CURRENT level as the
     // starting point for a delta and/or fade ramp, because that's
@@ -1320,7 +1320,7 @@ void DCSDecoderNative::MixingLevelOp(int curChannel, ROMPointer &p, int mode, bo
     // current level might be in flux due to a fade in progress,
     // but that would cause slightly different results compared to
     // the original decoders.)
-    int oldLevel = mixer.curLevel;
+    int oldLevel = curLevel;
 
     // interpret the new level/delta parameter according to the mode
     int newLevel = oldLevel;
@@ -1356,18 +1356,18 @@ void DCSDecoderNative::MixingLevelOp(int curChannel, ROMPointer &p, int mode, bo
         newLevel = -8191;
 
     // set the new target level
-    mixer.fadeTargetLevel = newLevel;
+    mixer.fadeTargetLevel[targetChannel][curChannel] = newLevel;
 
     // set the immediate change or fade ramp
     if (steps != 0)
     {
         // fade - set the per-step delta
-        mixer.fadeDelta = delta / steps;
+        mixer.fadeDelta[targetChannel][curChannel] = delta / steps;
     }
     else
     {
         // immediate - set the new level directly
-        mixer.curLevel = newLevel;
+        curLevel = newLevel;
     }
 }
 
@@ -1400,9 +1400,9 @@ void DCSDecoderNative::LoadAudioStream(int streamChannelNum, ROMPointer streamPt
         LoadAudioStream(streamChannelNum, streamChannelNum, 1, streamPtr);
 
         // set a default mixing level
-        auto &m = ch.mixer[streamChannelNum];
-        m.Reset();
-        m.curLevel = m.fadeTargetLevel = mixingLevel << 6;
+        mixer.Reset(streamChannelNum, streamChannelNum);
+        mixer.curLevel[streamChannelNum][streamChannelNum] = 
+            mixer.fadeTargetLevel[streamChannelNum][streamChannelNum] = mixingLevel << 6;
     }
 }
 
@@ -1424,7 +1424,7 @@ void DCSDecoderNative::LoadAudioStream(int streamChannel, int sourceProgramChann
     // source, reset its mixing level
     int oldSourceChannel = channel[streamChannel].sourceChannel;
     if (oldSourceChannel >= 0 && oldSourceChannel != static_cast<int>(sourceProgramChannelNum))
-        channel[streamChannel].mixer[oldSourceChannel].Reset();
+        mixer.Reset(streamChannel, oldSourceChannel);
 
     // mark the stream channel with the controlling source channel (that's
     // us, the current channel)
@@ -1502,8 +1502,8 @@ DCSDecoderNative::StreamInfo DCSDecoderNative::GetStreamInfo(ROMPointer streamPt
     // stream in bytes
     for (unsigned int i = 0 ; i < ch.audioStream.numFrames ; ++i)
     {
-        uint16_t buf[256];
-        decoderImpl->DecompressFrame(ch, buf);
+        uint16_t buf[0x200];
+        decoderImpl->DecompressFrame(ch, 0x7FFF, buf);
     }
 
     // figure the stream size
@@ -1537,6 +1537,38 @@ DCSDecoderNative::StreamInfo DCSDecoderNative::GetStreamInfo(ROMPointer streamPt
     return info;
 }
 
+void DCSDecoderNative::RenderStream(ROMPointer streamPtr, std::function<void(int frameNum, const int16_t *pcm)> callback)
+{
+    // The transform works in place on the frame, output, and overlap
+    // buffers, so save them for restoration when we're done.
+    uint16_t saveFrame[0x200], saveOutput[240], saveOverlap[0x10];
+    memcpy(saveFrame, frameBuffer, sizeof(frameBuffer));
+    memcpy(saveOutput, outputBuffer, sizeof(outputBuffer));
+    memcpy(saveOverlap, overlapBuffer, sizeof(overlapBuffer));
+
+    // set up a temporary channel object, and load the stream into it
+    Channel ch;
+    InitChannelStream(ch, streamPtr);
+    InitStreamPlayback(ch);
+
+    // Decode the frames, starting with no overlap carried in from a
+    // prior frame.  Decompressing at the maximum mixing multiplier and
+    // transforming with no volume shift gives us the full-scale PCM.
+    memset(overlapBuffer, 0, sizeof(overlapBuffer));
+    for (int frame = 0, nFrames = ch.audioStream.numFrames ; frame < nFrames ; ++frame)
+    {
+        memset(frameBuffer, 0, sizeof(frameBuffer));
+        decoderImpl->DecompressFrame(ch, 0x7FFF, frameBuffer);
+        decoderImpl->TransformFrame(0);
+        callback(frame, reinterpret_cast<const int16_t*>(outputBuffer));
+    }
+
+    // restore the buffers
+    memcpy(frameBuffer, saveFrame, sizeof(frameBuffer));
+    memcpy(outputBuffer, saveOutput, sizeof(outputBuffer));
+    memcpy(overlapBuffer, saveOverlap, sizeof(overlapBuffer));
+}
+
 // --------------------------------------------------------------------------
 //
 // Stream Decoding
@@ -1558,7 +1590,7 @@ void DCSDecoderNative::DecodeStream(uint16_t ch)
         InitStreamPlayback(channel[ch]);
 
     // Decompress the next frame
-    decoderImpl->DecompressFrame(channel[ch], frameBuffer);
+    decoderImpl->DecompressFrame(channel[ch], mixingMultiplier[ch], frameBuffer);
 
     // Decrement the stream's frame counter.  If it's non-zero, there
     // are more frames left to decode in the stream, so simply return
@@ -1677,7 +1709,7 @@ void DCSDecoderNative::InitStreamPlayback(Channel &ch)
 //     the frame header byte to determine the bit width and encoding
 //     of the samples in the input stream.
 //
-void DCSDecoderNative::DecoderImpl94x::DecompressFrame(Channel &channel, uint16_t *outputBuffer)
+void DCSDecoderNative::DecoderImpl94x::DecompressFrame(Channel &channel, uint16_t mixingMultiplier, uint16_t *outputBuffer)
 {
     // set up pointers to the audio stream header buffer
     auto &stream = channel.audioStream;
@@ -1715,9 +1747,6 @@ void DCSDecoderNative::DecoderImpl94x::DecompressFrame(Channel &channel, uint16_
     // set up to read from the current channel's stream
     ROMBitPointer playbackBitPtr = stream.playbackBitPtr;
 
-    // get the channel's mixing multiplier
-    uint16_t mixingMultiplier = channel.mixingMultiplier;
-
     // Get the appropriate pre-adjustment table pointer, based on the
     // high bits of the 2nd and 3rd header bytes.
     // 
@@ -1979,8 +2008,8 @@ void DCSDecoderNative::DecoderImpl94x::DecompressFrame(Channel &channel, uint16_
             static uint16_t scalingFactorTable[] ={ 0x8000, 0x9838, 0xb505, 0xd745 };
             uint16_t sampleScalingFactor = scalingFactorTable[scalingFactorCode & 0x0003] >> (15 - ((scalingFactorCode >> 2) & 0x000F));
 
-            // decompress the current band into a working buffer, which we'll add 
-            // into the combined output buffer later
+            // decompress the current band into a working buffer of frame buffer
+            // increments, which we'll add into the combined output buffer later
             uint16_t curBandOutputBuf[0x20];
             uint16_t *curBandOutputPtr = curBandOutputBuf; 
             if (curBandTypeCode == 0)
@@ -2183,6 +2212,21 @@ void DCSDecoderNative::DecoderImpl94x::DecompressFrame(Channel &channel, uint16_
                 };
                 const uint16_t *codebook = codebookByTypeCode[curBandTypeCode - 1];
 
+                // Get the band's dequantization table, rebuilding it if the
+                // type code, scaling factor, or mixing multiplier has changed
+                // since the last frame.  The table is indexed by the value
+                // byte from the codebook, which is the sample value plus the
+                // reference value, so entry n is for sample value n - ref.
+                auto &lut = stream.bandLUT[bandIndex];
+                if (lut.typeCode != curBandTypeCode || lut.scalingFactor != sampleScalingFactor || lut.mixingMultiplier != mixingMultiplier)
+                {
+                    lut.typeCode = static_cast<uint16_t>(curBandTypeCode);
+                    lut.scalingFactor = sampleScalingFactor;
+                    lut.mixingMultiplier = mixingMultiplier;
+                    for (int val = 0 ; val < sampleValueRef * 2 ; ++val)
+                        lut.delta[val] = MixSample(static_cast<uint16_t>(val - sampleValueRef), sampleScalingFactor, mixingMultiplier);
+                }
+
                 // process the samples
                 for (int i = outputCount ; i != 0 ; --i)
                 {
@@ -2201,7 +2245,9 @@ void DCSDecoderNative::DecoderImpl94x::DecompressFrame(Channel &channel, uint16_
                     if ((val & 0x80) != 0)
                     {
                         // high bit set - output TWO samples with value zero (making sure 
-                        // first that we have space available)
+                        // first that we have space available).  A zero sample leaves
+                        // the frame buffer unchanged at any scale, so its increment
+                        // is zero.
                         if (i >= 2)
                         {
                             // output the two zeroes
@@ -2220,18 +2266,25 @@ void DCSDecoderNative::DecoderImpl94x::DecompressFrame(Channel &channel, uint16_
                     }
                     else
                     {
-                        // high bit is zero - the output value is the value byte minus the reference
-                        *curBandOutputPtr++ = val - sampleValueRef;
+                        // High bit is zero - the output value is the value byte minus
+                        // the reference.  Look up its scaled and mixed frame buffer
+                        // increment in the band table.
+                        *curBandOutputPtr++ = lut.delta[val];
                     }
                 }
             }
             else
             {
                 // For codes 7+, it's a simple array of fixed-bit-width samples,
-                // encoded as signed 2's complement integer values.
+                // encoded as signed 2's complement integer values.  These bands
+                // are rare, and the range of values is too large to make a table
+                // worthwhile, so figure the frame buffer increments directly.
                 int sampleBitWidth = curBandTypeCode;
                 for (auto i = outputCount ; i != 0 ; --i)
-                    *curBandOutputPtr++ = static_cast<uint16_t>(playbackBitPtr.GetSigned(sampleBitWidth));
+                {
+                    auto sample = static_cast<uint16_t>(playbackBitPtr.GetSigned(sampleBitWidth));
+                    *curBandOutputPtr++ = MixSample(sample, sampleScalingFactor, mixingMultiplier);
+                }
             }
 
             // If we encountered an error, the whole frame is assumed to be
@@ -2240,15 +2293,11 @@ void DCSDecoderNative::DecoderImpl94x::DecompressFrame(Channel &channel, uint16_
                 memset(curBandOutputBuf, 0, sizeof(curBandOutputBuf));
 
             // Add the current band buffer into the aggregate output buffer.  The
-            // raw samples are all scaled by the input block's sample scaling factor
+            // band buffer contains the frame buffer increments for the samples,
+            // which are already scaled by the input block's sample scaling factor
             // and by the channel's mixing-level multiplier.
             for (uint16_t i = 0 ; i < outputCount ; ++i, outputBufIndex += outputInc)
-            {
-                auto scaledSample = static_cast<uint16_t>(static_cast<int64_t>(SIGNED(curBandOutputBuf[i])) * sampleScalingFactor);
-                auto prod = (static_cast<uint64_t>(SIGNED(outputBuffer[outputBufIndex])) << 16) | scaledSample;
-                prod += static_cast<int64_t>(SIGNED(scaledSample)) * mixingMultiplier;
-                outputBuffer[outputBufIndex] = static_cast<uint16_t>((prod >> 16) & 0xFFFF);
-            }
+                outputBuffer[outputBufIndex] += curBandOutputBuf[i];
         }
     }
 
@@ -2291,7 +2340,7 @@ void DCSDecoderNative::DecoderImpl94x::DecompressFrame(Channel &channel, uint16_
 //  - The override in subclass DecoderImpl93a handles OS93a Type 1
 //    streams
 // 
-void DCSDecoderNative::DecoderImpl93::DecompressFrame(Channel &channel, uint16_t *outputBuffer)
+void DCSDecoderNative::DecoderImpl93::DecompressFrame(Channel &channel, uint16_t mixingMultiplier, uint16_t *outputBuffer)
 {
     // set up pointers to the stream
     auto &stream = channel.audioStream;
@@ -2309,10 +2358,6 @@ void DCSDecoderNative::DecoderImpl93::DecompressFrame(Channel &channel, uint16_t
     int streamFormatType = (*hdrPtr & 0x80) >> 7;
     int bandSubType = (streamFormatType == 1 ? 0 : 2);
 
-    // get the channel's mixing level multiplier, for scaling the samples
-    // as we mix them into the output buffer
-    const uint16_t mixingMultiplier = channel.mixingMultiplier;
-
     // decoder state variables
     bool isFirstBand = true;
     uint16_t prvInput = 0;
@@ -2829,7 +2874,7 @@ static const uint16_t os93a_type1_samplePairTable[] ={
 
 
 // OS93a Type 1 frame decompression
-void DCSDecoderNative::DecoderImpl93a::DecompressFrame(Channel &channel, uint16_t *outputBuffer)
+void DCSDecoderNative::DecoderImpl93a::DecompressFrame(Channel &channel, uint16_t mixingMultiplier, uint16_t *outputBuffer)
 {
     // get the playback pointer and header byte
     auto &stream = channel.audioStream;
@@ -2840,13 +2885,12 @@ void DCSDecoderNative::DecoderImpl93a::DecompressFrame(Channel &channel, uint16_
     // unified OS93a/OS93b format.  We can simply invoke the common base 
     // class handler for these streams.
     if ((hdrByte & 0x80) == 0)
-        return DecoderImpl93::DecompressFrame(channel, outputBuffer);
+        return DecoderImpl93::DecompressFrame(channel, mixingMultiplier, outputBuffer);
 
     // It's a "Type 1" stream (bit $80 of first header byte is set). 
     // This is a unique format that only appears in a few tracks in
     // Judge Dredd.
     int prvScaleCode = 0x1A;
-    uint16_t mixingMultiplier = channel.mixingMultiplier;
 
     // The header byte has three fields:
     // 
@@ -3042,41 +3086,42 @@ void DCSDecoderNative::DecoderImpl93a::DecompressFrame(Channel &channel, uint16_
 //
 void DCSDecoderNative::UpdateMixingLevels()
 {
-    // update mixing fades on all channels
-    for (int i = 0 ; i < MAX_CHANNELS ; ++i)
+    // Update mixing fades on all channels.  Every cell of the mixing
+    // matrix is processed the same way, so we can treat the matrix as
+    // a flat vector of MAX_CHANNELS*MAX_CHANNELS cells.  The loop body
+    // is written as a series of conditional selects rather than an
+    // if/else chain, so that the compiler can vectorize it.  The
+    // result is the same as the straightforward branching version:
+    //
+    //   fadeSteps == 1  -> final step, peg to the target level
+    //   fadeSteps > 1   -> add one step's delta, limited to +/- 8191
+    //   fadeSteps <= 0  -> no fade in progress, leave the level as is
+    //
     {
-        auto *mixer = &channel[i].mixer[0];
-        for (int j = 0 ; j < MAX_CHANNELS ; ++j, ++mixer)
+        const int nCells = MAX_CHANNELS * MAX_CHANNELS;
+        int *const curLevel = &mixer.curLevel[0][0];
+        const int *const fadeTargetLevel = &mixer.fadeTargetLevel[0][0];
+        const int *const fadeDelta = &mixer.fadeDelta[0][0];
+        int *const fadeSteps = &mixer.fadeSteps[0][0];
+        for (int i = 0 ; i < nCells ; ++i)
         {
-            if (mixer->fadeSteps == 1)
-            {
-                // final step - peg to the target level
-                mixer->fadeSteps = 0;
-                mixer->curLevel = mixer->fadeTargetLevel;
-            }
-            else if (mixer->fadeSteps > 1)
-            {
-                // more steps to go - apply one fade step
-                mixer->fadeSteps -= 1;
-                mixer->curLevel += mixer->fadeDelta;
-                
-                // limit to +/- 8191
-                if (mixer->curLevel > 8191)
-                    mixer->curLevel = 8191;
-                else if (mixer->curLevel < -8191)
-                    mixer->curLevel = -8191;
-            }
+            int steps = fadeSteps[i];
+            int stepLevel = curLevel[i] + fadeDelta[i];
+            stepLevel = stepLevel > 8191 ? 8191 : stepLevel < -8191 ? -8191 : stepLevel;
+            curLevel[i] = steps == 1 ? fadeTargetLevel[i] : steps > 1 ? stepLevel : curLevel[i];
+            fadeSteps[i] = steps >= 1 ? steps - 1 : steps;
         }
     }
 
     // calculate the aggregate mixing level multipliers for all channels
     for (int i = 0 ; i < MAX_CHANNELS ; ++i)
     {
-        // add up the mixer adjustment levels for the channel
+        // add up the mixer adjustment levels for the channel (this is
+        // the channel's row in the mixing matrix)
         int mixerSum = 0;
-        auto *mixer = &channel[i].mixer[0];
-        for (int j = 0 ; j < MAX_CHANNELS ; ++j, ++mixer)
-            mixerSum += mixer->curLevel;
+        const int *level = &mixer.curLevel[i][0];
+        for (int j = 0 ; j < MAX_CHANNELS ; ++j)
+            mixerSum += level[j];
 
         // limit to +/- 8191
         if (mixerSum > 8191)
@@ -3118,16 +3163,17 @@ void DCSDecoderNative::UpdateMixingLevels()
                 multiplier = static_cast<uint16_t>((multiplier * prod) >> 15);
             prod = static_cast<uint16_t>((prod * prod) >> 15);
         }
-        channel[i].mixingMultiplier = multiplier << 1;
+        mixingMultiplier[i] = multiplier << 1;
     }
 
-    // process channel timers
+    // Increment the track counters for all channels.  These control the
+    // timing of the tracks' byte-code programs.
     for (int i = 0 ; i < MAX_CHANNELS ; ++i)
-    {
-        // Increment the track counter for the channel.  This controls the timing
-        // of the track's byte-code program.
-        channel[i].trackCounter += 1;
+        trackCounter[i] += 1;
 
+    // process channel event timers
+    for (int i = 0 ; i < MAX_CHANNELS ; ++i)
+    {
         // If there's an event timer for the channel, process it.  An event timer
         // is active if its interval setting is non-zero.
         if (channel[i].hostEventTimer.Update())
@@ -3160,6 +3206,12 @@ bool DCSDecoderNative::Initialize()
         break;
     }
 
+    // The level scan tables depend on the implementation, so invalidate
+    // any tables set up for a previous one.  We don't build them here,
+    // since most hosts never scan, and the setup runs the transform 256
+    // times; ScanStreamLevels() builds them on first use instead.
+    levelScanReady = false;
+
     // initialize channel buffers
     InitChannels();
 
@@ -3236,7 +3288,7 @@ void DCSDecoderNative::ResetMixingLevels(int ch)
     // reset the given channel's contribution to all of the
     // other channels' mixing levels
     for (int i = 0 ; i < MAX_CHANNELS ; ++i)
-        channel[i].mixer[ch].Reset();
+        mixer.Reset(i, ch);
 }
 
 
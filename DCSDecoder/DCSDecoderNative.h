@@ -4,7 +4,10 @@
 // DCS Decoder - universal native decoder.  This subclass implements
 // a DCS audio player in portable C++ code.
 //
+#pragma once
 #include <memory>
+#include <mutex>
+#include <string.h>
 #include "DCSDecoder.h"
 
 class DCSDecoderNative : public DCSDecoder
@@ -121,6 +124,143 @@ public:
     };
     StreamInfo GetStreamInfo(ROMPointer streamPtr);
 
+    // Scan a stream's loudness and peak levels.  This works directly
+    // from the decompressed frames, which are already frequency-domain
+    // data (the 256 transform coefficients for each 7.68ms frame), so
+    // it skips the frequency-to-time transform and never generates any
+    // PCM samples.  That makes it much faster than rendering the
+    // stream to PCM and analyzing the result, at the cost of giving
+    // estimates rather than exact figures:
+    //
+    // - The power figures use Parseval's theorem: the power of the PCM
+    //   output is the sum of the power contributed by each coefficient,
+    //   since the transform basis functions are orthogonal.  These are
+    //   accurate apart from the small overlap between frames.
+    //
+    // - The loudness is an approximation of the ITU-R BS.1770 integrated
+    //   loudness, in LUFS, with the K-weighting filter applied as a gain
+    //   per coefficient rather than as a filter on the PCM signal, and
+    //   with gating blocks built from whole frames.
+    //
+    // - The peak is an upper bound, not the actual peak.  Each output
+    //   sample is a weighted sum of the coefficients, so the sum of the
+    //   coefficient magnitudes times the largest weight for each one
+    //   bounds the largest sample.  The true peak is usually several dB
+    //   lower.  A bound over 1.0 means that the frame *might* clip.
+    //
+    // All levels are relative to the stream's own full scale (the level
+    // at which the stream plays with the maximum mixing level and master
+    // volume), with 1.0 representing a full-scale PCM sample.
+    struct FrameLevels
+    {
+        // mean-square level per band; the bands are the 16 encoding
+        // bands of the stream format, in ascending frequency order
+        float bandPower[16];
+
+        // K-weighted mean-square level, for the loudness calculation
+        float weightedPower;
+
+        // upper bound on the absolute PCM sample value
+        float peakBound;
+    };
+    struct StreamLevels
+    {
+        // number of frames in the stream
+        int nFrames = 0;
+
+        // overall RMS level
+        double rms = 0.0;
+
+        // approximate integrated loudness, in LUFS; this is -infinity
+        // for a silent stream
+        double loudness = 0.0;
+
+        // Peak bound for the whole stream (the highest frame peak bound),
+        // and the frame where it occurs
+        double peakBound = 0.0;
+        int peakFrame = -1;
+
+        // K-weighted mean-square level of each 400ms gating block, at
+        // 100ms steps.  This is kept so that the loudness of a track
+        // made of several streams can be figured by gating the blocks
+        // from all of the streams together (see IntegratedLoudness()).
+        std::vector<float> blockPower;
+
+        // per-frame levels; only populated on request
+        std::vector<FrameLevels> frames;
+    };
+    void ScanStreamLevels(ROMPointer streamPtr, StreamLevels &levels, bool perFrame = false);
+
+    // Scan a list of streams, using a pool of threads.  nThreads is the
+    // number of threads to use; zero selects the number of hardware
+    // threads available.  Apart from the one-time setup of the level
+    // scan tables, the scan only reads the ROM data and the tables, so
+    // any number of scans can run in parallel on the same decoder
+    // object, but the decoder must not be playing or re-initialized
+    // while the scan is running.  (The table setup borrows the decoder's
+    // transform buffers, which is why playback has to be stopped.)
+    void ScanStreamLevels(const std::vector<ROMPointer> &streams, std::vector<StreamLevels> &levels,
+        bool perFrame = false, int nThreads = 0);
+
+    // Decompress a stream's frames, without transforming them to PCM.
+    // This calls the callback for each frame in turn, passing the
+    // frequency-domain coefficients for the frame, decompressed at the
+    // full mixing level.  The coefficients are in the frame buffer
+    // layout: the DC term is at [0], [1] is unused (it's the sine term
+    // at zero frequency), and the remaining terms follow in ascending
+    // frequency order from [2].  Most formats fill the buffer through
+    // [255]; the 1993 Type 0 format has one more term, at [256].  The
+    // layout is the same for all of the stream formats, so this is a
+    // convenient way to work with the spectral content of a stream
+    // directly.  As with the level scan, this only reads the ROM data,
+    // so it can be used from multiple threads at once.
+    void DecompressStream(ROMPointer streamPtr, std::function<void(int frameNum, const int16_t *coefficients)> callback);
+
+    // Scan a stream's frames, for tools that edit streams in compressed
+    // form.  This decompresses each frame the same way as
+    // DecompressStream(), and also reports where the frame's bits are
+    // in the stream data, and the band type codes that the frame leaves
+    // in effect.  The band type codes are coded in each frame as deltas
+    // from the previous frame, so they're the only decoding state that
+    // carries from one frame to the next; a tool that moves a frame's
+    // bits to a new position in a stream has to know the codes on both
+    // sides of the frame to rewrite its deltas.  The callback returns
+    // false to stop the scan early.  Like DecompressStream(), this only
+    // reads the ROM data, so it can be used from multiple threads.
+    struct StreamFrameInfo
+    {
+        // frame number, from 0 at the start of the stream
+        int frameNum = 0;
+
+        // decompressed coefficients, in the DecompressStream() layout
+        const int16_t *coefficients = nullptr;
+
+        // Location of the frame's bits, as a bit offset from the start
+        // of the sample data (the first byte after the stream header),
+        // and the length in bits.  Frames are packed end to end, with
+        // no padding, so they don't generally start on byte boundaries.
+        uint32_t bitOffset = 0;
+        uint32_t nBits = 0;
+
+        // band type codes in effect after the frame
+        uint16_t bandType[16];
+    };
+    void ScanStreamFrames(ROMPointer streamPtr, std::function<bool(const StreamFrameInfo &info)> callback);
+
+    // Render a stream to PCM.  This calls the callback for each frame in
+    // turn, passing the frame's 240 PCM samples, decoded at the full
+    // mixing level and master volume, as though the stream were playing
+    // alone.  Unlike DecompressStream(), this runs the frames through
+    // the decoder's transform buffers, so it can only be used from one
+    // thread at a time per decoder.  The buffers are saved and restored,
+    // so this doesn't disturb any playback in progress.
+    void RenderStream(ROMPointer streamPtr, std::function<void(int frameNum, const int16_t *pcm)> callback);
+
+    // Figure the integrated loudness, in LUFS, from a collection of
+    // gating block power levels, applying the BS.1770 absolute and
+    // relative gates.  Returns -infinity if no blocks pass the gates.
+    static double IntegratedLoudness(const std::vector<float> &blockPower);
+
     // Clear all tracks
     void ClearTracks();
 
@@ -131,6 +271,35 @@ protected:
     // Initialize the decoder
     virtual bool Initialize() override;
 
+    // Level scan tables.  These depend on the decoder implementation,
+    // which is selected according to the ROM version, so Initialize()
+    // invalidates them, and the first ScanStreamLevels() call after that
+    // builds them.  For each of the 256 frequency-domain
+    // coefficients, these give the PCM output power per unit of squared
+    // coefficient value, the largest absolute PCM output per unit of
+    // coefficient value, the K-weighting power gain for the
+    // coefficient's frequency, and the encoding band it belongs to.
+    struct LevelScanTables
+    {
+        float power[256];
+        float gain[256];
+        float kWeight[256];
+        uint8_t band[256];
+    };
+    LevelScanTables levelScan;
+
+    // Are the level scan tables valid for the current implementation?
+    // levelScanMutex guards the setup, since parallel scans can all
+    // reach it at once.
+    bool levelScanReady = false;
+    std::mutex levelScanMutex;
+
+    // set up the level scan tables, if they're not already set up
+    void PrepareLevelScan();
+
+    // build the level scan tables
+    void InitLevelScan();
+
     // Frame buffer.  This contains the frequency-domain data
     // points decoded from the current compressed frame, and is
     // used to transform the data in-place to the time domain to
@@ -308,17 +477,10 @@ protected:
         // the track's byte-code program.
         ROMPointer trackPtr;
 
-        // Track counter.  This is set to zero when the opcode is initially 
-        // executed, and incremented on each main loop pass, so it's equivalent 
-        // to a timer in units of about 7.68ms.  Each opcode in a track program
-        // is preceded by a U16 count value that indicates how long the program
-        // should pause before executing the new opcode. E.g., if an opcode
-        // is preceded by a count of 10, it means that execution pauses for
-        // 77.5ms before proceeding.  (A count prefix of zero means that the
-        // program continues to the next opcode immediately, so groups of
-        // opcodes that are to be executed as a group all have prefixes of 0.
-        // The special counter prefix 0xFFFF halts the program indefinitely.)
-        uint16_t trackCounter = 0;
+        // Note that the track counter, the mixing multiplier, and the mixing
+        // level matrix, which are all updated on every main loop pass, are
+        // kept outside of this struct, in the decoder-level per-frame state
+        // arrays (see trackCounter[], mixingMultiplier[], and mixer below).
 
         // Next track type.  This is the type code for the track in
         // nextTrackLink.
@@ -428,6 +590,33 @@ protected:
             // what this buffer is for.
             uint16_t bandTypeBuf[16] ={ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
 
+            // Band dequantization tables (1994+ format only).  For a band
+            // coded with one of the Huffman codebooks, each decoded sample
+            // value is multiplied by the band's scaling factor and then by
+            // the channel's mixing multiplier before being added into the
+            // frame buffer.  All three inputs - the band type code, which
+            // determines the range of sample values, the scaling factor,
+            // and the mixing multiplier - are normally the same from one
+            // frame to the next, so we keep a table per band giving the
+            // final amount to add to the frame buffer for each possible
+            // sample value.  A table is rebuilt only when one of its
+            // inputs changes.  The codebook sample values range from
+            // -2^(t-1) to 2^(t-1)-1 for type code t = 1..6, and a table is
+            // indexed by the codebook's value byte, which is the sample
+            // value plus 2^(t-1), so a table needs at most 64 entries.
+            struct BandLUT
+            {
+                // inputs the table was built for; typeCode 0 means the
+                // table hasn't been built yet
+                uint16_t typeCode = 0;
+                uint16_t scalingFactor = 0;
+                uint16_t mixingMultiplier = 0;
+
+                // frame buffer increment for each sample value
+                uint16_t delta[64];
+            };
+            BandLUT bandLUT[16];
+
             // Stream frame counter  This is the number of frames the stream
             // contains.  A frame represents the decoding output for one main
             // loop pass - 240 samples, about 7.68ms of audio data.  This
@@ -457,38 +646,6 @@ protected:
         // current audio stream.
         int sourceChannel = -1;
 
-        // Mixing controls.  Each channel can set the mixing level in
-        // each *other* channel, separately, with the option to fade to
-        // a new level.  This allows a sound effect to temporarily reduce
-        // the mixing level of the main music channel, for example.
-        //
-        // Because each channel can independently set a mixing level for
-        // every other channel, each channel needs an array of mixer
-        // structs, indexed by the source channel.  The mixing levels
-        // in the array all apply to this channel; the array index 
-        // represents the source channel that's applying the effect.
-        struct MixingControl
-        {
-            // current mixing level
-            int curLevel = 0;
-
-            // Target level.  When a fade is in effect, this is the
-            // final level when the fade is completed.
-            int fadeTargetLevel = 0;
-
-            // Fade delta.  This is the increment to add on each fade
-            // step when a fade is in effect, until the level reaches
-            // the target level.
-            int fadeDelta = 0;
-
-            // number of fade steps
-            int fadeSteps = 0;
-
-            // reset - sets the adjustment level and fade counter to zero
-            void Reset() { curLevel = 0; fadeTargetLevel = 0; fadeSteps = 0; }
-        };
-        MixingControl mixer[MAX_CHANNELS];
-
         // Special mixing level flag: Use the maximum mixing level for
         // this channel, overriding the normal mixing calculation.  This
         // is a very odd special feature only implemented in the 1.05
@@ -503,15 +660,6 @@ protected:
         bool maxMixingLevelOverride = false;
 
 
-        // Current aggregate mixing level multiplier for the channel. 
-        // This is derived by adding up the individual mixing levels and
-        // then using the result as an exponent to calculate an attenuation
-        // level on a logarithmic volume scale.  Note that this value is
-        // interpreted as a 1.15 fixed-point fraction (that is, its
-        // mathematical value is the nominal 2's complement value divided
-        // by 32768).
-        uint16_t mixingMultiplier = 0x7FFF;
-
         // Host event timer.  Each channel's track program can set up an
         // event timer that writes notifications to the host data port at
         // timed intervals.  This lets the host perform actions in sync
@@ -664,6 +812,85 @@ protected:
     };
     Channel channel[MAX_CHANNELS];
 
+    // Per-frame channel state.  The main loop visits every channel
+    // several times on each pass (to sum the mixing levels, to scale
+    // the mixing multipliers, to decode the streams, and to update the
+    // fades and track timers), but each of those visits only touches a
+    // few fields.  The Channel struct is comparatively bulky, with the
+    // loop stack, host event timer, stream header copy, and so on, so
+    // if we interleaved the per-frame fields with all of that, each
+    // pass over the channels would drag a lot of unused memory through
+    // the cache.  We therefore keep the hot fields here in compact
+    // arrays indexed by channel number.
+
+    // Track counter.  This is set to zero when the opcode is initially 
+    // executed, and incremented on each main loop pass, so it's equivalent 
+    // to a timer in units of about 7.68ms.  Each opcode in a track program
+    // is preceded by a U16 count value that indicates how long the program
+    // should pause before executing the new opcode. E.g., if an opcode
+    // is preceded by a count of 10, it means that execution pauses for
+    // 77.5ms before proceeding.  (A count prefix of zero means that the
+    // program continues to the next opcode immediately, so groups of
+    // opcodes that are to be executed as a group all have prefixes of 0.
+    // The special counter prefix 0xFFFF halts the program indefinitely.)
+    uint16_t trackCounter[MAX_CHANNELS] ={ 0, 0, 0, 0, 0, 0, 0, 0 };
+
+    // Current aggregate mixing level multiplier for each channel. 
+    // This is derived by adding up the individual mixing levels and
+    // then using the result as an exponent to calculate an attenuation
+    // level on a logarithmic volume scale.  Note that this value is
+    // interpreted as a 1.15 fixed-point fraction (that is, its
+    // mathematical value is the nominal 2's complement value divided
+    // by 32768).
+    uint16_t mixingMultiplier[MAX_CHANNELS] ={ 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF };
+
+    // Mixing controls.  Each channel can set the mixing level in
+    // each *other* channel, separately, with the option to fade to
+    // a new level.  This allows a sound effect to temporarily reduce
+    // the mixing level of the main music channel, for example.
+    //
+    // Because each channel can independently set a mixing level for
+    // every other channel, the levels form a matrix indexed by target
+    // channel and source channel: [target][source] is the adjustment
+    // that the source channel's track program is applying to the
+    // target channel.  The matrix is stored as a separate array per
+    // field rather than as an array of structs, so that the per-frame
+    // fade update can process all of the cells as flat vectors, and
+    // so that the per-channel level sum reads one contiguous row.
+    struct MixingMatrix
+    {
+        // current mixing level
+        int curLevel[MAX_CHANNELS][MAX_CHANNELS];
+
+        // Target level.  When a fade is in effect, this is the
+        // final level when the fade is completed.
+        int fadeTargetLevel[MAX_CHANNELS][MAX_CHANNELS];
+
+        // Fade delta.  This is the increment to add on each fade
+        // step when a fade is in effect, until the level reaches
+        // the target level.
+        int fadeDelta[MAX_CHANNELS][MAX_CHANNELS];
+
+        // number of fade steps
+        int fadeSteps[MAX_CHANNELS][MAX_CHANNELS];
+
+        // Reset one cell - sets the adjustment level and fade counter
+        // to zero.  (The fade delta is left as is, since it's only
+        // meaningful while fadeSteps is non-zero.)
+        void Reset(int target, int source)
+        {
+            curLevel[target][source] = 0;
+            fadeTargetLevel[target][source] = 0;
+            fadeSteps[target][source] = 0;
+        }
+
+        // clear the whole matrix
+        void Clear() { memset(this, 0, sizeof(*this)); }
+
+        MixingMatrix() { Clear(); }
+    };
+    MixingMatrix mixer;
+
     // Channel "ready" mask.  This is a bit mask set to indicate which
     // channels have pending work in their track programs.  Each 
     // channel's bit is given by (1 << channelNumber).  The channel bit
@@ -752,8 +979,10 @@ protected:
         DecoderImpl(DCSDecoderNative *decoder) : decoder(decoder) { }
         DCSDecoderNative *decoder;
 
-        // Decompress a frame
-        virtual void DecompressFrame(Channel &channel, uint16_t *frameBuffer) = 0;
+        // Decompress a frame.  The decoded samples are scaled by the
+        // channel's current mixing multiplier and added into the frame
+        // buffer.
+        virtual void DecompressFrame(Channel &channel, uint16_t mixingMultiplier, uint16_t *frameBuffer) = 0;
 
         // Transform decompressed frame data into PCM samples.  This 
         virtual void TransformFrame(int volShift) = 0;
@@ -769,7 +998,7 @@ protected:
     {
     public:
         DecoderImpl93(DCSDecoderNative *decoder) : DecoderImpl(decoder) { }
-        virtual void DecompressFrame(Channel &channel, uint16_t *frameBuffer) override;
+        virtual void DecompressFrame(Channel &channel, uint16_t mixingMultiplier, uint16_t *frameBuffer) override;
         virtual void TransformFrame(int volShift) override;
 
     protected:
@@ -783,7 +1012,7 @@ protected:
     {
     public:
         DecoderImpl93a(DCSDecoderNative *decoder) : DecoderImpl93(decoder) { }
-        virtual void DecompressFrame(Channel &channel, uint16_t *frameBuffer) override;
+        virtual void DecompressFrame(Channel &channel, uint16_t mixingMultiplier, uint16_t *frameBuffer) override;
     };
 
     // Decoder implementation for OS93b (STTNG).  This has no differences
@@ -800,8 +1029,24 @@ protected:
     {
     public:
         DecoderImpl94x(DCSDecoderNative *decoder) : DecoderImpl(decoder) { }
-        virtual void DecompressFrame(Channel &channel, uint16_t *frameBuffer) override;
+        virtual void DecompressFrame(Channel &channel, uint16_t mixingMultiplier, uint16_t *frameBuffer) override;
         virtual void TransformFrame(int volShift) override;
+
+    protected:
+        // Figure the frame buffer increment for a decoded sample.  This
+        // applies the band scaling factor and the channel mixing multiplier
+        // exactly the way the ADSP-2105 code does, with the same rounding
+        // at each step.  The final result of mixing the sample into a frame
+        // buffer element is simply (element + increment) mod 2^16, since
+        // the multiply-accumulate only carries the old element value
+        // along in the high word.
+        static uint16_t MixSample(uint16_t sample, uint16_t scalingFactor, uint16_t mixingMultiplier)
+        {
+            auto scaledSample = static_cast<uint16_t>(static_cast<int64_t>(SIGNED(sample)) * scalingFactor);
+            auto prod = static_cast<uint64_t>(scaledSample);
+            prod += static_cast<int64_t>(SIGNED(scaledSample)) * mixingMultiplier;
+            return static_cast<uint16_t>((prod >> 16) & 0xFFFF);
+        }
     };
 
 
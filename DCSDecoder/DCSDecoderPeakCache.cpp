@@ -0,0 +1,527 @@
+// Copyright 2023 Michael J Roberts
+// BSD 3-clause license - NO WARRANTY
+//
+// DCS Decoder - waveform peak cache
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <unordered_set>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <filesystem>
+#include "DCSDecoderPeakCache.h"
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// File header.  The header is followed by the entry table (nEntries
+// Entry structs, in ascending key order), and then the Peak arrays for
+// the entries.  Each entry's levels are stored consecutively, starting
+// with level 0.
+//
+// Increment the file version whenever the layout changes, or whenever
+// the decoder changes in a way that affects the PCM output for a given
+// stream, so that old files are rejected rather than showing stale
+// waveforms.
+static const char peakCacheSignature[8] ={ 'D', 'C', 'S', 'P', 'E', 'A', 'K', '\x1A' };
+static const uint32_t peakCacheVersion = 1;
+struct PeakCacheHeader
+{
+	char signature[8];           // peakCacheSignature
+	uint32_t version;            // peakCacheVersion
+	uint32_t baseBucketSize;     // DCSDecoderPeakCache::BaseBucketSize
+	uint32_t nEntries;           // number of entries in the table
+	uint32_t reserved;           // reserved, currently zero
+};
+
+// --------------------------------------------------------------------------
+//
+// Pyramid geometry
+//
+int DCSDecoderPeakCache::LevelCount(uint32_t nSamples)
+{
+	// an empty stream has no levels; otherwise, keep adding levels
+	// until we reach a level with a single bucket
+	if (nSamples == 0)
+		return 0;
+
+	int n = 1;
+	while (LevelSize(nSamples, n - 1) > 1)
+		++n;
+	return n;
+}
+
+size_t DCSDecoderPeakCache::TotalBuckets(uint32_t nSamples)
+{
+	size_t total = 0;
+	for (int level = 0, nLevels = LevelCount(nSamples) ; level < nLevels ; ++level)
+		total += LevelSize(nSamples, level);
+	return total;
+}
+
+// --------------------------------------------------------------------------
+//
+// File mapping
+//
+bool DCSDecoderPeakCache::Open(const char *filename, std::string &errorMessage)
+{
+	// close any previous file
+	Close();
+
+	// map the file
+#if defined(_WIN32)
+	HANDLE fh = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fh == INVALID_HANDLE_VALUE)
+	{
+		errorMessage = "Unable to open file";
+		return false;
+	}
+	hFile = fh;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fh, &fileSize) || fileSize.QuadPart < static_cast<LONGLONG>(sizeof(PeakCacheHeader)))
+	{
+		Close();
+		errorMessage = "Invalid peak cache file (file too small)";
+		return false;
+	}
+	size = static_cast<size_t>(fileSize.QuadPart);
+
+	hMapping = CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (hMapping == NULL)
+	{
+		Close();
+		errorMessage = "Unable to map file into memory";
+		return false;
+	}
+	base = static_cast<const uint8_t*>(MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0));
+#else
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+	{
+		errorMessage = "Unable to open file";
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(PeakCacheHeader)))
+	{
+		close(fd);
+		errorMessage = "Invalid peak cache file (file too small)";
+		return false;
+	}
+	size = static_cast<size_t>(st.st_size);
+
+	// the mapping stays valid after the descriptor is closed
+	void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	base = (p != MAP_FAILED) ? static_cast<const uint8_t*>(p) : nullptr;
+#endif
+	if (base == nullptr)
+	{
+		Close();
+		errorMessage = "Unable to map file into memory";
+		return false;
+	}
+
+	// validate the header
+	auto Fail = [this, &errorMessage](const char *msg)
+	{
+		Close();
+		errorMessage = msg;
+		return false;
+	};
+	auto *hdr = reinterpret_cast<const PeakCacheHeader*>(base);
+	if (memcmp(hdr->signature, peakCacheSignature, sizeof(hdr->signature)) != 0)
+		return Fail("Not a peak cache file (invalid signature)");
+	if (hdr->version != peakCacheVersion || hdr->baseBucketSize != BaseBucketSize)
+		return Fail("Peak cache file was created by an incompatible version of the software");
+	if (hdr->nEntries > (size - sizeof(PeakCacheHeader)) / sizeof(Entry))
+		return Fail("Invalid peak cache file (entry table is truncated)");
+
+	// Validate the entry table.  Checking everything up front lets the
+	// lookup and rendering code trust the table without further checks.
+	entries = reinterpret_cast<const Entry*>(base + sizeof(PeakCacheHeader));
+	nEntries = hdr->nEntries;
+	for (uint32_t i = 0 ; i < nEntries ; ++i)
+	{
+		auto &e = entries[i];
+		if (i != 0 && e.key <= entries[i-1].key)
+			return Fail("Invalid peak cache file (entry table is out of order)");
+		if (e.nLevels != static_cast<uint32_t>(LevelCount(e.nSamples))
+			|| e.dataOffset > size
+			|| (size - e.dataOffset) / sizeof(Peak) < TotalBuckets(e.nSamples))
+			return Fail("Invalid peak cache file (entry data is out of bounds)");
+	}
+
+	// success
+	return true;
+}
+
+void DCSDecoderPeakCache::Close()
+{
+#if defined(_WIN32)
+	if (base != nullptr)
+		UnmapViewOfFile(base);
+	if (hMapping != nullptr)
+		CloseHandle(hMapping);
+	if (hFile != nullptr)
+		CloseHandle(hFile);
+#else
+	if (base != nullptr)
+		munmap(const_cast<uint8_t*>(base), size);
+#endif
+
+	base = nullptr;
+	size = 0;
+	entries = nullptr;
+	nEntries = 0;
+	hFile = nullptr;
+	hMapping = nullptr;
+}
+
+// --------------------------------------------------------------------------
+//
+// Lookup
+//
+uint64_t DCSDecoderPeakCache::StreamKey(DCSDecoderNative *decoder, DCSDecoder::ROMPointer streamPtr)
+{
+	// Hash the compressed stream bytes with 64-bit FNV-1a, starting
+	// with the OS version, since the same bytes decode differently
+	// under the different format versions.
+	DCSDecoder::OSVersion os = DCSDecoder::OSVersion::Unknown;
+	decoder->GetVersionInfo(nullptr, &os);
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	auto Add = [&hash](uint8_t b)
+	{
+		hash ^= b;
+		hash *= 0x100000001b3ULL;
+	};
+	Add(static_cast<uint8_t>(os));
+
+	auto info = decoder->GetStreamInfo(streamPtr);
+	const uint8_t *p = streamPtr.p;
+	for (int i = 0 ; i < info.nBytes ; ++i)
+		Add(*p++);
+
+	return hash;
+}
+
+const DCSDecoderPeakCache::Entry *DCSDecoderPeakCache::Find(uint64_t key) const
+{
+	auto *end = entries + nEntries;
+	auto *e = std::lower_bound(entries, end, key, [](const Entry &e, uint64_t key) { return e.key < key; });
+	return (e != end && e->key == key) ? e : nullptr;
+}
+
+DCSDecoderPeakCache::Level DCSDecoderPeakCache::GetLevel(const Entry *entry, int level) const
+{
+	Level l;
+	if (entry == nullptr || level < 0 || level >= static_cast<int>(entry->nLevels))
+		return l;
+
+	// skip the lower levels to find the start of the requested level
+	size_t index = 0;
+	for (int i = 0 ; i < level ; ++i)
+		index += LevelSize(entry->nSamples, i);
+
+	l.peaks = reinterpret_cast<const Peak*>(base + entry->dataOffset) + index;
+	l.nPeaks = LevelSize(entry->nSamples, level);
+	l.bucketSize = BaseBucketSize << level;
+	return l;
+}
+
+bool DCSDecoderPeakCache::Render(uint64_t key, int firstSample, int nSamples, int nColumns, Peak *columns) const
+{
+	// look up the stream
+	auto *e = Find(key);
+	if (e == nullptr)
+		return false;
+	if (nColumns <= 0 || nSamples <= 0)
+		return true;
+
+	// pick the coarsest level with buckets no wider than a column
+	double samplesPerColumn = static_cast<double>(nSamples) / nColumns;
+	int level = 0;
+	while (level + 1 < static_cast<int>(e->nLevels) && static_cast<double>(BaseBucketSize << (level + 1)) <= samplesPerColumn)
+		++level;
+	Level l = GetLevel(e, level);
+
+	// fill in the columns
+	const int64_t streamEnd = e->nSamples;
+	for (int col = 0 ; col < nColumns ; ++col)
+	{
+		// figure the column's sample range, clipped to the stream
+		int64_t s0 = firstSample + static_cast<int64_t>(nSamples) * col / nColumns;
+		int64_t s1 = firstSample + static_cast<int64_t>(nSamples) * (col + 1) / nColumns;
+		s0 = std::max<int64_t>(s0, 0);
+		s1 = std::min<int64_t>(s1, streamEnd);
+		if (s0 >= streamEnd || s1 <= 0 || s1 < s0 || l.peaks == nullptr)
+		{
+			columns[col] = { 0, 0, 0 };
+			continue;
+		}
+
+		// Combine the buckets that overlap the column.  A column narrower
+		// than a sample still shows the bucket containing its start.
+		int b0 = static_cast<int>(s0 / l.bucketSize);
+		int b1 = static_cast<int>((s1 > s0 ? s1 - 1 : s0) / l.bucketSize);
+		int16_t lo = 32767, hi = -32768;
+		double sumSq = 0.0, count = 0.0;
+		for (int b = b0 ; b <= b1 ; ++b)
+		{
+			auto &p = l.peaks[b];
+			lo = std::min(lo, p.min);
+			hi = std::max(hi, p.max);
+
+			// weight the RMS by the number of samples in the bucket; only
+			// the last bucket in the stream can be partial
+			double n = static_cast<double>(std::min<int64_t>(l.bucketSize, streamEnd - static_cast<int64_t>(b) * l.bucketSize));
+			sumSq += static_cast<double>(p.rms) * p.rms * n;
+			count += n;
+		}
+		columns[col] = { lo, hi, static_cast<uint16_t>(lround(sqrt(sumSq / count))) };
+	}
+	return true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Cache generation
+//
+bool DCSDecoderPeakCache::Update(const char *filename, DCSDecoderNative *decoder, const std::vector<uint32_t> &streams,
+	int nThreads, UpdateStats &stats, std::string &errorMessage)
+{
+	stats = UpdateStats();
+	if (nThreads <= 0)
+		nThreads = static_cast<int>(std::thread::hardware_concurrency());
+	if (nThreads <= 0)
+		nThreads = 1;
+
+	// Run a job on each of a series of items with a pool of threads.
+	// 'init' runs once on each thread, to set up per-thread resources.
+	auto RunJobs = [nThreads](size_t nItems, std::function<std::function<void(size_t)>()> init)
+	{
+		std::atomic<size_t> next(0);
+		std::vector<std::thread> workers;
+		for (int i = 0 ; i < nThreads && static_cast<size_t>(i) < nItems ; ++i)
+		{
+			workers.emplace_back([&next, nItems, &init]()
+			{
+				auto job = init();
+				for (size_t n ; (n = next++) < nItems ; )
+					job(n);
+			});
+		}
+		for (auto &t : workers)
+			t.join();
+	};
+
+	// Figure the stream keys.  This only reads the ROM data, so the
+	// threads can all share the caller's decoder.
+	std::vector<uint64_t> keys(streams.size());
+	RunJobs(streams.size(), [decoder, &streams, &keys]() -> std::function<void(size_t)>
+	{
+		return [decoder, &streams, &keys](size_t i) { keys[i] = StreamKey(decoder, decoder->MakeROMPointer(streams[i])); };
+	});
+
+	// Load the existing cache file, if there is one.  If the file exists
+	// but isn't a valid cache file, fail rather than overwriting it, in
+	// case the caller named the wrong file.
+	DCSDecoderPeakCache oldCache;
+	std::error_code ec;
+	if (std::filesystem::exists(filename, ec) && !oldCache.Open(filename, errorMessage))
+	{
+		errorMessage = std::string(filename) + ": " + errorMessage;
+		return false;
+	}
+
+	// find the streams that aren't already in the cache
+	std::vector<size_t> jobs;
+	std::unordered_set<uint64_t> seen;
+	for (size_t i = 0 ; i < streams.size() ; ++i)
+	{
+		if (seen.insert(keys[i]).second)
+		{
+			++stats.nStreams;
+			if (oldCache.Find(keys[i]) != nullptr)
+				++stats.nCached;
+			else
+				jobs.emplace_back(i);
+		}
+	}
+
+	// if there's nothing new, and the file already exists, we're done
+	if (jobs.empty() && oldCache.IsOpen())
+	{
+		stats.nEntries = static_cast<int>(oldCache.nEntries);
+		return true;
+	}
+
+	// Generate the new pyramids.  Rendering to PCM uses the decoder's
+	// internal transform buffers, so each thread needs its own decoder.
+	// The thread decoders share the ROM data with the caller's decoder.
+	struct NewEntry
+	{
+		uint64_t key;
+		uint32_t nSamples;
+		std::vector<Peak> peaks;
+	};
+	std::vector<NewEntry> results(jobs.size());
+	RunJobs(jobs.size(), [decoder, &streams, &keys, &jobs, &results]() -> std::function<void(size_t)>
+	{
+		auto host = std::make_shared<DCSDecoder::MinHost>();
+		auto worker = std::make_shared<DCSDecoderNative>(host.get());
+		for (auto &r : decoder->ROM)
+		{
+			if (r.data != nullptr && !r.isDummy)
+				worker->AddROM(r.chipSelect + 2, r.data, r.size);
+		}
+		worker->CheckROMs();
+		worker->SoftBoot();
+
+		return [host, worker, &streams, &keys, &jobs, &results](size_t n)
+		{
+			size_t i = jobs[n];
+			auto &result = results[n];
+			result.key = keys[i];
+
+			// Build level 0 from the PCM samples.  Keep the sums of squares
+			// in full precision for building the higher levels, so that we
+			// only round the RMS values once.
+			struct Bucket
+			{
+				int16_t min = 32767;
+				int16_t max = -32768;
+				double sumSq = 0.0;
+				uint32_t count = 0;
+			};
+			std::vector<Bucket> buckets;
+			uint32_t nSamples = 0;
+			worker->RenderStream(worker->MakeROMPointer(streams[i]), [&buckets, &nSamples](int, const int16_t *pcm)
+			{
+				for (int j = 0 ; j < 240 ; ++j, ++nSamples)
+				{
+					if (nSamples % BaseBucketSize == 0)
+						buckets.emplace_back();
+
+					auto &b = buckets.back();
+					int16_t s = pcm[j];
+					b.min = std::min(b.min, s);
+					b.max = std::max(b.max, s);
+					b.sumSq += static_cast<double>(s) * s;
+					b.count += 1;
+				}
+			});
+			result.nSamples = nSamples;
+
+			// store each level, and merge pairs of buckets to form the next one
+			result.peaks.reserve(TotalBuckets(nSamples));
+			for (int level = 0, nLevels = LevelCount(nSamples) ; level < nLevels ; ++level)
+			{
+				for (auto &b : buckets)
+					result.peaks.push_back({ b.min, b.max, static_cast<uint16_t>(lround(sqrt(b.sumSq / b.count))) });
+
+				std::vector<Bucket> next((buckets.size() + 1) / 2);
+				for (size_t j = 0 ; j < buckets.size() ; ++j)
+				{
+					auto &src = buckets[j];
+					auto &dst = next[j / 2];
+					dst.min = std::min(dst.min, src.min);
+					dst.max = std::max(dst.max, src.max);
+					dst.sumSq += src.sumSq;
+					dst.count += src.count;
+				}
+				buckets.swap(next);
+			}
+		};
+	});
+
+	// Merge the old and new entries into a single table, in key order
+	struct Source
+	{
+		uint64_t key;
+		uint32_t nSamples;
+		const Peak *peaks;
+	};
+	std::vector<Source> sources;
+	sources.reserve(oldCache.nEntries + results.size());
+	for (uint32_t i = 0 ; i < oldCache.nEntries ; ++i)
+	{
+		auto &e = oldCache.entries[i];
+		sources.push_back({ e.key, e.nSamples, reinterpret_cast<const Peak*>(oldCache.base + e.dataOffset) });
+	}
+	for (auto &r : results)
+		sources.push_back({ r.key, r.nSamples, r.peaks.data() });
+	std::sort(sources.begin(), sources.end(), [](const Source &a, const Source &b) { return a.key < b.key; });
+
+	// Write to a temporary file, and rename it into place when done,
+	// so that an interrupted write can't leave a truncated file.
+	std::string tmpFile = std::string(filename) + ".tmp";
+	FILE *fp = fopen(tmpFile.c_str(), "wb");
+	if (fp == nullptr)
+	{
+		errorMessage = "Unable to create " + tmpFile;
+		return false;
+	}
+
+	// write the header
+	PeakCacheHeader hdr;
+	memcpy(hdr.signature, peakCacheSignature, sizeof(hdr.signature));
+	hdr.version = peakCacheVersion;
+	hdr.baseBucketSize = BaseBucketSize;
+	hdr.nEntries = static_cast<uint32_t>(sources.size());
+	hdr.reserved = 0;
+	bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+
+	// write the entry table, laying out the data after it
+	uint64_t dataOffset = sizeof(PeakCacheHeader) + sources.size() * sizeof(Entry);
+	for (auto it = sources.begin() ; ok && it != sources.end() ; ++it)
+	{
+		Entry e;
+		memset(&e, 0, sizeof(e));
+		e.key = it->key;
+		e.nSamples = it->nSamples;
+		e.nLevels = static_cast<uint32_t>(LevelCount(it->nSamples));
+		e.dataOffset = dataOffset;
+		ok = fwrite(&e, sizeof(e), 1, fp) == 1;
+		dataOffset += TotalBuckets(it->nSamples) * sizeof(Peak);
+	}
+
+	// write the pyramid data
+	for (auto it = sources.begin() ; ok && it != sources.end() ; ++it)
+	{
+		size_t n = TotalBuckets(it->nSamples);
+		ok = n == 0 || fwrite(it->peaks, sizeof(Peak), n, fp) == n;
+	}
+
+	// Close the file, and move it into place if everything worked.  The
+	// old file has to be unmapped first, since Windows won't replace a
+	// file that's mapped.
+	ok = (fclose(fp) == 0) && ok;
+	oldCache.Close();
+	if (ok)
+		std::filesystem::rename(tmpFile, filename, ec);
+	if (!ok || ec)
+	{
+		std::filesystem::remove(tmpFile, ec);
+		errorMessage = std::string("Error writing ") + filename;
+		return false;
+	}
+
+	stats.nGenerated = static_cast<int>(results.size());
+	stats.nEntries = static_cast<int>(sources.size());
+	return true;
+}
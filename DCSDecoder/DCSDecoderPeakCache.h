@@ -0,0 +1,159 @@
+// Copyright 2023 Michael J Roberts
+// BSD 3-clause license - NO WARRANTY
+//
+// DCS Decoder - waveform peak cache
+//
+// This is an optional add-on for ROM browsers and editors that draw
+// stream waveforms.  Drawing a waveform the direct way means decoding
+// the whole stream to PCM every time the view changes, which is slow
+// enough to be noticeable for long music streams, and it's wasted work,
+// since the streams never change.  The peak cache decodes each stream
+// once, and saves a "mipmap" pyramid of waveform summaries:  level 0
+// holds the minimum, maximum, and RMS sample values for each 64-sample
+// bucket, and each level above it halves the resolution, up to a top
+// level with a single bucket covering the whole stream.  A view at any
+// zoom level can then be drawn from the level whose buckets are just
+// under one screen column wide, reading at most a few buckets per
+// column, without touching the decoder at all.
+//
+// Streams are keyed by a hash of their compressed bytes, together with
+// the DCS OS version (which determines how the bytes are decoded), so
+// a single cache file can serve any number of ROM sets, and a stream
+// that's shared among several ROM versions for the same game is only
+// stored once.  Updating the cache only decodes the streams whose keys
+// aren't already present, so re-running an update after loading a new
+// ROM set, or a revised version of one, only does the new work.
+//
+// The file is designed to be memory-mapped and used in place.  It
+// consists of a header, an entry table sorted by key, and the pyramid
+// data; everything is stored in native byte order, with no pointers
+// or variable-length fields to unpack.  A lookup is a binary search of
+// the entry table.
+//
+
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "DCSDecoderNative.h"
+
+class DCSDecoderPeakCache
+{
+public:
+	DCSDecoderPeakCache() { }
+	~DCSDecoderPeakCache() { Close(); }
+
+	// Number of samples in a level 0 bucket.  Each level above 0
+	// doubles the bucket size.
+	static const int BaseBucketSize = 64;
+
+	// Bucket summary.  min and max are the extreme PCM sample values
+	// in the bucket, and rms is the root-mean-square sample value,
+	// rounded to the nearest integer.
+	struct Peak
+	{
+		int16_t min;
+		int16_t max;
+		uint16_t rms;
+	};
+
+	// Stream entry in the file's entry table
+	struct Entry
+	{
+		uint64_t key;            // stream key (see StreamKey())
+		uint32_t nSamples;       // number of PCM samples in the stream
+		uint32_t nLevels;        // number of pyramid levels
+		uint64_t dataOffset;     // byte offset in the file of level 0's Peak array
+	};
+
+	// Pyramid level descriptor
+	struct Level
+	{
+		const Peak *peaks = nullptr;   // bucket array
+		int nPeaks = 0;                // number of buckets
+		int bucketSize = 0;            // samples per bucket
+	};
+
+	// Open a cache file, mapping it into memory.  Returns false, with
+	// an error message, if the file doesn't exist or isn't a valid
+	// cache file.
+	bool Open(const char *filename, std::string &errorMessage);
+
+	// close the file
+	void Close();
+
+	// is a file open?
+	bool IsOpen() const { return base != nullptr; }
+
+	// Figure the cache key for a stream.  This requires scanning the
+	// stream's frames to find its length in bytes, but it doesn't decode
+	// any PCM samples, so it's much faster than rendering the stream.
+	static uint64_t StreamKey(DCSDecoderNative *decoder, DCSDecoder::ROMPointer streamPtr);
+
+	// Look up a stream by key.  Returns null if the stream isn't in
+	// the cache.
+	const Entry *Find(uint64_t key) const;
+
+	// Get a pyramid level for an entry.  Returns an empty descriptor
+	// if the level is out of range.
+	Level GetLevel(const Entry *entry, int level) const;
+
+	// Render a waveform view.  This divides the samples from firstSample
+	// to firstSample+nSamples-1 into nColumns equal columns, and fills in
+	// columns[] with the summary of each one, using the coarsest level
+	// whose buckets are no wider than a column.  When zoomed in beyond
+	// the level 0 resolution (fewer than BaseBucketSize samples per
+	// column), each column shows the level 0 bucket containing it.
+	// Columns outside the stream are set to silence.  Returns false if
+	// the key isn't in the cache.
+	bool Render(uint64_t key, int firstSample, int nSamples, int nColumns, Peak *columns) const;
+
+	// Statistics from an update
+	struct UpdateStats
+	{
+		int nStreams = 0;        // number of distinct streams in the request
+		int nCached = 0;         // number of streams already in the cache
+		int nGenerated = 0;      // number of new entries generated
+		int nEntries = 0;        // total number of entries in the updated file
+	};
+
+	// Update a cache file, adding entries for any of the given streams
+	// that aren't already present.  The streams are read from the ROMs
+	// loaded into 'decoder', which must be booted (so that the ROM
+	// version has been identified).  The new entries are generated in
+	// parallel with nThreads threads (zero selects the number of hardware
+	// threads available); each thread uses a private decoder instance
+	// sharing the source decoder's ROM data.  Existing entries are kept,
+	// so the same file can accumulate the streams from any number of ROM
+	// sets.  The new file is written to a temporary file and renamed into
+	// place, so an interrupted update leaves the old file intact.  The
+	// file must not be open in any DCSDecoderPeakCache object during the
+	// update.
+	static bool Update(const char *filename, DCSDecoderNative *decoder, const std::vector<uint32_t> &streams,
+		int nThreads, UpdateStats &stats, std::string &errorMessage);
+
+protected:
+	// number of buckets in a pyramid level
+	static int LevelSize(uint32_t nSamples, int level)
+	{
+		uint32_t bucketSize = static_cast<uint32_t>(BaseBucketSize) << level;
+		return static_cast<int>((nSamples + bucketSize - 1) / bucketSize);
+	}
+
+	// number of levels in a pyramid, and the total number of buckets
+	static int LevelCount(uint32_t nSamples);
+	static size_t TotalBuckets(uint32_t nSamples);
+
+	// mapped file view
+	const uint8_t *base = nullptr;
+	size_t size = 0;
+
+	// entry table
+	const Entry *entries = nullptr;
+	uint32_t nEntries = 0;
+
+	// system file handles for the mapping; on Windows, these are the
+	// file and file mapping object handles
+	void *hFile = nullptr;
+	void *hMapping = nullptr;
+};
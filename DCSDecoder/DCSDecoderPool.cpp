@@ -0,0 +1,403 @@
+// Copyright 2023 Michael J Roberts
+// BSD 3-clause license - NO WARRANTY
+//
+// DCS Decoder - warm decoder pool
+//
+// See DCSDecoderPool.h for an overview.
+//
+
+#include <chrono>
+#include <algorithm>
+#include "DCSDecoderPool.h"
+
+
+DCSDecoderPool::DCSDecoderPool(int capacity, size_t memoryLimit, int defaultVolume) :
+	capacity(capacity < 1 ? 1 : capacity), memoryLimit(memoryLimit), defaultVolume(defaultVolume)
+{
+	thread = std::thread([this]() { ThreadMain(); });
+}
+
+DCSDecoderPool::~DCSDecoderPool()
+{
+	// stop the background thread; it finishes the game it's working on
+	// (if any) before exiting
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		quit = true;
+	}
+	workCv.notify_all();
+	thread.join();
+}
+
+DCSDecoder *DCSDecoderPool::Checkout(const char *zipFile, std::string &errorMessage)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	++stats.checkouts;
+	bool waited = false;
+	for (;;)
+	{
+		Entry *entry = Find(zipFile);
+		if (entry == nullptr)
+		{
+			// Not in the pool - add it, marked busy so that no one else
+			// tries to load it at the same time, and load it ourselves.
+			// Make room for it first, so that we don't go over the game
+			// count limit while loading.
+			entries.emplace_front(zipFile);
+			index.emplace(zipFile, entries.begin());
+			entry = &entries.front();
+			entry->state = Entry::State::Busy;
+			EnforceLimits(entry);
+			++stats.coldLoads;
+		}
+		else if (entry->state == Entry::State::Ready)
+		{
+			// warm - check it out
+			entry->state = Entry::State::Out;
+			Touch(entry);
+			if (waited)
+				++stats.waits;
+			else
+				++stats.warmHits;
+			return entry->decoder.get();
+		}
+		else if (entry->state == Entry::State::Busy)
+		{
+			// the background thread is working on it - wait for it to
+			// finish, then check again from the top, since the load
+			// might have failed
+			doneCv.wait(lock);
+			waited = true;
+			continue;
+		}
+		else if (entry->state == Entry::State::Reset)
+		{
+			// It's waiting for the background thread to restart it.  Take
+			// it off the queue and restart it ourselves, which is quick,
+			// since the ROMs are already loaded.
+			Dequeue(entry);
+			entry->state = Entry::State::Busy;
+			Touch(entry);
+			lock.unlock();
+			bool ok = StartDecoder(entry, errorMessage);
+			lock.lock();
+			doneCv.notify_all();
+			if (!ok)
+			{
+				++stats.failures;
+				Remove(entry);
+				return nullptr;
+			}
+
+			entry->state = Entry::State::Out;
+			++stats.waits;
+			return entry->decoder.get();
+		}
+		else if (entry->state == Entry::State::Load)
+		{
+			// queued for loading, but not started yet - load it ourselves
+			// rather than waiting for the background thread to get to it
+			Dequeue(entry);
+			entry->state = Entry::State::Busy;
+			Touch(entry);
+			++stats.coldLoads;
+		}
+		else
+		{
+			// already checked out
+			errorMessage = "The decoder for " + std::string(zipFile) + " is already checked out";
+			return nullptr;
+		}
+
+		// load the game, with the pool unlocked
+		lock.unlock();
+		auto t0 = std::chrono::steady_clock::now();
+		bool ok = LoadEntry(entry, errorMessage);
+		auto t1 = std::chrono::steady_clock::now();
+		lock.lock();
+		stats.coldLoadTime_ns += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count());
+
+		// let anyone waiting on the entry know that it's done
+		doneCv.notify_all();
+		if (!ok)
+		{
+			++stats.failures;
+			Remove(entry);
+			return nullptr;
+		}
+
+		// success - check it out, and drop older games if the new one put
+		// us over the memory limit
+		entry->state = Entry::State::Out;
+		entry->UpdateMemorySize();
+		EnforceLimits(entry);
+		return entry->decoder.get();
+	}
+}
+
+void DCSDecoderPool::Return(DCSDecoder *decoder)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	for (auto &e : entries)
+	{
+		if (e.state == Entry::State::Out && e.decoder.get() == decoder)
+		{
+			// Queue it for restarting, ahead of any pending loads.  If the
+			// caller had more games checked out than the pool would
+			// otherwise hold, the background thread drops the extra games
+			// when it's done, so that we don't free their memory here, on
+			// the caller's thread.
+			e.state = Entry::State::Reset;
+			queue.push_front(&e);
+			workCv.notify_one();
+			return;
+		}
+	}
+}
+
+void DCSDecoderPool::Prewarm(const std::vector<std::string> &zipFiles)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	// drop games from the previous prediction that we haven't started on
+	for (auto it = entries.begin() ; it != entries.end() ; )
+	{
+		auto cur = it++;
+		if (cur->state == Entry::State::Load)
+			Remove(&*cur);
+	}
+
+	// Add the new predictions.  We go through the list in reverse order,
+	// moving each game to the front of the MRU list as we go, so that the
+	// most likely game ends up at the front, and the least likely games
+	// are the first to go if the list is longer than the pool can hold.
+	for (auto it = zipFiles.rbegin() ; it != zipFiles.rend() ; ++it)
+	{
+		if (Entry *entry = Find(*it); entry != nullptr)
+		{
+			Touch(entry);
+		}
+		else
+		{
+			entries.emplace_front(*it);
+			index.emplace(*it, entries.begin());
+		}
+	}
+	EnforceLimits(nullptr);
+
+	// Queue the new games that survived the limits, most likely first.
+	// The list might name a game more than once, so make sure we only
+	// queue each one once.
+	for (auto &f : zipFiles)
+	{
+		if (Entry *entry = Find(f); entry != nullptr && entry->state == Entry::State::Load
+			&& std::find(queue.begin(), queue.end(), entry) == queue.end())
+			queue.push_back(entry);
+	}
+	workCv.notify_one();
+}
+
+bool DCSDecoderPool::IsWarm(const char *zipFile)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	Entry *entry = Find(zipFile);
+	return entry != nullptr && entry->state == Entry::State::Ready;
+}
+
+void DCSDecoderPool::WaitIdle()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	doneCv.wait(lock, [this]() { return queue.size() == 0 && nBusy == 0; });
+}
+
+DCSDecoderPool::Stats DCSDecoderPool::GetStats()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	Stats s = stats;
+	s.nGames = static_cast<int>(entries.size());
+	s.nWarm = 0;
+	s.nCheckedOut = 0;
+	s.memoryUsed = 0;
+	for (auto &e : entries)
+	{
+		if (e.state == Entry::State::Ready)
+			++s.nWarm;
+		else if (e.state == Entry::State::Out)
+			++s.nCheckedOut;
+		s.memoryUsed += e.memorySize;
+	}
+	s.memoryLimit = memoryLimit;
+	s.capacity = capacity;
+	return s;
+}
+
+bool DCSDecoderPool::LoadEntry(Entry *entry, std::string &errorMessage)
+{
+	// Load the ROMs.  The Zip loader needs a decoder to load them into,
+	// but we only use this one for the loading; StartDecoder() creates
+	// the decoder we'll actually use.
+	entry->decoder.reset(new DCSDecoderNative(&host));
+	if (entry->decoder->LoadROMFromZipFile(entry->zipFile.c_str(), entry->zipData, nullptr, &errorMessage) != DCSDecoder::ZipLoadStatus::Success)
+	{
+		entry->decoder.reset();
+		return false;
+	}
+
+	// The Zip file usually contains the game's CPU ROM and other files
+	// along with the sound ROMs.  The decoder only refers to the sound
+	// ROMs, so drop everything else, to save memory.
+	entry->zipData.remove_if([](const DCSDecoder::ZipFileData &zd) { return zd.chipNum < 2; });
+
+	// start the decoder
+	return StartDecoder(entry, errorMessage);
+}
+
+bool DCSDecoderPool::StartDecoder(Entry *entry, std::string &errorMessage)
+{
+	// Create a new decoder.  We don't just soft-boot the old decoder
+	// again, because a soft boot doesn't clear everything that playback
+	// leaves behind - the tail end of the last frame, for one, carries
+	// over into the first frame after the boot - so a re-booted decoder
+	// doesn't produce exactly the same output as a fresh one.  A new
+	// decoder costs a little more than a re-boot, but it's still quick
+	// compared to loading the Zip file, since it uses the ROM data that
+	// we already have in memory.
+	entry->decoder.reset(new DCSDecoderNative(&host));
+	for (auto &zd : entry->zipData)
+		entry->decoder->AddROM(zd.chipNum, zd.data.get(), zd.dataSize);
+
+	// Check the ROMs, to detect the hardware and software versions.  We
+	// don't treat a checksum mismatch as an error, since the soft boot
+	// skips the power-on self tests, so a mismatch doesn't affect
+	// playback, and modified ROM sets often have stale checksums.  A
+	// missing catalog will show up as a boot error.
+	entry->decoder->CheckROMs();
+
+	// Soft-boot it, with the default volume
+	entry->decoder->SetFastBootMode(true);
+	entry->decoder->SetDefaultVolume(defaultVolume);
+	entry->decoder->SoftBoot();
+	if (!entry->decoder->IsOK())
+	{
+		errorMessage = entry->decoder->GetErrorMessage();
+		return false;
+	}
+
+	return true;
+}
+
+DCSDecoderPool::Entry *DCSDecoderPool::Find(const std::string &zipFile)
+{
+	auto it = index.find(zipFile);
+	return it != index.end() ? &*it->second : nullptr;
+}
+
+void DCSDecoderPool::Touch(Entry *entry)
+{
+	auto it = index.find(entry->zipFile);
+	if (it != index.end())
+		entries.splice(entries.begin(), entries, it->second);
+}
+
+void DCSDecoderPool::Remove(Entry *entry)
+{
+	Dequeue(entry);
+	auto it = index.find(entry->zipFile);
+	if (it != index.end())
+	{
+		auto listIt = it->second;
+		index.erase(it);
+		entries.erase(listIt);
+	}
+}
+
+void DCSDecoderPool::EnforceLimits(const Entry *keep)
+{
+	// figure the current totals
+	int nGames = static_cast<int>(entries.size());
+	size_t memoryUsed = 0;
+	for (auto &e : entries)
+		memoryUsed += e.memorySize;
+
+	// drop games from the least recently used end of the list until we're
+	// within the limits, or we run out of games that can be dropped
+	auto it = entries.end();
+	while (it != entries.begin() && (nGames > capacity || memoryUsed > memoryLimit))
+	{
+		Entry *e = &*--it;
+		if (e == keep || e->state == Entry::State::Out || e->state == Entry::State::Busy)
+			continue;
+
+		--nGames;
+		memoryUsed -= e->memorySize;
+		if (e->state != Entry::State::Load)
+			++stats.evictions;
+
+		// Removing the entry invalidates its iterator, so move to the next
+		// older entry first.  The next pass steps back from there to the
+		// next newer entry.
+		++it;
+		Remove(e);
+	}
+}
+
+void DCSDecoderPool::Dequeue(Entry *entry)
+{
+	auto it = std::find(queue.begin(), queue.end(), entry);
+	if (it != queue.end())
+		queue.erase(it);
+}
+
+void DCSDecoderPool::ThreadMain()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;)
+	{
+		// wait for work
+		workCv.wait(lock, [this]() { return queue.size() != 0 || quit; });
+		if (quit)
+			break;
+
+		// take the next entry off the queue
+		Entry *entry = queue.front();
+		queue.pop_front();
+		auto prevState = entry->state;
+		entry->state = Entry::State::Busy;
+		++nBusy;
+
+		// do the work with the pool unlocked
+		lock.unlock();
+		std::string errorMessage;
+		bool ok;
+		if (prevState == Entry::State::Reset)
+		{
+			// restart a returned game's decoder
+			ok = StartDecoder(entry, errorMessage);
+		}
+		else
+		{
+			// load a predicted game
+			ok = LoadEntry(entry, errorMessage);
+		}
+		lock.lock();
+
+		// update the entry
+		--nBusy;
+		if (ok)
+		{
+			entry->state = Entry::State::Ready;
+			entry->UpdateMemorySize();
+			if (prevState == Entry::State::Load)
+				++stats.prewarmLoads;
+			EnforceLimits(entry);
+		}
+		else
+		{
+			++stats.failures;
+			Remove(entry);
+		}
+
+		// let waiters know that the entry is done
+		doneCv.notify_all();
+	}
+}
@@ -0,0 +1,256 @@
+// Copyright 2023 Michael J Roberts
+// BSD 3-clause license - NO WARRANTY
+//
+// DCS Decoder - warm decoder pool
+//
+// This is an optional add-on for front-end programs that switch among
+// many games quickly, such as a cabinet menu that previews each table's
+// music as the user scrolls through the list.  Starting a decoder for
+// a game from scratch means unpacking the ROM Zip file, checking the
+// ROMs, creating the decoder, and booting it, which adds up to enough
+// time to be heard as a gap every time the selection changes.  Almost
+// all of that time goes into the Zip file and the boot, and none of it
+// depends on what the program is going to play, so it can be done
+// ahead of time.
+//
+// The pool keeps a small number of games loaded, each with a decoder
+// that's already soft-booted with the default volume set, so that it
+// can start playing a track immediately.  The games are kept in most-
+// recently-used order, and when the pool is full, the least recently
+// used game is dropped to make room for a new one.  The program can
+// also tell the pool which games it expects to need next (the tables
+// on either side of the current menu selection, say), and a background
+// thread loads and boots those ahead of time.
+//
+// A game is used by checking out its decoder, which hands the decoder
+// over to the caller for exclusive use, and returning it afterwards.
+// Checking out a warm game just marks it as in use.  Returning it just
+// queues it for the background thread, which replaces the used decoder
+// with a freshly booted one, using the ROM data already in memory, so
+// that the next checkout plays exactly as a brand new decoder would.
+// Checking out a game that isn't in the pool loads it on the calling
+// thread, the same as starting from scratch.
+//
+// Memory use is bounded by the game count limit and by a memory limit.
+// Each game's memory is mostly its ROM data; the pool only keeps the
+// DCS sound ROM images from each Zip file, discarding the rest.  Games
+// that are checked out are never dropped, so the pool can temporarily
+// exceed its limits if the caller has too many games checked out at
+// once, but it never grows beyond the checked-out games plus the limits.
+//
+// The pool only uses native decoders, since the emulator can only run
+// one instance at a time.  All of the pool's methods can be called from
+// any thread.
+//
+
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <list>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "DCSDecoder.h"
+#include "DCSDecoderNative.h"
+
+class DCSDecoderPool
+{
+public:
+	// Create the pool.  'capacity' is the maximum number of games to keep
+	// loaded (including games checked out), and 'memoryLimit' is the
+	// limit on the total memory they use, in bytes.  'defaultVolume' is
+	// the default volume setting (0..255) applied to each decoder at boot.
+	DCSDecoderPool(int capacity = 4, size_t memoryLimit = 64*1024*1024, int defaultVolume = 255);
+
+	// Destruction stops the background thread and deletes all of the
+	// decoders.  All decoders must be returned before the pool is deleted.
+	~DCSDecoderPool();
+
+	// Check out a decoder for the game in the given ROM Zip file.  The
+	// decoder is soft-booted, with the default volume set, and ready to
+	// accept track commands.  The caller has exclusive use of the decoder
+	// until it's returned with Return(), and must not delete it.  If the
+	// game is warm, this returns immediately; if the background thread
+	// is loading the game, this waits for it to finish; otherwise this
+	// loads the game on the calling thread.  Returns null, with an error
+	// message, if the game can't be loaded.
+	//
+	// Games are identified by the Zip filename exactly as given, so the
+	// caller should use the same form of the name every time.
+	DCSDecoder *Checkout(const char *zipFile, std::string &errorMessage);
+
+	// Return a decoder obtained from Checkout().  The caller must not use
+	// the decoder after returning it: the background thread deletes it,
+	// and starts a new decoder for the game, to get ready for the next
+	// checkout.
+	void Return(DCSDecoder *decoder);
+
+	// Set the list of games that the caller expects to need soon, in order
+	// of likelihood, most likely first.  The background thread loads any
+	// of these that aren't already in the pool, in order, and the games
+	// already in the pool are moved up in the most-recently-used order, so
+	// that they're the last to be dropped.  This replaces any previous
+	// prediction list: games from an earlier list that haven't been loaded
+	// yet are dropped from the queue, since the prediction has changed.
+	void Prewarm(const std::vector<std::string> &zipFiles);
+
+	// Is the game loaded and ready for immediate checkout?
+	bool IsWarm(const char *zipFile);
+
+	// Wait for the background thread to finish all pending work
+	void WaitIdle();
+
+	// Pool statistics
+	struct Stats
+	{
+		// number of games in the pool, including games checked out and
+		// games queued for loading
+		int nGames = 0;
+
+		// number of games ready for immediate checkout
+		int nWarm = 0;
+
+		// number of games checked out
+		int nCheckedOut = 0;
+
+		// Memory used by the loaded games, in bytes, and the memory and
+		// game count limits.  The memory figure counts the ROM data and
+		// the decoder objects, which account for nearly all of the memory
+		// that a game uses.
+		size_t memoryUsed = 0;
+		size_t memoryLimit = 0;
+		int capacity = 0;
+
+		// Checkouts.  'warmHits' counts checkouts that found the game
+		// ready; 'waits' counts checkouts that had to wait for the
+		// background thread to finish loading or restarting the game;
+		// 'coldLoads' counts checkouts that loaded the game on the calling
+		// thread.  'coldLoadTime_ns' is the total time spent in the cold
+		// loads.
+		uint64_t checkouts = 0;
+		uint64_t warmHits = 0;
+		uint64_t waits = 0;
+		uint64_t coldLoads = 0;
+		uint64_t coldLoadTime_ns = 0;
+
+		// games loaded by the background thread, games dropped to stay
+		// within the limits, and games that failed to load
+		uint64_t prewarmLoads = 0;
+		uint64_t evictions = 0;
+		uint64_t failures = 0;
+	};
+	Stats GetStats();
+
+protected:
+	// Pooled game
+	struct Entry
+	{
+		Entry(const std::string &zipFile) : zipFile(zipFile) { }
+
+		// Game state:
+		//
+		//   Load     - queued for the background thread to load
+		//   Reset    - returned, queued for the background thread to restart
+		//   Busy     - being loaded or booted, by the background thread or
+		//              by a thread in Checkout()
+		//   Ready    - loaded and booted, ready for checkout
+		//   Out      - checked out
+		enum class State { Load, Reset, Busy, Ready, Out };
+		State state = State::Load;
+
+		// ROM Zip filename, which serves as the game's key
+		std::string zipFile;
+
+		// ROM data loaded from the Zip file; we only keep the DCS ROM images
+		std::list<DCSDecoder::ZipFileData> zipData;
+
+		// decoder
+		std::unique_ptr<DCSDecoderNative> decoder;
+
+		// Memory used by the ROM data and decoder, in bytes.  This is only
+		// updated with the pool locked, after a load completes, since the
+		// limit checks read it while other entries are loading.
+		size_t memorySize = 0;
+		void UpdateMemorySize()
+		{
+			memorySize = sizeof(DCSDecoderNative);
+			for (auto &zd : zipData)
+				memorySize += zd.dataSize;
+		}
+	};
+
+	// Load the game's ROMs and start its decoder.  This runs with the
+	// pool unlocked, on an entry marked Busy.  Returns false, with an
+	// error message, on failure.
+	bool LoadEntry(Entry *entry, std::string &errorMessage);
+
+	// Create and soft-boot a new decoder for a game, using the ROM data
+	// already loaded, replacing any existing decoder.  This runs with the
+	// pool unlocked, on an entry marked Busy.  Returns false, with an
+	// error message, on failure.
+	bool StartDecoder(Entry *entry, std::string &errorMessage);
+
+	// Look up an entry by Zip filename.  Returns null if the game isn't
+	// in the pool.  Must be called with the pool locked.
+	Entry *Find(const std::string &zipFile);
+
+	// Move an entry to the front of the most-recently-used list.  Must be
+	// called with the pool locked.
+	void Touch(Entry *entry);
+
+	// Remove an entry from the pool, deleting its decoder and ROM data.
+	// Must be called with the pool locked.
+	void Remove(Entry *entry);
+
+	// Drop least recently used games, other than 'keep', until the pool is
+	// within its game count and memory limits.  Games that are checked
+	// out or busy can't be dropped.  Must be called with the pool locked.
+	void EnforceLimits(const Entry *keep);
+
+	// remove an entry from the background work queue, if it's there
+	void Dequeue(Entry *entry);
+
+	// background thread main loop
+	void ThreadMain();
+
+	// limits
+	int capacity;
+	size_t memoryLimit;
+
+	// default volume for the decoders
+	int defaultVolume;
+
+	// Games, in most-recently-used order, and an index by Zip filename.
+	// The pool only holds a handful of games, so Return() simply searches
+	// the checked-out games for the decoder.
+	std::list<Entry> entries;
+	std::unordered_map<std::string, std::list<Entry>::iterator> index;
+
+	// Background work queue.  Returned decoders go at the front, since
+	// restarting them is quick and they're the most likely to be needed
+	// again soon; predicted games go at the back, in order of likelihood.
+	std::deque<Entry*> queue;
+
+	// number of entries the background thread is working on (0 or 1)
+	int nBusy = 0;
+
+	// statistics
+	Stats stats;
+
+	// shared host interface for the decoders
+	DCSDecoder::MinHost host;
+
+	// pool lock, signal for new background work, and signal for completed
+	// work (for threads waiting in Checkout() and WaitIdle())
+	std::mutex mutex;
+	std::condition_variable workCv;
+	std::condition_variable doneCv;
+
+	// background thread, and its exit flag
+	std::thread thread;
+	bool quit = false;
+};
@@ -0,0 +1,291 @@
+// Copyright 2023 Michael J Roberts
+// BSD 3-clause license - NO WARRANTY
+//
+// DCS Decoder - adaptive output resampler
+//
+// See DCSDecoderResampler.h for an overview.
+//
+
+#include <string.h>
+#include <math.h>
+#include "DCSDecoderResampler.h"
+
+static const double PI = 3.14159265358979323846;
+
+// Zeroth-order modified Bessel function of the first kind, for the
+// Kaiser window.  The power series converges quickly for the argument
+// range we use.
+static double BesselI0(double x)
+{
+	double sum = 1.0, term = 1.0, q = x*x/4.0;
+	for (int k = 1 ; k < 50 && term > sum*1e-12 ; ++k)
+	{
+		term *= q / (static_cast<double>(k) * k);
+		sum += term;
+	}
+	return sum;
+}
+
+DCSDecoderResampler::DCSDecoderResampler(int outputRate, int targetFill, int maxDeviation_ppm) :
+	outputRate(outputRate),
+
+	// the control loop normalizes the error by the target, so it must be
+	// at least one sample
+	targetFill(targetFill < 1 ? 1 : targetFill)
+{
+	// figure the nominal input step per output sample
+	nominalStep = static_cast<double>(DCS_SAMPLE_RATE) / outputRate;
+	step = nominalStep;
+
+	// set up the control loop
+	maxDeviation = maxDeviation_ppm / 1.0e6;
+	filteredFill = this->targetFill;
+
+	// Size the output FIFO at four times the target, so that there's
+	// plenty of headroom above the set point before we start dropping
+	// samples.
+	fifoSize = this->targetFill * 4 + 1024;
+	fifo.reset(new int16_t[fifoSize]);
+	memset(fifo.get(), 0, fifoSize * sizeof(int16_t));
+
+	// clear the input history
+	memset(history, 0, sizeof(history));
+
+	// Build the polyphase filter table.  The cutoff is just below the
+	// lower of the two Nyquist frequencies, expressed in cycles per input
+	// sample.  When upsampling (the usual case, since DCS audio is only
+	// 31250 Hz), that's just below the input Nyquist limit of 0.5; when
+	// downsampling, it's scaled down by the rate ratio.
+	double fc = 0.5 * 0.92 * (nominalStep > 1.0 ? 1.0/nominalStep : 1.0);
+	const double beta = 8.0;
+	const double i0beta = BesselI0(beta);
+	const double halfWidth = TAPS / 2.0;
+	for (int p = 0 ; p <= PHASES ; ++p)
+	{
+		// Figure each tap's distance from the output time.  Tap k holds
+		// the input sample k-(TAPS/2-1) intervals from the input sample
+		// just before the output point, and the output point lies at
+		// fraction f of the interval following that sample.
+		double f = static_cast<double>(p) / PHASES;
+		double sum = 0.0;
+		double c[TAPS];
+		for (int k = 0 ; k < TAPS ; ++k)
+		{
+			double d = (k - (TAPS/2 - 1)) - f;
+			double x = 2.0 * fc * d;
+			double sinc = (fabs(x) < 1e-9) ? 1.0 : sin(PI * x) / (PI * x);
+			double w = d / halfWidth;
+			double win = (fabs(w) >= 1.0) ? 0.0 : BesselI0(beta * sqrt(1.0 - w*w)) / i0beta;
+			c[k] = 2.0 * fc * sinc * win;
+			sum += c[k];
+		}
+
+		// normalize to unity gain at DC
+		for (int k = 0 ; k < TAPS ; ++k)
+			coef[p][k] = static_cast<float>(c[k] / sum);
+	}
+
+	// initialize the statistics
+	ResetStats();
+}
+
+void DCSDecoderResampler::Write(const int16_t *samples, int n)
+{
+	uint64_t wp = writePos.load(std::memory_order_relaxed);
+	uint64_t rp = readPos.load(std::memory_order_acquire);
+	int nOut = 0, nDropped = 0;
+	for (int i = 0 ; i < n ; ++i)
+	{
+		// add the sample to both copies of the history ring
+		float s = static_cast<float>(samples[i]);
+		history[historyIdx] = s;
+		history[historyIdx + TAPS] = s;
+		historyIdx = (historyIdx + 1) % TAPS;
+
+		// The history window now runs from historyIdx (oldest) for TAPS
+		// samples.  Generate all of the output samples that fall within
+		// the interval at the center of the window.
+		const float *h = &history[historyIdx];
+		while (pos < 1.0)
+		{
+			// find the two nearest precomputed phases and interpolate
+			double phase = pos * PHASES;
+			int p = static_cast<int>(phase);
+			float frac = static_cast<float>(phase - p);
+			const float *c0 = coef[p];
+			const float *c1 = coef[p + 1];
+			float acc = 0.0f;
+			for (int k = 0 ; k < TAPS ; ++k)
+				acc += h[k] * (c0[k] + frac * (c1[k] - c0[k]));
+
+			// round and saturate to INT16
+			long v = lrintf(acc);
+			int16_t out = static_cast<int16_t>(v < -32768 ? -32768 : v > 32767 ? 32767 : v);
+
+			// Store it if there's room in the FIFO, otherwise drop it.  If
+			// the FIFO looks full, refresh our snapshot of the consumer
+			// position before giving up, since it might have read more
+			// since we started.
+			if (wp - rp >= static_cast<uint64_t>(fifoSize))
+				rp = readPos.load(std::memory_order_acquire);
+			if (wp - rp < static_cast<uint64_t>(fifoSize))
+			{
+				fifo[static_cast<size_t>(wp % fifoSize)] = out;
+				++wp;
+				++nOut;
+			}
+			else
+				++nDropped;
+
+			// advance to the next output time
+			pos += step;
+		}
+
+		// move on to the next input interval
+		pos -= 1.0;
+	}
+
+	// publish the new samples
+	writePos.store(wp, std::memory_order_release);
+	samplesIn.fetch_add(n, std::memory_order_relaxed);
+	samplesOut.fetch_add(nOut, std::memory_order_relaxed);
+	if (nDropped != 0)
+		overrunSamples.fetch_add(nDropped, std::memory_order_relaxed);
+
+	// update the control loop
+	UpdateControl(n);
+}
+
+void DCSDecoderResampler::UpdateControl(int nIn)
+{
+	// elapsed time represented by this batch of input, in seconds
+	double dt = static_cast<double>(nIn) / DCS_SAMPLE_RATE;
+	if (dt <= 0.0)
+		return;
+
+	// Measure the FIFO fill.  The raw level is jumpy, since the producer
+	// and consumer both work in blocks, so smooth it with a first-order
+	// low-pass filter with a time constant of about a quarter second.
+	int fill = static_cast<int>(writePos.load(std::memory_order_relaxed) - readPos.load(std::memory_order_acquire));
+	double alpha = 1.0 - exp(-dt / 0.25);
+	filteredFill += alpha * (fill - filteredFill);
+
+	// Normalized error: positive when we have more buffered than the
+	// target, meaning that we're producing faster than the device is
+	// consuming.
+	double e = (filteredFill - targetFill) / targetFill;
+
+	// PI controller.  The plant is an integrator: the fill level changes
+	// at outputRate*(correction - drift) samples per second, so the
+	// normalized error changes at a*(correction - drift) per second,
+	// where a = outputRate/targetFill.  The proportional gain gives full
+	// deviation at half the target away from the set point, and the
+	// integral gain is chosen for a damping ratio of about 0.7.
+	double a = static_cast<double>(outputRate) / targetFill;
+	double kp = 2.0 * maxDeviation;
+	double ki = a * kp * kp / (4.0 * 0.7 * 0.7);
+
+	// integrate, limiting the integral term to the deviation range so
+	// that it can't wind up during long excursions (such as startup)
+	integral += e * dt;
+	double iLimit = maxDeviation / ki;
+	integral = integral > iLimit ? iLimit : integral < -iLimit ? -iLimit : integral;
+
+	// figure the new correction, limited to the allowed deviation
+	correction = -(kp * e + ki * integral);
+	correction = correction > maxDeviation ? maxDeviation : correction < -maxDeviation ? -maxDeviation : correction;
+
+	// apply it to the resampling step
+	step = nominalStep / (1.0 + correction);
+
+	// update statistics
+	double ppm = correction * 1.0e6;
+	curCorrection_ppm.store(ppm, std::memory_order_relaxed);
+	curFilteredFill.store(filteredFill, std::memory_order_relaxed);
+	if (ppm < minCorrection_ppm.load(std::memory_order_relaxed))
+		minCorrection_ppm.store(ppm, std::memory_order_relaxed);
+	if (ppm > maxCorrection_ppm.load(std::memory_order_relaxed))
+		maxCorrection_ppm.store(ppm, std::memory_order_relaxed);
+	if (fill < minFill.load(std::memory_order_relaxed))
+		minFill.store(fill, std::memory_order_relaxed);
+	if (fill > maxFill.load(std::memory_order_relaxed))
+		maxFill.store(fill, std::memory_order_relaxed);
+}
+
+int DCSDecoderResampler::Read(int16_t *buf, int n)
+{
+	// figure how many samples are available
+	uint64_t rp = readPos.load(std::memory_order_relaxed);
+	int avail = static_cast<int>(writePos.load(std::memory_order_acquire) - rp);
+
+	// If we're not primed yet, play silence until the FIFO reaches the
+	// target level.  This happens at startup and after an underrun.  It
+	// gets the fill level to the set point immediately, rather than
+	// leaving it to the control loop, which deliberately reacts slowly
+	// (it's limited to a tiny pitch deviation).
+	if (!primed)
+	{
+		if (avail < targetFill)
+		{
+			memset(buf, 0, n * sizeof(int16_t));
+			return 0;
+		}
+		primed = true;
+	}
+
+	// copy as much as we can
+	int nCopy = n < avail ? n : avail;
+
+	// copy out the available samples, in up to two sections if we wrap
+	int idx = static_cast<int>(rp % fifoSize);
+	int n1 = fifoSize - idx < nCopy ? fifoSize - idx : nCopy;
+	memcpy(buf, fifo.get() + idx, n1 * sizeof(int16_t));
+	memcpy(buf + n1, fifo.get(), (nCopy - n1) * sizeof(int16_t));
+
+	// fill any shortfall with silence, count the underrun, and re-prime
+	if (nCopy < n)
+	{
+		memset(buf + nCopy, 0, (n - nCopy) * sizeof(int16_t));
+		underruns.fetch_add(1, std::memory_order_relaxed);
+		underrunSamples.fetch_add(n - nCopy, std::memory_order_relaxed);
+		primed = false;
+	}
+
+	// consume the samples
+	readPos.store(rp + nCopy, std::memory_order_release);
+	return nCopy;
+}
+
+DCSDecoderResampler::Stats DCSDecoderResampler::GetStats() const
+{
+	Stats s;
+	s.samplesIn = samplesIn.load(std::memory_order_relaxed);
+	s.samplesOut = samplesOut.load(std::memory_order_relaxed);
+	s.fill = static_cast<int>(writePos.load(std::memory_order_relaxed) - readPos.load(std::memory_order_relaxed));
+	s.filteredFill = curFilteredFill.load(std::memory_order_relaxed);
+	s.minFill = minFill.load(std::memory_order_relaxed);
+	s.maxFill = maxFill.load(std::memory_order_relaxed);
+	s.correction_ppm = curCorrection_ppm.load(std::memory_order_relaxed);
+	s.minCorrection_ppm = minCorrection_ppm.load(std::memory_order_relaxed);
+	s.maxCorrection_ppm = maxCorrection_ppm.load(std::memory_order_relaxed);
+	s.underruns = underruns.load(std::memory_order_relaxed);
+	s.underrunSamples = underrunSamples.load(std::memory_order_relaxed);
+	s.overrunSamples = overrunSamples.load(std::memory_order_relaxed);
+	return s;
+}
+
+void DCSDecoderResampler::ResetStats()
+{
+	// start the extremes at the current values
+	int fill = static_cast<int>(writePos.load(std::memory_order_relaxed) - readPos.load(std::memory_order_relaxed));
+	double ppm = curCorrection_ppm.load(std::memory_order_relaxed);
+	minFill.store(fill);
+	maxFill.store(fill);
+	minCorrection_ppm.store(ppm);
+	maxCorrection_ppm.store(ppm);
+
+	// clear the event counters
+	underruns.store(0);
+	underrunSamples.store(0);
+	overrunSamples.store(0);
+}
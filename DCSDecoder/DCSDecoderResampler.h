@@ -0,0 +1,173 @@
+// Copyright 2023 Michael J Roberts
+// BSD 3-clause license - NO WARRANTY
+//
+// DCS Decoder - adaptive output resampler
+//
+// This is an optional add-on for hosts where the decoder isn't paced
+// directly by the audio device.  The typical case is a WPC emulator,
+// where the decoder is clocked along with the emulated machine, so it
+// produces samples at 31250 Hz of *emulated* time, while the audio
+// device consumes them at its own rate according to its own crystal.
+// Even if the host resamples at the nominal ratio (say 48000/31250),
+// the two clocks never match exactly, so the buffer between them
+// slowly fills up (adding latency) or drains (causing underruns).
+// Making the buffer bigger only postpones the problem.
+//
+// This class sits between the two clocks.  The producer side writes
+// decoder samples at 31250 Hz with Write(), and the consumer side
+// (normally the audio device callback) reads device-rate samples
+// with Read().  The resampling ratio is continuously trimmed by a
+// control loop that watches the fill level of the output FIFO and
+// steers it towards a target level.  The correction is limited to a
+// small, configurable deviation from the nominal ratio (a few hundred
+// parts per million is enough for ordinary crystal tolerances), so
+// the pitch change is inaudible, and the host can run indefinitely
+// with a small fixed buffer.
+//
+// The resampler itself is a windowed-sinc interpolator with a table
+// of precomputed polyphase coefficients, interpolated between phases,
+// so the ratio can vary continuously.  There are no external library
+// dependencies.
+//
+// Write() and Read() can be called from different threads, as long
+// as there's only one producer thread and one consumer thread.
+//
+
+#pragma once
+#include <stdint.h>
+#include <memory>
+#include <atomic>
+
+class DCSDecoderResampler
+{
+public:
+	// Set up the resampler.
+	//
+	// outputRate is the audio device sample rate, in samples per second.
+	// The input rate is always the DCS rate, 31250 samples per second.
+	//
+	// targetFill is the desired output FIFO fill level, in output samples.
+	// This is the steady-state latency that the control loop maintains,
+	// so it should be a bit more than the largest block the consumer
+	// reads at once, plus the largest block the producer writes at once.
+	// The minimum is 1; smaller values (including zero and negative
+	// values) are treated as 1.
+	//
+	// maxDeviation_ppm is the limit on the ratio correction, in parts per
+	// million of the nominal ratio.
+	DCSDecoderResampler(int outputRate, int targetFill, int maxDeviation_ppm = 1000);
+
+	// Producer side: add DCS samples at 31250 Hz.  The samples are
+	// resampled into the output FIFO immediately, and the control loop
+	// updates the ratio.  If the FIFO is full, the excess output samples
+	// are discarded and counted as overruns.
+	void Write(const int16_t *samples, int n);
+
+	// Consumer side: read output samples at the device rate.  If fewer
+	// than 'n' samples are available, the remainder is filled with
+	// silence and the shortfall is counted as an underrun.  At startup,
+	// and after an underrun, this returns silence until the FIFO refills
+	// to the target level.  Returns the number of actual samples copied.
+	int Read(int16_t *buf, int n);
+
+	// Statistics.  These are snapshots, so they're only approximately
+	// consistent with one another when read while the resampler is
+	// running.
+	struct Stats
+	{
+		// total input and output samples
+		uint64_t samplesIn = 0;
+		uint64_t samplesOut = 0;
+
+		// current raw and filtered FIFO fill level, in output samples
+		int fill = 0;
+		double filteredFill = 0.0;
+
+		// minimum and maximum raw fill levels observed by the control loop
+		int minFill = 0;
+		int maxFill = 0;
+
+		// Current ratio correction, in parts per million of the nominal
+		// ratio (positive means we're producing more output samples per
+		// input sample than nominal), and the extremes observed.
+		double correction_ppm = 0.0;
+		double minCorrection_ppm = 0.0;
+		double maxCorrection_ppm = 0.0;
+
+		// Number of Read() calls that came up short, and the total
+		// number of silence samples substituted.
+		uint64_t underruns = 0;
+		uint64_t underrunSamples = 0;
+
+		// number of output samples discarded because the FIFO was full
+		uint64_t overrunSamples = 0;
+	};
+	Stats GetStats() const;
+
+	// reset the min/max and underrun/overrun statistics
+	void ResetStats();
+
+	// the DCS sample rate
+	static const int DCS_SAMPLE_RATE = 31250;
+
+protected:
+	// interpolation filter parameters: number of taps, and number of
+	// precomputed phases per input sample interval
+	static const int TAPS = 16;
+	static const int PHASES = 256;
+
+	// Filter coefficient table.  There's an extra phase at the end,
+	// so that we can interpolate between phase p and p+1 for any p.
+	float coef[PHASES + 1][TAPS];
+
+	// Input history.  This holds the most recent TAPS input samples,
+	// stored twice in a row so that we can always read TAPS consecutive
+	// samples without wrapping.
+	float history[TAPS * 2];
+	int historyIdx = 0;
+
+	// Fractional position of the next output sample, in input sample
+	// intervals, relative to the center of the filter window.
+	double pos = 0.0;
+
+	// output rate and nominal input step per output sample
+	int outputRate;
+	double nominalStep;
+
+	// current input step per output sample, including the correction
+	double step;
+
+	// control loop parameters and state
+	int targetFill;
+	double maxDeviation;
+	double filteredFill;
+	double integral = 0.0;
+	double correction = 0.0;
+
+	// update the control loop after adding 'nIn' input samples
+	void UpdateControl(int nIn);
+
+	// output FIFO (single producer, single consumer)
+	std::unique_ptr<int16_t[]> fifo;
+	int fifoSize;
+	std::atomic<uint64_t> writePos{ 0 };
+	std::atomic<uint64_t> readPos{ 0 };
+
+	// Consumer priming flag.  The consumer plays silence until the FIFO
+	// first reaches the target fill level, and again after an underrun.
+	// This is only accessed on the consumer thread.
+	bool primed = false;
+
+	// statistics
+	std::atomic<uint64_t> samplesIn{ 0 };
+	std::atomic<uint64_t> samplesOut{ 0 };
+	std::atomic<int> minFill{ 0 };
+	std::atomic<int> maxFill{ 0 };
+	std::atomic<double> curCorrection_ppm{ 0.0 };
+	std::atomic<double> curFilteredFill{ 0.0 };
+	std::atomic<double> minCorrection_ppm{ 0.0 };
+	std::atomic<double> maxCorrection_ppm{ 0.0 };
+	std::atomic<uint64_t> underruns{ 0 };
+	std::atomic<uint64_t> underrunSamples{ 0 };
+	std::atomic<uint64_t> overrunSamples{ 0 };
+};
@@ -0,0 +1,295 @@
+// Copyright 2023 Michael J Roberts
+// BSD 3-clause license - NO WARRANTY
+//
+// DCS Decoder - multi-instance scheduler
+//
+// See DCSDecoderScheduler.h for an overview.
+//
+
+#include <string.h>
+#include <chrono>
+#include "DCSDecoderScheduler.h"
+
+
+DCSDecoderScheduler::DCSDecoderScheduler(int nWorkers, int bufferSamples)
+{
+	// use one worker per hardware thread if the caller didn't specify
+	if (nWorkers <= 0)
+		nWorkers = static_cast<int>(std::thread::hardware_concurrency());
+	if (nWorkers <= 0)
+		nWorkers = 1;
+	this->nWorkers = nWorkers;
+
+	// round the buffer up to whole frames, with a minimum of two frames,
+	// so that the consumer can always be draining one frame while a
+	// worker renders the next
+	int nFrames = (bufferSamples + FRAME_SAMPLES - 1) / FRAME_SAMPLES;
+	this->bufferSamples = (nFrames < 2 ? 2 : nFrames) * FRAME_SAMPLES;
+}
+
+DCSDecoderScheduler::~DCSDecoderScheduler()
+{
+	Stop();
+}
+
+DCSDecoderScheduler::Slot::Slot(DCSDecoder *decoder, int homeWorker, int capacity) :
+	decoder(decoder), homeWorker(homeWorker), buf(new int16_t[capacity]), capacity(capacity)
+{
+	memset(buf.get(), 0, capacity * sizeof(int16_t));
+	minFill.store(capacity);
+}
+
+int DCSDecoderScheduler::AddDecoder(DCSDecoder *decoder)
+{
+	// the slot list is fixed while the workers are running
+	if (workers.size() != 0)
+		return -1;
+
+	// assign home workers round-robin
+	int id = static_cast<int>(slots.size());
+	slots.emplace_back(new Slot(decoder, id % nWorkers, bufferSamples));
+	return id;
+}
+
+void DCSDecoderScheduler::Start()
+{
+	// ignore if already running
+	if (workers.size() != 0)
+		return;
+
+	// Start every decoder's deadline clock now.  Until the consumer
+	// makes its first read, this makes the deadlines simply reflect
+	// how many samples each decoder has buffered.
+	int64_t now = Now_ns();
+	for (auto &s : slots)
+		s->lastReadTime_ns.store(now, std::memory_order_relaxed);
+
+	// launch the workers
+	stopping.store(false);
+	for (int i = 0 ; i < nWorkers ; ++i)
+		workers.emplace_back(&DCSDecoderScheduler::WorkerMain, this, i);
+}
+
+void DCSDecoderScheduler::Stop()
+{
+	// signal the workers to exit, and wake any that are idle
+	{
+		std::lock_guard<std::mutex> lock(wakeMutex);
+		stopping.store(true);
+	}
+	wakeCond.notify_all();
+
+	// wait for them to finish
+	for (auto &t : workers)
+		t.join();
+	workers.clear();
+}
+
+void DCSDecoderScheduler::WriteDataPort(int id, uint8_t data)
+{
+	if (id >= 0 && id < static_cast<int>(slots.size()))
+	{
+		auto &s = *slots[id];
+		std::lock_guard<std::mutex> lock(s.portMutex);
+		s.portQueue.emplace_back(data);
+	}
+}
+
+int DCSDecoderScheduler::ReadSamples(int id, int16_t *buf, int n)
+{
+	// validate the ID
+	if (id < 0 || id >= static_cast<int>(slots.size()))
+		return 0;
+
+	// figure how many samples are available
+	auto &s = *slots[id];
+	uint64_t readPos = s.readPos.load(std::memory_order_relaxed);
+	int avail = static_cast<int>(s.writePos.load(std::memory_order_acquire) - readPos);
+	int nCopy = n < avail ? n : avail;
+
+	// copy out the available samples, in up to two sections if we wrap
+	// around the end of the ring
+	int idx = static_cast<int>(readPos % s.capacity);
+	int n1 = s.capacity - idx < nCopy ? s.capacity - idx : nCopy;
+	memcpy(buf, s.buf.get() + idx, n1 * sizeof(int16_t));
+	memcpy(buf + n1, s.buf.get(), (nCopy - n1) * sizeof(int16_t));
+
+	// If we came up short, the decoder missed its deadline.  Fill the
+	// rest with silence and count the miss.
+	if (nCopy < n)
+	{
+		memset(buf + nCopy, 0, (n - nCopy) * sizeof(int16_t));
+		s.deadlineMisses.fetch_add(1, std::memory_order_relaxed);
+		s.samplesMissed.fetch_add(n - nCopy, std::memory_order_relaxed);
+	}
+
+	// note the low-water mark
+	int fill = avail - nCopy;
+	if (fill < s.minFill.load(std::memory_order_relaxed))
+		s.minFill.store(fill, std::memory_order_relaxed);
+
+	// consume the samples and restart the deadline clock
+	s.lastReadTime_ns.store(Now_ns(), std::memory_order_relaxed);
+	s.readPos.store(readPos + nCopy, std::memory_order_release);
+
+	// there's now room in the buffer, so wake an idle worker
+	wakeCond.notify_one();
+
+	// return the number of decoded samples copied
+	return nCopy;
+}
+
+DCSDecoderScheduler::Stats DCSDecoderScheduler::GetStats(int id) const
+{
+	Stats st;
+	if (id >= 0 && id < static_cast<int>(slots.size()))
+	{
+		auto &s = *slots[id];
+		st.framesRendered = s.framesRendered.load(std::memory_order_relaxed);
+		st.framesStolen = s.framesStolen.load(std::memory_order_relaxed);
+		st.deadlineMisses = s.deadlineMisses.load(std::memory_order_relaxed);
+		st.samplesMissed = s.samplesMissed.load(std::memory_order_relaxed);
+		st.totalFrameTime_ns = s.totalFrameTime_ns.load(std::memory_order_relaxed);
+		st.maxFrameTime_ns = s.maxFrameTime_ns.load(std::memory_order_relaxed);
+		st.minFill = s.minFill.load(std::memory_order_relaxed);
+	}
+	return st;
+}
+
+void DCSDecoderScheduler::ResetStats(int id)
+{
+	if (id >= 0 && id < static_cast<int>(slots.size()))
+	{
+		auto &s = *slots[id];
+		s.framesRendered.store(0);
+		s.framesStolen.store(0);
+		s.deadlineMisses.store(0);
+		s.samplesMissed.store(0);
+		s.totalFrameTime_ns.store(0);
+		s.maxFrameTime_ns.store(0);
+		s.minFill.store(s.capacity);
+	}
+}
+
+int64_t DCSDecoderScheduler::Slot::Deadline() const
+{
+	// The consumer plays the buffered samples at 31250 samples per
+	// second (32us per sample), starting from its last read.
+	return lastReadTime_ns.load(std::memory_order_relaxed) + static_cast<int64_t>(Fill()) * 32000;
+}
+
+int64_t DCSDecoderScheduler::Now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void DCSDecoderScheduler::WorkerMain(int workerIndex)
+{
+	while (!stopping.load(std::memory_order_relaxed))
+	{
+		// find the most urgent decoder that needs a frame
+		bool stolen = false;
+		if (Slot *slot = ClaimSlot(workerIndex, stolen); slot != nullptr)
+		{
+			// render a frame and release the slot
+			RenderFrame(slot, stolen);
+			slot->busy.store(false, std::memory_order_release);
+		}
+		else
+		{
+			// Nothing to do - all of the buffers are full or claimed by
+			// other workers.  Wait for a consumer to drain a buffer.  The
+			// timeout covers the case where the notification arrives
+			// between our scan and the wait; one millisecond is small
+			// compared to the 7.68ms frame time.
+			std::unique_lock<std::mutex> lock(wakeMutex);
+			if (!stopping.load())
+				wakeCond.wait_for(lock, std::chrono::milliseconds(1));
+		}
+	}
+}
+
+DCSDecoderScheduler::Slot *DCSDecoderScheduler::ClaimSlot(int workerIndex, bool &stolen)
+{
+	// Make two passes: the first considers only our own home slots, the
+	// second considers everyone else's.  In each pass, pick the slot with
+	// the earliest deadline.  Another worker might claim the slot between
+	// our scan and our claim, in which case we simply rescan.
+	//
+	// Only steal from a slot that's at least half drained.  A slot with
+	// more buffered than that isn't in any danger yet, and its home worker
+	// will probably get to it shortly, so taking it would just move the
+	// decoder's state to another core's cache for no benefit.
+	for (int pass = 0 ; pass < 2 ; ++pass)
+	{
+		for (;;)
+		{
+			Slot *best = nullptr;
+			int64_t bestDeadline = 0;
+			for (auto &sp : slots)
+			{
+				Slot *s = sp.get();
+				if ((s->homeWorker == workerIndex) == (pass == 0)
+					&& !s->busy.load(std::memory_order_relaxed)
+					&& (pass == 0 ? s->NeedsFrame() : s->Fill() <= s->capacity / 2))
+				{
+					int64_t d = s->Deadline();
+					if (best == nullptr || d < bestDeadline)
+						best = s, bestDeadline = d;
+				}
+			}
+
+			// if there's no candidate in this pass, go on to the next pass
+			if (best == nullptr)
+				break;
+
+			// try to claim it
+			bool expected = false;
+			if (best->busy.compare_exchange_strong(expected, true, std::memory_order_acquire))
+			{
+				stolen = (pass != 0);
+				return best;
+			}
+		}
+	}
+
+	// nothing needs work right now
+	return nullptr;
+}
+
+void DCSDecoderScheduler::RenderFrame(Slot *slot, bool stolen)
+{
+	// forward pending data port bytes to the decoder
+	std::vector<uint8_t> port;
+	{
+		std::lock_guard<std::mutex> lock(slot->portMutex);
+		port.swap(slot->portQueue);
+	}
+	for (auto b : port)
+		slot->decoder->WriteDataPort(b);
+
+	// render one frame's worth of samples into the ring
+	int64_t t0 = Now_ns();
+	uint64_t writePos = slot->writePos.load(std::memory_order_relaxed);
+	int idx = static_cast<int>(writePos % slot->capacity);
+	int16_t *buf = slot->buf.get();
+	for (int i = 0 ; i < FRAME_SAMPLES ; ++i)
+	{
+		buf[idx] = slot->decoder->GetNextSample();
+		if (++idx == slot->capacity)
+			idx = 0;
+	}
+
+	// publish the new samples to the consumer
+	slot->writePos.store(writePos + FRAME_SAMPLES, std::memory_order_release);
+
+	// update statistics
+	uint64_t dt = static_cast<uint64_t>(Now_ns() - t0);
+	slot->framesRendered.fetch_add(1, std::memory_order_relaxed);
+	if (stolen)
+		slot->framesStolen.fetch_add(1, std::memory_order_relaxed);
+	slot->totalFrameTime_ns.fetch_add(dt, std::memory_order_relaxed);
+	if (dt > slot->maxFrameTime_ns.load(std::memory_order_relaxed))
+		slot->maxFrameTime_ns.store(dt, std::memory_order_relaxed);
+}
@@ -0,0 +1,217 @@
+// Copyright 2023 Michael J Roberts
+// BSD 3-clause license - NO WARRANTY
+//
+// DCS Decoder - multi-instance scheduler
+//
+// This is an optional add-on for hosts that run many DCSDecoder
+// instances at once, such as a server driving a whole room full of
+// virtual pinball cabinets.  The straightforward way to run several
+// decoders is to give each one its own thread that calls
+// GetNextSample() and feeds the result to an audio device, but that
+// doesn't scale well past the number of CPU cores, since the OS
+// scheduler has no idea which of the threads is closest to running
+// out of audio.
+//
+// The scheduler instead owns a fixed pool of worker threads and a set
+// of decoders.  Each decoder gets a ring buffer of rendered PCM samples,
+// which the host's audio output code drains via ReadSamples().  The
+// workers render one DCS frame (240 samples, 7.68ms) at a time into
+// the ring buffers, always choosing the decoder whose buffer will run
+// dry soonest - that is, earliest deadline first.  Each decoder has a
+// "home" worker; a worker serves its own decoders first, and when none
+// of them need a frame, it steals the most urgent frame from another
+// worker's decoders that are running low.  That keeps each decoder's state warm in one
+// core's cache in the steady state, while still letting idle workers
+// help out when one worker falls behind.
+//
+// A decoder is never rendered by two workers at the same time, so the
+// decoder objects themselves don't need to be thread-safe.  However,
+// the decoder's Host callbacks (ReceiveDataPort, etc) will be invoked
+// on whichever worker thread is currently rendering that decoder, so
+// the host implementation must be prepared for that.
+//
+// Note that the emulator decoder (DCSDecoderEmulated) can only be
+// instantiated once at a time, so a scheduler can hold at most one of
+// those.  Any number of native decoders can be scheduled.
+//
+
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "DCSDecoder.h"
+
+class DCSDecoderScheduler
+{
+public:
+	// Create the scheduler.  'nWorkers' is the number of worker threads
+	// to use; zero selects the number of hardware threads available.
+	// 'bufferSamples' is the size of each decoder's PCM ring buffer, in
+	// samples; it's rounded up to a whole number of frames, with a
+	// minimum of two frames.
+	DCSDecoderScheduler(int nWorkers = 0, int bufferSamples = 240*8);
+
+	// destruction stops the workers, if they're running
+	~DCSDecoderScheduler();
+
+	// Add a decoder.  This must be called before Start().  The caller
+	// retains ownership of the decoder object, which must remain valid
+	// until the scheduler is stopped.  The decoder should already have
+	// its ROMs loaded and be booted (or booting) when the workers start.
+	// Returns the decoder's ID, for use in the other calls, or -1 if
+	// the scheduler is already running.
+	int AddDecoder(DCSDecoder *decoder);
+
+	// start/stop the worker threads
+	void Start();
+	void Stop();
+
+	// number of worker threads
+	int GetNumWorkers() const { return nWorkers; }
+
+	// number of decoders
+	int GetNumDecoders() const { return static_cast<int>(slots.size()); }
+
+	// Queue a data port byte for a decoder.  This can be called from
+	// any thread.  The byte is passed to the decoder's WriteDataPort()
+	// just before its next frame is rendered.
+	void WriteDataPort(int id, uint8_t data);
+
+	// Read rendered samples.  This is the consumer side of the decoder's
+	// ring buffer; there must be only one consumer thread per decoder
+	// (typically the thread servicing that decoder's audio device).
+	// Copies up to 'n' samples into the buffer.  If fewer than 'n'
+	// samples are available, the remainder is filled with silence and
+	// the shortfall is counted as a deadline miss.  Returns the number
+	// of actual decoded samples copied.
+	int ReadSamples(int id, int16_t *buf, int n);
+
+	// Per-decoder statistics
+	struct Stats
+	{
+		// number of frames rendered
+		uint64_t framesRendered = 0;
+
+		// number of frames rendered by a worker other than the
+		// decoder's home worker
+		uint64_t framesStolen = 0;
+
+		// Deadline misses.  This counts ReadSamples() calls that found
+		// the ring buffer short of the requested number of samples,
+		// which corresponds to an audible underrun on the output device.
+		uint64_t deadlineMisses = 0;
+
+		// total silence samples substituted for missing samples
+		uint64_t samplesMissed = 0;
+
+		// total and worst-case frame rendering time, in nanoseconds
+		uint64_t totalFrameTime_ns = 0;
+		uint64_t maxFrameTime_ns = 0;
+
+		// Low-water mark of the ring buffer, in samples, as observed
+		// at ReadSamples() time.  This shows how close the decoder has
+		// come to an underrun.
+		int minFill = 0;
+	};
+	Stats GetStats(int id) const;
+
+	// reset a decoder's statistics
+	void ResetStats(int id);
+
+protected:
+	// samples per DCS frame
+	static const int FRAME_SAMPLES = 240;
+
+	// per-decoder scheduling slot
+	struct Slot
+	{
+		Slot(DCSDecoder *decoder, int homeWorker, int capacity);
+
+		// the decoder
+		DCSDecoder *decoder;
+
+		// home worker index
+		int homeWorker;
+
+		// PCM ring buffer
+		std::unique_ptr<int16_t[]> buf;
+		int capacity;
+
+		// Producer and consumer positions, as running sample counts.
+		// The buffer index is the position modulo the capacity, and
+		// the difference is the number of buffered samples.
+		std::atomic<uint64_t> writePos{ 0 };
+		std::atomic<uint64_t> readPos{ 0 };
+
+		// Time of the last consumer read, in steady_clock nanoseconds.
+		// The consumer drains samples at the DCS sample rate, so the
+		// underrun deadline is this time plus the playing time of the
+		// samples that were buffered at that point.
+		std::atomic<int64_t> lastReadTime_ns{ 0 };
+
+		// set while a worker is rendering this decoder
+		std::atomic<bool> busy{ false };
+
+		// pending data port bytes
+		std::mutex portMutex;
+		std::vector<uint8_t> portQueue;
+
+		// statistics
+		std::atomic<uint64_t> framesRendered{ 0 };
+		std::atomic<uint64_t> framesStolen{ 0 };
+		std::atomic<uint64_t> deadlineMisses{ 0 };
+		std::atomic<uint64_t> samplesMissed{ 0 };
+		std::atomic<uint64_t> totalFrameTime_ns{ 0 };
+		std::atomic<uint64_t> maxFrameTime_ns{ 0 };
+		std::atomic<int> minFill{ 0 };
+
+		// number of samples currently buffered
+		int Fill() const {
+			return static_cast<int>(writePos.load(std::memory_order_acquire) - readPos.load(std::memory_order_acquire));
+		}
+
+		// does the ring buffer have room for another frame?
+		bool NeedsFrame() const { return Fill() <= capacity - FRAME_SAMPLES; }
+
+		// underrun deadline, in steady_clock nanoseconds
+		int64_t Deadline() const;
+	};
+
+	// worker thread main
+	void WorkerMain(int workerIndex);
+
+	// Choose and claim the next slot for a worker to render, in earliest-
+	// deadline-first order, preferring the worker's home slots.  Returns
+	// null if no slot currently needs a frame.
+	Slot *ClaimSlot(int workerIndex, bool &stolen);
+
+	// render one frame into a claimed slot
+	void RenderFrame(Slot *slot, bool stolen);
+
+	// current steady_clock time in nanoseconds
+	static int64_t Now_ns();
+
+	// number of worker threads
+	int nWorkers;
+
+	// per-decoder ring buffer capacity, in samples
+	int bufferSamples;
+
+	// scheduling slots, one per decoder
+	std::vector<std::unique_ptr<Slot>> slots;
+
+	// worker threads
+	std::vector<std::thread> workers;
+
+	// Worker wakeup.  Idle workers wait here for a consumer to make room
+	// in one of the ring buffers.
+	std::mutex wakeMutex;
+	std::condition_variable wakeCond;
+
+	// stop flag for the workers
+	std::atomic<bool> stopping{ false };
+};
@@ -0,0 +1,228 @@
+// Copyright 2023 Michael J Roberts
+// BSD 3-clause license - NO WARRANTY
+//
+// DCS Decoder - session recording and replay
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <memory>
+#include "DCSDecoderSession.h"
+
+const char *const DCSDecoderSession::Signature = "DCSSessn";
+
+// --------------------------------------------------------------------------
+//
+// Recorder
+//
+
+bool DCSDecoderSession::Recorder::Open(const char *filename, DCSDecoder *decoder, int defaultVolume, std::string &errorMessage)
+{
+	// close any previous session
+	Close(nullptr);
+
+	// create the file
+	if ((fp = fopen(filename, "wb")) == nullptr)
+	{
+		errorMessage = std::string("Unable to create session file \"") + filename + "\"";
+		return false;
+	}
+	this->filename = filename;
+
+	// Write the header.  The ROM signature and decoder name are for
+	// information only, so truncate them to fit the length bytes if
+	// necessary.
+	std::string sig = decoder->GetSignature().substr(0, 255);
+	std::string name = std::string(decoder->Name()).substr(0, 255);
+	uint8_t hdr[SignatureLen + 4];
+	memcpy(hdr, Signature, SignatureLen);
+	hdr[SignatureLen] = static_cast<uint8_t>(Version >> 8);
+	hdr[SignatureLen + 1] = static_cast<uint8_t>(Version & 0xFF);
+	hdr[SignatureLen + 2] = static_cast<uint8_t>(std::max(0, std::min(255, defaultVolume)));
+	hdr[SignatureLen + 3] = static_cast<uint8_t>(sig.size());
+	fwrite(hdr, 1, sizeof(hdr), fp);
+	fwrite(sig.data(), 1, sig.size(), fp);
+	fputc(static_cast<int>(name.size()), fp);
+	fwrite(name.data(), 1, name.size(), fp);
+
+	// start the timeline at the decoder's current sample position
+	startSample = lastSample = decoder->GetSampleCounter();
+	nEvents = 0;
+
+	// attach to the decoder
+	this->decoder = decoder;
+	decoder->SetDataPortRecorder(this);
+	return true;
+}
+
+bool DCSDecoderSession::Recorder::Close(std::string *errorMessage)
+{
+	// if there's no file open, there's nothing to do
+	if (fp == nullptr)
+		return true;
+
+	// detach from the decoder
+	decoder->SetDataPortRecorder(nullptr);
+
+	// write the end marker at the decoder's current position
+	uint64_t endSample = decoder->GetSampleCounter();
+	WriteVarInt(((endSample - lastSample) << 1) | 1);
+
+	// close the file, checking for errors in any of the writes
+	bool ok = !ferror(fp);
+	ok = (fclose(fp) == 0) && ok;
+	fp = nullptr;
+	decoder = nullptr;
+
+	if (!ok && errorMessage != nullptr)
+		*errorMessage = "Error writing session file \"" + filename + "\"";
+	return ok;
+}
+
+void DCSDecoderSession::Recorder::RecordDataPortWrite(uint64_t sampleCounter, uint8_t data)
+{
+	// write the sample delta with the event type bit clear, then the data byte
+	WriteVarInt((sampleCounter - lastSample) << 1);
+	fputc(data, fp);
+	lastSample = sampleCounter;
+	++nEvents;
+}
+
+void DCSDecoderSession::Recorder::WriteVarInt(uint64_t val)
+{
+	uint8_t buf[10];
+	int n = 0;
+	do
+	{
+		buf[n] = static_cast<uint8_t>(val & 0x7F);
+		val >>= 7;
+		if (val != 0)
+			buf[n] |= 0x80;
+		++n;
+	} while (val != 0);
+	fwrite(buf, 1, n, fp);
+}
+
+// --------------------------------------------------------------------------
+//
+// Session file loader
+//
+
+bool DCSDecoderSession::Load(const char *filename, std::string &errorMessage)
+{
+	// Read the whole file into memory.  Session files are small, even
+	// for long sessions, since they only contain the data port bytes.
+	FILE *fp = fopen(filename, "rb");
+	if (fp == nullptr)
+	{
+		errorMessage = std::string("Unable to open session file \"") + filename + "\"";
+		return false;
+	}
+	std::vector<uint8_t> buf;
+	uint8_t tmp[65536];
+	for (size_t n ; (n = fread(tmp, 1, sizeof(tmp), fp)) != 0 ; )
+		buf.insert(buf.end(), tmp, tmp + n);
+	bool readError = ferror(fp) != 0;
+	fclose(fp);
+	if (readError)
+	{
+		errorMessage = std::string("Error reading session file \"") + filename + "\"";
+		return false;
+	}
+
+	// set up the read pointer
+	const uint8_t *p = buf.data();
+	const uint8_t *endp = p + buf.size();
+	auto Avail = [&p, endp](size_t n) { return static_cast<size_t>(endp - p) >= n; };
+	auto Corrupted = [&errorMessage, filename]() {
+		errorMessage = std::string("Session file \"") + filename + "\" is corrupted";
+		return false;
+	};
+
+	// check the signature and version
+	if (!Avail(SignatureLen + 4) || memcmp(p, Signature, SignatureLen) != 0)
+	{
+		errorMessage = std::string("\"") + filename + "\" isn't a DCS session file";
+		return false;
+	}
+	p += SignatureLen;
+	int version = (p[0] << 8) | p[1];
+	if (version != Version)
+	{
+		errorMessage = std::string("Session file \"") + filename + "\" uses an unsupported format version ("
+			+ std::to_string(version) + ")";
+		return false;
+	}
+	p += 2;
+
+	// read the header fields
+	defaultVolume = *p++;
+	size_t sigLen = *p++;
+	if (!Avail(sigLen + 1))
+		return Corrupted();
+	romSignature.assign(reinterpret_cast<const char*>(p), sigLen);
+	p += sigLen;
+	size_t nameLen = *p++;
+	if (!Avail(nameLen))
+		return Corrupted();
+	decoderName.assign(reinterpret_cast<const char*>(p), nameLen);
+	p += nameLen;
+
+	// Read the events.  If the recording program didn't exit normally,
+	// the file can end anywhere, even in the middle of an event, so
+	// running out of data just ends the session at the last complete
+	// event.
+	events.clear();
+	truncated = true;
+	uint64_t sampleNo = 0;
+	for (;;)
+	{
+		// read the variable-length sample delta and event type
+		uint64_t val = 0;
+		int shift = 0;
+		bool complete = false;
+		while (Avail(1))
+		{
+			if (shift > 63)
+				return Corrupted();
+			uint8_t b = *p++;
+			val |= static_cast<uint64_t>(b & 0x7F) << shift;
+			shift += 7;
+			if ((b & 0x80) == 0)
+			{
+				complete = true;
+				break;
+			}
+		}
+
+		// check the event type
+		if (!complete)
+			break;
+		if ((val & 1) != 0)
+		{
+			// end of session - this must be the last thing in the file
+			if (p != endp)
+				return Corrupted();
+			sampleNo += val >> 1;
+			truncated = false;
+			break;
+		}
+
+		// data port byte
+		if (!Avail(1))
+			break;
+		sampleNo += val >> 1;
+		events.push_back({ sampleNo, *p++ });
+	}
+
+	// Set the session length.  A truncated session has no end marker to
+	// say how long the host ran after the last byte, so play through
+	// the end of the frame containing the last event.  Ending exactly at
+	// the last event's position would stop the replay just before that
+	// byte is sent, since the replay delivers each byte ahead of the
+	// sample at its position.
+	endSample = sampleNo;
+	if (truncated && events.size() != 0)
+		endSample = (events.back().sampleNo / SamplesPerFrame + 1) * SamplesPerFrame;
+	return true;
+}
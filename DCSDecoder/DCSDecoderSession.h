@@ -0,0 +1,183 @@
+// Copyright 2023 Michael J Roberts
+// BSD 3-clause license - NO WARRANTY
+//
+// DCS Decoder - session recording and replay
+//
+// The decoder's workload depends on the command stream that the host
+// sends through the data port: which tracks are playing, how many of
+// them overlap, and when the volume and mixing levels change.  A
+// session recording captures that command stream from a live session,
+// so that the session can be played back later, exactly as it ran,
+// to reproduce a problem or to serve as a benchmark.
+//
+// The recorder attaches to a decoder through the decoder's data port
+// recorder hook, and logs each byte written to the data port along with
+// the decoder's sample counter at the time of the write.  The sample
+// counter gives the exact position of the byte in the output stream,
+// down to the individual sample; the frame number is simply the sample
+// number divided by the 240 samples per frame.  Replaying the bytes at
+// the same sample positions, on a decoder booted the same way, yields
+// exactly the same output.
+//
+// File format.  All multi-byte fixed fields are big-endian.
+//
+//   char[8]   signature "DCSSessn"
+//   uint16    format version (currently 1)
+//   uint8     default volume setting (0..255) at the start of the session
+//   uint8     length of the U2 ROM signature string, followed by the string
+//   uint8     length of the decoder name, followed by the name
+//   events...
+//
+// Each event starts with a variable-length integer (7 bits per byte,
+// low-order group first, high bit set on all but the last byte) giving
+// (D << 1) | E, where D is the number of samples since the previous
+// event (or since the start of the session, for the first event), and
+// E is 0 for a data port byte and 1 for the end of the session.  A data
+// port event is followed by the byte written.  The end event marks the
+// total length of the session, and is always the last item in the file.
+// Commands typically arrive a few bytes at a time, at frame boundaries,
+// so a typical byte takes two to four bytes in the file, and a session
+// of several hours of real play fits in a few hundred kilobytes.
+//
+
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "DCSDecoder.h"
+
+class DCSDecoderSession
+{
+public:
+	// samples per decoder frame
+	static const int SamplesPerFrame = 240;
+
+	// Recorded data port byte
+	struct Event
+	{
+		uint64_t sampleNo;       // number of samples generated since the start of the session
+		uint8_t data;            // byte written to the data port
+
+		uint64_t GetFrameNo() const { return sampleNo / SamplesPerFrame; }
+		int GetSampleInFrame() const { return static_cast<int>(sampleNo % SamplesPerFrame); }
+	};
+
+	// Session recorder.  This writes the session file as the session
+	// runs, through an ordinary stdio buffer, so that a session cut
+	// short by a crash can still be replayed, up to the last buffer
+	// that made it to disk.
+	class Recorder : public DCSDecoder::DataPortRecorder
+	{
+	public:
+		Recorder() { }
+		~Recorder() { Close(nullptr); }
+
+		// Create the session file, and attach the recorder to the
+		// decoder.  The session starts at the decoder's current sample
+		// position, so this should be called just before the host
+		// boots the decoder.  'defaultVolume' is the default volume
+		// setting that the host applies at boot, which the replay must
+		// apply the same way.
+		bool Open(const char *filename, DCSDecoder *decoder, int defaultVolume, std::string &errorMessage);
+
+		// End the session: write the end marker, close the file, and
+		// detach from the decoder.  Returns false, with an error message
+		// (if 'errorMessage' isn't null), if any write to the file failed.
+		bool Close(std::string *errorMessage);
+
+		// number of bytes recorded so far
+		uint64_t GetNumEvents() const { return nEvents; }
+
+		// DCSDecoder::DataPortRecorder implementation
+		virtual void RecordDataPortWrite(uint64_t sampleCounter, uint8_t data) override;
+
+	protected:
+		// write a variable-length integer
+		void WriteVarInt(uint64_t val);
+
+		// decoder we're attached to
+		DCSDecoder *decoder = nullptr;
+
+		// output file
+		FILE *fp = nullptr;
+		std::string filename;
+
+		// decoder sample counter at the start of the session, and at the
+		// last event recorded
+		uint64_t startSample = 0;
+		uint64_t lastSample = 0;
+
+		// number of events recorded
+		uint64_t nEvents = 0;
+	};
+
+	// Load a session file for replay.  Returns false, with an error
+	// message, if the file can't be read or isn't a valid session file.
+	// A file that's missing its end marker (because the recording
+	// program didn't exit normally) loads successfully, with the end
+	// of the session set to the end of the frame containing the last
+	// event, and 'truncated' set.
+	bool Load(const char *filename, std::string &errorMessage);
+
+	// Replay the session through a decoder.  This boots the decoder the
+	// same way the recording host did, then feeds it the recorded bytes
+	// at their original sample positions, calling 'frameCallback' with
+	// each frame of output samples (240 samples, or fewer for the last
+	// frame).  The callback can return false to stop the replay early.
+	// 'frameStart' is called just before each frame is generated, for
+	// callers that want to time the frames.
+	template<typename FrameStart, typename FrameCallback>
+	void Replay(DCSDecoder *decoder, FrameStart frameStart, FrameCallback frameCallback) const
+	{
+		decoder->HardBoot();
+		decoder->StartSelfTests();
+		decoder->SetDefaultVolume(defaultVolume);
+
+		size_t nextEvent = 0;
+		int16_t buf[SamplesPerFrame];
+		for (uint64_t sampleNo = 0 ; sampleNo < endSample ; )
+		{
+			int n = static_cast<int>(std::min<uint64_t>(SamplesPerFrame, endSample - sampleNo));
+			frameStart();
+			for (int i = 0 ; i < n ; )
+			{
+				// send the bytes due at this sample position
+				for ( ; nextEvent < events.size() && events[nextEvent].sampleNo == sampleNo + i ; ++nextEvent)
+					decoder->WriteDataPort(events[nextEvent].data);
+
+				// generate samples up to the next event or the end of the frame
+				int stop = n;
+				if (nextEvent < events.size() && events[nextEvent].sampleNo < sampleNo + n)
+					stop = static_cast<int>(events[nextEvent].sampleNo - sampleNo);
+				for ( ; i < stop ; ++i)
+					buf[i] = decoder->GetNextSample();
+			}
+
+			if (!frameCallback(buf, n))
+				break;
+
+			sampleNo += n;
+		}
+	}
+
+	// session parameters, from the file header
+	int defaultVolume = 255;
+	std::string romSignature;
+	std::string decoderName;
+
+	// recorded data port bytes, in order of sample position
+	std::vector<Event> events;
+
+	// length of the session, in samples
+	uint64_t endSample = 0;
+
+	// was the end marker missing?
+	bool truncated = false;
+
+	// file format signature and version
+	static const char *const Signature;
+	static const int SignatureLen = 8;
+	static const uint16_t Version = 1;
+};
@@ -23,8 +23,8 @@
 #include <stdarg.h>
 #include <regex>
 #include <list>
+#include <vector>
 #include <functional>
-#include <Windows.h>  // for the UINTx types required by unzip.h
 #include "DCSDecoder.h"
 #include "../miniz/miniz.h"
 #include "../miniz/miniz_zip.h"
@@ -205,3 +205,207 @@ DCSDecoder::ZipLoadStatus DCSDecoder::LoadROMFromZipFile(
 	// success
 	return ZipLoadStatus::Success;
 }
+
+
+// --------------------------------------------------------------------------
+//
+// Delta patch loader
+//
+DCSDecoder::ZipLoadStatus DCSDecoder::ApplyROMPatch(
+	const char *patchFileName, std::list<ZipFileData> &romData, std::string *errorDetails)
+{
+	// return an error
+	auto Error = [errorDetails](ZipLoadStatus status, const char *fmt, ...)
+	{
+		// pass back the error message, if the caller is interested
+		if (errorDetails != nullptr)
+		{
+			va_list va;
+			va_start(va, fmt);
+			*errorDetails = vformat(fmt, va);
+			va_end(va);
+		}
+
+		// return the status code
+		return status;
+	};
+
+	// Load the whole patch file into memory.  Patches are small (that's
+	// the point of them), and it's simpler to parse from memory.
+	FILE *fp = fopen(patchFileName, "rb");
+	if (fp == nullptr)
+		return Error(ZipLoadStatus::PatchFileError, "Error opening delta patch file \"%s\"", patchFileName);
+	std::unique_ptr<FILE, int(*)(FILE*)> fpHolder(fp, fclose);
+	long fileLen = -1;
+	if (fseek(fp, 0, SEEK_END) == 0)
+		fileLen = ftell(fp);
+	if (fileLen < 0 || fseek(fp, 0, SEEK_SET) != 0)
+		return Error(ZipLoadStatus::PatchFileError, "Error reading delta patch file \"%s\"", patchFileName);
+	std::unique_ptr<uint8_t[]> buf(new uint8_t[fileLen + 1]);
+	if (fread(buf.get(), 1, fileLen, fp) != static_cast<size_t>(fileLen))
+		return Error(ZipLoadStatus::PatchFileError, "Error reading delta patch file \"%s\"", patchFileName);
+	fpHolder.reset();
+
+	// set up the read pointer, and a helper to check for enough bytes
+	// remaining in the file to read the next item
+	const uint8_t *p = buf.get();
+	const uint8_t *endp = p + fileLen;
+	auto Avail = [&p, endp](size_t n) { return static_cast<size_t>(endp - p) >= n; };
+	auto Corrupted = [&Error, patchFileName]() {
+		return Error(ZipLoadStatus::PatchFileError, "Delta patch file \"%s\" is truncated or corrupted", patchFileName);
+	};
+
+	// check the header
+	if (!Avail(DeltaPatchFormat::signatureLen + 4)
+		|| memcmp(p, DeltaPatchFormat::signature, DeltaPatchFormat::signatureLen) != 0)
+		return Error(ZipLoadStatus::PatchFileError, "\"%s\" is not a DCS delta patch file", patchFileName);
+	p += DeltaPatchFormat::signatureLen;
+	if (uint16_t ver = ReadU16(p); ver != DeltaPatchFormat::version)
+		return Error(ZipLoadStatus::PatchFileError, "Delta patch file \"%s\" uses an unsupported format version (%d)", patchFileName, ver);
+	int nBase = p[2];
+	int nNew = p[3];
+	p += 4;
+
+	// Match the original chips listed in the patch to the loaded ROM
+	// images.  Each one has to be present with the same contents that
+	// the patch was made against, since the patch copies blocks out of
+	// them by offset.
+	std::vector<const ZipFileData*> base;
+	for (int i = 0 ; i < nBase ; ++i)
+	{
+		if (!Avail(9))
+			return Corrupted();
+		int chipNum = p[0];
+		uint32_t size = ReadU32(p + 1);
+		uint32_t crc = ReadU32(p + 5);
+		p += 9;
+
+		const ZipFileData *rd = nullptr;
+		for (auto &r : romData)
+		{
+			if (r.chipNum == chipNum)
+			{
+				rd = &r;
+				break;
+			}
+		}
+		if (rd == nullptr)
+			return Error(ZipLoadStatus::PatchMismatch, "The delta patch requires ROM U%d, which isn't in the loaded ROM set", chipNum);
+		if (rd->dataSize != size || mz_crc32(MZ_CRC32_INIT, rd->data.get(), rd->dataSize) != crc)
+		{
+			return Error(ZipLoadStatus::PatchMismatch, "ROM U%d (%s) isn't the same version that the delta patch was made from",
+				chipNum, rd->filename.c_str());
+		}
+		base.push_back(rd);
+	}
+
+	// Build the new chips.  We build these in a private list, so that
+	// the caller's ROM set is left untouched if anything goes wrong.
+	std::list<ZipFileData> newData;
+	for (int i = 0 ; i < nNew ; ++i)
+	{
+		// read the chip header
+		if (!Avail(2))
+			return Corrupted();
+		int chipNum = p[0];
+		size_t nameLen = p[1];
+		p += 2;
+		if (!Avail(nameLen + 8) || chipNum < 2 || chipNum > 9)
+			return Corrupted();
+		std::string name(reinterpret_cast<const char*>(p), nameLen);
+		p += nameLen;
+		uint32_t size = ReadU32(p);
+		uint32_t crc = ReadU32(p + 4);
+		p += 8;
+
+		// the DCS boards can't address more than 16MB of ROM
+		if (size == 0 || size > 16*1024*1024)
+			return Corrupted();
+
+		// run the build operations
+		auto &nd = newData.emplace_back(name.c_str(), size);
+		uint8_t *dst = nd.data.get();
+		size_t pos = 0;
+		for (bool done = false ; !done ; )
+		{
+			if (!Avail(1))
+				return Corrupted();
+
+			uint32_t len = 0;
+			switch (*p++)
+			{
+			case DeltaPatchFormat::End:
+				done = true;
+				break;
+
+			case DeltaPatchFormat::Copy:
+				{
+					if (!Avail(9))
+						return Corrupted();
+					size_t idx = p[0];
+					uint32_t ofs = ReadU32(p + 1);
+					len = ReadU32(p + 5);
+					p += 9;
+					if (idx >= base.size() || ofs > base[idx]->dataSize || len > base[idx]->dataSize - ofs || len > size - pos)
+						return Corrupted();
+					memcpy(dst + pos, base[idx]->data.get() + ofs, len);
+				}
+				break;
+
+			case DeltaPatchFormat::Insert:
+				if (!Avail(4))
+					return Corrupted();
+				len = ReadU32(p);
+				p += 4;
+				if (len > size - pos || !Avail(len))
+					return Corrupted();
+				memcpy(dst + pos, p, len);
+				p += len;
+				break;
+
+			case DeltaPatchFormat::Fill:
+				if (!Avail(5))
+					return Corrupted();
+				len = ReadU32(p);
+				if (len > size - pos)
+					return Corrupted();
+				memset(dst + pos, p[4], len);
+				p += 5;
+				break;
+
+			default:
+				return Corrupted();
+			}
+			pos += len;
+		}
+
+		// the operations must fill the chip exactly, and the result has
+		// to match the checksum of the chip the patch was made from
+		if (pos != size)
+			return Corrupted();
+		if (mz_crc32(MZ_CRC32_INIT, dst, size) != crc)
+			return Error(ZipLoadStatus::PatchMismatch, "The patched image for ROM U%d doesn't match the checksum recorded in the delta patch", chipNum);
+
+		nd.chipNum = chipNum;
+	}
+
+	// The new chips replace the entire original set of sound ROMs, so
+	// unload all of the original chips, including any that the new set
+	// doesn't have a counterpart for.
+	for (auto &rd : romData)
+	{
+		if (rd.chipNum >= 2)
+			rd.chipNum = -1;
+	}
+	for (auto &r : ROM)
+		r = ROMInfo();
+	ROMBankPtr = nullptr;
+
+	// load the new chips, and hand their data over to the caller
+	for (auto &nd : newData)
+		AddROM(nd.chipNum, nd.data.get(), nd.dataSize);
+	romData.splice(romData.end(), newData);
+
+	// success
+	return ZipLoadStatus::Success;
+}
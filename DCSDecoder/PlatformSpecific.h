@@ -13,3 +13,22 @@
 #define _countof(array) (sizeof(array)/sizeof((array)[0]))
 #endif
 
+// Case-insensitive string comparison.  MSVC calls this _stricmp; the
+// POSIX equivalent is strcasecmp.
+#if !defined(_MSC_VER)
+#include <strings.h>
+#define _stricmp strcasecmp
+#endif
+
+// Bounded string copy into a fixed-size array.  This is the template form
+// of the MSVC "secure" strcpy_s(), which infers the buffer size from the
+// array type; other compilers don't provide it, so supply an equivalent.
+#if !defined(_MSC_VER)
+#include <stdio.h>
+template<size_t N> inline int strcpy_s(char (&dst)[N], const char *src)
+{
+	snprintf(dst, N, "%s", src);
+	return 0;
+}
+#endif
+
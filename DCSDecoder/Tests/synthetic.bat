@@ -0,0 +1,35 @@
+@echo off
+
+pushd %~dp0
+
+set encoderexe=..\..\Release\DCSEncoder
+set progexe=..\..\Release\DCSExplorer
+
+if not exist %encoderexe%.exe (
+    echo This script runs against the x86 Release builds of %encoderexe%.exe
+    echo and %progexe%.exe.  Please run the Visual Studio build, selecting
+    echo configuration x86 Release before building.
+    popd
+    exit /b
+)
+
+if not exist synthetic\roms mkdir synthetic\roms
+del /q synthetic\roms\*.zip synthetic\roms\*.log
+
+for %%i in (
+   93a
+   93b
+   94
+   95
+) do (
+  echo *** Building synthetic ROM: OS%%i
+  %encoderexe% -q -o synthetic\roms\synth_%%i.zip synthetic:%%i synthetic\synth-tones.txt > synthetic\roms\synth_%%i.log
+  if errorlevel 1 (
+     echo Build failed - see synthetic\roms\synth_%%i.log
+  ) else (
+     %progexe% --vol=220 --autoplay --silent --terse synthetic\roms\synth_%%i
+  )
+  echo.
+)
+
+popd
@@ -0,0 +1,45 @@
+@echo off
+
+pushd %~dp0
+
+set encoderexe=..\..\Release\DCSEncoder
+set progexe=..\..\Release\DCSExplorer
+
+if not exist %encoderexe%.exe (
+    echo This script runs against the x86 Release builds of %encoderexe%.exe
+    echo and %progexe%.exe.  Please run the Visual Studio build, selecting
+    echo configuration x86 Release before building.
+    popd
+    exit /b
+)
+
+if not exist synthetic\roms mkdir synthetic\roms
+if not exist synthetic\roms\opt mkdir synthetic\roms\opt
+if not exist synthetic\roms\raw mkdir synthetic\roms\raw
+del /q synthetic\roms\opt\*.* synthetic\roms\raw\*.*
+
+set failed=0
+for %%i in (
+   93a
+   93b
+   94
+   95
+) do (
+  echo *** Building optimized and unoptimized ROMs: OS%%i
+  %encoderexe% -o synthetic\roms\opt\programs_%%i.zip synthetic:%%i synthetic\synth-programs.txt > synthetic\roms\opt\programs_%%i.log
+  %encoderexe% --no-optimize -o synthetic\roms\raw\programs_%%i.zip synthetic:%%i synthetic\synth-programs.txt > synthetic\roms\raw\programs_%%i.log
+  %progexe% --silent --terse --extract-tracks=synthetic\roms\opt\%%i_ synthetic\roms\opt\programs_%%i
+  %progexe% --silent --terse --extract-tracks=synthetic\roms\raw\%%i_ synthetic\roms\raw\programs_%%i
+  for %%f in (synthetic\roms\opt\%%i_*.wav) do (
+    fc /b synthetic\roms\opt\%%~nxf synthetic\roms\raw\%%~nxf > nul
+    if errorlevel 1 (
+      echo Mismatch: %%~nxf
+      set failed=1
+    )
+  )
+  echo.
+)
+
+if %failed%==0 (echo All tracks match) else (echo Optimized tracks differ from unoptimized tracks - see above)
+
+popd
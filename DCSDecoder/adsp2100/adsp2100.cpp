@@ -113,6 +113,7 @@
 #include <list>
 #include <unordered_map>
 #include <unordered_set>
+#include "../PlatformSpecific.h"
 #include "adsp2100.h"
 
 
@@ -144,6 +145,7 @@
 **#################################################################################################*/
 
 int	adsp2100_icount = 50000;
+uint64_t adsp2100_total_cycles = 0;
 
 
 /*###################################################################################################
@@ -994,6 +996,11 @@ int adsp2100_execute(int cycles)
 	adsp2100_icount -= adsp2100.interrupt_cycles;
 	adsp2100.interrupt_cycles = 0;
 
+	/* Count the instructions actually executed, for the profiling counter.
+	   We can't figure this from adsp2100_icount afterwards, since TRAP,
+	   IDLE, and busy loops zero the budget to force an early return. */
+	int executed = 0;
+
 	/* core execution loop */
 	do
 	{
@@ -1700,8 +1707,10 @@ int adsp2100_execute(int cycles)
 		}
 
 		adsp2100_icount--;
+		executed++;
 	} while (adsp2100_icount > 0);
 
+	adsp2100_total_cycles += executed;
 	adsp2100_icount -= adsp2100.interrupt_cycles;
 	adsp2100.interrupt_cycles = 0;
 
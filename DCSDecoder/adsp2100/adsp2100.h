@@ -18,6 +18,10 @@
 // instruction cycle execution counter, for metering processor time slices
 extern int adsp2100_icount;
 
+// total instruction cycles executed, over all calls to the execute
+// functions, for profiling
+extern uint64_t adsp2100_total_cycles;
+
 // get the CPU's register file
 adsp2100_Regs& adsp2100_get_regs();
 
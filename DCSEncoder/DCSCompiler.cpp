@@ -27,6 +27,9 @@
 #pragma comment(lib, "dcsdecoder")
 #pragma comment(lib, "miniz")
 
+// tokenizer keyword IDs
+using KW = DCSTokenizer::Keyword;
+
 DCSCompiler::DCSCompiler() : decoder(&decoderHostIfc)
 {
 	// get the local time
@@ -68,6 +71,12 @@ bool DCSCompiler::LoadPrototypeROM(const char *romZipName, bool patchMode, std::
 	if (loadStatus != DCSDecoder::ZipLoadStatus::Success)
 		return false;
 
+	// set up the compiler for the prototype
+	return InitPrototypeROM(romZipName, patchMode, errMsg);
+}
+
+bool DCSCompiler::InitPrototypeROM(const char *romName, bool patchMode, std::string &errMsg)
+{
 	// initialize the decoder
 	decoder.SoftBoot();
 
@@ -181,7 +190,7 @@ bool DCSCompiler::LoadPrototypeROM(const char *romZipName, bool patchMode, std::
 								streamsByProtoAddr.emplace(streamAddr, &stream);
 
 								// store a direct pointer to the stream data in the prototype ROM
-								stream.refName = DCSEncoder::format("%s($%07x)", romZipName, streamAddr);
+								stream.refName = DCSEncoder::format("%s($%07x)", romName, streamAddr);
 								stream.data = streamPtr.p;
 								stream.nBytes = streamInfo.nBytes;
 								stream.nFrames = streamInfo.nFrames;
@@ -235,28 +244,179 @@ bool DCSCompiler::LoadPrototypeROM(const char *romZipName, bool patchMode, std::
 	return true;
 }
 
-DCSCompiler::Stream *DCSCompiler::EncodeFile(Stream *replaces, 
-	const char *symbolicName, const char *filename,
-	const DCSEncoder::CompressionParams &params, 
-	DCSTokenizer &tokenizer)
+bool DCSCompiler::CreateSyntheticPrototypeROM(DCSDecoder::OSVersion osVersion, int nChannels, std::string &errMsg)
 {
-	using ErrorLevel = DCSTokenizer::ErrorLevel;
-	const ErrorLevel EError = ErrorLevel::Error;
-	const ErrorLevel EFatal = ErrorLevel::Fatal;
+	// Figure the U2 layout for the OS version.  The decoder identifies
+	// the hardware platform by the location of the catalog, and the
+	// software version by looking for certain instruction sequences
+	// in the soft-boot program, which starts at $01000 or $02000.
+	uint32_t catalogOfs = 0;
+	uint32_t softBootOfs = 0;
+	const char *verName = nullptr;
+	switch (osVersion)
+	{
+	case DCSDecoder::OSVersion::OS93a:
+		catalogOfs = 0x4000;
+		softBootOfs = 0x1000;
+		verName = "OS93a";
+		break;
 
-	// log a status report
-	auto Status = [&tokenizer](bool pending, const char *msg, ...)
+	case DCSDecoder::OSVersion::OS93b:
+		catalogOfs = 0x3000;
+		softBootOfs = 0x1000;
+		verName = "OS93b";
+		break;
+
+	case DCSDecoder::OSVersion::OS94:
+		catalogOfs = 0x4000;
+		softBootOfs = 0x1000;
+		verName = "OS94";
+		break;
+
+	case DCSDecoder::OSVersion::OS95:
+		catalogOfs = 0x6000;
+		softBootOfs = 0x2000;
+		verName = "OS95";
+		break;
+
+	default:
+		errMsg = "Invalid OS version for a synthetic prototype ROM";
+		return false;
+	}
+
+	// apply the default channel count, and validate it
+	bool isOS93 = (osVersion == DCSDecoder::OSVersion::OS93a || osVersion == DCSDecoder::OSVersion::OS93b);
+	if (nChannels == 0)
+		nChannels = isOS93 ? 4 : 6;
+	if (nChannels < 1 || nChannels > 8)
 	{
-		// format the message arguments
-		va_list va;
-		va_start(va, msg);
-		auto fmt = DCSEncoder::vformat(msg, va);
-		va_end(va);
+		errMsg = "Invalid channel count for a synthetic prototype ROM (must be 1 to 8)";
+		return false;
+	}
 
-		// log it
-		tokenizer.logger.Status(fmt.c_str(), pending);
+	// Create the U2 image.  This only has to be big enough to hold the
+	// catalog, since GenerateROM() only copies the prototype up to that
+	// point.  The size must be a multiple of 4K, since the catalog stores
+	// it in 4K units.  Fill it with $FF bytes, as in unused areas of the
+	// original ROMs.
+	const size_t u2Size = 0x8000;
+	auto &u2 = protoZipData.emplace_back("synthetic_u2.rom", u2Size);
+	u2.chipNum = 2;
+	uint8_t *rom = u2.data.get();
+	memset(rom, 0xFF, u2Size);
+
+	// Write ADSP-2105 instructions.  Opcodes are stored in the ROM as
+	// 24-bit big-endian values in 4-byte units, with $FF in the fourth byte.
+	auto WriteOps = [rom](uint32_t ofs, std::initializer_list<uint32_t> ops)
+	{
+		for (auto op : ops)
+		{
+			rom[ofs++] = static_cast<uint8_t>((op >> 16) & 0xFF);
+			rom[ofs++] = static_cast<uint8_t>((op >> 8) & 0xFF);
+			rom[ofs++] = static_cast<uint8_t>(op & 0xFF);
+			rom[ofs++] = 0xFF;
+		}
 	};
 
+	// Write big-endian integers
+	auto WriteU16 = [rom](uint32_t ofs, uint16_t val)
+	{
+		rom[ofs] = static_cast<uint8_t>((val >> 8) & 0xFF);
+		rom[ofs+1] = static_cast<uint8_t>(val & 0xFF);
+	};
+	auto WriteU24 = [rom](uint32_t ofs, uint32_t val)
+	{
+		rom[ofs] = static_cast<uint8_t>((val >> 16) & 0xFF);
+		rom[ofs+1] = static_cast<uint8_t>((val >> 8) & 0xFF);
+		rom[ofs+2] = static_cast<uint8_t>(val & 0xFF);
+	};
+
+	// Write the reset vector and the soft-boot entrypoint.  These must
+	// be JUMP instructions ($18xxxF), since the ROM loader and decoder
+	// use them to recognize U2 and the soft-boot program location.
+	// There's no real program to jump to, so make each one a JUMP to
+	// itself, which at least parks the processor harmlessly if anything
+	// tries to execute the code.
+	WriteOps(0x0000, { 0x18000F });
+	WriteOps(softBootOfs, { 0x18000F });
+
+	// Write the signature string, which always starts at offset 4
+	std::string sig = DCSEncoder::format("Synthetic DCS Test ROM (%s) %s", verName, shortDateStr);
+	memcpy(&rom[4], sig.c_str(), sig.size() + 1);
+
+	// Write the version identification sequences.  OS93 (a and b) is
+	// identified by a sequence in the $01000 program segment, and OS93a
+	// by an additional sequence in the $02000 segment.  See CheckROMs().
+	if (isOS93)
+		WriteOps(0x1000 + 0x0100*4, { 0x380026, 0x3C1005, 0x0C00C0 });
+	if (osVersion == DCSDecoder::OSVersion::OS93a)
+		WriteOps(0x2000 + 0x0200*4, { 0x47FFF2, 0x47C946 });
+
+	// OS95 has a version number query handler, which we'll label as 1.05
+	if (osVersion == DCSDecoder::OSVersion::OS95)
+	{
+		WriteOps(0x2000 + 0x0300*4, {
+			0x40105E, 0x0F16F8, 0x93300E, 0x18000F,
+			0x40105E, 0x0F1608, 0x0F16F8, 0x93300E, 0x18000F });
+	}
+
+	// Write the channel loop sequence that GetNumChannels() looks for.  The
+	// channel count and channel bit mask are immediate operands.
+	uint32_t channelMask = (1 << nChannels) - 1;
+	WriteOps(softBootOfs + 0x0200*4, {
+		0x22200F, 0x400004 | (static_cast<uint32_t>(nChannels) << 4), 0x26E20F, 0x221800,
+		0x90000A, 0x80000A, 0x400004 | (channelMask << 4), 0x26E20F, 0x180001 });
+
+	// Write the catalog.  The ROM table has a single entry, for U2 itself,
+	// with its size in 4K units, chip select 0, and checksum 0, followed
+	// by the end-of-table marker.
+	WriteU16(catalogOfs + 0, static_cast<uint16_t>(u2Size / 4096));
+	WriteU16(catalogOfs + 2, 0x0000);
+	WriteU16(catalogOfs + 4, 0x0000);
+	WriteU16(catalogOfs + 6, 0x0000);
+
+	// Write the track index pointers and the track count.  There are no
+	// tracks in the prototype, so point both indices just past the header.
+	WriteU24(catalogOfs + 0x40, catalogOfs + 0x48);
+	WriteU24(catalogOfs + 0x43, catalogOfs + 0x48);
+	WriteU16(catalogOfs + 0x46, 0);
+
+	// Set the checksum fixup bytes (in the same place GenerateROM() puts
+	// them) so that the U2 checksum comes out to zero, to match the
+	// catalog.  The checksum is the sum of the even bytes in the high
+	// byte and the sum of the odd bytes in the low byte, each mod 256.
+	const uint32_t fixupOfs = catalogOfs + 0x32;
+	WriteU16(fixupOfs, 0x0000);
+	uint8_t evenSum = 0, oddSum = 0;
+	for (size_t i = 0 ; i < u2Size ; i += 2)
+	{
+		evenSum += rom[i];
+		oddSum += rom[i+1];
+	}
+	rom[fixupOfs] = static_cast<uint8_t>(0x100 - evenSum);
+	rom[fixupOfs+1] = static_cast<uint8_t>(0x100 - oddSum);
+
+	// load it into the decoder, and set up the compiler for the prototype
+	decoder.AddROM(2, rom, u2Size);
+	if (!InitPrototypeROM("synthetic prototype", false, errMsg))
+		return false;
+
+	// make sure that the decoder identified the image the way we intended
+	if (protoRomOSVer != osVersion || numChannels != nChannels)
+	{
+		errMsg = "Internal error: the synthetic prototype ROM wasn't identified as the requested version";
+		return false;
+	}
+
+	// success
+	return true;
+}
+
+DCSCompiler::Stream *DCSCompiler::EncodeFile(Stream *replaces, 
+	const char *symbolicName, const char *filename,
+	const DCSEncoder::CompressionParams &params, 
+	DCSTokenizer &tokenizer)
+{
 	// If the file doesn't exist with the name exactly as given, and the name
 	// is a relative path, search for the file in each stream folder.
 	std::string streamFile = filename;
@@ -276,30 +436,81 @@ DCSCompiler::Stream *DCSCompiler::EncodeFile(Stream *replaces,
 		}
 	}
 
+	// DCS-encode the audio file
+	return EncodeStream(replaces, symbolicName, streamFile.c_str(), params, tokenizer,
+		[this, &streamFile](DCSEncoder::DCSAudio &dcsObj, std::string &errMsg, DCSEncoder::OpenStreamStatus *status) {
+			return encoder.EncodeFile(streamFile.c_str(), dcsObj, errMsg, status); });
+}
+
+DCSCompiler::Stream *DCSCompiler::EncodeSignal(Stream *replaces, 
+	const char *symbolicName, const DCSEncoder::SignalParams &signal,
+	const DCSEncoder::CompressionParams &params, 
+	DCSTokenizer &tokenizer)
+{
+	// describe the signal, for the stream name and progress reports
+	static const char *waveName[] ={ "sine", "square", "sawtooth", "sweep", "noise", "silence" };
+	using Wave = DCSEncoder::SignalParams::Wave;
+	std::string desc = DCSEncoder::format("synth %s", waveName[static_cast<int>(signal.wave)]);
+	if (signal.wave == Wave::Sweep)
+		desc += DCSEncoder::format(" %.0f-%.0f Hz", signal.freq, signal.freq2);
+	else if (signal.wave != Wave::Noise && signal.wave != Wave::Silence)
+		desc += DCSEncoder::format(" %.0f Hz", signal.freq);
+	desc += DCSEncoder::format(" %.2f sec", signal.duration);
+
+	// Generate and encode the signal.  The signal encoder doesn't report
+	// a status code, so any failure counts as a generic error.
+	return EncodeStream(replaces, symbolicName, desc.c_str(), params, tokenizer,
+		[this, &signal](DCSEncoder::DCSAudio &dcsObj, std::string &errMsg, DCSEncoder::OpenStreamStatus *status) {
+			*status = DCSEncoder::OpenStreamStatus::Error;
+			return encoder.EncodeSignal(signal, dcsObj, errMsg); });
+}
+
+DCSCompiler::Stream *DCSCompiler::EncodeStream(Stream *replaces, 
+	const char *symbolicName, const char *sourceName,
+	const DCSEncoder::CompressionParams &params, DCSTokenizer &tokenizer,
+	std::function<bool(DCSEncoder::DCSAudio&, std::string&, DCSEncoder::OpenStreamStatus*)> encode)
+{
+	using ErrorLevel = DCSTokenizer::ErrorLevel;
+	const ErrorLevel EError = ErrorLevel::Error;
+	const ErrorLevel EFatal = ErrorLevel::Fatal;
+
+	// log a status report
+	auto Status = [&tokenizer](bool pending, const char *msg, ...)
+	{
+		// format the message arguments
+		va_list va;
+		va_start(va, msg);
+		auto fmt = DCSEncoder::vformat(msg, va);
+		va_end(va);
+
+		// log it
+		tokenizer.logger.Status(fmt.c_str(), pending);
+	};
+
 	// establish the new encoding parameters
 	encoder.compressionParams = params;
 
 	// log progress
-	Status(true, "Encoding %s", streamFile.c_str());
+	Status(true, "Encoding %s", sourceName);
 
-	// DCS-encode the audio file
+	// DCS-encode the source
 	DCSEncoder::DCSAudio dcsObj;
 	std::string encodingErrMsg;
 	DCSEncoder::OpenStreamStatus status;
-	if (encoder.EncodeFile(streamFile.c_str(), dcsObj, encodingErrMsg, &status))
+	if (encode(dcsObj, encodingErrMsg, &status))
 	{
 		// Success.  If we're replacing an existing stream, simply
 		// reuse that stream object, overwrite its existing stream data.
 		// Otherwise, create a new stream object
-		Stream *stream = replaces != nullptr ? replaces : &streams.emplace_back(streamFile.c_str());
+		Stream *stream = replaces != nullptr ? replaces : &streams.emplace_back(sourceName);
 
 		// set the filename, and forget any prototype address (in case we're
 		// replacing a prototype stream)
 		if (symbolicName != nullptr)
-			stream->refName = DCSEncoder::format("%s(%s)", symbolicName, streamFile.c_str());
+			stream->refName = DCSEncoder::format("%s(%s)", symbolicName, sourceName);
 		else
-			stream->refName = streamFile;
-		stream->filename = streamFile;
+			stream->refName = sourceName;
+		stream->filename = sourceName;
 		stream->protoAddr = 0;
 
 		// hand ownership of the new DCS object to the new stream entry
@@ -403,10 +614,10 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 			break;
 
 		// see what we have
-		if (tok.IsKeyword("signature"))
+		if (tok.IsKeyword(KW::Signature))
 		{
 			// get the signature string
-			std::string sigTok = tokenizer.ReadString().text;
+			std::string sigTok = tokenizer.ReadString().Str();
 
 			// expand date strings
 			sigTok = std::regex_replace(sigTok, std::regex("<date>"), dateStr);
@@ -449,30 +660,45 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 			// end the statement
 			tokenizer.EndStatement();
 		}
-		else if (tok.IsKeyword("default"))
+		else if (tok.IsKeyword(KW::Default))
 		{
 			// Set the default encoding parameters:
 			// 
 			//   default encoding parameters ( name=value, ... );
 			//
-			if (tokenizer.RequireSymbol("encoding") 
-				&& tokenizer.RequireSymbol("parameters")
+			if (tokenizer.RequireSymbol(KW::Encoding) 
+				&& tokenizer.RequireSymbol(KW::Parameters)
 				&& tokenizer.RequirePunct("("))
 				ParseCompressionParams(tokenizer, defaultCompressionParams);
 
 			// end of statement
 			tokenizer.EndStatement();
 		}
-		else if (tok.IsKeyword("stream"))
+		else if (tok.IsKeyword(KW::Stream))
 		{
 			// stream <symbolic-stream-name> "sound-file-name" [replaces <address>] (param=value ...) ;
-			std::string streamName = tokenizer.ReadSymbol().text;
-			std::string streamFile = tokenizer.ReadString().text;
+			// stream <symbolic-stream-name> synth(param=value ...) [replaces <address>] (param=value ...) ;
+			std::string streamName = tokenizer.ReadSymbol().Str();
+			std::string streamFile;
+			bool isSynth = false;
+			DCSEncoder::SignalParams signal;
+			if (tokenizer.CheckKeyword(KW::Synth))
+			{
+				// synthetic signal - parse the signal parameters
+				isSynth = true;
+				if (tokenizer.RequirePunct("("))
+					ParseSignalParams(tokenizer, signal);
+			}
+			else
+			{
+				// audio file
+				streamFile = tokenizer.ReadString().text;
+			}
 
 			// check for a 'replaces' clause
 			Stream *replaces = nullptr;
 			uint32_t replacesAddr = 0;
-			if (tokenizer.CheckKeyword("replaces"))
+			if (tokenizer.CheckKeyword(KW::Replaces))
 			{
 				// skip 'replaces' and read the original stream address
 				replacesAddr = static_cast<uint32_t>(tokenizer.ReadInt().ival);
@@ -512,8 +738,10 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 			if (auto it = streamsByName.find(key); it != streamsByName.end())
 				tokenizer.Error(EError, "Stream '%s' has already been defined", streamName.c_str());
 
-			// encode the file
-			Stream *stream = EncodeFile(replaces, streamName.c_str(), streamFile.c_str(), curParams, tokenizer);
+			// encode the file or signal
+			Stream *stream = isSynth ?
+				EncodeSignal(replaces, streamName.c_str(), signal, curParams, tokenizer) :
+				EncodeFile(replaces, streamName.c_str(), streamFile.c_str(), curParams, tokenizer);
 			if (stream != nullptr)
 			{
 				// add it to the by-scripting-name map
@@ -523,7 +751,7 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 			// end the statement
 			tokenizer.EndStatement();
 		}
-		else if (tok.IsKeyword("var"))
+		else if (tok.IsKeyword(KW::Var))
 		{
 			// Variable name definition(s)
 			// 
@@ -531,7 +759,7 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 			do
 			{
 				// get the name
-				std::string name = tokenizer.ReadSymbol().text;
+				std::string name = tokenizer.ReadSymbol().Str();
 
 				// make sure the name isn't already taken
 				if (FindVariable(name.c_str()) != nullptr)
@@ -617,18 +845,18 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 			// end the statement
 			tokenizer.EndStatement();
 		}
-		else if (tok.IsKeyword("deferred"))
+		else if (tok.IsKeyword(KW::Deferred))
 		{
 			// Deferred indirect table definition:
 			//
 			//  deferred indirect table <name> [=<index>] { <trackNum>, ... } ;
-			if (tokenizer.RequireSymbol("indirect") && tokenizer.RequireSymbol("table"))
+			if (tokenizer.RequireSymbol(KW::Indirect) && tokenizer.RequireSymbol(KW::Table))
 			{
 				if (auto nameTok = tokenizer.ReadSymbol(); nameTok.type == DCSTokenizer::TokType::Symbol)
 				{
 					// make sure the table name isn't a repeat
-					if (FindDITable(nameTok.text.c_str()) != nullptr)
-						tokenizer.Error(EError, "Deferred indirect table '%s' has already been defined", nameTok.text.c_str());
+					if (FindDITable(nameTok.Str().c_str()) != nullptr)
+						tokenizer.Error(EError, "Deferred indirect table '%s' has already been defined", nameTok.Str().c_str());
 
 					// check for a table index
 					int index = -1;
@@ -675,12 +903,12 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 						else
 						{
 							// the slot is empty - create a new table
-							table = new DeferredIndirectTable(nameTok.text.c_str(), index);
+							table = new DeferredIndirectTable(nameTok.Str().c_str(), index);
 							diByNumber[index].reset(table);
 
 							// add it to the name index, using the upper-case name as the key,
 							// for case-insensitive lookup
-							std::string key = nameTok.text;
+							std::string key = nameTok.Str();
 							std::transform(key.begin(), key.end(), key.begin(), ::toupper);
 							deferredIndirectTables.emplace(key, table);
 						}
@@ -714,11 +942,11 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 			// end the statement
 			tokenizer.EndStatement();
 		}
-		else if (tok.IsKeyword("track"))
+		else if (tok.IsKeyword(KW::Track))
 		{
 			// get the track number and channel number
 			int trackNum = tokenizer.ReadInt().ival;
-			int channel = tokenizer.RequireSymbol("channel") ? tokenizer.ReadInt().ival : 0;
+			int channel = tokenizer.RequireSymbol(KW::Channel) ? tokenizer.ReadInt().ival : 0;
 
 			// it's an error if it's out of range
 			if (channel < 0 || channel > maxChannelNumber)
@@ -768,13 +996,13 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 
 			// check for "defer"
 			auto tok = tokenizer.Read();
-			if (tok.IsKeyword("defer"))
+			if (tok.IsKeyword(KW::Defer))
 			{
 				// defererd or deferred indierct - these track types don't have any program steps
 				track->steps.clear();
 
 				// check for DEFER INDIRECT
-				if (tokenizer.CheckKeyword("indirect"))
+				if (tokenizer.CheckKeyword(KW::Indirect))
 				{
 					// DEFER INDIRECT ( <tableName|id> [ <varName|id> ] )
 					// Track type 3
@@ -786,11 +1014,11 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 						if (tableTok.type == DCSTokenizer::TokType::Symbol)
 						{
 							// deferred indirect table name
-							auto *table = FindDITable(tableTok.text.c_str());
+							auto *table = FindDITable(tableTok.Str().c_str());
 							if (table != nullptr)
 								tableId = table->index;
 							else
-								tokenizer.Error(EError, "Undefined DEFER INDIRECT table '%s'", tableTok.text.c_str());
+								tokenizer.Error(EError, "Undefined DEFER INDIRECT table '%s'", tableTok.Str().c_str());
 						}
 						else if (tableTok.type == DCSTokenizer::TokType::Int)
 						{
@@ -803,7 +1031,7 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 						{
 							tokenizer.Error(EError,
 								"Expected deferred indirect table name or number in DEFER INDIRECT statement, found '%s'",
-								tableTok.text.c_str());
+								tableTok.Str().c_str());
 						}
 
 						// get the [variable] section
@@ -813,10 +1041,10 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 							if (varTok.type == DCSTokenizer::TokType::Symbol)
 							{
 								// variable name
-								if (auto *v = FindVariable(varTok.text.c_str()) ; v != nullptr)
+								if (auto *v = FindVariable(varTok.Str().c_str()) ; v != nullptr)
 									varId = v->id;
 								else
-									tokenizer.Error(EError, "Undefined variable name '%s'", varTok.text.c_str());
+									tokenizer.Error(EError, "Undefined variable name '%s'", varTok.Str().c_str());
 							}
 							else if (tableTok.type == DCSTokenizer::TokType::Int)
 							{
@@ -829,7 +1057,7 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 							{
 								tokenizer.Error(EError,
 									"Expected deferred indirect variable name or number in DEFER INDIRECT statement, found '%s'",
-									varTok.text.c_str());
+									varTok.Str().c_str());
 							}
 
 							// end the [variable] section
@@ -955,15 +1183,16 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 								*pNumTok = numTok;
 
 							// handle time-based units
-							auto ParseUnit = [&tokenizer, &numTok, EError, EWarning](const char *unit, float msValue, int64_t &result)
+							auto ParseUnit = [&tokenizer, &numTok, EError, EWarning](KW unitKw, float msValue, int64_t &result)
 							{
 								// match the keyword
-								if (tokenizer.CheckKeyword(unit))
+								if (tokenizer.CheckKeyword(unitKw))
 								{
+									const char *unit = DCSTokenizer::KeywordName(unitKw);
 									// figure the time in 7.68ms DCS frames
 									int64_t t = static_cast<int64_t>(roundf(numTok.fval * msValue / 7.68f));
 									if (numTok.type != DCSTokenizer::TokType::Int && numTok.type != DCSTokenizer::TokType::Float)
-										tokenizer.Error(EError, "Time value \"<n> %s\" must be a number, found '%s'", unit, numTok.text.c_str());
+										tokenizer.Error(EError, "Time value \"<n> %s\" must be a number, found '%s'", unit, numTok.Str().c_str());
 									else if (t < 0)
 										tokenizer.Error(EError, "Invalid negative time value");
 									else if (t == 0)
@@ -981,15 +1210,15 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 
 							// try unit suffixes
 							int64_t result;
-							if (ParseUnit("sec", 1000.0f, result))
+							if (ParseUnit(KW::Sec, 1000.0f, result))
 								return result;
-							else if (ParseUnit("ms", 1.0f, result))
+							else if (ParseUnit(KW::Ms, 1.0f, result))
 								return result;
 
 							// no time units, so it's a frame counter; get the integer value
 							result = numTok.ival;
 							if (numTok.type != DCSTokenizer::TokType::Int)
-								tokenizer.Error(EError, "Time value in frame units must be an integer, found '%s'", numTok.text.c_str());
+								tokenizer.Error(EError, "Time value in frame units must be an integer, found '%s'", numTok.Str().c_str());
 
 							// reject negative frame counts
 							if (result < 0)
@@ -1063,7 +1292,7 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 						};
 
 						// check for a Wait prefix
-						if (tokenizer.CheckKeyword("wait"))
+						if (tokenizer.CheckKeyword(KW::Wait))
 						{
 							// require the '('
 							if (!tokenizer.RequirePunct("("))
@@ -1072,12 +1301,12 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 							// the wait parameter can be "forever", "stream", "stream - <time>", or
 							// a time value
 							int64_t curWait = 0;
-							if (tokenizer.CheckKeyword("forever"))
+							if (tokenizer.CheckKeyword(KW::Forever))
 							{
 								// the magic value 0xFFFF means wait(forever)
 								step->wait = 0xFFFF;
 							}
-							else if (tokenizer.CheckKeyword("stream"))
+							else if (tokenizer.CheckKeyword(KW::Stream))
 							{
 								// Wait for the remaining time on the most recently played stream. 
 								// Conditions of use:
@@ -1216,7 +1445,7 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 						DCSTokenizer::Token opname = tokenizer.ReadSymbol();
 
 						// "Loop" has special syntax
-						if (opname.IsKeyword("loop"))
+						if (opname.IsKeyword(KW::Loop))
 						{
 							// set the opcode
 							step->opcode = 0x0E;
@@ -1369,21 +1598,21 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 							}
 
 							// get a parameter as a symbol
-							const char *GetSym(const char *name, const char *stmt) const
+							std::string GetSym(const char *name, const char *stmt) const
 							{
 								auto &tok = GetTok(name, stmt);
 								if (tok.type != DCSTokenizer::TokType::Invalid && tok.type != DCSTokenizer::TokType::Symbol)
 									tokenizer.Error(EError, "Wrong type for %s parameter in %s statement; expected a name", name, stmt);
-								return tok.text.c_str();
+								return tok.Str();
 							}
 
 							// get a parameter as a string
-							const char *GetStr(const char *name, const char *stmt) const
+							std::string GetStr(const char *name, const char *stmt) const
 							{
 								auto &tok = GetTok(name, stmt);
 								if (tok.type != DCSTokenizer::TokType::Invalid && tok.type != DCSTokenizer::TokType::String)
 									tokenizer.Error(EError, "Wrong type for %s parameter in %s statement; expected a string value", name, stmt);
-								return tok.text.c_str();
+								return tok.Str();
 							}
 
 							// get a parameter as a number
@@ -1471,7 +1700,7 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 
 								// For PLAY("filename"), with the STREAM param name implied,
 								// allow compression parameters in parens after the filename.
-								if (params.params.size() == 0 && opname.IsKeyword("PLAY")
+								if (params.params.size() == 0 && opname.IsKeyword(KW::Play)
 									&& paramName.type == DCSTokenizer::TokType::String
 									&& tokenizer.CheckPunct("("))
 								{
@@ -1494,14 +1723,14 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 								//   SetMixingLevel(STEPS) -> time value
 								//
 								bool valueDone = false;
-								if (opname.IsKeyword("SetMixingLevel") && paramName.IsKeyword("STEPS"))
+								if (opname.IsKeyword(KW::SetMixingLevel) && paramName.IsKeyword(KW::Steps))
 								{
 									// parse a time value
 									DCSTokenizer::Token leadTok;
 									int64_t t = ParseTime(&leadTok);
 
 									// add the parameter and set the time value
-									auto &v = params.Add(paramName.text, leadTok);
+									auto &v = params.Add(paramName.Str(), leadTok);
 									v.timeVal = t;
 
 									// value processed
@@ -1513,12 +1742,12 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 								{
 									// read the parameter value, and add a map entry
 									DCSTokenizer::Token paramVal = tokenizer.Read();
-									params.Add(paramName.text, paramVal);
+									params.Add(paramName.Str(), paramVal);
 
 									// Special case: for a PLAY(STREAM) parameter, we can have a
 									// list of compression parameters in parens when the stream is
 									// specified as a filename string
-									if (opname.IsKeyword("PLAY") && paramName.IsKeyword("STREAM")
+									if (opname.IsKeyword(KW::Play) && paramName.IsKeyword(KW::Stream)
 										&& paramVal.type == DCSTokenizer::TokType::String
 										&& tokenizer.CheckPunct("("))
 									{
@@ -1541,20 +1770,20 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 								{
 									// error
 									auto tok = tokenizer.Read();
-									tokenizer.Error(EError, "Expected ',' or ')' in opcode parameter list, found '%s'", tok.text.c_str());
+									tokenizer.Error(EError, "Expected ',' or ')' in opcode parameter list, found '%s'", tok.Str().c_str());
 									break;
 								}
 							}
 						}
 
 						// set the opcode and operand bytes the code for the program step
-						if (opname.IsKeyword("End"))
+						if (opname.IsKeyword(KW::End))
 						{
 							// end of track
 							hasEndOp = true;
 							step->opcode = 0x00;
 						}
-						else if (opname.IsKeyword("Play"))
+						else if (opname.IsKeyword(KW::Play))
 						{
 							// Play(channel <channel>, stream <stream>, repeat <count>) - load and play an audio stream
 							params.SetDefaultParam("STREAM");
@@ -1584,7 +1813,7 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 								// references.  If we've already loaded the stream, we can get
 								// its Stream object directly; otherwise we have to keep the
 								// reference in the form of a name until later.
-								if (Stream *stream = FindStream(streamTok.text.c_str()) ; stream != nullptr)
+								if (Stream *stream = FindStream(streamTok.Str().c_str()) ; stream != nullptr)
 								{
 									// it's already defined - set the direct stream reference
 									step->stream = stream;
@@ -1626,7 +1855,7 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 								// Encode the stream and store the result in the program step.  This
 								// type of stream has no name, so there's no need to add a name map
 								// entry for it - it's only reachable from this script step.
-								step->stream = EncodeFile(nullptr, nullptr, streamTok.text.c_str(),
+								step->stream = EncodeFile(nullptr, nullptr, streamTok.Str().c_str(),
 									compressionParams, tokenizer);
 
 								// set the stream time
@@ -1638,7 +1867,7 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 								tokenizer.Error(EError, "Invalid STREAM parameter value '%s' in Play statement; "
 									"the stream must be specified as a stream name, a numeric stream address for "
 									"a stream imported from the prototype file (only for --patch mode), or the name "
-									"of an external audio file to encode as the stream contents", streamTok.text.c_str());
+									"of an external audio file to encode as the stream contents", streamTok.Str().c_str());
 							}
 
 							// Encode the instruction.  Use zero as placeholder for the 
@@ -1650,7 +1879,7 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 							step->AddOpPtr(0);
 							step->AddOpByte(repeat);
 						}
-						else if (opname.IsKeyword("Stop"))
+						else if (opname.IsKeyword(KW::Stop))
 						{
 							// Stop(channel <channel>)
 							params.SetDefaultParam("CHANNEL");
@@ -1699,7 +1928,7 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 								step->AddOpByte(targetChannel);
 							}
 						}
-						else if (opname.IsKeyword("Queue"))
+						else if (opname.IsKeyword(KW::Queue))
 						{
 							// Queue(track <trackNum>)
 							params.SetDefaultParam("TRACK");
@@ -1710,7 +1939,7 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 							step->opcode = 0x03;
 							step->AddOpWord(track);
 						}
-						else if (opname.IsKeyword("WriteDataPort"))
+						else if (opname.IsKeyword(KW::WriteDataPort))
 						{
 							// WriteDataPort(byte <val>)
 							params.SetDefaultParam("BYTE");
@@ -1744,11 +1973,11 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 								}
 							}
 						}
-						else if (opname.IsKeyword("SetChannelTimer"))
+						else if (opname.IsKeyword(KW::SetChannelTimer))
 						{
 							// SetTimer(byte <val>, counter <count>)
 							params.SetDefaultParam("BYTE");
-							params.Check("SetChannelTimer", "BYTE", "INTERVAL");
+							params.Check("SetChannelTimer", "BYTE", "INTERVAL", nullptr);
 							int b = params.GetUInt8("BYTE", "SetChannelTimer");
 							int interval = params.Has("INTERVAL") ? params.GetUInt16("INTERVAL", "SetChannelTimer") : 0;
 
@@ -1765,7 +1994,7 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 									"OS versions is WriteDataPort()");
 							}
 						}
-						else if (opname.IsKeyword("StartDeferred"))
+						else if (opname.IsKeyword(KW::StartDeferred))
 						{
 							// trigger a deferred command on a channel
 							params.SetDefaultParam("CHANNEL");
@@ -1776,7 +2005,7 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 							step->opcode = 0x05;
 							step->AddOpByte(targetChannel);
 						}
-						else if (opname.IsKeyword("SetVariable"))
+						else if (opname.IsKeyword(KW::SetVariable))
 						{
 							// SetVariable(var <name|number>, value <byteval>)
 							params.Check("SetVariable", "VAR", "VALUE", nullptr);
@@ -1790,12 +2019,12 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 							if (varTok.type == DCSTokenizer::TokType::Symbol)
 							{
 								// look up the variable
-								if (auto *v = FindVariable(varTok.text.c_str()); v != nullptr)
+								if (auto *v = FindVariable(varTok.Str().c_str()); v != nullptr)
 									varIndex = v->id;
 								else
 									tokenizer.Error(EError, "Undefined variable name '%s' used in SetVariable VAR parameter "
 										"; variables must be defined before use with VAR <name> statements in global scope",
-										varTok.text.c_str());
+										varTok.Str().c_str());
 							}
 							else if (varTok.type == DCSTokenizer::TokType::Int)
 							{
@@ -1812,7 +2041,7 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 							{
 								tokenizer.Error(EError,
 									"SetVariable VAR parameter must be a variable name or numeric index, found '%s'",
-									varTok.text.c_str());
+									varTok.Str().c_str());
 							}
 
 							// encode the instruction
@@ -1841,7 +2070,7 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 								step->refLoc = tokenizer.GetLocation();
 							}
 						}
-						else if (opname.IsKeyword("SetMixingLevel"))
+						else if (opname.IsKeyword(KW::SetMixingLevel))
 						{
 							// SetMixingLevel([channel <channel>], level|increase|decrease <val>, [steps <steps>])
 
@@ -1900,7 +2129,7 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 						else
 						{
 							// invalid opcode name
-							tokenizer.Error(EError, "Invalid track program step command '%s'", opname.text.c_str());
+							tokenizer.Error(EError, "Invalid track program step command '%s'", opname.Str().c_str());
 						}
 
 						// If we have an infinite wait with an opcode other
@@ -1912,7 +2141,7 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 							hasWaitForever = true;
 
 							// warn if anything other than End follows
-							if (!opname.IsKeyword("end") && !opsPastEnd)
+							if (!opname.IsKeyword(KW::End) && !opsPastEnd)
 							{
 								// warn
 								tokenizer.Error(EWarning, "Everything after wait(forever) is unreachable");
@@ -1963,8 +2192,24 @@ void DCSCompiler::ParseScript(const char *filename, DCSTokenizer::ErrorLogger &l
 
 	// Run post-compile checks and fixups: resolve stream name references, check
 	// deferred indirect table reference bounds.
+	std::vector<const Track*> indirectTracks;
+	for (auto &track : tracks)
+	{
+		if (track.second.type == 3)
+			indirectTracks.push_back(&track.second);
+	}
 	for (auto &track : tracks)
-		track.second.ResolveRefs(this, tokenizer);
+		track.second.ResolveRefs(this, tokenizer, indirectTracks);
+
+	// Optimize the track programs defined in the script
+	if (optimizeTracks)
+	{
+		for (auto &track : tracks)
+		{
+			if (!track.second.fromRom && track.second.type == 1)
+				track.second.Optimize(trackOptimizerStats);
+		}
+	}
 }
 
 void DCSCompiler::ParseCompressionParams(DCSTokenizer &tokenizer, DCSEncoder::CompressionParams &params)
@@ -1988,7 +2233,7 @@ void DCSCompiler::ParseCompressionParams(DCSTokenizer &tokenizer, DCSEncoder::Co
 		}
 
 		// Read the name, and convert to upper-case for case-insensitive matching
-		std::string param = tokenizer.ReadSymbol().text;
+		std::string param = tokenizer.ReadSymbol().Str();
 		std::transform(param.begin(), param.end(), param.begin(), ::toupper);
 
 		// Read the value.  Some parameters allow '*' to indicate a special option.
@@ -2062,6 +2307,199 @@ void DCSCompiler::ParseCompressionParams(DCSTokenizer &tokenizer, DCSEncoder::Co
 	}
 }
 
+void DCSCompiler::ParseSignalParams(DCSTokenizer &tokenizer, DCSEncoder::SignalParams &signal)
+{
+	// convenience definitions for the error logger
+	using ErrorLevel = DCSTokenizer::ErrorLevel;
+	const ErrorLevel EError = ErrorLevel::Error;
+	using Wave = DCSEncoder::SignalParams::Wave;
+
+	// keep going until we reach the ")"
+	while (!tokenizer.CheckPunct(")"))
+	{
+		// if we're at a ';', assume the ')' was missing
+		auto save = tokenizer.Save();
+		if (tokenizer.CheckPunct(";"))
+		{
+			tokenizer.Restore(save);
+			tokenizer.Error(EError, "Found ';' within a SYNTH parameter list; check for a missing ')' at the end of the parameters");
+			return;
+		}
+
+		// Read the name, and convert to upper-case for case-insensitive matching
+		std::string param = tokenizer.ReadSymbol().Str();
+		std::transform(param.begin(), param.end(), param.begin(), ::toupper);
+		tokenizer.RequirePunct("=");
+
+		// apply the parameter
+		if (param == "WAVE")
+		{
+			// the value is a waveform name
+			auto tok = tokenizer.ReadSymbol();
+			if (tok.IsKeyword(KW::Sine))
+				signal.wave = Wave::Sine;
+			else if (tok.IsKeyword(KW::Square))
+				signal.wave = Wave::Square;
+			else if (tok.IsKeyword(KW::Sawtooth))
+				signal.wave = Wave::Sawtooth;
+			else if (tok.IsKeyword(KW::Sweep))
+				signal.wave = Wave::Sweep;
+			else if (tok.IsKeyword(KW::Noise))
+				signal.wave = Wave::Noise;
+			else if (tok.IsKeyword(KW::Silence))
+				signal.wave = Wave::Silence;
+			else
+				tokenizer.Error(EError, "Invalid WAVE parameter \"%s\"; must be SINE, SQUARE, SAWTOOTH, SWEEP, NOISE, or SILENCE", tok.Str().c_str());
+		}
+		else if (param == "SEED")
+		{
+			// the noise seed is an integer
+			signal.seed = static_cast<uint32_t>(tokenizer.ReadInt().ival);
+		}
+		else
+		{
+			// everything else is numeric
+			float fval = tokenizer.ReadFloat().fval;
+			if (param == "FREQ" || param == "FREQ2")
+			{
+				(param == "FREQ" ? signal.freq : signal.freq2) = fval;
+				if (fval <= 0.0f || fval >= 15625.0f)
+					tokenizer.Error(EError, "Invalid %s parameter; must be above 0 and below 15625 Hz", param.c_str());
+			}
+			else if (param == "TIME")
+			{
+				signal.duration = fval;
+				if (fval <= 0.0f || fval > 600.0f)
+					tokenizer.Error(EError, "Invalid TIME parameter; must be above 0 and at most 600 seconds");
+			}
+			else if (param == "LEVEL")
+			{
+				signal.level = fval / 100.0f;
+				if (fval < 0.0f || fval > 100.0f)
+					tokenizer.Error(EError, "Invalid LEVEL parameter; must be 0.0 to 100.0");
+			}
+			else if (param == "FADE")
+			{
+				signal.fade = fval / 1000.0f;
+				if (fval < 0.0f)
+					tokenizer.Error(EError, "Invalid FADE parameter; must be 0 or more milliseconds");
+			}
+			else
+			{
+				tokenizer.Error(EError, "Invalid SYNTH parameter name \"%s\"", param.c_str());
+			}
+		}
+
+		// check for ',' or ')' - stop looping at ')'
+		if (!tokenizer.CheckPunct(","))
+		{
+			tokenizer.RequirePunct(")");
+			break;
+		}
+	}
+}
+
+// Count the reachable steps at the start of a track program.  Execution
+// can't proceed past an End step, past a step with an infinite wait (which
+// never executes at all), or past the end of an infinite loop, so every
+// step after the first of these is unreachable.  Returns the number of
+// steps up to and including the last reachable one.
+template<class StepList> static size_t ReachableLength(const StepList &steps)
+{
+	size_t n = 0;
+	std::vector<uint8_t> loops;
+	for (auto &s : steps)
+	{
+		++n;
+		if (s.wait == 0xFFFF || s.opcode == 0x00)
+			break;
+
+		if (s.opcode == 0x0E)
+		{
+			// Loop - note the repeat count
+			loops.push_back(s.operandBytes[0]);
+		}
+		else if (s.opcode == 0x0F && loops.size() != 0)
+		{
+			// End Loop - a repeat count of zero loops forever
+			bool infinite = (loops.back() == 0);
+			loops.pop_back();
+			if (infinite)
+				break;
+		}
+	}
+	return n;
+}
+
+void DCSCompiler::FindReachableStreams()
+{
+	// start over with nothing referenced
+	reachabilityStats = ReachabilityStats();
+	for (auto &s : streams)
+		s.referenced = false;
+
+	// Every populated slot in the track index is an entry point, since
+	// the WPC host can command any track number.  The other ways to reach
+	// a track - Queue steps, deferred links, and deferred indirect tables -
+	// can only lead to other slots in the same index, so they don't add
+	// any new roots.  What remains is to find how far execution can get
+	// within each track program, and mark the streams played along the
+	// way.
+	for (auto &t : tracks)
+	{
+		// only Type 1 tracks have programs
+		auto &track = t.second;
+		if (track.type != 1)
+			continue;
+
+		// Trim the unreachable steps from tracks imported from the
+		// prototype ROM.  Tracks from the script have already been through
+		// the optimizer, which does the same thing; if the optimizer is
+		// disabled, the script wants its programs stored as written, so
+		// leave them alone, and count all of their streams as reachable.
+		if (track.fromRom)
+		{
+			size_t n = ReachableLength(track.steps);
+			if (n < track.steps.size())
+			{
+				reachabilityStats.deadStepsRemoved += static_cast<int>(track.steps.size() - n);
+				track.steps.resize(n);
+			}
+
+			// A Play step with an infinite wait never executes, so turn it
+			// into a NOP, to drop its stream reference
+			if (n != 0 && track.steps.back().wait == 0xFFFF && track.steps.back().opcode == 0x01)
+			{
+				auto &last = track.steps.back();
+				last.opcode = 0x0D;
+				last.nOperandBytes = 0;
+				last.stream = nullptr;
+			}
+		}
+
+		// mark the streams played
+		for (auto &step : track.steps)
+		{
+			if (step.opcode == 0x01 && step.stream != nullptr)
+				step.stream->referenced = true;
+		}
+	}
+
+	// tally the prototype streams that we're dropping
+	for (auto &s : streams)
+	{
+		if (s.protoAddr != 0)
+		{
+			reachabilityStats.protoStreams += 1;
+			if (!s.referenced)
+			{
+				reachabilityStats.protoStreamsDropped += 1;
+				reachabilityStats.bytesReclaimed += s.nBytes;
+			}
+		}
+	}
+}
+
 bool DCSCompiler::GenerateROM(const char *outZipFile,
 	uint32_t romSize, const char *romPrefix,
 	std::string &errorMessage, std::list<ROMDesc> *romList)
@@ -2428,6 +2866,15 @@ bool DCSCompiler::GenerateROM(const char *outZipFile,
 		}
 	}
 
+	// Figure which streams the track programs can reach, so that we only
+	// store the streams that can actually be played
+	FindReachableStreams();
+
+	// Track programs placed so far, for sharing identical programs
+	// among track numbers.  Each entry gives the track object and the
+	// ROM image containing its program.
+	std::vector<std::pair<const Track*, const ROMImage*>> placedTracks;
+
 	// Write the track programs, populating the track index as we go
 	for (int trackNum = 0 ; trackNum < nTracks ; ++trackNum)
 	{
@@ -2441,6 +2888,30 @@ bool DCSCompiler::GenerateROM(const char *outZipFile,
 			auto &track = it->second;
 			track.Compile(this);
 
+			// If the optimizer is enabled, and another track number has
+			// an identical program, point this track's index entry at the
+			// existing copy rather than storing the program again.  The
+			// decoder only uses the index to find the track header, so
+			// there's no reason that two index entries can't point to
+			// the same place.  The two programs compile identically even
+			// with the final stream addresses filled in, since they
+			// reference the same stream objects, so the second pass
+			// will just write the same bytes twice.
+			size_t trackSize = 2 + (track.type == 1 ? track.byteCode.size() : 2);
+			if (optimizeTracks)
+			{
+				auto dup = std::find_if(placedTracks.begin(), placedTracks.end(),
+					[&track](const std::pair<const Track*, const ROMImage*> &p) { return track.IsSameProgram(*p.first); });
+				if (dup != placedTracks.end())
+				{
+					track.romImagePtr = dup->first->romImagePtr;
+					WriteROMPtr(pTrackIndex, track.romImagePtr, dup->second);
+					trackOptimizerStats.tracksShared += 1;
+					trackOptimizerStats.bytesSaved += static_cast<int>(trackSize);
+					continue;
+				}
+			}
+
 			// Reserve space for track.  In practice it's almost inconceivable
 			// that the track programs could ever overflow U2, since they're
 			// only on the order of tens of bytes each and there are typically
@@ -2453,7 +2924,6 @@ bool DCSCompiler::GenerateROM(const char *outZipFile,
 			// per entry = 192KB, which is way less than the minimum ROM size
 			// of 512K - and that's only if every possible track were
 			// populated, which is never true anyway).
-			size_t trackSize = 2 + (track.type == 1 ? track.byteCode.size() : 2);
 			if (!Reserve(pRom->p, pRom, trackSize))
 				return false;
 
@@ -2461,6 +2931,7 @@ bool DCSCompiler::GenerateROM(const char *outZipFile,
 			// object, so that we can come back and re-write the byte code
 			// program after resolving all of the stream references
 			track.romImagePtr = pRom->p;
+			placedTracks.emplace_back(&track, pRom);
 
 			// write the index entry to point to the track's reserved location
 			WriteROMPtr(pTrackIndex, pRom->p, pRom);
@@ -2920,10 +3391,243 @@ bool DCSCompiler::GenerateROM(const char *outZipFile,
 			romList->emplace_back(ROMDesc{ r.chipNum, r.filename, r.size, r.BytesFree() });
 	}
 
+	// write the delta patch, if desired
+	if (deltaPatchFile.size() != 0)
+	{
+		std::vector<DeltaPatchROM> patchRoms;
+		for (auto &r : newRoms)
+			patchRoms.emplace_back(DeltaPatchROM{ r.chipNum, r.filename.c_str(), r.data.get(), r.size });
+
+		if (!WriteDeltaPatch(patchRoms, errorMessage))
+			return false;
+	}
+
 	// success
 	return true;
 }
 
+bool DCSCompiler::WriteDeltaPatch(const std::vector<DeltaPatchROM> &roms, std::string &errorMessage)
+{
+	using Format = DCSDecoder::DeltaPatchFormat;
+	deltaPatchStats = DeltaPatchStats();
+
+	// Gather the prototype sound ROM images, in chip order.  These are
+	// the images that the patch copies from, so the loader will insist
+	// on finding exactly the same images when applying the patch.
+	std::vector<const DCSDecoder::ZipFileData*> protoRoms;
+	for (auto &z : protoZipData)
+	{
+		if (z.chipNum >= 2 && z.chipNum <= 9)
+			protoRoms.push_back(&z);
+	}
+	std::sort(protoRoms.begin(), protoRoms.end(), [](const DCSDecoder::ZipFileData *a, const DCSDecoder::ZipFileData *b) {
+		return a->chipNum < b->chipNum; });
+	if (protoRoms.size() == 0)
+	{
+		errorMessage = "A delta patch can only be generated from a prototype ROM set loaded from a file";
+		return false;
+	}
+
+	// Index the prototype images for the match search.  We hash the
+	// 16-byte block at every 4-byte-aligned offset into a direct-mapped
+	// table, keeping the chip index in the high byte of each entry and
+	// the offset in the low 24 bits.  Indexing only the aligned offsets
+	// keeps the table to a manageable size, and still finds every match
+	// long enough to be worth storing as a copy, since any such match
+	// contains at least one whole aligned block.  Collisions simply
+	// overwrite the older entry; that only costs us the occasional match.
+	const size_t blockSize = 16;
+	size_t nBlocks = 0;
+	for (auto z : protoRoms)
+		nBlocks += z->dataSize / 4;
+	int hashBits = 10;
+	while ((static_cast<size_t>(1) << hashBits) < nBlocks)
+		++hashBits;
+	std::vector<uint32_t> hashTable(static_cast<size_t>(1) << hashBits, 0xFFFFFFFF);
+	auto Hash = [hashBits](const uint8_t *p) -> size_t
+	{
+		uint64_t a, b;
+		memcpy(&a, p, 8);
+		memcpy(&b, p + 8, 8);
+		uint64_t h = (a * 0x9E3779B97F4A7C15ULL) ^ (b * 0xC2B2AE3D27D4EB4FULL);
+		h ^= h >> 29;
+		return static_cast<size_t>((h * 0x165667B19E3779F9ULL) >> (64 - hashBits));
+	};
+	for (size_t i = 0 ; i < protoRoms.size() ; ++i)
+	{
+		const uint8_t *p = protoRoms[i]->data.get();
+		for (size_t ofs = 0 ; ofs + blockSize <= protoRoms[i]->dataSize ; ofs += 4)
+			hashTable[Hash(p + ofs)] = static_cast<uint32_t>((i << 24) | ofs);
+	}
+
+	// helpers to write big-endian values to the patch
+	std::vector<uint8_t> out;
+	auto Put8 = [&out](uint32_t val) { out.push_back(static_cast<uint8_t>(val & 0xFF)); };
+	auto Put16 = [&Put8](uint32_t val) { Put8(val >> 8); Put8(val); };
+	auto Put32 = [&Put16](uint32_t val) { Put16(val >> 16); Put16(val); };
+
+	// write the header
+	out.insert(out.end(), Format::signature, Format::signature + Format::signatureLen);
+	Put16(Format::version);
+	Put8(static_cast<uint32_t>(protoRoms.size()));
+	Put8(static_cast<uint32_t>(roms.size()));
+
+	// write the prototype chip list
+	for (auto z : protoRoms)
+	{
+		Put8(z->chipNum);
+		Put32(static_cast<uint32_t>(z->dataSize));
+		Put32(static_cast<uint32_t>(mz_crc32(MZ_CRC32_INIT, z->data.get(), z->dataSize)));
+	}
+
+	// Encode each new chip.  Copies and fills are only worthwhile when
+	// they're long enough to save more than the size of the operation,
+	// so anything shorter is stored literally.
+	const size_t minCopy = blockSize;
+	const size_t minFill = 32;
+	for (auto &rom : roms)
+	{
+		// write the chip header
+		size_t nameLen = std::min<size_t>(strlen(rom.filename), 255);
+		Put8(rom.chipNum);
+		Put8(static_cast<uint32_t>(nameLen));
+		out.insert(out.end(), rom.filename, rom.filename + nameLen);
+		Put32(rom.size);
+		Put32(static_cast<uint32_t>(mz_crc32(MZ_CRC32_INIT, rom.data, rom.size)));
+
+		// write the pending literal bytes, up to the given position
+		const uint8_t *t = rom.data;
+		size_t litStart = 0;
+		auto FlushLiteral = [&](size_t end)
+		{
+			if (end > litStart)
+			{
+				Put8(Format::Insert);
+				Put32(static_cast<uint32_t>(end - litStart));
+				out.insert(out.end(), t + litStart, t + end);
+				deltaPatchStats.insertedBytes += end - litStart;
+			}
+		};
+
+		// Figure the length of the match between the new chip at 'pos' and
+		// a prototype chip at 'ofs'
+		auto MatchLength = [t, &rom, &protoRoms](size_t pos, size_t chip, size_t ofs)
+		{
+			const uint8_t *s = protoRoms[chip]->data.get();
+			size_t maxLen = std::min<size_t>(rom.size - pos, protoRoms[chip]->dataSize - ofs);
+			size_t len = 0;
+			while (len < maxLen && s[ofs + len] == t[pos + len])
+				++len;
+			return len;
+		};
+
+		// Scan the new chip.  New data usually goes in at the same place
+		// as in the prototype, or shifted by the same amount as the last
+		// copy, so we try continuing from the last copy's position before
+		// consulting the hash table.
+		size_t prevChip = 0;
+		int64_t prevDelta = 0;
+		bool havePrev = false;
+		for (size_t pos = 0 ; pos < rom.size ; )
+		{
+			// find the best copy candidate
+			size_t bestLen = 0, bestChip = 0, bestOfs = 0;
+			if (havePrev)
+			{
+				int64_t ofs = static_cast<int64_t>(pos) + prevDelta;
+				if (ofs >= 0 && static_cast<size_t>(ofs) < protoRoms[prevChip]->dataSize)
+				{
+					bestLen = MatchLength(pos, prevChip, static_cast<size_t>(ofs));
+					bestChip = prevChip;
+					bestOfs = static_cast<size_t>(ofs);
+				}
+			}
+			if (bestLen < minCopy && pos + blockSize <= rom.size)
+			{
+				if (uint32_t entry = hashTable[Hash(t + pos)]; entry != 0xFFFFFFFF)
+				{
+					size_t chip = entry >> 24;
+					size_t ofs = entry & 0x00FFFFFF;
+					if (size_t len = MatchLength(pos, chip, ofs); len > bestLen)
+					{
+						bestLen = len;
+						bestChip = chip;
+						bestOfs = ofs;
+					}
+				}
+			}
+
+			// measure the run of identical bytes starting here
+			size_t run = 1;
+			while (pos + run < rom.size && t[pos + run] == t[pos])
+				++run;
+
+			if (bestLen >= minCopy && (run < minFill || bestLen >= run))
+			{
+				// extend the match backwards over any pending literal bytes
+				while (pos > litStart && bestOfs > 0 && protoRoms[bestChip]->data.get()[bestOfs - 1] == t[pos - 1])
+					--pos, --bestOfs, ++bestLen;
+
+				// write the copy
+				FlushLiteral(pos);
+				Put8(Format::Copy);
+				Put8(static_cast<uint32_t>(bestChip));
+				Put32(static_cast<uint32_t>(bestOfs));
+				Put32(static_cast<uint32_t>(bestLen));
+				deltaPatchStats.copiedBytes += bestLen;
+
+				// remember the displacement for the next match
+				havePrev = true;
+				prevChip = bestChip;
+				prevDelta = static_cast<int64_t>(bestOfs) - static_cast<int64_t>(pos);
+				pos += bestLen;
+				litStart = pos;
+			}
+			else if (run >= minFill)
+			{
+				// write the fill
+				FlushLiteral(pos);
+				Put8(Format::Fill);
+				Put32(static_cast<uint32_t>(run));
+				Put8(t[pos]);
+				deltaPatchStats.filledBytes += run;
+				pos += run;
+				litStart = pos;
+			}
+			else
+			{
+				// no match - add this byte to the literal run
+				++pos;
+			}
+		}
+
+		// finish the chip
+		FlushLiteral(rom.size);
+		Put8(Format::End);
+		deltaPatchStats.romBytes += rom.size;
+	}
+
+	// write the file
+	const char *filename = deltaPatchFile.c_str();
+	FILE *fp = nullptr;
+	if (fopen_s(&fp, filename, "wb") != 0 || fp == nullptr)
+	{
+		errorMessage = DCSEncoder::format("Unable to open delta patch file %s (system error %d)", filename, errno);
+		return false;
+	}
+	bool ok = fwrite(out.data(), 1, out.size(), fp) == out.size();
+	ok = (fclose(fp) == 0) && ok;
+	if (!ok)
+	{
+		errorMessage = DCSEncoder::format("Error writing delta patch file %s (system error %d)", filename, errno);
+		return false;
+	}
+
+	// success
+	deltaPatchStats.patchSize = out.size();
+	return true;
+}
+
 DCSCompiler::Stream *DCSCompiler::FindStream(const char *name)
 {
 	// get the key, as the name in upper-case, for case-insensitive matching
@@ -3080,9 +3784,6 @@ void DCSCompiler::Track::Compile(DCSCompiler *compiler)
 				step.operandBytes[1] = static_cast<uint8_t>((addr >> 16) & 0xFF);
 				step.operandBytes[2] = static_cast<uint8_t>((addr >> 8) & 0xFF);
 				step.operandBytes[3] = static_cast<uint8_t>(addr & 0xFF);
-
-				// mark the stream as referenced
-				step.stream->referenced = true;
 			}
 			break;
 		}
@@ -3093,7 +3794,231 @@ void DCSCompiler::Track::Compile(DCSCompiler *compiler)
 	}
 }
 
-void DCSCompiler::Track::ResolveRefs(DCSCompiler *compiler, DCSTokenizer &tokenizer)
+void DCSCompiler::Track::Optimize(TrackOptimizerStats &stats)
+{
+	// Work on a vector copy of the steps, for random access.  Each pass
+	// below returns true if it changed anything; we keep running the
+	// passes until none of them finds anything else to do, since one
+	// simplification often exposes another (a loop that collapses into
+	// a wait can merge with the waits around it, for example).
+	std::vector<ProgramStep> v(steps.begin(), steps.end());
+
+	// figure the byte code size of the program
+	auto ByteCodeSize = [&v]()
+	{
+		int n = 0;
+		for (auto &s : v)
+			n += 3 + s.nOperandBytes;
+		return n;
+	};
+	int oldSteps = static_cast<int>(v.size());
+	int oldSize = ByteCodeSize();
+
+	// turn a step into a NOP, keeping its wait prefix
+	auto MakeNOP = [](ProgramStep &s)
+	{
+		s.opcode = 0x0D;
+		s.nOperandBytes = 0;
+		s.stream = nullptr;
+		s.streamName.clear();
+	};
+
+	// Remove unreachable steps (see ReachableLength()).  A step with an
+	// infinite wait never executes at all, so its opcode doesn't matter;
+	// we make it a NOP to drop any operands.
+	auto RemoveDeadSteps = [&v, &MakeNOP]()
+	{
+		bool changed = false;
+		size_t n = ReachableLength(v);
+		if (n < v.size())
+		{
+			v.erase(v.begin() + n, v.end());
+			changed = true;
+		}
+		if (n != 0 && v[n - 1].wait == 0xFFFF && v[n - 1].nOperandBytes != 0)
+		{
+			MakeNOP(v[n - 1]);
+			changed = true;
+		}
+		return changed;
+	};
+
+	// Fold constant loops.  A loop with a repeat count of 1 runs its body
+	// once, so the Loop and End Loop steps are just NOPs, which the wait
+	// merging pass will absorb.  A finite loop whose body only contains
+	// waits is the same as a single wait of the total time.  (Note that a
+	// repeat count of zero means "forever", not "never", so those loops
+	// stay as they are, as do loops containing an infinite wait.)
+	auto FoldLoops = [&v, &MakeNOP]()
+	{
+		std::vector<size_t> loops;
+		for (size_t i = 0 ; i < v.size() ; ++i)
+		{
+			if (v[i].opcode == 0x0E)
+			{
+				loops.push_back(i);
+			}
+			else if (v[i].opcode == 0x0F && loops.size() != 0)
+			{
+				size_t start = loops.back();
+				loops.pop_back();
+				int count = v[start].operandBytes[0];
+				if (count == 1)
+				{
+					MakeNOP(v[start]);
+					MakeNOP(v[i]);
+					return true;
+				}
+
+				// Check for a body that only waits, figuring the wait per
+				// iteration.  A wait of 0xFFFF means "forever", not a frame
+				// count, so a body or End Loop with an infinite wait can't
+				// be folded into a finite total.
+				bool waitOnly = (v[i].wait != 0xFFFF);
+				int64_t iterTime = v[i].wait;
+				for (size_t j = start + 1 ; j < i && waitOnly ; ++j)
+				{
+					waitOnly = (v[j].opcode == 0x0D && v[j].wait != 0xFFFF);
+					iterTime += v[j].wait;
+				}
+				if (waitOnly && count != 0)
+				{
+					// Replace the body and End Loop with NOPs for the total time,
+					// splitting it into steps of up to 0xFFFE frames as needed, and
+					// turn the Loop step into a NOP carrying the original wait
+					std::vector<ProgramStep> waits;
+					for (int64_t t = iterTime * count ; t > 0 ; t -= 0xFFFE)
+					{
+						auto &w = waits.emplace_back();
+						w.opcode = 0x0D;
+						w.wait = static_cast<uint16_t>(t > 0xFFFE ? 0xFFFE : t);
+					}
+					MakeNOP(v[start]);
+					v.erase(v.begin() + start + 1, v.begin() + i + 1);
+					v.insert(v.begin() + start + 1, waits.begin(), waits.end());
+					return true;
+				}
+			}
+		}
+		return false;
+	};
+
+	// Remove mixing level changes that are overridden within the same
+	// frame.  An immediate absolute level setting (opcode 0x07) replaces
+	// the entire state of its mixing cell, including any fade in progress,
+	// so any earlier level operation on the same cell is redundant if the
+	// two execute on the same frame with nothing in between that could
+	// observe the level.  The cell is indexed by the current channel and
+	// the target channel, so we only have to match the target channel.
+	auto RemoveOverriddenLevels = [&v]()
+	{
+		for (size_t i = 0 ; i < v.size() ; ++i)
+		{
+			if (v[i].opcode < 0x07 || v[i].opcode > 0x0C)
+				continue;
+
+			uint8_t target = v[i].operandBytes[0];
+			for (size_t j = i + 1 ; j < v.size() && v[j].wait == 0 ; ++j)
+			{
+				auto op = v[j].opcode;
+				if (op == 0x07 && v[j].operandBytes[0] == target)
+				{
+					// overridden - remove the earlier step, moving its wait to
+					// the next step (which has no wait of its own, since it's
+					// in the same frame)
+					v[i + 1].wait = v[i].wait;
+					v.erase(v.begin() + i);
+					return true;
+				}
+
+				// stop at anything that could affect or observe the level,
+				// or that changes the flow of control
+				bool otherCell = (op >= 0x07 && op <= 0x0C && v[j].operandBytes[0] != target);
+				if (!(otherCell || op == 0x03 || op == 0x04 || op == 0x06 || op == 0x0D || (op >= 0x10 && op <= 0x12)))
+					break;
+			}
+		}
+		return false;
+	};
+
+	// Merge waits.  A NOP only serves to carry a wait, so we can fold its
+	// wait into the next step's, as long as the sum fits in a finite wait.
+	// The next step can't be the start of a loop body, since that would
+	// require the NOP to be the Loop step itself, so this doesn't change
+	// the timing of any loop iterations.
+	auto MergeWaits = [&v]()
+	{
+		bool changed = false;
+		for (size_t i = 0 ; i + 1 < v.size() ; )
+		{
+			auto &s = v[i];
+			auto &next = v[i + 1];
+			if (s.opcode == 0x0D && s.wait != 0xFFFF && next.wait != 0xFFFF
+				&& static_cast<int>(s.wait) + next.wait <= 0xFFFE)
+			{
+				next.wait += s.wait;
+				v.erase(v.begin() + i);
+				changed = true;
+			}
+			else
+				++i;
+		}
+		return changed;
+	};
+
+	// run the passes until nothing changes
+	for (bool changed = true ; changed ; )
+	{
+		changed = RemoveDeadSteps();
+		changed |= FoldLoops();
+		changed |= RemoveOverriddenLevels();
+		changed |= MergeWaits();
+	}
+
+	// update the statistics
+	stats.stepsRemoved += oldSteps - static_cast<int>(v.size());
+	stats.bytesSaved += oldSize - ByteCodeSize();
+
+	// store the result
+	steps.assign(v.begin(), v.end());
+}
+
+bool DCSCompiler::Track::IsSameProgram(const Track &other) const
+{
+	// the headers must match
+	if (type != other.type || channel != other.channel)
+		return false;
+
+	// deferred tracks only have the link code
+	if (type != 1)
+		return deferredTrack == other.deferredTrack;
+
+	// compare the programs step by step
+	if (steps.size() != other.steps.size())
+		return false;
+	for (auto a = steps.begin(), b = other.steps.begin() ; a != steps.end() ; ++a, ++b)
+	{
+		if (a->wait != b->wait || a->opcode != b->opcode
+			|| a->nOperandBytes != b->nOperandBytes || a->stream != b->stream)
+			return false;
+
+		// Compare the operands.  For a Play Stream step with a stream
+		// object, skip the stream address, since that isn't filled in
+		// until the stream is assigned its final location; matching
+		// stream objects are enough.
+		for (int i = 0 ; i < a->nOperandBytes ; ++i)
+		{
+			if (a->stream != nullptr && i >= 1 && i <= 3)
+				continue;
+			if (a->operandBytes[i] != b->operandBytes[i])
+				return false;
+		}
+	}
+	return true;
+}
+
+void DCSCompiler::Track::ResolveRefs(DCSCompiler *compiler, DCSTokenizer &tokenizer,
+	const std::vector<const Track*> &indirectTracks)
 {
 	// scan the program steps
 	for (auto &step : steps)
@@ -3127,32 +4052,28 @@ void DCSCompiler::Track::ResolveRefs(DCSCompiler *compiler, DCSTokenizer &tokeni
 			if (compiler->protoRomOSVer != DCSDecoder::OSVersion::OS93a
 				&& compiler->protoRomOSVer != DCSDecoder::OSVersion::OS93b)
 			{
-				for (auto &t : compiler->tracks)
+				for (const Track *track : indirectTracks)
 				{
-					Track *track = &t.second;
-					if (track->type == 3)
-					{
-						// get the table number and variable number from the deferral code
-						int tableNum = (track->deferredTrack & 0xFF);
-						int varNum = ((track->deferredTrack >> 8) & 0xFF);
+					// get the table number and variable number from the deferral code
+					int tableNum = (track->deferredTrack & 0xFF);
+					int varNum = ((track->deferredTrack >> 8) & 0xFF);
 
-						// check to see if it's the same variable number (first operand byte)
-						if (varNum == step.operandBytes[0])
+					// check to see if it's the same variable number (first operand byte)
+					if (varNum == step.operandBytes[0])
+					{
+						// It's the same variable, so this track can index the target
+						// table by the variable value set by this opcode (the second
+						// operand byte).  Check that this index is valid for the table.
+						int varVal = step.operandBytes[1];
+						DeferredIndirectTable *table = compiler->diByNumber[tableNum].get();
+						int maxIndex = table != nullptr ? static_cast<int>(table->trackNumbers.size()) : -1;
+						if (table == nullptr || varVal >= maxIndex)
 						{
-							// It's the same variable, so this track can index the target
-							// table by the variable value set by this opcode (the second
-							// operand byte).  Check that this index is valid for the table.
-							int varVal = step.operandBytes[1];
-							DeferredIndirectTable *table = compiler->diByNumber[tableNum].get();
-							int maxIndex = table != nullptr ? static_cast<int>(table->trackNumbers.size()) : -1;
-							if (table == nullptr || varVal >= maxIndex)
-							{
-								tokenizer.Error(DCSTokenizer::EError, step.refLoc,
-									"Track $%04x references deferred indirect table %d (%s) entry [%d] through variable %d (%s); "
-									"the maximum index for this table is %d",
-									track->trackNo, tableNum, compiler->DITableName(tableNum),
-									varVal, varNum, compiler->VariableName(varNum), maxIndex);
-							}
+							tokenizer.Error(DCSTokenizer::EError, step.refLoc,
+								"Track $%04x references deferred indirect table %d (%s) entry [%d] through variable %d (%s); "
+								"the maximum index for this table is %d",
+								track->trackNo, tableNum, compiler->DITableName(tableNum),
+								varVal, varNum, compiler->VariableName(varNum), maxIndex);
 						}
 					}
 				}
@@ -39,6 +39,7 @@
 #include <unordered_map>
 #include <vector>
 #include <memory>
+#include <functional>
 #include "DCSTokenizer.h"
 #include "DCSEncoder.h"
 #include "../DCSDecoder/DCSDecoderNative.h"
@@ -100,9 +101,69 @@ public:
 	bool LoadPrototypeROM(const char *romZipFile, bool patchMode, 
 		std::string &errorMessage);
 
+	// Create a synthetic prototype ROM, as an alternative to loading a
+	// real one.  This builds a minimal U2 image containing just the
+	// structures that the decoder uses to identify the hardware and
+	// software version (the ROM catalog, plus the handful of ADSP-2105
+	// instruction sequences that the version detection looks for), for
+	// the given OS version.  There's no working ADSP-2105 program in the
+	// synthetic image, so the ROMs generated from it only play back in
+	// the native decoder, not in the emulator or on real hardware.  The
+	// point is to be able to build self-contained test and benchmark
+	// ROM sets without needing any of the original copyrighted ROMs.
+	//
+	// 'numChannels' sets the channel count that the synthetic firmware
+	// claims to support; pass 0 to use the usual count for the version
+	// (4 for OS93, 6 for later versions).
+	bool CreateSyntheticPrototypeROM(DCSDecoder::OSVersion osVersion, int numChannels,
+		std::string &errorMessage);
+
 	// Parse a script file
 	void ParseScript(const char *filename, DCSTokenizer::ErrorLogger &logger);
 
+	// Track program optimization.  When this is set (the default),
+	// ParseScript() runs an optimization pass over each track program
+	// defined in the script, and GenerateROM() stores a single copy of
+	// the program for tracks with identical contents.  The optimizer
+	// only makes changes that leave the program's behavior the same,
+	// frame for frame: it merges consecutive waits, unrolls single-pass
+	// loops, collapses finite loops that only wait into a single wait,
+	// drops mixing level changes that are overridden in the same frame,
+	// and removes steps that can never be reached, such as anything
+	// after End.  Tracks imported from the prototype ROM in patch mode
+	// are left exactly as they were, apart from program sharing.
+	bool optimizeTracks = true;
+
+	// Track optimizer statistics, for reporting
+	struct TrackOptimizerStats
+	{
+		int stepsRemoved = 0;       // number of program steps removed
+		int tracksShared = 0;       // number of tracks sharing another track's program
+		int bytesSaved = 0;         // total ROM bytes saved
+	};
+	TrackOptimizerStats trackOptimizerStats;
+
+	// Delta patch output file.  If this is set, GenerateROM() also writes
+	// a delta patch to this file, describing the new sound ROM images in
+	// terms of the prototype ROM images (see DCSDecoder::ApplyROMPatch()
+	// for the format).  Anyone who has the prototype ROM set can rebuild
+	// the new ROM set from the patch, so the patch can be distributed in
+	// place of the full ROM set.  This is most useful in patch mode, where
+	// the new ROMs share most of their contents with the prototype, and
+	// the patch is typically a small fraction of the size of the .zip.
+	std::string deltaPatchFile;
+
+	// Delta patch statistics, for reporting
+	struct DeltaPatchStats
+	{
+		size_t romBytes = 0;        // total size of the new ROM images
+		size_t copiedBytes = 0;     // bytes copied from the prototype images
+		size_t filledBytes = 0;     // bytes stored as runs of a repeated byte
+		size_t insertedBytes = 0;   // bytes stored literally in the patch
+		size_t patchSize = 0;       // size of the patch file
+	};
+	DeltaPatchStats deltaPatchStats;
+
 	// Generate the new ROM set.  This creates the ROM images based on
 	// the current in-memory data structures, and writes them to the
 	// specified .zip file.  All of the non-DCS files from the prototype
@@ -161,6 +222,27 @@ public:
 		uint32_t romSize, const char *romPrefix,
 		std::string &errorMessage, std::list<ROMDesc> *romList);
 
+	// Find the reachable streams.  GenerateROM() calls this before laying
+	// out the ROM, to set the 'referenced' flag on each stream that can
+	// actually be played.  Only referenced streams are stored in the new
+	// ROM, so in patch mode, the space used by prototype streams that were
+	// only played by tracks the script replaced, or only by steps that can
+	// never execute, is freed up for new streams.  Unreachable steps in
+	// prototype tracks are removed in the process, so that they don't hold
+	// pointers to streams that are no longer stored.
+	void FindReachableStreams();
+
+	// Reachability statistics, for reporting the space reclaimed in
+	// patch mode
+	struct ReachabilityStats
+	{
+		int protoStreams = 0;            // number of streams imported from the prototype ROM
+		int protoStreamsDropped = 0;     // number of imported streams that aren't reachable
+		size_t bytesReclaimed = 0;       // total size of the dropped streams
+		int deadStepsRemoved = 0;        // unreachable steps removed from prototype tracks
+	};
+	ReachabilityStats reachabilityStats;
+
 	// Audio stream list entry
 	struct Stream
 	{
@@ -173,8 +255,8 @@ public:
 
 		// Is this stream referenced from a track program?  Before we generate
 		// the final ROM images, we'll go through all of the track programs and
-		// mark all of the streams they reference.  Any streams that aren't
-		// mentioned in track programs can be omitted from the final ROM set
+		// mark all of the streams they can reach (see FindReachableStreams()).
+		// Any streams that can't be played can be omitted from the final ROM set
 		bool referenced = false;
 
 		// Prototype ROM address, as a 24-bit linear ROM pointer, for streams
@@ -309,10 +391,22 @@ public:
 		// Compile the program steps into the byte-code program
 		void Compile(DCSCompiler *compiler);
 
+		// Optimize the program steps.  See DCSCompiler::optimizeTracks.
+		// Adds the number of steps and bytes removed to 'stats'.
+		void Optimize(TrackOptimizerStats &stats);
+
+		// Does this track have the same header and program as another
+		// track?  If so, the two can share a single copy in the ROM.
+		bool IsSameProgram(const Track &other) const;
+
 		// Resolve references.  Scans the program steps; resolves
 		// stream name references to Stream objects, and bounds-checks
-		// deferred indirect table references.
-		void ResolveRefs(DCSCompiler *compiler, DCSTokenizer &tokenizer);
+		// deferred indirect table references.  'indirectTracks' lists
+		// the Type 3 (deferred indirect) tracks, which the caller
+		// gathers once for all tracks, since a generated script can
+		// have thousands of tracks.
+		void ResolveRefs(DCSCompiler *compiler, DCSTokenizer &tokenizer,
+			const std::vector<const Track*> &indirectTracks);
 
 		// compiled program byte code
 		std::vector<uint8_t> byteCode;
@@ -376,11 +470,32 @@ public:
 	// Parse compression parameters
 	void ParseCompressionParams(DCSTokenizer &tokenizer, DCSEncoder::CompressionParams &params);
 
+	// Finish loading a prototype ROM, after the U2 image has been added to
+	// the decoder.  This detects the version information and sets up the
+	// default compression parameters accordingly.
+	bool InitPrototypeROM(const char *romName, bool patchMode, std::string &errorMessage);
+
+	// Parse synthetic signal parameters
+	void ParseSignalParams(DCSTokenizer &tokenizer, DCSEncoder::SignalParams &signal);
+
 	// Encode a file
 	Stream *EncodeFile(Stream *replaces, 
 		const char *symbolicName, const char *file, 
 		const DCSEncoder::CompressionParams &params, DCSTokenizer &tokenizer);
 
+	// Encode a synthetic signal
+	Stream *EncodeSignal(Stream *replaces, 
+		const char *symbolicName, const DCSEncoder::SignalParams &signal, 
+		const DCSEncoder::CompressionParams &params, DCSTokenizer &tokenizer);
+
+	// Encode a stream from a generic source, and add it to the stream list.
+	// 'sourceName' is the source file name, or a description of the source
+	// for a stream that doesn't come from a file.  'encode' performs the
+	// actual encoding.
+	Stream *EncodeStream(Stream *replaces, const char *symbolicName, const char *sourceName,
+		const DCSEncoder::CompressionParams &params, DCSTokenizer &tokenizer,
+		std::function<bool(DCSEncoder::DCSAudio&, std::string&, DCSEncoder::OpenStreamStatus*)> encode);
+
 	// DCS Decoder, containing the prototype ROM set
 	DCSDecoder::MinHost decoderHostIfc;
 	DCSDecoderNative decoder;
@@ -388,6 +503,17 @@ public:
 	// prototype ROM zip file contents
 	std::list<DCSDecoder::ZipFileData> protoZipData;
 
+	// Write the delta patch file (see deltaPatchFile).  'roms' describes
+	// the new ROM images, in chip number order.
+	struct DeltaPatchROM
+	{
+		int chipNum;
+		const char *filename;
+		const uint8_t *data;
+		uint32_t size;
+	};
+	bool WriteDeltaPatch(const std::vector<DeltaPatchROM> &roms, std::string &errorMessage);
+
 	// Hardware platform and software version of prototype ROM software
 	std::string protoRomVer;
 	DCSDecoder::HWVersion protoRomHWVer = DCSDecoder::HWVersion::Unknown;
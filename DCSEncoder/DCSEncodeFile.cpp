@@ -51,6 +51,20 @@ bool DCSEncoder::EncodeFile(const char *filename, DCSAudio &dcsObj,
     if (IsDCSFile(filename))
         return EncodeDCSFile(filename, dcsObj, errorMessage);
 
+    // If we have a cached analysis of this file, skip the decoding and
+    // transform steps and go straight to compression
+    AnalysisCacheKey cacheKey;
+    bool useCache = GetAnalysisCacheKey(filename, cacheKey);
+    if (useCache)
+    {
+        if (std::unique_ptr<Stream> cached(LoadAnalysisCache(cacheKey)); cached != nullptr)
+        {
+            if (!CloseStream(cached.get(), dcsObj, errorMessage))
+                return Status(OpenStreamStatus::Error);
+            return Status(OpenStreamStatus::OK);
+        }
+    }
+
     // load the file
     nqr::AudioData fileData;
     nqr::NyquistIO loader;
@@ -105,6 +119,10 @@ bool DCSEncoder::EncodeFile(const char *filename, DCSAudio &dcsObj,
     if (!CloseStream(stream.get(), dcsObj, errorMessage))
         return Status(OpenStreamStatus::Error);
 
+    // save the analysis for next time
+    if (useCache)
+        SaveAnalysisCache(cacheKey, stream.get());
+
     // success
     return Status(OpenStreamStatus::OK);
 }
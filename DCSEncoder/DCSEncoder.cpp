@@ -27,12 +27,23 @@
 #include <stdlib.h>
 #include <math.h>
 #include <stdarg.h>
+#include <filesystem>
+#include <map>
+#include <mutex>
 #include "DCSEncoder.h"
 #include "../DCSDecoder/DCSDecoderNative.h"
 #include "../libsamplerate/src/samplerate.h"
 
 #pragma comment(lib, "libsamplerate")
 
+// SSE is always available on x64, and on x86 when the compiler is
+// allowed to use it; the polyphase resampler uses it for its inner
+// loop when it's there
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1) || defined(__SSE__)
+#include <xmmintrin.h>
+#define DCSENCODER_USE_SSE 1
+#endif
+
 // a much-used constant
 static const float PI = 3.1415926536f;
 
@@ -142,6 +153,14 @@ static const int scalingFactors[] ={
     55109   // 3f
 };
 
+// scaling factor pre-adjustment maps for stream subtypes 0 and 3
+static const uint16_t preAdjMap0[16] ={
+    0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1
+};
+static const uint16_t preAdjMap3[16] ={
+   0, 0, 0, 0, 1, 2, 3, 4, 4, 4, 4, 4, 4, 4, 4, 4
+};
+
 DCSEncoder::DCSEncoder()
 {
     // build the 9-bit bit-reversed indexing table (for the FFT)
@@ -162,7 +181,7 @@ DCSEncoder::~DCSEncoder()
 {
 }
 
-DCSEncoder::Stream::Stream(int sampleRate)
+DCSEncoder::Stream::Stream(int sampleRate, Resampler resampler)
 {
     // clear the input buffer
     memset(inputBuf, 0, sizeof(inputBuf));
@@ -174,13 +193,23 @@ DCSEncoder::Stream::Stream(int sampleRate)
     // phantom overlap from the non-existent prior frame.
     nInputBuf = 16;
 
-    // Create the libsamplerate state object.  We can afford to use the 
-    // slower high quality level, since we don't need to run in real time.
-    int err = 0;
-    lsrState = src_new(SRC_SINC_BEST_QUALITY, 1, &err);
-
-    // set the libsamplerate sampling rate
+    // set the sampling rate ratio
     sampleRateRatio = 31250.0 / sampleRate;
+
+    // Use our polyphase filter if there's one for this rate.  Start the
+    // input with zeroes for the filter taps before the first sample, so
+    // that the first output is centered on the first input sample.
+    if (resampler == Resampler::Auto && (polyphase = PolyphaseFilter::Get(sampleRate)) != nullptr)
+    {
+        polyInput.assign(polyphase->nTaps/2 - 1, 0.0f);
+        return;
+    }
+
+    // Otherwise create the libsamplerate state object.  We can afford
+    // to use the slower high quality level, since we don't need to run
+    // in real time.
+    int err = 0;
+    lsrState = src_new(resampler == Resampler::SincMedium ? SRC_SINC_MEDIUM_QUALITY : SRC_SINC_BEST_QUALITY, 1, &err);
     src_set_ratio(lsrState, sampleRateRatio);
 }
 
@@ -201,6 +230,15 @@ DCSEncoder::Stream::~Stream()
 // the need for any external dependencies.
 bool DCSEncoder::EncodeWAVFile(const char *filename, DCSAudio &dcsObj, std::string &errorMessage)
 {
+    // if we have a cached analysis of this file, skip straight to compression
+    AnalysisCacheKey cacheKey;
+    bool useCache = GetAnalysisCacheKey(filename, cacheKey);
+    if (useCache)
+    {
+        if (std::unique_ptr<Stream> cached(LoadAnalysisCache(cacheKey)); cached != nullptr)
+            return CloseStream(cached.get(), dcsObj, errorMessage);
+    }
+
     // open the WAV file
     FILE *fp = nullptr;
     if (int err = fopen_s(&fp, filename, "rb"); err != 0 || fp == nullptr)
@@ -351,6 +389,10 @@ bool DCSEncoder::EncodeWAVFile(const char *filename, DCSAudio &dcsObj, std::stri
     if (!CloseStream(stream.get(), dcsObj, errorMessage))
         return false;
 
+    // save the analysis for next time
+    if (useCache)
+        SaveAnalysisCache(cacheKey, stream.get());
+
     // success
     return true;
 }
@@ -399,6 +441,106 @@ bool DCSEncoder::IsDCSFile(const char *filename, int *formatVersion)
     }
 }
 
+bool DCSEncoder::SaveDCSFile(const char *filename, const DCSAudio &dcsObj,
+    uint16_t formatVersion, std::string &errorMessage)
+{
+    // Build the header.  This uses the same layout that IsDCSFile()
+    // checks for (see above), with all integer fields big-endian.
+    uint8_t hdr[36];
+    memset(hdr, 0, sizeof(hdr));
+    memcpy(&hdr[0], "DCSa", 4);
+    hdr[4] = static_cast<uint8_t>((formatVersion >> 8) & 0xFF);
+    hdr[5] = static_cast<uint8_t>(formatVersion & 0xFF);
+    hdr[6] = 0x00;
+    hdr[7] = 0x01;
+    hdr[8] = 0x7A;
+    hdr[9] = 0x12;
+    hdr[32] = static_cast<uint8_t>((dcsObj.nBytes >> 24) & 0xFF);
+    hdr[33] = static_cast<uint8_t>((dcsObj.nBytes >> 16) & 0xFF);
+    hdr[34] = static_cast<uint8_t>((dcsObj.nBytes >> 8) & 0xFF);
+    hdr[35] = static_cast<uint8_t>(dcsObj.nBytes & 0xFF);
+
+    // open the file
+    FILE *fp = nullptr;
+    if (fopen_s(&fp, filename, "wb") != 0 || fp == nullptr)
+    {
+        errorMessage = format("Unable to open output file \"%s\" (system error %d)", filename, errno);
+        return false;
+    }
+
+    // write the header and stream data
+    bool ok = fwrite(hdr, 1, sizeof(hdr), fp) == sizeof(hdr)
+        && fwrite(dcsObj.data.get(), 1, dcsObj.nBytes, fp) == dcsObj.nBytes;
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok)
+    {
+        errorMessage = format("Error writing output file \"%s\" (system error %d)", filename, errno);
+        return false;
+    }
+
+    // success
+    return true;
+}
+
+bool DCSEncoder::LoadDCSFile(const char *filename, DCSAudio &dcsObj,
+    uint16_t &formatVersion, std::string &errorMessage)
+{
+    // open the file
+    FILE *fp = nullptr;
+    if (fopen_s(&fp, filename, "rb") != 0 || fp == nullptr)
+    {
+        errorMessage = format("Unable to open \"%s\" (system error %d)", filename, errno);
+        return false;
+    }
+    std::unique_ptr<FILE, int(*)(FILE*)> fpHolder(fp, fclose);
+
+    // read and check the header (see IsDCSFile() for the layout)
+    uint8_t hdr[36];
+    if (fread(hdr, 1, _countof(hdr), fp) != _countof(hdr)
+        || memcmp(&hdr[0], "DCSa", 4) != 0
+        || !(hdr[4] == 0x93 || hdr[4] == 0x94)
+        || !(hdr[6] == 0 && hdr[7] == 1)
+        || !(hdr[8] == 0x7A && hdr[9] == 0x12))
+    {
+        errorMessage = format("\"%s\" is not a raw DCS stream file", filename);
+        return false;
+    }
+
+    // get the format version and the data size
+    formatVersion = (static_cast<uint16_t>(hdr[4]) << 8) | hdr[5];
+    uint32_t nBytes = (static_cast<uint32_t>(hdr[32]) << 24)
+        | (static_cast<uint32_t>(hdr[33]) << 16)
+        | (static_cast<uint32_t>(hdr[34]) << 8)
+        | (static_cast<uint32_t>(hdr[35]) << 0);
+
+    // The decoder's bit reader reads a few bytes ahead of the bits it's
+    // actually using, which is harmless in a ROM, where there's always
+    // more data after a stream, but would run past the end of a buffer
+    // holding a stream alone.  Add some zero padding past the end, so
+    // that the stream can be handed to the decoder directly.
+    const size_t padding = 8;
+    std::unique_ptr<uint8_t> data(new (std::nothrow) uint8_t[nBytes + padding]);
+    if (data == nullptr)
+    {
+        errorMessage = format("Out of memory loading DCS stream data from \"%s\"", filename);
+        return false;
+    }
+    memset(data.get() + nBytes, 0, padding);
+
+    // read the stream data
+    if (fread(data.get(), 1, nBytes, fp) != nBytes)
+    {
+        errorMessage = format("Error reading DCS stream data from \"%s\" (system error %d)", filename, errno);
+        return false;
+    }
+
+    // success
+    dcsObj.nBytes = nBytes;
+    dcsObj.nFrames = nBytes >= 2 ? ((static_cast<int>(data.get()[0]) << 8) | data.get()[1]) : 0;
+    dcsObj.data.reset(data.release());
+    return true;
+}
+
 bool DCSEncoder::EncodeDCSFile(const char *filename, DCSAudio &dcsObj,
     std::string &errorMessage, OpenStreamStatus *statusPtr)
 {
@@ -450,11 +592,8 @@ bool DCSEncoder::EncodeDCSFile(const char *filename, DCSAudio &dcsObj,
         && (hdr[6] == 0 && hdr[7] == 1)           // number of channels = 1
         && (hdr[8] == 0x7A && hdr[9] == 0x12))    // sample rate = $7A12 = 31250
     {
-        // It's one of our DCS files - assuming it uses the same format
-        // version as the target game, we can copy its encoded stream
-        // bytes without any transcoding.   We will have to decode it
-        // and re-encode it if it's for a different format version,
-        // however.
+        // It's one of our DCS files.  Load the stream data section, and
+        // pass it to the in-memory stream encoder.
 
         // get the number of bytes in the stream data section
         uint32_t nBytes = (static_cast<uint32_t>(hdr[32]) << 24)
@@ -477,113 +616,614 @@ bool DCSEncoder::EncodeDCSFile(const char *filename, DCSAudio &dcsObj,
                 format("Error reading DCS stream data from %s (error %d)", filename, errno).c_str());
         }
 
-        // get the frame count - it's the first UINT16 in the stream data
-        uint16_t nFrames = (static_cast<uint16_t>(data.get()[0]) << 8) | data.get()[1];
-
         // get the format version
         uint16_t formatVersion = (static_cast<uint16_t>(hdr[4]) << 8) | hdr[5];
 
-        // Get the stream's major type from the header - this is encoded in
-        // the high bit of the first header byte.  The header starts at the
-        // third byte of the stream data, immediatley following the frame
-        // count prefix.
-        int streamMajorType = (data.get()[2] & 0x80) >> 7;
-
-        // Check to see if this stream type is compatible with our target
-        // format:
-        //
-        // - If the format versions match exactly, it's compatible.  Each
-        //   DCS OS version can decode all of the stream types defined for 
-        //   that exact version.
-        //
-        // - If the stream format version is one of the 1993 versions, and
-        //   the target format is the other 1993 versions, and the stream's
-        //   major type is Type 0, it's compatible.  The 1993 Type 0 formats
-        //   are identical in 1993a and 1993b.
-        // 
-        // Otherwise, it's incompatible and must be re-encoded in the target
-        // format.
-        if (formatVersion == compressionParams.formatVersion
-            || ((formatVersion & 0xFF00) == 0x9300 
-                && (compressionParams.formatVersion & 0xFF00) == 0x9300
-                && streamMajorType == 0))
+        // encode the stream
+        if (!EncodeDCSStream(data.get(), nBytes, formatVersion, dcsObj, errorMessage, statusPtr))
         {
-            // It's identical to the target format, so we can use this stream
-            // directly, without having to re-encode it in the target format.
-            // Simply pass it back to the caller.
-            dcsObj.nBytes = nBytes;
-            dcsObj.nFrames = nFrames;
-            dcsObj.data.reset(data.release());
+            errorMessage = format("%s: %s", filename, errorMessage.c_str());
+            return false;
         }
-        else
+
+        // success
+        return Status(OpenStreamStatus::OK);
+    }
+
+    // not a DCS file
+    return Status(OpenStreamStatus::UnsupportedFormat, "Not a raw DCS stream file");
+}
+
+// Get the DCSDecoder OS version corresponding to a stream format version
+// code.  Returns false if the format version isn't recognized.
+static bool GetStreamOSVersion(uint16_t formatVersion, DCSDecoder::OSVersion &osVer)
+{
+    switch (formatVersion)
+    {
+    case 0x9301:
+        osVer = DCSDecoder::OSVersion::OS93a;
+        return true;
+
+    case 0x9302:
+        osVer = DCSDecoder::OSVersion::OS93b;
+        return true;
+
+    case 0x9400:
+        osVer = DCSDecoder::OSVersion::OS94;
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// Convert a decompressed frame, as returned by DCSDecoderNative::
+// DecompressStream(), to an encoder frame.  The decompressed frames and
+// our transformed frames hold the same transform coefficients, in nearly
+// the same layout, since the encoder transform is the inverse of the
+// decoder transform.  The decoder's frame buffer has the DC term at [0]
+// and an unused slot at [1] (the sine term at zero frequency, which is
+// always zero), with the rest of the terms following from [2].  Our
+// frames omit the unused slot.  The decompressed values at the full
+// mixing level are scaled by half, in 1.15 fixed-point terms, relative
+// to our normalized floats.
+static void DecompressedToFrame(const int16_t *c, float f[256])
+{
+    const float scale = 1.0f / 16384.0f;
+    f[0] = static_cast<float>(c[0]) * scale;
+    for (int i = 1 ; i < 256 ; ++i)
+        f[i] = static_cast<float>(c[i+1]) * scale;
+}
+
+bool DCSEncoder::EncodeDCSStream(const uint8_t *data, size_t nBytes, uint16_t formatVersion,
+    DCSAudio &dcsObj, std::string &errorMessage, OpenStreamStatus *statusPtr)
+{
+    // return an error message and status
+    auto Status = [&errorMessage, statusPtr](OpenStreamStatus statusVal, const char *msg = nullptr)
+    {
+        // set the error message text
+        if (msg != nullptr)
+            errorMessage = msg;
+
+        // set the status, if the caller requested it
+        if (statusPtr != nullptr)
+            *statusPtr = statusVal;
+
+        // return true on success, false on failure
+        return statusVal == OpenStreamStatus::OK;
+    };
+
+    // The stream has to contain at least the frame count prefix and the
+    // first header byte, which tells us the major type.
+    if (nBytes < 3)
+        return Status(OpenStreamStatus::Error, "DCS stream data is too short");
+
+    // get the frame count - it's the first UINT16 in the stream data
+    uint16_t nFrames = (static_cast<uint16_t>(data[0]) << 8) | data[1];
+
+    // Get the stream's major type from the header - this is encoded in
+    // the high bit of the first header byte.  The header starts at the
+    // third byte of the stream data, immediatley following the frame
+    // count prefix.
+    int streamMajorType = (data[2] & 0x80) >> 7;
+
+    // Check to see if this stream type is compatible with our target
+    // format:
+    //
+    // - If the format versions match exactly, it's compatible.  Each
+    //   DCS OS version can decode all of the stream types defined for 
+    //   that exact version.
+    //
+    // - If the stream format version is one of the 1993 versions, and
+    //   the target format is the other 1993 versions, and the stream's
+    //   major type is Type 0, it's compatible.  The 1993 Type 0 formats
+    //   are identical in 1993a and 1993b.
+    // 
+    // Otherwise, it's incompatible and must be re-encoded in the target
+    // format.
+    if (formatVersion == compressionParams.formatVersion
+        || ((formatVersion & 0xFF00) == 0x9300 
+            && (compressionParams.formatVersion & 0xFF00) == 0x9300
+            && streamMajorType == 0))
+    {
+        // It's identical to the target format, so we can use this stream
+        // directly, without having to re-encode it in the target format.
+        // Simply pass back a copy.
+        std::unique_ptr<uint8_t> copy(new (std::nothrow) uint8_t[nBytes]);
+        if (copy == nullptr)
+            return Status(OpenStreamStatus::OutOfMemory, "Out of memory copying DCS stream data");
+        memcpy(copy.get(), data, nBytes);
+        dcsObj.nBytes = nBytes;
+        dcsObj.nFrames = nFrames;
+        dcsObj.data.reset(copy.release());
+        return Status(OpenStreamStatus::OK);
+    }
+
+    // The stream uses an incompatible DCS format.  Set up a universal decoder,
+    // and set it to the selected source format version.
+    DCSDecoder::MinHost hostifc;
+    DCSDecoderNative decoder(&hostifc);
+
+    // figure the DCSDeocder OS version corersponding to the source format
+    DCSDecoder::OSVersion sourceOSVer;
+    if (!GetStreamOSVersion(formatVersion, sourceOSVer))
+    {
+        return Status(OpenStreamStatus::Error,
+            format("Unrecognized DCS stream format version (%04x)", formatVersion).c_str());
+    }
+
+    // initialize the decoder in stand-alone mode (no ROMs loaded)
+    decoder.InitStandalone(sourceOSVer);
+    decoder.SoftBoot();
+
+    // create a DCS encoder stream for the new stream
+    std::unique_ptr<Stream> stream(OpenStream(31250, errorMessage, statusPtr));
+    if (stream == nullptr)
+        return Status(OpenStreamStatus::Error);
+
+    // load the stream into the decoder
+    DCSDecoder::ROMPointer rp(0, data);
+    if (transcodeViaPCM)
+    {
+        // Full round trip through PCM.  Play the stream through the decoder
+        // at the full mixing level and master volume, and feed the samples
+        // to the encoder.
+        decoder.SetMasterVolume(0xFF);
+        decoder.LoadAudioStream(0, rp, 0xFF);
+
+        // Decode all of the frames and send them to the stream.  Add one extra
+        // frame to make sure we fade to silence after the last source frame.
+        for (uint16_t frame = 0 ; frame < nFrames + 1 ; ++frame)
         {
-            // The stream uses an incompatible DCS format.  Set up a universal decoder,
-            // and set it to the selected source format version.
-            DCSDecoder::MinHost hostifc;
-            DCSDecoderNative decoder(&hostifc);
-
-            // figure the DCSDeocder OS version corersponding to the source format
-            DCSDecoder::OSVersion sourceOSVer;
-            switch (formatVersion)
-            {
-            case 0x9301:
-                sourceOSVer = DCSDecoder::OSVersion::OS93a;
-                break;
+            // decode a frame from the source (always 240 samples)
+            int16_t buf[240];
+            for (int s = 0 ; s < 240 ; ++s)
+                buf[s] = decoder.GetNextSample();
 
-            case 0x9302:
-                sourceOSVer = DCSDecoder::OSVersion::OS93b;
-                break;
+            // send the samples to the encoder stream
+            WriteStream(stream.get(), buf, 240);
+        }
+    }
+    else
+    {
+        // Transcode in the frequency domain, by converting each
+        // decompressed frame directly to an encoder frame
+        decoder.DecompressStream(rp, [this, &stream](int, const int16_t *c)
+        {
+            float f[256];
+            DecompressedToFrame(c, f);
+            AddFrame(stream.get(), f);
+        });
 
-            case 0x9400:
-                sourceOSVer = DCSDecoder::OSVersion::OS94;
-                break;
+        // the frame list is complete, so there's no PCM input to flush
+        stream->analysisComplete = true;
+    }
 
-            default:
-                return Status(OpenStreamStatus::Error,
-                    format("%s uses an unrecognized DCS stream format version (%04x)",
-                        filename, formatVersion).c_str());
-            }
+    // close the stream
+    if (!CloseStream(stream.get(), dcsObj, errorMessage))
+        return Status(OpenStreamStatus::Error);
 
-            // initialize the decoder in stand-alone mode (no ROMs loaded)
-            decoder.InitStandalone(sourceOSVer);
-            decoder.SoftBoot();
+    // success
+    return Status(OpenStreamStatus::OK);
+}
 
-            // load the stream into the decoder
-            DCSDecoder::ROMPointer rp(0, data.get());
-            decoder.LoadAudioStream(0, rp, 0xFF);
+// Splice streams in compressed form
+bool DCSEncoder::SpliceDCSStreams(const std::vector<SpliceSegment> &segments, DCSAudio &dcsObj,
+    std::string &errorMessage, SpliceStats *stats, int headerSegment)
+{
+    // use a local stats struct if the caller didn't provide one
+    SpliceStats localStats;
+    SpliceStats &st = (stats != nullptr) ? *stats : localStats;
+    st = SpliceStats();
 
-            // create a DCS encoder stream for the new stream
-            std::unique_ptr<Stream> stream(OpenStream(31250, errorMessage, statusPtr));
-            if (stream == nullptr)
-                return Status(OpenStreamStatus::Error);
+    // the result is always a 1994+ stream
+    if (compressionParams.formatVersion != 0x9400)
+    {
+        errorMessage = "Stream splicing is only supported for the 1994+ format";
+        return false;
+    }
 
-            // Decode all of the frames and send them to the stream.  Add one extra
-            // frame to make sure we fade to silence after the last source frame.
-            for (uint16_t frame = 0 ; frame < nFrames + 1 ; ++frame)
-            {
-                // decode a frame from the source (always 240 samples)
-                int16_t buf[240];
-                for (int s = 0 ; s < 240 ; ++s)
-                    buf[s] = decoder.GetNextSample();
+    // Check the segments, and figure the frame range for each one
+    struct Seg
+    {
+        const SpliceSegment *src;
+        DCSDecoder::OSVersion osVer;
+        int startFrame;
+        int endFrame;
+    };
+    std::vector<Seg> segs;
+    int nFramesTotal = 0;
+    for (size_t i = 0 ; i < segments.size() ; ++i)
+    {
+        // make sure the stream is at least long enough for the frame count
+        // and the stream header
+        auto &s = segments[i];
+        if (s.data == nullptr || s.nBytes < 18)
+        {
+            errorMessage = format("Segment %d: DCS stream data is too short", static_cast<int>(i + 1));
+            return false;
+        }
+
+        // get the decoder version for the format
+        DCSDecoder::OSVersion osVer;
+        if (!GetStreamOSVersion(s.formatVersion, osVer))
+        {
+            errorMessage = format("Segment %d: Unrecognized DCS stream format version (%04x)",
+                static_cast<int>(i + 1), s.formatVersion);
+            return false;
+        }
+
+        // check the frame range against the stream's frame count
+        int nFrames = (static_cast<int>(s.data[0]) << 8) | s.data[1];
+        int endFrame = s.endFrame < 0 ? nFrames : s.endFrame;
+        if (s.startFrame < 0 || s.startFrame > endFrame || endFrame > nFrames)
+        {
+            errorMessage = format("Segment %d: frame range %d-%d is outside of the stream (%d frames)",
+                static_cast<int>(i + 1), s.startFrame, endFrame, nFrames);
+            return false;
+        }
+
+        // add it to the list, skipping empty segments
+        if (endFrame > s.startFrame)
+        {
+            segs.emplace_back(Seg{ &s, osVer, s.startFrame, endFrame });
+            nFramesTotal += endFrame - s.startFrame;
+        }
+    }
+
+    // the frame count has to fit the stream's UINT16 frame count prefix
+    if (nFramesTotal == 0)
+    {
+        errorMessage = "The segments don't contain any frames";
+        return false;
+    }
+    if (nFramesTotal > 0xFFFF)
+    {
+        errorMessage = format("The spliced stream would have %d frames; the limit is 65535", nFramesTotal);
+        return false;
+    }
+
+    // Set up a decoder for each source format version.  The decoders only
+    // serve to parse the streams, so they don't need any ROMs.
+    DCSDecoder::MinHost hostifc;
+    std::map<DCSDecoder::OSVersion, std::unique_ptr<DCSDecoderNative>> decoders;
+    for (auto &seg : segs)
+    {
+        auto &d = decoders[seg.osVer];
+        if (d == nullptr)
+        {
+            d.reset(new DCSDecoderNative(&hostifc));
+            d->InitStandalone(seg.osVer);
+            d->SoftBoot();
+        }
+    }
+
+    // Pick the header for the new stream.  If the caller selected a
+    // segment, use its stream's header.
+    const uint8_t *header = nullptr;
+    if (headerSegment >= 0)
+    {
+        if (headerSegment >= static_cast<int>(segments.size()) || segments[headerSegment].formatVersion != 0x9400)
+        {
+            errorMessage = format("The header can only be taken from a 1994+ format stream (segment %d)", headerSegment + 1);
+            return false;
+        }
+        header = segments[headerSegment].data + 2;
+    }
+
+    // Otherwise use the header of the 1994+ source stream that contributes
+    // the most frames, counting all of the segments that share the same
+    // header together
+    if (header == nullptr)
+    {
+        int headerFrames = 0;
+        for (auto &seg : segs)
+        {
+            if (seg.src->formatVersion != 0x9400)
+                continue;
 
-                // send the samples to the encoder stream
-                WriteStream(stream.get(), buf, 240);
+            int n = 0;
+            for (auto &other : segs)
+            {
+                if (other.src->formatVersion == 0x9400 && memcmp(other.src->data + 2, seg.src->data + 2, 16) == 0)
+                    n += other.endFrame - other.startFrame;
+            }
+            if (n > headerFrames)
+            {
+                header = seg.src->data + 2;
+                headerFrames = n;
             }
+        }
+    }
+
+    // If there aren't any 1994+ sources, there's no header to borrow, so
+    // transcode the frames as one long stream, letting the usual analysis
+    // pick the header.  Every frame is re-encoded in this case anyway.
+    if (header == nullptr)
+    {
+        std::unique_ptr<Stream> stream(OpenStream(31250, errorMessage));
+        if (stream == nullptr)
+            return false;
+
+        for (auto &seg : segs)
+        {
+            decoders[seg.osVer]->ScanStreamFrames(DCSDecoder::ROMPointer(0, seg.src->data),
+                [this, &stream, &seg](const DCSDecoderNative::StreamFrameInfo &fi)
+            {
+                if (fi.frameNum >= seg.endFrame)
+                    return false;
+
+                if (fi.frameNum >= seg.startFrame)
+                {
+                    float f[256];
+                    DecompressedToFrame(fi.coefficients, f);
+                    AddFrame(stream.get(), f);
+                }
+                return true;
+            });
+        }
 
-            // close the stream
-            if (!CloseStream(stream.get(), dcsObj, errorMessage))
+        stream->analysisComplete = true;
+        if (!CloseStream(stream.get(), dcsObj, errorMessage))
+            return false;
+
+        st.nFrames = st.nReencoded = nFramesTotal;
+        return true;
+    }
+
+    // Set up the bit writer with the new stream's header.  The stream
+    // type and subtype come from the header bits that encode them (see
+    // CompressStream()), for the frames we have to re-encode.
+    BitWriter bw;
+    bw.params = compressionParams;
+    bw.params.streamFormatType = (header[0] & 0x80) >> 7;
+    bw.params.streamFormatSubType = ((header[1] & 0x80) >> 6) | ((header[2] & 0x80) >> 7);
+    memcpy(bw.header, header, 16);
+
+    // count the populated bands; the first band with 0x7F in the low 7 bits
+    // of its header byte ends the list
+    int nBands = 0;
+    while (nBands < 16 && (header[nBands] & 0x7F) != 0x7F)
+        ++nBands;
+
+    // get the pre-adjustment map that Type 1 streams apply to bands 0-2
+    bool type1 = bw.params.streamFormatType != 0;
+    const uint16_t *preAdjMap = bw.params.streamFormatSubType == 0 ? preAdjMap0 : preAdjMap3;
+
+    // Copy bits from a source stream to the bit writer.  The source bits
+    // aren't byte-aligned, so we take them a byte at a time, shifted into
+    // place from the two bytes that straddle each 8-bit group.
+    auto CopyBits = [&bw](const uint8_t *src, uint32_t bitOffset, uint32_t nBits)
+    {
+        const uint8_t *p = src + bitOffset / 8;
+        int shift = bitOffset % 8;
+        for ( ; nBits >= 8 ; nBits -= 8, ++p)
+        {
+            uint32_t b = shift == 0 ? p[0] : (((static_cast<uint32_t>(p[0]) << 8) | p[1]) >> (8 - shift)) & 0xFF;
+            bw.Write(b, 8);
+        }
+        if (nBits != 0)
+        {
+            uint32_t b = (static_cast<uint32_t>(p[0]) << 8) | (shift + nBits > 8 ? p[1] : 0);
+            bw.Write((b >> (16 - shift - nBits)) & (0xFF >> (8 - nBits)), nBits);
+        }
+    };
+
+    // run through the segments
+    int frameNo = 0;
+    for (auto &seg : segs)
+    {
+        // Frames from this source can only be copied if the source uses
+        // the same format version and the same header as the new stream
+        const uint8_t *src = seg.src->data;
+        bool sameHeader = seg.src->formatVersion == 0x9400 && memcmp(src + 2, header, 16) == 0;
+
+        // The sample data starts after the frame count and header.  Figure
+        // its size in bits, so that we can make sure that each frame is
+        // entirely within the stream data before copying its bits.
+        const uint8_t *sampleData = src + 18;
+        uint64_t sampleDataBits = static_cast<uint64_t>(seg.src->nBytes - 18) * 8;
+
+        // Scan the source stream.  We have to start at the first frame
+        // even if the segment starts later, to follow the band type codes
+        // through the skipped frames.
+        bool ok = true;
+        uint16_t prevCodes[16] ={ 0 };
+        decoders[seg.osVer]->ScanStreamFrames(DCSDecoder::ROMPointer(0, src),
+            [&](const DCSDecoderNative::StreamFrameInfo &fi)
+        {
+            // stop at the end of the segment
+            if (fi.frameNum >= seg.endFrame)
+                return false;
+
+            // process frames within the segment
+            if (fi.frameNum >= seg.startFrame)
             {
-                if (statusPtr != nullptr) *statusPtr = OpenStreamStatus::Error;
-                return Status(OpenStreamStatus::Error);
+                // Check whether we can copy the frame.  Its band type codes
+                // will stay the same, but the deltas that encode them are
+                // relative to the previous frame in the new stream, so each
+                // new delta has to be within the codebook's range.  For Type
+                // 1 streams, the scaling in bands 0-2 also depends on the
+                // previous frame's codes, through the pre-adjustment map,
+                // so the map entries have to match those from the source.
+                bool copy = sameHeader;
+                for (int band = 0 ; copy && band < nBands ; ++band)
+                {
+                    int delta = fi.bandType[band] - bw.bandTypeCode[band];
+                    if (fi.bandType[band] > 15 || delta < -16 || delta > 14)
+                        copy = false;
+                    else if (type1 && band < 3 && preAdjMap[bw.bandTypeCode[band]] != preAdjMap[prevCodes[band]])
+                        copy = false;
+                }
+
+                if (copy)
+                {
+                    // Figure the size of the frame's original header, which
+                    // consists of the delta codes from the previous frame in
+                    // the source stream.  The samples follow.
+                    uint32_t headerBits = 0;
+                    bool valid = true;
+                    for (int band = 0 ; band < nBands ; ++band)
+                    {
+                        int delta = fi.bandType[band] - prevCodes[band];
+                        if (delta < -16 || delta > 14)
+                            valid = false;
+                        else
+                            headerBits += frameHeaderCodes94[delta + 16].nBits;
+                    }
+
+                    // make sure the frame is within the stream data
+                    if (!valid || static_cast<uint64_t>(fi.bitOffset) + fi.nBits > sampleDataBits || headerBits > fi.nBits)
+                    {
+                        errorMessage = format("Frame %d of the source stream is corrupted or truncated", fi.frameNum);
+                        ok = false;
+                        return false;
+                    }
+
+                    // write the new header, relative to the new previous frame
+                    for (int band = 0 ; band < nBands ; ++band)
+                    {
+                        bw.Write(frameHeaderCodes94[fi.bandType[band] - bw.bandTypeCode[band] + 16]);
+                        bw.bandTypeCode[band] = fi.bandType[band];
+                    }
+
+                    // copy the samples
+                    CopyBits(sampleData, fi.bitOffset + headerBits, fi.nBits - headerBits);
+                    ++st.nCopied;
+                }
+                else
+                {
+                    // re-encode the frame under the new header
+                    float f[256];
+                    DecompressedToFrame(fi.coefficients, f);
+                    Stream::Frame frame(f, bw.params);
+                    if (!CompressFrame94(bw, frameNo, frame, errorMessage))
+                    {
+                        ok = false;
+                        return false;
+                    }
+                    ++st.nReencoded;
+                }
+                ++frameNo;
             }
+
+            // remember the source stream's codes for the next frame
+            memcpy(prevCodes, fi.bandType, sizeof(prevCodes));
+            return true;
+        });
+
+        if (!ok)
+            return false;
+    }
+
+    // store the result
+    bw.Flush();
+    if (!bw.Store(dcsObj, frameNo, errorMessage))
+        return false;
+
+    // success
+    st.nFrames = frameNo;
+    return true;
+}
+
+// Encode a synthetic signal
+bool DCSEncoder::EncodeSignal(const SignalParams &signal, DCSAudio &dcsObj, std::string &errorMessage)
+{
+    // validate the parameters
+    if (signal.duration <= 0.0f || signal.duration > 600.0f)
+    {
+        errorMessage = "Invalid signal duration (must be greater than 0 and no more than 600 seconds)";
+        return false;
+    }
+    if (signal.freq <= 0.0f || signal.freq >= 15625.0f || signal.freq2 <= 0.0f || signal.freq2 >= 15625.0f)
+    {
+        errorMessage = "Invalid signal frequency (must be above 0 Hz and below the 15625 Hz Nyquist limit)";
+        return false;
+    }
+
+    // Create the stream.  We generate the samples directly at the DCS
+    // sample rate, so there's no rate conversion involved.
+    std::unique_ptr<Stream> stream(OpenStream(31250, errorMessage));
+    if (stream == nullptr)
+        return false;
+
+    // figure the sample counts for the whole signal and the fades
+    const double rate = 31250.0;
+    const int nSamples = static_cast<int>(signal.duration * rate + 0.5);
+    const int nFade = static_cast<int>(signal.fade * rate + 0.5);
+
+    // noise generator state (32-bit xorshift), which mustn't be zero
+    uint32_t rng = signal.seed != 0 ? signal.seed : 1;
+
+    // Generate the samples.  The oscillator phase is tracked in cycles
+    // (0..1), as a double, to keep long tones free of drift.
+    double phase = 0.0;
+    const double sweepRatio = static_cast<double>(signal.freq2) / signal.freq;
+    float buf[256];
+    int nBuf = 0;
+    for (int i = 0 ; i < nSamples ; ++i)
+    {
+        // figure the instantaneous frequency; for a sweep, this moves
+        // exponentially from freq to freq2 over the signal duration
+        double f = signal.freq;
+        if (signal.wave == SignalParams::Wave::Sweep)
+            f = signal.freq * pow(sweepRatio, static_cast<double>(i) / nSamples);
+
+        // generate the raw waveform sample, -1..+1
+        double s = 0.0;
+        switch (signal.wave)
+        {
+        case SignalParams::Wave::Sine:
+        case SignalParams::Wave::Sweep:
+            s = sin(2.0 * 3.14159265358979323846 * phase);
+            break;
+
+        case SignalParams::Wave::Square:
+            s = phase < 0.5 ? 1.0 : -1.0;
+            break;
+
+        case SignalParams::Wave::Sawtooth:
+            s = 2.0 * phase - 1.0;
+            break;
+
+        case SignalParams::Wave::Noise:
+            rng ^= rng << 13;
+            rng ^= rng >> 17;
+            rng ^= rng << 5;
+            s = static_cast<double>(rng) / 2147483648.0 - 1.0;
+            break;
+
+        case SignalParams::Wave::Silence:
+            s = 0.0;
+            break;
         }
 
-        // success
-        return Status(OpenStreamStatus::OK);
+        // advance the oscillator
+        phase += f / rate;
+        phase -= floor(phase);
+
+        // apply the level and the fade-in/fade-out envelope
+        double env = signal.level;
+        if (nFade > 0 && i < nFade)
+            env *= static_cast<double>(i) / nFade;
+        if (nFade > 0 && nSamples - 1 - i < nFade)
+            env *= static_cast<double>(nSamples - 1 - i) / nFade;
+
+        // buffer the sample, and send the buffer to the encoder when full
+        buf[nBuf++] = static_cast<float>(s * env);
+        if (nBuf == _countof(buf))
+        {
+            WriteStream(stream.get(), buf, nBuf);
+            nBuf = 0;
+        }
     }
 
-    // not a DCS file
-    return Status(OpenStreamStatus::UnsupportedFormat, "Not a raw DCS stream file");
+    // write the last partial buffer
+    if (nBuf != 0)
+        WriteStream(stream.get(), buf, nBuf);
+
+    // close the stream to generate the compressed result
+    return CloseStream(stream.get(), dcsObj, errorMessage);
 }
 
 
@@ -604,12 +1244,12 @@ DCSEncoder::Stream *DCSEncoder::OpenStream(int sampleRate, std::string &errorMes
     };
 
     // create a new stream
-    std::unique_ptr<Stream> stream(new (std::nothrow) Stream(sampleRate));
+    std::unique_ptr<Stream> stream(new (std::nothrow) Stream(sampleRate, resampler));
     if (stream == nullptr)
         return Error(OpenStreamStatus::OutOfMemory, "Out of memory");
 
     // we can't proceed if we couldn't create a libsamplerate context
-    if (stream->lsrState == nullptr)
+    if (stream->lsrState == nullptr && stream->polyphase == nullptr)
         return Error(OpenStreamStatus::LibSampleRateError, "Error creating libsamplerate context");
 
     // indicate success and release the stream object to the caller's custody
@@ -636,7 +1276,7 @@ void DCSEncoder::WriteStream(Stream *stream, const int16_t *pcm, size_t numSampl
         // convert a batch of samples to float
         size_t cur;
         for (cur = 0 ; cur < _countof(floatBuf) && numSamples != 0 ; ++cur, --numSamples)
-            floatBuf[cur++] = static_cast<float>(*pcm++) / 32768.0f;
+            floatBuf[cur] = static_cast<float>(*pcm++) / 32768.0f;
 
         // write the batch
         WriteStream(stream, floatBuf, cur, false);
@@ -687,7 +1327,7 @@ void DCSEncoder::WriteStream(Stream *stream, const float *pcm, size_t numSamples
         // process the samples
         d.output_frames_gen = 0;
         d.input_frames_used = 0;
-        if (src_process(stream->lsrState, &d) != 0)
+        if (!Resample(stream, d))
             return;
 
         // buffer the output
@@ -706,34 +1346,211 @@ void DCSEncoder::WriteStream(Stream *stream, const float *pcm, size_t numSamples
     }
 }
 
-// scaling factor pre-adjustment maps for stream subtypes 0 and 3
-static const uint16_t preAdjMap0[16] ={
-    0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1
-};
-static const uint16_t preAdjMap3[16] ={
-   0, 0, 0, 0, 1, 2, 3, 4, 4, 4, 4, 4, 4, 4, 4, 4
-};
+// Polyphase filter design.  The filter is a Kaiser-windowed sinc,
+// designed around the DCS band structure.  The DCS frame divides the
+// spectrum into 16 bands of about 977 Hz each (with the 1994 format
+// merging the top two), so we center the transition band on the DCS
+// Nyquist frequency, 15625 Hz, and make it one band wide on either
+// side.  That keeps the passband flat up through band 14, and anything
+// that aliases past the Nyquist frequency folds back into band 15
+// only, which is the band that the encoder gives the fewest bits, and
+// the first to be dropped under the power band cutoff.  The stopband
+// attenuation is set to about the dynamic range of 16-bit audio.
+// Compared to libsamplerate's best sinc converter, which puts its whole
+// transition band below the Nyquist frequency, the wider transition
+// needs far fewer taps: 152 per output sample from 44100 Hz.
+static const double polyphaseTransition = 15625.0 / 16.0;
+static const double polyphaseAttenuation = 100.0;
+
+// Largest number of phases we'll use for a polyphase filter.  The
+// phase count is the numerator of the rate ratio in lowest terms,
+// which is 625 for 44100 Hz and 125 for 48000 Hz.
+static const int polyphaseMaxPhases = 625;
+
+std::shared_ptr<const DCSEncoder::PolyphaseFilter> DCSEncoder::PolyphaseFilter::Get(int sampleRate)
+{
+    // We only handle downsampling, from a reasonable range of rates.
+    // Upsampling from a lower rate would need the cutoff placed at the
+    // source Nyquist frequency instead, and those rates are rare enough
+    // that we can leave them to libsamplerate.
+    if (sampleRate <= 31250 || sampleRate > 192000)
+        return nullptr;
 
-bool DCSEncoder::CloseStream(Stream *stream, DCSAudio &obj, std::string &errorMessage)
+    // reduce the ratio to lowest terms, and make sure it's small enough
+    int a = 31250, b = sampleRate;
+    while (b != 0)
+    {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    int L = 31250 / a, M = sampleRate / a;
+    if (L > polyphaseMaxPhases)
+        return nullptr;
+
+    // check for an existing filter for this rate
+    static std::mutex cacheMutex;
+    static std::map<int, std::shared_ptr<const PolyphaseFilter>> cache;
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (auto it = cache.find(sampleRate); it != cache.end())
+        return it->second;
+
+    // Figure the Kaiser window parameters for the attenuation and the
+    // transition width, relative to the source rate.  The tap count is
+    // rounded up to a multiple of 8 for the inner loop.
+    const double pi = 3.14159265358979323846;
+    double A = polyphaseAttenuation;
+    double beta = 0.1102 * (A - 8.7);
+    double dw = 2.0 * pi * (2.0 * polyphaseTransition) / sampleRate;
+    int nTaps = (static_cast<int>(ceil((A - 7.95) / (2.285 * dw))) + 7) & ~7;
+
+    // zeroth-order modified Bessel function of the first kind, for the window
+    auto I0 = [](double x)
+    {
+        double sum = 1.0, term = 1.0;
+        for (int k = 1 ; k < 50 && term > sum * 1e-12 ; ++k)
+        {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+        }
+        return sum;
+    };
+
+    // Build the phase tables.  The output for phase p falls p/L of the way
+    // from input sample i to i+1, and its taps cover inputs i+1-nTaps/2
+    // through i+nTaps/2, so tap j is at distance p/L + nTaps/2 - 1 - j from
+    // the output, in input sample units.  Each phase is normalized to unity
+    // gain at DC, so that the sub-filters match exactly.
+    auto f = std::make_shared<PolyphaseFilter>();
+    f->L = L;
+    f->M = M;
+    f->nTaps = nTaps;
+    f->coeffs.resize(static_cast<size_t>(L) * nTaps);
+    double fc = 15625.0 / sampleRate;
+    double halfWidth = nTaps / 2.0;
+    double i0Beta = I0(beta);
+    std::vector<double> tmp(nTaps);
+    for (int p = 0 ; p < L ; ++p)
+    {
+        float *h = &f->coeffs[static_cast<size_t>(p) * nTaps];
+        double sum = 0.0;
+        for (int j = 0 ; j < nTaps ; ++j)
+        {
+            double t = static_cast<double>(p) / L + halfWidth - 1 - j;
+            double x = 2.0 * fc * t;
+            double sinc = (x == 0.0) ? 1.0 : sin(pi * x) / (pi * x);
+            double u = t / halfWidth;
+            double w = (u * u < 1.0) ? I0(beta * sqrt(1.0 - u * u)) / i0Beta : 0.0;
+            tmp[j] = 2.0 * fc * sinc * w;
+            sum += tmp[j];
+        }
+        for (int j = 0 ; j < nTaps ; ++j)
+            h[j] = static_cast<float>(tmp[j] / sum);
+    }
+
+    cache.emplace(sampleRate, f);
+    return f;
+}
+
+// Polyphase filter inner loop: the dot product of nTaps input samples and
+// coefficients, where nTaps is a multiple of 8
+static inline float PolyphaseDot(const float *x, const float *h, int nTaps)
+{
+#if DCSENCODER_USE_SSE
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    for (int j = 0 ; j < nTaps ; j += 8)
+    {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(x + j), _mm_loadu_ps(h + j)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(x + j + 4), _mm_loadu_ps(h + j + 4)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#else
+    float acc[8] ={ 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int j = 0 ; j < nTaps ; j += 8)
+    {
+        for (int k = 0 ; k < 8 ; ++k)
+            acc[k] += x[j + k] * h[j + k];
+    }
+    return ((acc[0] + acc[4]) + (acc[1] + acc[5])) + ((acc[2] + acc[6]) + (acc[3] + acc[7]));
+#endif
+}
+
+bool DCSEncoder::Resample(Stream *stream, SRC_DATA &d)
 {
-    // Flush any partially processed samples still pending in the
-    // libsamplerate context by writing a final zero-length input
-    // buffer with the EOF flag set.
-    WriteStream(stream, static_cast<const float *>(nullptr), 0, true);
+    // use libsamplerate if we don't have a polyphase filter
+    if (stream->polyphase == nullptr)
+        return src_process(stream->lsrState, &d) == 0;
+
+    // Add the new input to the buffer.  We always take all of it, since
+    // we only buffer as much as the filter needs.  At the end of the
+    // input, add zeroes for the taps past the last sample, so that the
+    // last output is centered on the last input sample.
+    const PolyphaseFilter &f = *stream->polyphase;
+    std::vector<float> &in = stream->polyInput;
+    in.insert(in.end(), d.data_in, d.data_in + d.input_frames);
+    d.input_frames_used = d.input_frames;
+    if (d.end_of_input && !stream->polyEOF)
+    {
+        in.insert(in.end(), f.nTaps/2, 0.0f);
+        stream->polyEOF = true;
+    }
 
-    // If we have any samples buffered in a partial final input
-    // frame, fill out the remainder of the frame with silence, 
-    // and encode the frame.  Note that the buffer always starts
-    // with 16 samples, representing the overlap with the prior
-    // frame, so a frame with 16 samples is effectively empty.
-    if (stream->nInputBuf != 16)
+    // generate outputs until we run out of input or output space
+    long nOut = 0;
+    size_t pos = stream->polyPos;
+    int phase = stream->polyPhase;
+    const size_t nTaps = static_cast<size_t>(f.nTaps);
+    while (nOut < d.output_frames && pos + nTaps <= in.size())
     {
-        // fill out the rest of the frame with zeroes
-        while (stream->nInputBuf < 256)
-            stream->inputBuf[stream->nInputBuf++] = 0;
+        d.data_out[nOut++] = PolyphaseDot(&in[pos], &f.coeffs[static_cast<size_t>(phase) * nTaps], f.nTaps);
+        phase += f.M;
+        pos += phase / f.L;
+        phase %= f.L;
+    }
+    d.output_frames_gen = nOut;
 
-        // transform the frame into frequency-domain samples
-        TransformFrame(stream);
+    // Discard the input that's no longer needed.  Do this in batches, so
+    // that we're not shifting the buffer on every call.
+    if (pos >= 4096)
+    {
+        in.erase(in.begin(), in.begin() + pos);
+        pos = 0;
+    }
+    stream->polyPos = pos;
+    stream->polyPhase = phase;
+    return true;
+}
+
+bool DCSEncoder::CloseStream(Stream *stream, DCSAudio &obj, std::string &errorMessage)
+{
+    // Finish the analysis pass, unless the frames came from the
+    // analysis cache, in which case they're already complete.
+    if (!stream->analysisComplete)
+    {
+        // Flush any partially processed samples still pending in the
+        // libsamplerate context by writing a final zero-length input
+        // buffer with the EOF flag set.
+        WriteStream(stream, static_cast<const float *>(nullptr), 0, true);
+
+        // If we have any samples buffered in a partial final input
+        // frame, fill out the remainder of the frame with silence, 
+        // and encode the frame.  Note that the buffer always starts
+        // with 16 samples, representing the overlap with the prior
+        // frame, so a frame with 16 samples is effectively empty.
+        if (stream->nInputBuf != 16)
+        {
+            // fill out the rest of the frame with zeroes
+            while (stream->nInputBuf < 256)
+                stream->inputBuf[stream->nInputBuf++] = 0;
+
+            // transform the frame into frequency-domain samples
+            TransformFrame(stream);
+        }
+
+        // the frame list is now complete
+        stream->analysisComplete = true;
     }
 
     // get the normalization table for the format version
@@ -761,10 +1578,11 @@ bool DCSEncoder::CloseStream(Stream *stream, DCSAudio &obj, std::string &errorMe
             powerBelow += rmsPower[i] * powerNorm;
 
             // if we've reached the total power cutoff point, discard
-            // the higher-frequency bands
+            // the higher-frequency bands, and this band too unless the
+            // caller asked to keep it
             if (powerBelow >= compressionParams.powerBandCutoff)
             {
-                bandsToKeep = i;
+                bandsToKeep = compressionParams.keepCutoffBand ? i + 1 : i;
                 break;
             }
         }
@@ -1044,7 +1862,7 @@ void DCSEncoder::TransformFrame(Stream *stream)
     // fbuf[1..255] now contains the DCS frame in uncompressed format.
     // Save it in the frame list for compression when we construct the
     // final output stream.
-    auto &frame = stream->frames.emplace_back(&fbuf[1], compressionParams);
+    AddFrame(stream, &fbuf[1]);
 
     // Copy the overlap buffer (the last 16 samples of the current
     // frame, before applying the overlap coefficients) to the start of
@@ -1052,6 +1870,12 @@ void DCSEncoder::TransformFrame(Stream *stream)
     stream->nInputBuf = 16;
     for (int i = 0 ; i < 16 ; ++i)
         stream->inputBuf[i] = overlapBuf[i];
+}
+
+void DCSEncoder::AddFrame(Stream *stream, const float *f)
+{
+    // add the frame to the list
+    auto &frame = stream->frames.emplace_back(f, compressionParams);
 
     // save the power sums and high/low extremes
     bool isFirstFrame = stream->frames.size() == 1;
@@ -1114,12 +1938,13 @@ void DCSEncoder::DFTAlgorithmNew(float outbuf[258], Stream *stream)
         buf[bi++] = *pInput++;
     }
 
-    // pre-calculate the DFT coefficients
-    static bool coeffInited = false;
+    // Pre-calculate the DFT coefficients.  This is done in a static
+    // initializer, so that it's safe when several encoders are running
+    // on separate threads: C++ guarantees that the initializer runs
+    // exactly once, and that other threads wait for it to finish.
     static double coeff[896];
-    if (!coeffInited)
+    [[maybe_unused]] static const bool coeffInited = []()
     {
-        coeffInited = true;
         double *cp = coeff;
         for (int s = 1 ; s <= 7 ; ++s)
         {
@@ -1134,7 +1959,8 @@ void DCSEncoder::DFTAlgorithmNew(float outbuf[258], Stream *stream)
                 }
             }
         }
-    }
+        return true;
+    }();
 
     // Perform a 128-point complex DFT using Cooley-Tukey
     const double *pCoeff = coeff;
@@ -1177,12 +2003,11 @@ void DCSEncoder::DFTAlgorithmNew(float outbuf[258], Stream *stream)
 
     // Initialize the split algorithm coefficients.  These depend only
     // on the loop index in the loop below, so we can pre-compute them
-    // and store them in a static array for fast lookup.
-    static bool inited = false;
+    // and store them in a static array for fast lookup.  (As with the
+    // DFT coefficients, the static initializer makes this thread-safe.)
     static double Ai[128], Ar[128], Bi[128], Br[128];
-    if (!inited)
+    [[maybe_unused]] static const bool inited = []()
     {
-        inited = true;
         for (int k = 0 ; k < 128 ; ++k)
         {
             double th = 3.14159265358979323846 * k / 128;
@@ -1191,7 +2016,8 @@ void DCSEncoder::DFTAlgorithmNew(float outbuf[258], Stream *stream)
             Bi[k] = -Ai[k];
             Br[k] = 1.0 + sin(th);
         }
-    }
+        return true;
+    }();
 
     // Split the real and imaginary parts of the complex DFT to
     // recover the real DFT coefficients.  Apply normalization at
@@ -1376,16 +2202,15 @@ void DCSEncoder::DualFFT(float buf[256], const float inbuf[256])
     // calculate the coefficients for the 7th outer loop iteration even though 
     // we only run the loop 6 times, because we do a sort of half loop pass in
     // an additional post-processing step, where we use the 7th-iteration
-    // coefficients.
+    // coefficients.  The table is built in a static initializer, which makes
+    // it safe for encoders running in parallel on separate threads.
     //
     // The value we call theta is the real value theta in the Euler formula for a 
     // complex exponent, exp(i*theta) = i*cos(theta) + sin(theta).  The Cooley-
     // Tukey FFT coefficient w[j,m] = exp(-2*pi*i*j/m), so theta = -2*pi*j/m.
     static float coeff[896];
-    static bool coeffInited = false;
-    if (!coeffInited)
+    [[maybe_unused]] static const bool coeffInited = []()
     {
-        coeffInited = true;
         float *pCoeff = coeff;
         for (int s = 1 ; s <= 7 ; ++s)
         {
@@ -1400,7 +2225,8 @@ void DCSEncoder::DualFFT(float buf[256], const float inbuf[256])
                 }
             }
         }
-    }
+        return true;
+    }();
 
     // Calculate the FFT, using the Cooley-Tukey iterative in-place
     // algorithm.  C-T is a divide-and-conquer algorithm that divides
@@ -1616,6 +2442,43 @@ int DCSEncoder::FindBestResult(const BandTestResult *results, int nResults)
     return bestResultIndex;
 }
 
+// Frame header codebook for the 1994+ format, indexed by (plain text
+// value + 16).  The plain text value is the change in a band's type
+// code from the previous frame.
+const DCSEncoder::CodebookEntry DCSEncoder::frameHeaderCodes94[31] ={
+    { -16, 0x00050404, 20 },
+    { -15, 0x00050403, 20 },
+    { -14, 0x00282011, 23 },
+    { -13, 0x000a080b, 21 },
+    { -12, 0x00141009, 22 },
+    { -11, 0x00141001, 22 },
+    { -10, 0x00282010, 23 },
+    {  -9, 0x000a0801, 21 },
+    {  -8, 0x000a0805, 21 },
+    {  -7, 0x00028203, 19 },
+    {  -6, 0x00005041, 16 },
+    {  -5, 0x00001411, 14 },
+    {  -4, 0x00000140, 10 },
+    {  -3, 0x00000029,  7 },
+    {  -2, 0x0000000b,  5 },
+    {  -1, 0x00000000,  2 },
+    {   0, 0x00000001,  1 },
+    {   1, 0x00000003,  3 },
+    {   2, 0x00000004,  4 },
+    {   3, 0x00000015,  6 },
+    {   4, 0x00000051,  8 },
+    {   5, 0x000000a1,  9 },
+    {   6, 0x00000283, 11 },
+    {   7, 0x00000505, 12 },
+    {   8, 0x00000a09, 13 },
+    {   9, 0x00002821, 15 },
+    {  10, 0x00141000, 22 },
+    {  11, 0x00014103, 18 },
+    {  12, 0x00050401, 20 },
+    {  13, 0x00014102, 18 },
+    {  14, 0x000a080a, 21 }
+};
+
 // Frame compression for the 1994+ format, used in all original DCS software
 // except the software shipped with the first three games released in 1993
 // (IJTPA, JD, STTNG).  This format is used uniformly in all 26 of the games
@@ -1623,41 +2486,6 @@ int DCSEncoder::FindBestResult(const BandTestResult *results, int nResults)
 bool DCSEncoder::CompressFrame94(BitWriter &bitWriter,
     int frameNo, Stream::Frame &frame, std::string &errorMessage)
 {
-    // Frame header codebook, indexed by (plain text value + 16).
-    static const CodebookEntry frameHeaderCodes[] ={
-        { -16, 0x00050404, 20 },
-        { -15, 0x00050403, 20 },
-        { -14, 0x00282011, 23 },
-        { -13, 0x000a080b, 21 },
-        { -12, 0x00141009, 22 },
-        { -11, 0x00141001, 22 },
-        { -10, 0x00282010, 23 },
-        {  -9, 0x000a0801, 21 },
-        {  -8, 0x000a0805, 21 },
-        {  -7, 0x00028203, 19 },
-        {  -6, 0x00005041, 16 },
-        {  -5, 0x00001411, 14 },
-        {  -4, 0x00000140, 10 },
-        {  -3, 0x00000029,  7 },
-        {  -2, 0x0000000b,  5 },
-        {  -1, 0x00000000,  2 },
-        {   0, 0x00000001,  1 },
-        {   1, 0x00000003,  3 },
-        {   2, 0x00000004,  4 },
-        {   3, 0x00000015,  6 },
-        {   4, 0x00000051,  8 },
-        {   5, 0x000000a1,  9 },
-        {   6, 0x00000283, 11 },
-        {   7, 0x00000505, 12 },
-        {   8, 0x00000a09, 13 },
-        {   9, 0x00002821, 15 },
-        {  10, 0x00141000, 22 },
-        {  11, 0x00014103, 18 },
-        {  12, 0x00050401, 20 },
-        {  13, 0x00014102, 18 },
-        {  14, 0x000a080a, 21 }
-    };
-
     // Sample codebooks (not in the sense of "samples of codebooks", but rather
     // "codebooks for encoding samples").  sampleCodebookN is the codebook for
     // samples of bit width N.  Samples are signed integers, so these encode
@@ -1919,25 +2747,72 @@ bool DCSEncoder::CompressFrame94(BitWriter &bitWriter,
             int refVal = (bitWidth >= 1 && bitWidth <= 6) ? (1 << (bitWidth - 1)) : 0;
 
             // The high byte of the table entry is the band type code, and
-            // the low byte is the scaling code adjustment.  
-            return BandEncoding{ bitWidth, scalingCode + scalingAdj, refVal };
+            // the low byte is the scaling code adjustment.  The adjustments
+            // can carry the scaling code past the top of the table; the
+            // decoder only looks at the low six bits of the sum, so it
+            // simply wraps around.
+            return BandEncoding{ bitWidth, (scalingCode + scalingAdj) & 0x3F, refVal };
         }
     };
 
+    // Get the samples for a band.  A band whose header byte has bit 0x40
+    // set only codes half of its samples, at every other position in the
+    // band, starting with the first; the decoder leaves the positions in
+    // between at zero.  For these bands, we gather the coded positions
+    // into 'buf'.  Other bands just use the frame samples in place.
+    auto GetBandSamples = [&frame, &bitWriter](int band, int firstSample, int &nSamples, float *buf) -> const float*
+    {
+        nSamples = bandSampleCounts94[band];
+        if ((bitWriter.header[band] & 0x40) == 0)
+            return &frame.f[firstSample];
+
+        nSamples /= 2;
+        for (int i = 0 ; i < nSamples ; ++i)
+            buf[i] = frame.f[firstSample + i*2];
+        return buf;
+    };
+
     // Build the frame header.  This consists of one codeword from the
     // frame header codebook per populated band.  The codeword specifies
     // the band sample type, and is given as the DIFFERENCE from the
     // corresponding value in the previous frame's header.
-    for (int band = 0, firstSample = 0 ; band < 16 && (bitWriter.header[band] & 0x7f) != 0x7f ; ++band)
+    //
+    // We also figure the starting position of each band in the frame
+    // buffer as we go.  The bands are normally at fixed positions, but
+    // the decoder only skips over half of a half-size band (see above)
+    // when the band is coded as all zeroes, which moves all of the later
+    // bands down.  That's surely a bug in the original decoder, but it's
+    // how the streams play, so we have to follow suit.
+    int bandStart[16];
+    for (int band = 0, firstSample = 0, usualStart = 0 ; band < 16 && (bitWriter.header[band] & 0x7f) != 0x7f ;
+        usualStart += bandSampleCounts94[band++])
     {
-        // get the nubmer of samples in this band
-        int nSamples = bandSampleCounts94[band];
+        // get the band's samples
+        float halfBuf[16];
+        int nSamples;
+        const float *samples = GetBandSamples(band, firstSample, nSamples, halfBuf);
+        bandStart[band] = firstSample;
+
+        // Figure the dynamic range.  The frame's per-band ranges cover the
+        // bands at their usual positions, so we can only use them for full
+        // bands in their usual places; otherwise figure it from the samples.
+        auto range = frame.range[band];
+        if (samples == halfBuf || firstSample != usualStart)
+        {
+            range ={ samples[0], samples[0] };
+            for (int i = 1 ; i < nSamples ; ++i)
+            {
+                if (samples[i] < range.lo)
+                    range.lo = samples[i];
+                if (samples[i] > range.hi)
+                    range.hi = samples[i];
+            }
+        }
 
         // If this band has a negligible dynamic range (below the minimum
         // threshold set in the parameters), encode it with the special
         // "all zeroes" band type code, which doesn't require any bits in
         // the stream.
-        const auto &range = frame.range[band];
         int oldCode = bitWriter.bandTypeCode[band];
         int newCode;
         if (range.hi - range.lo < params.minimumDynamicRange)
@@ -1952,7 +2827,7 @@ bool DCSEncoder::CompressFrame94(BitWriter &bitWriter,
             // the new type code, the new code can only differ from the old
             // code by -16 to +14.
             newCode = FindBestBandEncoding(params, InterpretBandTypeCode,
-                oldCode - 16, oldCode + 14, band, &frame.f[firstSample], nSamples).bandTypeCode;
+                oldCode - 16, oldCode + 14, band, samples, nSamples).bandTypeCode;
         }
 
         // Figure the difference from the old code, and make sure it's in the valid 
@@ -1967,18 +2842,19 @@ bool DCSEncoder::CompressFrame94(BitWriter &bitWriter,
         }
 
         // write the differential code
-        bitWriter.Write(frameHeaderCodes[delta + 16]);
+        bitWriter.Write(frameHeaderCodes94[delta + 16]);
 
         // save the new code in the stream record
         bitWriter.bandTypeCode[band] = newCode;
 
-        // advance the base sample index
-        firstSample += nSamples;
+        // advance the base sample index; an all-zero half-size band only
+        // advances by the number of samples coded
+        firstSample += (newCode == 0 && samples == halfBuf) ? nSamples : bandSampleCounts94[band];
     }
 
     // Populate the retained bands.  The first non-populated band is marked
     // with 0x7F in the low-order bits of the band's header byte.
-    for (int band = 0, firstSample = 0 ; band < 16 && (bitWriter.header[band] & 0x7f) != 0x7f ; ++band)
+    for (int band = 0 ; band < 16 && (bitWriter.header[band] & 0x7f) != 0x7f ; ++band)
     {
         // interpret the band type code into the encoding parameters for the band
         auto enc = InterpretBandTypeCode(band, bitWriter.bandTypeCode[band]);
@@ -1993,12 +2869,15 @@ bool DCSEncoder::CompressFrame94(BitWriter &bitWriter,
         const SampleCodebook *codebook = (enc.bitWidth >= 1 && enc.bitWidth <= 6) ? &sampleCodebooks[enc.bitWidth - 1] : nullptr;
 
         // if the band contains any samples, write them
-        int nSamples = bandSampleCounts94[band];
         if (enc.bitWidth != 0)
         {
+            // get the band's samples
+            float halfBuf[16];
+            int nSamples;
+            const float *pSample = GetBandSamples(band, bandStart[band], nSamples, halfBuf);
+
             // figure the scaled sample values
             int staging[32];
-            const float *pSample = &frame.f[firstSample];
             for (int i = 0 ; i < nSamples ; ++i)
             {
                 // get the next sample as a signed 16-bit int, scaled by the scaling factor,
@@ -2038,9 +2917,6 @@ bool DCSEncoder::CompressFrame94(BitWriter &bitWriter,
                 }
             }
         }
-
-        // advance the base sample index
-        firstSample += nSamples;
     }
 
     // success
@@ -2528,6 +3404,151 @@ bool DCSEncoder::CompressFrame93a(BitWriter &bitWriter,
 }
 
 
+// --------------------------------------------------------------------------
+//
+// Analysis cache
+//
+
+// Analysis cache file header.  The header is followed by the frames,
+// each stored as the 256 floats of Stream::Frame::f.  The band ranges
+// and power sums aren't stored, since they're cheap to recompute from
+// the frame samples as we load them.
+//
+// Increment the cache version whenever the input side of the encoder
+// changes in a way that affects the transformed frames (the resampler
+// settings, window function, or transform), so that old entries are
+// ignored rather than silently producing different results.
+static const char analysisCacheSignature[8] ={ 'D', 'C', 'S', 'F', 'R', 'M', 'C', '\x1A' };
+static const uint32_t analysisCacheVersion = 2;
+struct AnalysisCacheHeader
+{
+    char signature[8];        // analysisCacheSignature
+    uint32_t cacheVersion;    // analysisCacheVersion
+    uint32_t formatVersion;   // CompressionParams::formatVersion
+    uint64_t sourceHash;      // source file content hash
+    uint64_t sourceSize;      // source file size in bytes
+    uint32_t nFrames;         // number of frames following
+    uint32_t frameSize;       // size of each frame in bytes
+};
+
+bool DCSEncoder::GetAnalysisCacheKey(const char *filename, AnalysisCacheKey &key) const
+{
+    // The cache is disabled if there's no directory.  It's also bypassed
+    // when a non-default resampler is selected, since the frames it holds
+    // are from the default resampler.
+    if (analysisCacheDir.empty() || resampler != Resampler::Auto)
+        return false;
+
+    // open the source file
+    FILE *fp = nullptr;
+    if (fopen_s(&fp, filename, "rb") != 0 || fp == nullptr)
+        return false;
+    std::unique_ptr<FILE, int(*)(FILE*)> ufp(fp, &fclose);
+
+    // Hash the contents with 64-bit FNV-1a.  This isn't a cryptographic
+    // hash, but that's not a concern here, since we're only trying to
+    // detect whether a file has changed.  We also check the file size
+    // against the cache header, for a little extra assurance.
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    uint64_t size = 0;
+    std::unique_ptr<uint8_t[]> buf(new uint8_t[65536]);
+    for (size_t n ; (n = fread(buf.get(), 1, 65536, fp)) != 0 ; size += n)
+    {
+        const uint8_t *p = buf.get();
+        for (size_t i = 0 ; i < n ; ++i)
+        {
+            hash ^= *p++;
+            hash *= 0x100000001b3ULL;
+        }
+    }
+    if (ferror(fp))
+        return false;
+
+    // build the cache file name from the hash and format version
+    key.hash = hash;
+    key.size = size;
+    key.cacheFile = (std::filesystem::path(analysisCacheDir)
+        / format("%016llx-%04x.dcsframes", static_cast<unsigned long long>(hash), compressionParams.formatVersion)).string();
+    return true;
+}
+
+DCSEncoder::Stream *DCSEncoder::LoadAnalysisCache(const AnalysisCacheKey &key)
+{
+    // open the cache file; if it doesn't exist, it's a cache miss
+    FILE *fp = nullptr;
+    if (fopen_s(&fp, key.cacheFile.c_str(), "rb") != 0 || fp == nullptr)
+        return nullptr;
+    std::unique_ptr<FILE, int(*)(FILE*)> ufp(fp, &fclose);
+
+    // read and validate the header
+    AnalysisCacheHeader hdr;
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1
+        || memcmp(hdr.signature, analysisCacheSignature, sizeof(hdr.signature)) != 0
+        || hdr.cacheVersion != analysisCacheVersion
+        || hdr.formatVersion != static_cast<uint32_t>(compressionParams.formatVersion)
+        || hdr.sourceHash != key.hash
+        || hdr.sourceSize != key.size
+        || hdr.frameSize != sizeof(Stream::Frame::f))
+        return nullptr;
+
+    // Create the stream.  The sample rate doesn't matter, since we won't
+    // be writing any PCM input to it.
+    std::unique_ptr<Stream> stream(new (std::nothrow) Stream(31250, Resampler::Auto));
+    if (stream == nullptr)
+        return nullptr;
+
+    // Load the frames.  AddFrame() recomputes the per-frame and stream
+    // statistics in the same order as the original analysis pass, so
+    // the results are identical to what TransformFrame() produced.
+    float f[256];
+    for (uint32_t i = 0 ; i < hdr.nFrames ; ++i)
+    {
+        if (fread(f, sizeof(f), 1, fp) != 1)
+            return nullptr;
+        AddFrame(stream.get(), f);
+    }
+
+    // the analysis is complete, so the stream is ready to compress
+    stream->analysisComplete = true;
+    return stream.release();
+}
+
+void DCSEncoder::SaveAnalysisCache(const AnalysisCacheKey &key, const Stream *stream) const
+{
+    // make sure the cache directory exists
+    std::error_code ec;
+    std::filesystem::create_directories(analysisCacheDir, ec);
+
+    // Write to a temporary file, and rename it into place when done,
+    // so that an interrupted write can't leave a truncated entry.
+    std::string tmpFile = key.cacheFile + ".tmp";
+    FILE *fp = nullptr;
+    if (fopen_s(&fp, tmpFile.c_str(), "wb") != 0 || fp == nullptr)
+        return;
+
+    // write the header
+    AnalysisCacheHeader hdr;
+    memcpy(hdr.signature, analysisCacheSignature, sizeof(hdr.signature));
+    hdr.cacheVersion = analysisCacheVersion;
+    hdr.formatVersion = static_cast<uint32_t>(compressionParams.formatVersion);
+    hdr.sourceHash = key.hash;
+    hdr.sourceSize = key.size;
+    hdr.nFrames = static_cast<uint32_t>(stream->frames.size());
+    hdr.frameSize = sizeof(Stream::Frame::f);
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+
+    // write the frames
+    for (auto it = stream->frames.begin() ; ok && it != stream->frames.end() ; ++it)
+        ok = fwrite(it->f, sizeof(it->f), 1, fp) == 1;
+
+    // close the file, and move it into place if everything worked
+    ok = (fclose(fp) == 0) && ok;
+    if (ok)
+        std::filesystem::rename(tmpFile, key.cacheFile, ec);
+    if (!ok || ec)
+        std::filesystem::remove(tmpFile, ec);
+}
+
 // --------------------------------------------------------------------------
 //
 // Raw frequency-domain frame
@@ -38,6 +38,7 @@
 #include <string>
 #include <memory>
 #include <list>
+#include <vector>
 #include <functional>
 #include "../libsamplerate/src/samplerate.h"
 
@@ -156,6 +157,20 @@ public:
 		// force the encoder to retain all of the bands.
 		float powerBandCutoff = 0.97f;
 
+		// Keep the cutoff band.  By default, the encoder also drops
+		// the band where the cumulative power reaches the cutoff, so
+		// it keeps somewhat less than the powerBandCutoff fraction of
+		// the power, and a cutoff of 1.0 can still lose the top band.
+		// That's the behavior that existing soundtracks were built
+		// with, so it stays the default.  Set this to true to keep
+		// the cutoff band as well.  This matters most when re-encoding
+		// material that's already band-limited, such as a DCS stream
+		// being converted to another format version: all of the power
+		// is in the bands the original encoding kept, so the default
+		// rule drops the top one of those on every generation, and a
+		// signal with power in only one band comes out silent.
+		bool keepCutoffBand = false;
+
 		// Target bit rate, in bits per second.  The encoder uses
 		// this to set the initial frequency band scaling factors, 
 		// which determine the approximate number of bits needed to
@@ -180,6 +195,54 @@ public:
 	};
 	CompressionParams compressionParams;
 
+	// Analysis cache directory.  If this is set, EncodeFile() and
+	// EncodeWAVFile() save the transformed (frequency-domain) frames
+	// for each input file in this directory, and reuse them the next
+	// time the same file is encoded.  The frame transform depends only
+	// on the source audio and the format version, not on the rest of
+	// the compression parameters, so a cache hit skips straight to the
+	// compression stage.  This makes it fast to re-encode a whole
+	// soundtrack while experimenting with the compression parameters.
+	//
+	// Entries are keyed by a hash of the source file contents plus the
+	// format version, so editing a source file or changing the format
+	// simply creates a new entry.  The cache files are in the native
+	// byte order and float format, so they're not meant to be shared
+	// across machines; stale files can be deleted at any time.  An
+	// empty string (the default) disables the cache.
+	std::string analysisCacheDir;
+
+	// Transcoding method for raw DCS streams.  When EncodeDCSFile() or
+	// EncodeDCSStream() has to convert a stream to a different format
+	// version, it normally works entirely in the frequency domain: it
+	// decompresses each frame to its transform coefficients, and then
+	// compresses the coefficients again in the target format, skipping
+	// the PCM stage (and with it the resampling, windowing, and forward
+	// transform).  That's several times faster than a full round trip,
+	// and it's usually a little more accurate, since it avoids a second
+	// generation of windowing and transform errors.  Set this to true
+	// to use the full round trip instead, which decodes the stream to
+	// PCM and encodes the PCM as though it were new audio.  That's
+	// mostly useful for comparison testing.
+	bool transcodeViaPCM = false;
+
+	// Sample rate converter.  All input is converted to the DCS native
+	// rate, 31250 Hz, before the frame transform.  By default (Auto), we
+	// use our own polyphase filter for source rates above the DCS rate
+	// that reduce to a small rational ratio to it, which covers the
+	// common 44100 and 48000 Hz rates, and libsamplerate's best-quality
+	// sinc converter for everything else.  The other settings force one
+	// of the libsamplerate converters at every rate, which is mostly
+	// useful for comparison testing.  The analysis cache only holds
+	// results from the Auto setting, so it's bypassed for the others.
+	enum class Resampler
+	{
+		Auto,         // polyphase filter where applicable, otherwise SincBest
+		SincBest,     // libsamplerate SRC_SINC_BEST_QUALITY
+		SincMedium,   // libsamplerate SRC_SINC_MEDIUM_QUALITY
+	};
+	Resampler resampler = Resampler::Auto;
+
 	// Encode an MP3, Ogg Vorbis, FLAC, or WAV file.  The function inspects
 	// the file's contents to determine which audio format is uses and
 	// transcodes the audio data into a DCS stream.  On success, the new DCS
@@ -207,11 +270,50 @@ public:
 	// stream object from the loaded data.  If the stream uses a format
 	// version that's compatible with the current encoding parameters, the
 	// original raw data stream is returned without any re-encoding.  If it
-	// uses an incompatible version, we'll automatically decode the stream
-	// and re-encode it using the current encoding parameters.
+	// uses an incompatible version, we'll automatically transcode the
+	// stream using the current encoding parameters (see transcodeViaPCM).
 	bool EncodeDCSFile(const char *filename, DCSAudio &dcsObj, 
 		std::string &errorMessage, OpenStreamStatus *statusPtr = nullptr);
 
+	// Encode DCS stream data in memory.  This does the same thing as
+	// EncodeDCSFile(), for stream data that's already been loaded: 'data'
+	// points to the stream, starting with the frame count prefix, as it
+	// appears in the ROM or in the data section of a raw DCS stream file,
+	// and formatVersion is the stream's format version code (0x9301,
+	// 0x9302, or 0x9400, as in CompressionParams::formatVersion).
+	bool EncodeDCSStream(const uint8_t *data, size_t nBytes, uint16_t formatVersion,
+		DCSAudio &dcsObj, std::string &errorMessage, OpenStreamStatus *statusPtr = nullptr);
+
+	// Encode a synthetic test signal into a DCS audio stream.  This
+	// generates the PCM signal directly at the DCS sample rate, so it
+	// doesn't need any input file.  It's meant for building test and
+	// benchmark ROMs that don't depend on any outside audio material.
+	// The generator is fully deterministic (including the noise source,
+	// which uses a fixed seed), so the same parameters always yield the
+	// same stream.
+	struct SignalParams
+	{
+		// waveform type
+		enum class Wave
+		{
+			Sine,        // pure tone
+			Square,      // square wave at 'freq'
+			Sawtooth,    // sawtooth wave at 'freq'
+			Sweep,       // exponential sine sweep from 'freq' to 'freq2'
+			Noise,       // white noise
+			Silence      // digital silence
+		};
+		Wave wave = Wave::Sine;
+
+		float freq = 440.0f;      // frequency in Hz; starting frequency for a sweep
+		float freq2 = 4000.0f;    // ending frequency in Hz for a sweep
+		float duration = 1.0f;    // length in seconds
+		float level = 0.5f;       // peak amplitude, as a fraction of full scale
+		float fade = 0.01f;       // fade-in/fade-out time in seconds, to avoid clicks at the ends
+		uint32_t seed = 1;        // random number seed for noise
+	};
+	bool EncodeSignal(const SignalParams &signal, DCSAudio &dcsObj, std::string &errorMessage);
+
 	// Determine if a file is a raw DCS stream file, containing an audio
 	// stream extracted in raw format from a DCS ROM by DCS Explorer.
 	// Returns true if it has a valid DCS raw stream file header, false if
@@ -223,6 +325,85 @@ public:
 	// (0x9301 for 1993a, 0x9302 for 1993b, 0x9400 for 1994+).
 	static bool IsDCSFile(const char *filename, int *formatVersion = nullptr);
 
+	// Save a DCS audio stream to a raw DCS stream file, in the same
+	// format that DCS Explorer uses for raw stream extraction, so that
+	// the file can be read back with EncodeDCSFile().  formatVersion is
+	// the stream's format version code, as in CompressionParams.
+	// Returns true on success; on failure, fills in errorMessage and
+	// returns false.
+	static bool SaveDCSFile(const char *filename, const DCSAudio &dcsObj,
+		uint16_t formatVersion, std::string &errorMessage);
+
+	// Load a raw DCS stream file, as written by SaveDCSFile() or by DCS
+	// Explorer's raw stream extraction, without any re-encoding.  On
+	// success, fills in dcsObj with the stream data, exactly as stored
+	// in the file, and formatVersion with the stream's format version
+	// code.  Returns false, with an error message, if the file can't be
+	// read or isn't a raw DCS stream file.
+	static bool LoadDCSFile(const char *filename, DCSAudio &dcsObj,
+		uint16_t &formatVersion, std::string &errorMessage);
+
+	// Splice streams in compressed form.  This builds a new stream from
+	// a list of segments, each a range of frames from an existing stream,
+	// played back to back.  It's for trimming a stream, or joining two or
+	// more streams, without a round trip through PCM.
+	//
+	// DCS frames are almost independent of one another.  The only stream
+	// state that carries from one frame to the next is the set of band
+	// type codes, which each frame codes as deltas from the previous
+	// frame; and the frame's samples are only meaningful under the stream
+	// header that they were compressed for.  The 16-sample overlap between
+	// frames is part of the decoder's transform, not the stream, so it
+	// takes care of itself at a join, just as it does between any two
+	// frames.  So a frame can be moved into a new stream with the same
+	// header by rewriting its band type deltas relative to the frame that
+	// now precedes it, and copying the rest of its bits unchanged.  The
+	// only exceptions are frames where a new delta would fall outside the
+	// range the codebook can express, or where the previous frame's codes
+	// change the frame's scaling (Type 1 streams scale bands 0-2 partly
+	// according to the previous frame's codes).  Those frames, and all
+	// frames from streams with a different header or format version, are
+	// decompressed and compressed again under the new stream's header,
+	// using the quantization settings in compressionParams.  Copied frames
+	// decode exactly as they did in the original stream; re-encoded frames
+	// pick up one generation of quantization error.
+	//
+	// The new stream uses the header of the 1994+ source stream that
+	// contributes the most frames, so that as many frames as possible can
+	// be copied, or the header of the stream for segment 'headerSegment'
+	// (an index into the segment list), if that's zero or higher.  A
+	// header determines which frequency bands the stream can represent,
+	// and at what scale, so frames re-encoded from a stream of a very
+	// different character can lose some of their high end; selecting the
+	// header explicitly lets the caller trade more re-encoding for a
+	// better fit.  If none of the segments come from 1994+ streams, the
+	// frames are all re-encoded, with the stream header chosen by the
+	// usual analysis, as though transcoding one long stream.  The result
+	// is always in the 1994+ format, so compressionParams.formatVersion
+	// must be set to 0x9400.
+	struct SpliceSegment
+	{
+		// Source stream data, starting with the frame count prefix, and its
+		// format version code, as in EncodeDCSStream()
+		const uint8_t *data = nullptr;
+		size_t nBytes = 0;
+		uint16_t formatVersion = 0x9400;
+
+		// Range of frames to take from the stream: from startFrame up to
+		// but not including endFrame.  -1 for endFrame takes the frames
+		// through the end of the stream.
+		int startFrame = 0;
+		int endFrame = -1;
+	};
+	struct SpliceStats
+	{
+		int nFrames = 0;       // frames in the new stream
+		int nCopied = 0;       // frames copied from the source streams
+		int nReencoded = 0;    // frames decompressed and compressed again
+	};
+	bool SpliceDCSStreams(const std::vector<SpliceSegment> &segments, DCSAudio &dcsObj,
+		std::string &errorMessage, SpliceStats *stats = nullptr, int headerSegment = -1);
+
 	// Begin a new audio stream.  Creates and returns a new stream object, 
 	// which can be used to write PCM data into a DCS object.  If an error 
 	// occurs, returns null and fills in the error string with a descriptive 
@@ -275,18 +456,48 @@ protected:
 		int nBits;
 	};
 
+	// Polyphase FIR decimation filter, for converting to the DCS rate
+	// from a source rate with an exact ratio of L/M to it.  This works
+	// as though the input were upsampled by L, low-pass filtered, and
+	// downsampled by M, but it only computes the outputs that survive
+	// the downsampling, using one of the L sub-filters ("phases") for
+	// each.  The filter tables depend only on the source rate, so they're
+	// built once per rate and shared among all streams.
+	struct PolyphaseFilter
+	{
+		// Get the filter for a source rate.  Returns null if the rate
+		// doesn't have a suitable ratio, in which case the caller should
+		// use libsamplerate instead.
+		static std::shared_ptr<const PolyphaseFilter> Get(int sampleRate);
+
+		int L = 1;                   // interpolation factor (number of phases)
+		int M = 1;                   // decimation factor
+		int nTaps = 0;               // taps per phase, a multiple of 8
+		std::vector<float> coeffs;   // coefficients, nTaps per phase, phase 0 first
+	};
+
 	// Stream descriptor.  This encpasulates a stream in progress.
 	struct Stream
 	{
-		Stream(int sampleRate);
+		Stream(int sampleRate, Resampler resampler);
 		~Stream();
 
-		// libsamplerate context
+		// libsamplerate context, if we're not using a polyphase filter
 		SRC_STATE *lsrState = nullptr;
 
 		// sample rate ratio between the input stream and the DCS native rate
 		double sampleRateRatio = 1.0;
 
+		// Polyphase filter, if the source rate has one.  polyInput holds
+		// the input samples that the next outputs still need; polyPos is
+		// the index in polyInput of the first sample under the filter for
+		// the next output, and polyPhase is its phase.
+		std::shared_ptr<const PolyphaseFilter> polyphase;
+		std::vector<float> polyInput;
+		size_t polyPos = 0;
+		int polyPhase = 0;
+		bool polyEOF = false;
+
 		// Buffered input samples.  We collect input samples here, after
 		// conversion to the DCS sample rate, until we have enough samples
 		// to form a complete frame, at which point we send them to the
@@ -328,6 +539,11 @@ protected:
 			float power[16];
 		};
 		std::list<Frame> frames;
+
+		// Analysis complete.  This is set when the frame list was loaded
+		// from the analysis cache, in which case there's no PCM input
+		// left to flush when the stream is closed.
+		bool analysisComplete = false;
 	};
 
 	// Bit writer.  DCS streams are encoded in code words of varying
@@ -406,6 +622,42 @@ protected:
 	// frame and adds it to the stream's sample list.
 	void TransformFrame(Stream *stream);
 
+	// Add a transformed frame to the stream's frame list, and update the
+	// stream's power sums and band ranges
+	void AddFrame(Stream *stream, const float *f);
+
+	// Convert a block of input samples to the DCS rate.  This has the
+	// same interface as libsamplerate's src_process(), using the fields
+	// of 'd' the same way, but it runs the stream's polyphase filter if
+	// it has one.  Returns false on error.
+	static bool Resample(Stream *stream, SRC_DATA &d);
+
+	// Analysis cache key.  This identifies the cache entry for a source
+	// file: the cache file name, plus the source file's content hash and
+	// size, which are also stored in the cache file header so that we
+	// can verify that an entry really matches its source.
+	struct AnalysisCacheKey
+	{
+		std::string cacheFile;
+		uint64_t hash = 0;
+		uint64_t size = 0;
+	};
+
+	// Get the analysis cache key for a source file.  This hashes the
+	// file contents.  Returns false if the cache is disabled or the file
+	// can't be read.
+	bool GetAnalysisCacheKey(const char *filename, AnalysisCacheKey &key) const;
+
+	// Load a stream from the analysis cache.  Returns a new stream,
+	// populated with the cached frames and ready for CloseStream(), or
+	// null if there's no valid entry for the key.
+	Stream *LoadAnalysisCache(const AnalysisCacheKey &key);
+
+	// Save a closed stream's frames to the analysis cache.  The cache is
+	// only an optimization, so a failure here isn't an error; we simply
+	// skip the save if anything goes wrong.
+	void SaveAnalysisCache(const AnalysisCacheKey &key, const Stream *stream) const;
+
 	// Perform the DCS Discrete Fourier Transform (DFT), using "algorithm 3"
 	// from my DCS technical reference document.  This is a much simpler
 	// approach from the inverse decoder algorithm, but accomplishes the
@@ -446,6 +698,11 @@ protected:
 	bool CompressFrame94(BitWriter &bitWriter,
 		int frameNo, Stream::Frame &frame, std::string &errorMessage);
 
+	// Frame header codebook for the 94+ version, indexed by the change in
+	// a band's type code from the previous frame, plus 16.  This is shared
+	// with SpliceDCSStreams(), which rewrites the headers of copied frames.
+	static const CodebookEntry frameHeaderCodes94[31];
+
 	// 93a version - used for IJTPA and JD only
 	bool CompressFrame93a(BitWriter &bitWriter, 
 		int frameNo, Stream::Frame &frame, std::string &errorMessage);
@@ -7,12 +7,145 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <limits.h>
+#include <string.h>
 #include <string>
+#include <algorithm>
 #include "DCSTokenizer.h"
 #include "DCSEncoder.h"
 #include "DCSCompiler.h"
 
 
+// Keyword names, in the order of the Keyword enum
+static const char *const keywordNames[] = {
+	"",
+	"channel",
+	"default",
+	"defer",
+	"deferred",
+	"encoding",
+	"end",
+	"forever",
+	"indirect",
+	"loop",
+	"ms",
+	"noise",
+	"parameters",
+	"play",
+	"queue",
+	"replaces",
+	"sawtooth",
+	"sec",
+	"SetChannelTimer",
+	"SetMixingLevel",
+	"SetVariable",
+	"signature",
+	"silence",
+	"sine",
+	"square",
+	"StartDeferred",
+	"steps",
+	"stop",
+	"stream",
+	"sweep",
+	"synth",
+	"table",
+	"track",
+	"var",
+	"wait",
+	"WriteDataPort",
+};
+static_assert(sizeof(keywordNames)/sizeof(keywordNames[0]) == static_cast<size_t>(DCSTokenizer::Keyword::NumKeywords),
+	"keywordNames[] must have one entry per Keyword enum value");
+
+// Keyword hash table.  This is a perfect hash table - every keyword has
+// a slot to itself - built the first time it's needed.  The hash is a
+// case-insensitive FNV-1a hash with an adjustable seed; we build the
+// table by trying seeds in order until we find one that places every
+// keyword in a different slot.  With a few dozen keywords in a table of
+// 256 slots, a suitable seed turns up after a handful of tries.  Since
+// the seed search is deterministic, any change to the keyword list will
+// simply select a new seed the next time the program runs.
+//
+// The hash folds case by setting bit 5 of each character, which maps
+// upper-case letters to lower-case.  That also aliases a few non-letter
+// characters, but the keywords are all letters, and anything else that
+// lands in a keyword's slot fails the final comparison anyway.
+namespace {
+	struct KeywordTable
+	{
+		static const uint32_t Size = 256;
+
+		KeywordTable()
+		{
+			for (seed = 0 ; ; ++seed)
+			{
+				// clear the table
+				for (auto &slot : slots)
+					slot = DCSTokenizer::Keyword::None;
+
+				// place the keywords, stopping if we find a collision
+				bool ok = true;
+				maxLength = 0;
+				for (int i = 1 ; ok && i < static_cast<int>(DCSTokenizer::Keyword::NumKeywords) ; ++i)
+				{
+					lengths[i] = static_cast<uint8_t>(strlen(keywordNames[i]));
+					maxLength = std::max(maxLength, static_cast<size_t>(lengths[i]));
+					auto &slot = slots[Hash(keywordNames[i]) & (Size - 1)];
+					ok = (slot == DCSTokenizer::Keyword::None);
+					slot = static_cast<DCSTokenizer::Keyword>(i);
+				}
+
+				// if everything has its own slot, this seed works
+				if (ok)
+					break;
+			}
+		}
+
+		uint32_t Hash(std::string_view name) const
+		{
+			uint32_t h = 2166136261U ^ seed;
+			for (char c : name)
+			{
+				h ^= static_cast<uint8_t>(c) | 0x20;
+				h *= 16777619U;
+			}
+			return h;
+		}
+
+		uint32_t seed;
+		DCSTokenizer::Keyword slots[Size];
+
+		// keyword name lengths, and the longest keyword length
+		uint8_t lengths[static_cast<int>(DCSTokenizer::Keyword::NumKeywords)] = { 0 };
+		size_t maxLength = 0;
+	};
+}
+
+DCSTokenizer::Keyword DCSTokenizer::LookupKeyword(std::string_view name)
+{
+	// anything longer than the longest keyword can't be a keyword, which
+	// saves hashing long identifiers
+	static const KeywordTable table;
+	if (name.size() > table.maxLength)
+		return Keyword::None;
+
+	// find the one keyword that can match
+	auto kw = table.slots[table.Hash(name) & (KeywordTable::Size - 1)];
+
+	// check that it really matches
+	if (kw != Keyword::None && name.size() == table.lengths[static_cast<int>(kw)]
+		&& _strnicmp(name.data(), keywordNames[static_cast<int>(kw)], name.size()) == 0)
+		return kw;
+
+	// not a keyword
+	return Keyword::None;
+}
+
+const char *DCSTokenizer::KeywordName(Keyword kw)
+{
+	return keywordNames[static_cast<int>(kw)];
+}
+
 void DCSTokenizer::ErrorLogger::Log(Level level, const char *where, const char *msg)
 {
 	// format the message to stdout
@@ -87,7 +220,7 @@ void DCSTokenizer::EndStatement()
 	Token tok = Read();
 	if (tok.type != TokType::Punct || tok.text != ";")
 	{
-		Error(EError, "Expected ';' at end of statement, but found \"%s\"; skipping to next ';'", tok.text.c_str());
+		Error(EError, "Expected ';' at end of statement, but found \"%s\"; skipping to next ';'", tok.Str().c_str());
 		SkipStatement();
 	}
 }
@@ -159,7 +292,7 @@ DCSTokenizer::Token DCSTokenizer::ReadSymbol()
 		return tok;
 	else
 	{
-		Error(EWarning, "Expected symbol name, found \"%s\"", tok.text.c_str());
+		Error(EWarning, "Expected symbol name, found \"%s\"", tok.Str().c_str());
 		return Token(TokType::Symbol);
 	}
 }
@@ -171,7 +304,7 @@ DCSTokenizer::Token DCSTokenizer::ReadString()
 		return tok;
 	else
 	{
-		Error(EWarning, "Expected string, found \"%s\"", tok.text.c_str());
+		Error(EWarning, "Expected string, found \"%s\"", tok.Str().c_str());
 		return Token(TokType::String);
 	}
 }
@@ -185,12 +318,12 @@ DCSTokenizer::Token DCSTokenizer::ReadInt()
 	{
 		tok.type = TokType::Int;
 		tok.ival = static_cast<int>(roundf(tok.fval));
-		Error(EError, "Floating-point value %s rounded to integer (%d)", tok.text.c_str(), tok.ival);
+		Error(EError, "Floating-point value %s rounded to integer (%d)", tok.Str().c_str(), tok.ival);
 		return tok;
 	}
 	else
 	{
-		Error(EWarning, "Expected integer value, found \"%s\"", tok.text.c_str());
+		Error(EWarning, "Expected integer value, found \"%s\"", tok.Str().c_str());
 		return Token(TokType::Int);
 	}
 }
@@ -224,7 +357,7 @@ DCSTokenizer::Token DCSTokenizer::ReadFloat()
 	}
 	else
 	{
-		Error(EWarning, "Expected floating-point value, found \"%s\"", tok.text.c_str());
+		Error(EWarning, "Expected floating-point value, found \"%s\"", tok.Str().c_str());
 		return Token(TokType::Float);
 	}
 }
@@ -264,19 +397,19 @@ bool DCSTokenizer::RequirePunct(const char *s)
 	{
 		// no match - un-read the token and log the error
 		Restore(state);
-		Error(EError, "Expected \"%s\", found \"%s\"", s, tok.text.c_str());
+		Error(EError, "Expected \"%s\", found \"%s\"", s, tok.Str().c_str());
 		return false;
 	}
 }
 
-bool DCSTokenizer::RequireSymbol(const char *s)
+bool DCSTokenizer::RequireSymbol(Keyword kw)
 {
 	// remember where we started, in case we decide to un-get the token
 	auto state = Save();
 
 	// read the token and check for a match
 	Token tok = Read();
-	if (tok.type == TokType::Symbol && _stricmp(tok.text.c_str(), s) == 0)
+	if (tok.IsKeyword(kw))
 	{
 		return true;
 	}
@@ -284,19 +417,19 @@ bool DCSTokenizer::RequireSymbol(const char *s)
 	{
 		// no match - un-read the token and log the error
 		Restore(state);
-		Error(EError, "Expected \"%s\", found \"%s\"", s, tok.text.c_str());
+		Error(EError, "Expected \"%s\", found \"%s\"", KeywordName(kw), tok.Str().c_str());
 		return false;
 	}
 }
 
-bool DCSTokenizer::CheckKeyword(const char *s)
+bool DCSTokenizer::CheckKeyword(Keyword kw)
 {
 	// remember where we started, in case we decide to un-get the token
 	auto state = Save();
 
 	// read the token and check for a match
 	Token tok = Read();
-	if (tok.type == TokType::Symbol && _stricmp(tok.text.c_str(), s) == 0)
+	if (tok.IsKeyword(kw))
 	{
 		// it's a match - keep the token
 		return true;
@@ -344,8 +477,11 @@ DCSTokenizer::Token DCSTokenizer::Read()
 		}
 		else if (*p == '"')
 		{
-			// string
-			Token tok(TokType::String);
+			// String.  In the usual case, where there are no stuttered
+			// quotes, the token text can point directly to the string
+			// contents in the file buffer.  If we find any stuttered
+			// quotes, we have to build an un-escaped copy instead.
+			std::string *unescaped = nullptr;
 			for (++p, ++start ; p < endp ; ++p)
 			{
 				// check for quotes
@@ -356,7 +492,9 @@ DCSTokenizer::Token DCSTokenizer::Read()
 					{
 						// stuttered string - copy the part from start to the first quote
 						++p;
-						tok.text.append(start, p - start);
+						if (unescaped == nullptr)
+							unescaped = &unescapedStrings.emplace_back();
+						unescaped->append(start, p - start);
 
 						// start over after the second quote
 						start = p + 1;
@@ -374,12 +512,16 @@ DCSTokenizer::Token DCSTokenizer::Read()
 			if (p < endp && *p == '"')
 				++p;
 
-			// append the rest of the string
-			if (closequote > start)
-				tok.text.append(start, closequote - start);
+			// if we're building an un-escaped copy, append the rest of the string
+			if (unescaped != nullptr)
+			{
+				if (closequote > start)
+					unescaped->append(start, closequote - start);
+				return Token(TokType::String, unescaped->data(), unescaped->data() + unescaped->size());
+			}
 
-			// done
-			return tok;
+			// return a token pointing to the string contents in the buffer
+			return Token(TokType::String, start, closequote);
 		}
 		else if (isdigit(*p) || ((*p == '-' || *p == '+') && p + 1 < endp && (isdigit(p[1]) || p[1] == '.')))
 		{
@@ -550,8 +692,10 @@ DCSTokenizer::Token DCSTokenizer::Read()
 			while (p < endp && (isalpha(*p) || isdigit(*p) || *p == '_'))
 				++p;
 
-			// return the new symbol
-			return Token(TokType::Symbol, start, p);
+			// return the new symbol, noting its keyword ID, if any
+			Token tok(TokType::Symbol, start, p);
+			tok.kw = LookupKeyword(tok.text);
+			return tok;
 		}
 		else
 		{
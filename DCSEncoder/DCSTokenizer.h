@@ -5,9 +5,21 @@
 // encoder's script compiler.  This implements a basic token reader
 // mechanism to read text input using a C-like lexical structure.
 //
+// Tokens don't own their text; they point directly into the loaded
+// file contents, so reading a token doesn't allocate any memory.  (The
+// only exception is a string containing stuttered quotes, which has to
+// be un-escaped into a separate buffer, owned by the tokenizer.)  This
+// means that a token is only valid for the lifetime of the tokenizer
+// that read it, so copy the text into a std::string if it has to be
+// kept longer.  Symbols are looked up in the keyword table as they're
+// read, so the parser can check for keywords with an integer compare.
+//
 
 #pragma once
+#include <stdint.h>
 #include <string>
+#include <string_view>
+#include <list>
 #include <memory>
 
 // Simple input tokenizer
@@ -87,6 +99,59 @@ public:
 	// load a file
 	bool LoadFile(const char *filename, std::string &errorMessage);
 
+	// Keywords.  These are all of the reserved words that the script
+	// compiler's grammar looks for.  Keywords are case-insensitive.
+	enum class Keyword : uint8_t
+	{
+		None,           // not a keyword
+		Channel,
+		Default,
+		Defer,
+		Deferred,
+		Encoding,
+		End,
+		Forever,
+		Indirect,
+		Loop,
+		Ms,
+		Noise,
+		Parameters,
+		Play,
+		Queue,
+		Replaces,
+		Sawtooth,
+		Sec,
+		SetChannelTimer,
+		SetMixingLevel,
+		SetVariable,
+		Signature,
+		Silence,
+		Sine,
+		Square,
+		StartDeferred,
+		Steps,
+		Stop,
+		Stream,
+		Sweep,
+		Synth,
+		Table,
+		Track,
+		Var,
+		Wait,
+		WriteDataPort,
+
+		NumKeywords     // number of entries in the enum (not a keyword)
+	};
+
+	// Look up a keyword by name.  Returns Keyword::None if the name isn't
+	// a keyword.  This uses a perfect hash table, so it only has to do one
+	// string comparison, against the single keyword that hashes to the
+	// same slot.
+	static Keyword LookupKeyword(std::string_view name);
+
+	// get the name of a keyword
+	static const char *KeywordName(Keyword kw);
+
 	enum class TokType
 	{
 		Symbol,		// symbol or keyword
@@ -104,24 +169,20 @@ public:
 			type(type), text(start, end == nullptr ? 0 : end - start), ival(ival), fval(fval)
 		{ }
 
-		Token(const Token &t)
-		{
-			type = t.type;
-			text = t.text;
-			ival = t.ival;
-			fval = t.fval;
-		}
-
 		TokType type;
-		std::string text;   // symbol text, string contents (stripped of quotes and escapes), punctuation mark text
-		int ival;           // integer value, if applicable
-		float fval;         // floating-point value, if applicable
+		std::string_view text;  // symbol text, string contents (stripped of quotes and escapes), punctuation mark text
+		int ival;               // integer value, if applicable
+		float fval;             // floating-point value, if applicable
+		Keyword kw = Keyword::None;  // keyword ID, for a symbol that matches a keyword
+
+		// get a copy of the token text as a std::string
+		std::string Str() const { return std::string(text); }
 
 		// is this a keyword match?
-		bool IsKeyword(const char *kw) { return type == TokType::Symbol && _stricmp(text.c_str(), kw) == 0; }
+		bool IsKeyword(Keyword k) const { return type == TokType::Symbol && kw == k; }
 
 		// is this a punctuation match>?
-		bool IsPunct(const char *s) { return type == TokType::Punct && text == s; }
+		bool IsPunct(const char *s) const { return type == TokType::Punct && text == s; }
 	};
 
 	// At EOF?
@@ -151,12 +212,12 @@ public:
 	// and return true, otherwise return false without changing the
 	// input position.
 	bool CheckPunct(const char *s);
-	bool CheckKeyword(const char *s);
+	bool CheckKeyword(Keyword kw);
 
 	// require a specified token; if present, skips the token and returns
 	// true; if not, shows an error and returns false
 	bool RequirePunct(const char *s);
-	bool RequireSymbol(const char *s);
+	bool RequireSymbol(Keyword kw);
 
 	// filename
 	std::string filename = "no file";
@@ -171,6 +232,12 @@ public:
 	// end pointer
 	const char *endp = nullptr;
 
+	// Un-escaped string buffers.  Strings containing stuttered quotes
+	// can't point directly into the file contents, since the escapes have
+	// to be removed, so we store the un-escaped text here instead.  This
+	// is a list so that the string buffers never move.
+	std::list<std::string> unescapedStrings;
+
 	// current line number
 	int lineNum = 1;
 
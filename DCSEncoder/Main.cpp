@@ -107,6 +107,21 @@ int main(int argc, char **argv)
 			// add the stream directory prefix
 			compiler.streamFilePaths.emplace_back(argp + 13);
 		}
+		else if (strncmp(argp, "--analysis-cache=", 17) == 0)
+		{
+			// set the encoder analysis cache directory
+			compiler.encoder.analysisCacheDir = argp + 17;
+		}
+		else if (strcmp(argp, "--no-optimize") == 0)
+		{
+			// disable the track program optimizer
+			compiler.optimizeTracks = false;
+		}
+		else if (strncmp(argp, "--delta=", 8) == 0)
+		{
+			// write a delta patch against the prototype ROM
+			compiler.deltaPatchFile = argp + 8;
+		}
 		else
 		{
 			// unrecognized option - consume remaining arguments
@@ -134,16 +149,30 @@ int main(int argc, char **argv)
 			"A/V) that the target ROM will run on, so you must choose a prototype ROM\n"
 			"that runs on the same hardware platform you're targeting for the new ROM.\n"
 			"\n"
+			"For testing, the prototype ROM can instead be given as synthetic:<version>,\n"
+			"where <version> is 93a, 93b, 94, or 95, to build the ROM set without any\n"
+			"original ROMs.  The result contains no ADSP-2105 program, so it only plays\n"
+			"back in the native decoder.\n"
+			"\n"
 			"Options:\n"
 			"   -o <file>            set the output file name (default is <romDefFile>.zip)\n"
 			"   -q                   quiet mode (suppress updates on stream encoding)\n"
+			"   --delta=<file>       also write a delta patch file, describing the new ROM images in\n"
+			"                        terms of the prototype ROM images; DCS Explorer can load the\n"
+			"                        new ROM set from the prototype ROM and the patch file\n"
 			"   --patch              patch mode (copies all tracks and streams from the prototype ROM)\n"
 			"   --rom-prefix=<x>     set the prefix string for the sound files generated in the zip\n"
 			"   --rom-size=<size>    set the ROM size to x bytes; valid sizes are 512K and 1M (default),\n"
 			"                        or * to use the same sizes as the corresponding prototype ROMs\n"
 			"   --stream-dir=<dir>   search in directory <dir> when looking for a stream file that's\n"
 			"                        not found in the current directory (this can be specified any\n"
-			"                        number of times, to search in multiple locations)\n",
+			"                        number of times, to search in multiple locations)\n"
+			"   --analysis-cache=<dir>  cache the analyzed audio for each stream file in <dir>, so\n"
+			"                        that re-encoding the same file with different compression\n"
+			"                        parameters skips the decoding and transform steps\n"
+			"   --no-optimize        store the track programs exactly as written in the script,\n"
+			"                        without merging waits, folding loops, or sharing identical\n"
+			"                        programs among track numbers\n",
 			buildDate.YYYYMMDD().c_str(), buildDate.CopyrightYears(2023).c_str());
 		exit(1);
 	}
@@ -166,15 +195,63 @@ int main(int argc, char **argv)
 	// string to receive error message text from various interfaces we call
 	std::string errMsg;
 
-	// Show progress if we're not in quiet mode
-	if (!quietMode)
-		printf("Loading prototype ROM set from %s\n", protoRomFile);
+	// check for a synthetic prototype
+	if (strncmp(protoRomFile, "synthetic:", 10) == 0)
+	{
+		// get the OS version
+		const char *ver = protoRomFile + 10;
+		DCSDecoder::OSVersion osVersion = DCSDecoder::OSVersion::Invalid;
+		if (strcmp(ver, "93a") == 0)
+			osVersion = DCSDecoder::OSVersion::OS93a;
+		else if (strcmp(ver, "93b") == 0)
+			osVersion = DCSDecoder::OSVersion::OS93b;
+		else if (strcmp(ver, "94") == 0)
+			osVersion = DCSDecoder::OSVersion::OS94;
+		else if (strcmp(ver, "95") == 0)
+			osVersion = DCSDecoder::OSVersion::OS95;
+		else
+		{
+			printf("Invalid synthetic prototype version \"%s\" - must be 93a, 93b, 94, or 95\n", ver);
+			exit(1);
+		}
 
-		// load the prototype ROM set
-	if (!compiler.LoadPrototypeROM(protoRomFile, patchMode, errMsg))
+		// there's nothing to patch in a synthetic prototype
+		if (patchMode)
+		{
+			printf("The --patch option can't be used with a synthetic prototype ROM\n");
+			exit(1);
+		}
+
+		// likewise, there's no prototype file to apply a delta patch to
+		if (compiler.deltaPatchFile.size() != 0)
+		{
+			printf("The --delta option can't be used with a synthetic prototype ROM\n");
+			exit(1);
+		}
+
+		// Show progress if we're not in quiet mode
+		if (!quietMode)
+			printf("Creating synthetic prototype ROM for OS%s\n", ver);
+
+		// create the prototype
+		if (!compiler.CreateSyntheticPrototypeROM(osVersion, 0, errMsg))
+		{
+			printf("Error creating synthetic prototype ROM: %s\n", errMsg.c_str());
+			exit(2);
+		}
+	}
+	else
 	{
-		printf("Error loading prototype ROM file %s: %s\n", protoRomFile, errMsg.c_str());
-		exit(2);
+		// Show progress if we're not in quiet mode
+		if (!quietMode)
+			printf("Loading prototype ROM set from %s\n", protoRomFile);
+
+		// load the prototype ROM set
+		if (!compiler.LoadPrototypeROM(protoRomFile, patchMode, errMsg))
+		{
+			printf("Error loading prototype ROM file %s: %s\n", protoRomFile, errMsg.c_str());
+			exit(2);
+		}
 	}
 
 	// Show progress
@@ -240,6 +317,33 @@ int main(int argc, char **argv)
 				r.size == 512*1024 ? "512k" : r.size == 1024*1024 ? "1M" : DCSEncoder::format("%dK", r.size/1024).c_str(),
 				r.size - r.bytesFree, r.bytesFree, r.filename.c_str());
 		}
+		if (!quietMode && compiler.optimizeTracks)
+		{
+			auto &st = compiler.trackOptimizerStats;
+			printf("\nTrack optimizer: %d step%s removed, %d track%s sharing programs, %d bytes saved\n",
+				st.stepsRemoved, st.stepsRemoved == 1 ? "" : "s", st.tracksShared, st.tracksShared == 1 ? "" : "s", st.bytesSaved);
+		}
+		if (!quietMode && patchMode)
+		{
+			auto &st = compiler.reachabilityStats;
+			printf("Prototype streams: %d of %d unreachable, %u bytes reclaimed for new streams\n",
+				st.protoStreamsDropped, st.protoStreams, static_cast<unsigned int>(st.bytesReclaimed));
+			if (st.deadStepsRemoved != 0)
+				printf("Removed %d unreachable step%s from prototype track programs\n", st.deadStepsRemoved, st.deadStepsRemoved == 1 ? "" : "s");
+		}
+		if (compiler.deltaPatchFile.size() != 0)
+		{
+			auto &st = compiler.deltaPatchStats;
+			printf("\nDelta patch written to %s: %u bytes (%.2f%% of the ROM data)\n",
+				compiler.deltaPatchFile.c_str(), static_cast<unsigned int>(st.patchSize),
+				st.romBytes != 0 ? static_cast<double>(st.patchSize) * 100.0 / static_cast<double>(st.romBytes) : 0.0);
+			if (!quietMode)
+			{
+				printf("  %u bytes copied from the prototype, %u filled, %u stored literally\n",
+					static_cast<unsigned int>(st.copiedBytes), static_cast<unsigned int>(st.filledBytes),
+					static_cast<unsigned int>(st.insertedBytes));
+			}
+		}
 		printf("\nROM creation succeeded\n");
 	}
 	else
@@ -35,6 +35,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 #include <string.h>
 #include <memory.h>
 #include <ctype.h>
@@ -47,6 +48,7 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <set>
+#include <map>
 #include <Windows.h>
 #include <conio.h>
 #include "../Utilities/BuildDate.h"
@@ -55,6 +57,9 @@
 #include "../DCSDecoder/DCSDecoder.h"
 #include "../DCSDecoder/DCSDecoderNative.h"
 #include "../DCSDecoder/DCSDecoderEmu.h"
+#include "../DCSDecoder/DCSDecoderPeakCache.h"
+#include "../DCSDecoder/DCSDecoderSession.h"
+#include "OutputWriter.h"
 
 // include the DCSDecoder library and libsamplerate
 #pragma comment(lib, "DCSDecoder")
@@ -68,6 +73,8 @@
 //
 static void Disassemble(FILE *fp, const uint8_t *u2, uint16_t offset, uint16_t length, uint16_t loadAddr);
 static void ExtractTracksOrStreams(bool streams, DCSDecoder *decoder, const char *prefix, const char *format);
+static bool ReplaySession(DCSDecoder *decoder, const char *filename, const std::string &romSignature, bool terse);
+static bool ProfileCycles(const std::list<DCSDecoder::ZipFileData> &zipFileData, const char *filename, bool terse);
 static void IdleTask(void*);
 extern unsigned adsp2100_dasm(char *buffer, unsigned long op);
 
@@ -83,6 +90,11 @@ static HiResTimer hrt;
 // Windows audio interface
 std::unique_ptr<SimpleWindowsAudio> audioPlayer;
 
+// Background writer for file outputs (extracted audio files and the
+// validation log).  This is a static object so that it finishes any
+// pending writes when the program exits, even via exit().
+static OutputWriter outputWriter;
+
 
 // --------------------------------------------------------------------------
 //
@@ -237,12 +249,12 @@ public:
 	std::list<uint8_t> history;
 
 	// display the history
-	void LogHistory(FILE *fp)
+	void LogHistory(OutputWriter::File *fp)
 	{
-		fprintf(fp, "Data port bytes sent to host from %s:", decoder->Name());
+		fp->Printf("Data port bytes sent to host from %s:", decoder->Name());
 		for (auto b : history)
-			fprintf(fp, " %02x", b);
-		fprintf(fp, "\n");
+			fp->Printf(" %02x", b);
+		fp->Printf("\n");
 	}
 
 	// clear the history
@@ -272,10 +284,16 @@ int main(int argc, char **argv)
 	bool listStreams = false;
 	bool listPrograms = false;
 	bool listDITables = false;
+	bool listLevels = false;
+	const char *peakCacheFile = nullptr;
+	const char *deltaPatchFile = nullptr;
+	const char *recordFile = nullptr;
+	const char *replayFile = nullptr;
+	const char *cycleProfileFile = nullptr;
 	const char *decoderVersion = nullptr;
 	bool validationMode = false;
 	const char *validationFile = nullptr;
-	FILE *validationFp = nullptr;
+	std::shared_ptr<OutputWriter::File> validationLog;
 	bool adspDebugMode = false;
 	bool autoplay = false;
 	bool silent = false;
@@ -333,6 +351,36 @@ int main(int argc, char **argv)
 			// generate a track listing with program code listing
 			listPrograms = true;
 		}
+		else if (strcmp(argp, "--levels") == 0)
+		{
+			// generate a loudness and peak level listing
+			listLevels = true;
+		}
+		else if (strncmp(argp, "--delta=", 8) == 0)
+		{
+			// apply a delta patch to the loaded ROM set
+			deltaPatchFile = argp + 8;
+		}
+		else if (strncmp(argp, "--record=", 9) == 0)
+		{
+			// record the session's data port traffic
+			recordFile = argp + 9;
+		}
+		else if (strncmp(argp, "--replay=", 9) == 0)
+		{
+			// replay a recorded session as a benchmark
+			replayFile = argp + 9;
+		}
+		else if (strncmp(argp, "--cycle-profile=", 16) == 0)
+		{
+			// profile the emulator's ADSP-2105 cycles per frame for each track
+			cycleProfileFile = argp + 16;
+		}
+		else if (strncmp(argp, "--peak-cache=", 13) == 0)
+		{
+			// generate/update a waveform peak cache file
+			peakCacheFile = argp + 13;
+		}
 		else if (strcmp(argp, "--ditables") == 0)
 		{
 			// generate a list of Deferred Indirect tables
@@ -419,7 +467,8 @@ int main(int argc, char **argv)
 			// enable validation mode with file capture
 			validationMode = true;
 			validationFile = argv[argi] + 11;
-			if (fopen_s(&validationFp, validationFile, "w") != 0 || validationFp == nullptr)
+			std::string errorMessage;
+			if ((validationLog = outputWriter.Open(validationFile, true, errorMessage)) == nullptr)
 			{
 				printf("Unable to open validation report file \"%s\"\n", validationFile);
 				exit(2);
@@ -564,15 +613,21 @@ int main(int argc, char **argv)
 			"   -s               list streams (same as --streams)\n"
 			"   -t               list tracks (same as --tracks)\n"
 			"   --autoplay       automatically play each track once, exit after last track\n"
+			"   --cycle-profile=<file>     profile ADSP-2105 cycles per frame for each track, write histograms to <file>\n"
 			"   --dasm=<file>    generate disassembly (<file> is optional; default is <rom-zip-file>.dasm\n"
 			"   --decoder=<dec>  select decoder version (--decoder=? lists options)\n"
+			"   --delta=<file>   apply delta patch file <file> (created with DCS Encoder) to the ROMs\n"
 			"   --ditables       list the \"deferred indirect\" tables\n"
 			"   --extract-format=<fmt>     set the stream extract format (raw, wav [default])\n"
 			"   --extract-streams=<pre>    extract all streams to WAV files, prefixing each filename with <pre>\n"
 			"   --extract-tracks=<pre>     extract all tracks to WAV files, prefixing each filename with <pre>\n"
 			"   --ignore-checksum-errors   ignore checksum errors (same as -I)"
 			"   --info           information only; show ROM information and other requested listings, then exit\n"
+			"   --levels         list estimated loudness and peak levels for all streams and tracks\n"
+			"   --peak-cache=<file>        add the ROM's streams to waveform peak cache file <file>\n"
 			"   --programs       show full program opcode listings for all tracks\n"
+			"   --record=<file>  record the data port commands sent during the session to <file>\n"
+			"   --replay=<file>  replay a session recorded with --record, as fast as possible, and report timing\n"
 			"   --silent         run in silent mode (no audio output, for fast validation testing)\n"
 			"   --terse          minimize status reports\n"
 			"   --tracks         show a listing of the tracks found in the ROM catalog\n"
@@ -626,6 +681,13 @@ int main(int argc, char **argv)
 		exit(2);
 	}
 
+	// apply the delta patch, if desired
+	if (deltaPatchFile != nullptr && decoder->ApplyROMPatch(deltaPatchFile, zipFileData, &zipLoadError) != DCSDecoder::ZipLoadStatus::Success)
+	{
+		printf("Unable to apply delta patch: %s\n", zipLoadError.c_str());
+		exit(2);
+	}
+
 	// list the ROM files loaded
 	DCSDecoder::ZipFileData *roms[8] ={ nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
 	for (auto &rd : zipFileData)
@@ -640,7 +702,8 @@ int main(int argc, char **argv)
 	if (!terse)
 	{
 		// show the loaded ROM files
-		printf("Loaded ROM files from %s:\n", romZipFile.c_str());
+		printf("Loaded ROM files from %s%s%s:\n", romZipFile.c_str(),
+			deltaPatchFile != nullptr ? ", patched with " : "", deltaPatchFile != nullptr ? deltaPatchFile : "");
 		for (int i = 0 ; i < 8 ; ++i)
 		{
 			if (roms[i] != nullptr)
@@ -770,6 +833,143 @@ int main(int argc, char **argv)
 			}
 		}
 
+		// list the stream and track levels, if desired
+		if (listLevels)
+		{
+			// The level scan is a feature of the native decoder
+			auto d9xx = dynamic_cast<DCSDecoderNative*>(decoder.get());
+			if (d9xx == nullptr)
+			{
+				printf("A level listing can only be generated when the native decoder is selected\n");
+				exit(2);
+			}
+
+			// initialize the decoder
+			decoder->SoftBoot();
+
+			// Gather the streams, and the streams that each Play track uses.
+			// Use a map to assign each stream an index in the scan list.
+			std::map<uint32_t, size_t> streamIndex;
+			std::vector<DCSDecoder::ROMPointer> streams;
+			std::map<uint16_t, std::list<size_t>> trackStreams;
+			for (uint16_t i = 0 ; i <= maxTrackNum ; ++i)
+			{
+				DCSDecoder::TrackInfo ti;
+				if (decoder->GetTrackInfo(i, ti) && ti.type == 1)
+				{
+					for (auto &instr : decoder->DecompileTrackProgram(i))
+					{
+						if (instr.opcode == 0x01)
+						{
+							// add the stream to the scan list if it's not already there
+							uint32_t addr = ReadU24(&instr.operandBytes[1]);
+							auto it = streamIndex.find(addr);
+							if (it == streamIndex.end())
+							{
+								it = streamIndex.emplace(addr, streams.size()).first;
+								streams.emplace_back(decoder->MakeROMPointer(addr));
+							}
+
+							// add it to the track's list
+							trackStreams[i].emplace_back(it->second);
+						}
+					}
+				}
+			}
+
+			// scan the streams
+			std::vector<DCSDecoderNative::StreamLevels> levels;
+			double t0 = hrt.GetTime_seconds();
+			d9xx->ScanStreamLevels(streams, levels);
+			double t1 = hrt.GetTime_seconds();
+
+			// format a level in decibels, showing silence as a dash
+			auto dB = [](char *buf, size_t bufSize, double db) -> const char*
+			{
+				if (db == -HUGE_VAL || db < -150.0)
+					return "-";
+				sprintf_s(buf, bufSize, "%.1f", db);
+				return buf;
+			};
+			char lufs[20], rms[20], peak[20];
+
+			// list the streams
+			printf("\n----- Stream levels -----\n"
+				"Levels are estimated from the frequency-domain frame data.  Loudness is in LUFS;\n"
+				"RMS and peak are in dB relative to full scale.  The peak is an upper bound, and is\n"
+				"usually several dB above the actual peak.\n\n"
+				"Address           Time (sec)  Loudness     RMS   Peak bound\n");
+			for (auto &s : streamIndex)
+			{
+				auto &l = levels[s.second];
+				auto romPtr = streams[s.second];
+				printf("%06X [U%d %05X]  %9.2f  %8s  %6s  %6s\n",
+					s.first, romPtr.NominalChipNumber(), decoder->ROMPointerOffset(romPtr),
+					static_cast<float>(l.nFrames) * 0.00768f,
+					dB(lufs, sizeof(lufs), l.loudness), 
+					dB(rms, sizeof(rms), l.rms > 0.0 ? 20.0 * log10(l.rms) : -HUGE_VAL),
+					dB(peak, sizeof(peak), l.peakBound > 0.0 ? 20.0 * log10(l.peakBound) : -HUGE_VAL));
+			}
+
+			// List the Play tracks.  The loudness of a track with several
+			// streams is figured by gating the blocks of all of its streams
+			// together, and the peak bound is the highest of the streams.
+			// Note that these are the streams' own levels; they don't take
+			// into account the mixing levels that the track program sets.
+			printf("\n----- Track levels -----\n"
+				"Command  Streams  Loudness   Peak bound\n");
+			for (auto &t : trackStreams)
+			{
+				std::vector<float> blocks;
+				double peakBound = 0.0;
+				for (auto idx : t.second)
+				{
+					auto &l = levels[idx];
+					blocks.insert(blocks.end(), l.blockPower.begin(), l.blockPower.end());
+					peakBound = l.peakBound > peakBound ? l.peakBound : peakBound;
+				}
+				printf("%02x %02x    %7d  %8s  %6s\n",
+					(t.first >> 8) & 0xFF, t.first & 0xFF, static_cast<int>(t.second.size()),
+					dB(lufs, sizeof(lufs), DCSDecoderNative::IntegratedLoudness(blocks)),
+					dB(peak, sizeof(peak), peakBound > 0.0 ? 20.0 * log10(peakBound) : -HUGE_VAL));
+			}
+
+			printf("\nScanned %d streams in %.1f ms\n", static_cast<int>(streams.size()), (t1 - t0) * 1000.0);
+		}
+
+		// update the waveform peak cache, if desired
+		if (peakCacheFile != nullptr)
+		{
+			// the peak cache renders streams with the native decoder
+			auto d9xx = dynamic_cast<DCSDecoderNative*>(decoder.get());
+			if (d9xx == nullptr)
+			{
+				printf("A peak cache can only be generated when the native decoder is selected\n");
+				exit(2);
+			}
+
+			// initialize the decoder
+			decoder->SoftBoot();
+
+			// add all of the streams in the ROM
+			std::vector<uint32_t> streams;
+			for (auto addr : decoder->ListStreams())
+				streams.emplace_back(addr);
+
+			DCSDecoderPeakCache::UpdateStats stats;
+			std::string errorMessage;
+			double t0 = hrt.GetTime_seconds();
+			if (!DCSDecoderPeakCache::Update(peakCacheFile, d9xx, streams, 0, stats, errorMessage))
+			{
+				printf("Error updating peak cache: %s\n", errorMessage.c_str());
+				exit(2);
+			}
+			double t1 = hrt.GetTime_seconds();
+
+			printf("\nPeak cache %s: %d streams (%d already cached, %d added), %d total entries, %.1f ms\n",
+				peakCacheFile, stats.nStreams, stats.nCached, stats.nGenerated, stats.nEntries, (t1 - t0) * 1000.0);
+		}
+
 		// list the tracks, if desired
 		if (listTracks)
 		{
@@ -1004,9 +1204,30 @@ int main(int argc, char **argv)
 	if (extractStreamsPrefix != nullptr)
 		ExtractTracksOrStreams(true, decoder.get(), extractStreamsPrefix, extractFormat);
 
+	// if we're replaying a recorded session, run the replay, and exit
+	if (replayFile != nullptr)
+	{
+		if (recordFile != nullptr)
+			printf("Note: --record can't be used with --replay; ignored\n");
+
+		exit(ReplaySession(decoder.get(), replayFile, sig, terse) ? 0 : 2);
+	}
+
+	// if we're profiling the emulator's cycle usage, run the profile, and exit
+	if (cycleProfileFile != nullptr)
+	{
+		// only one emulator instance can exist at a time, so if the main
+		// decoder is the emulator, discard it before the profiler creates
+		// its own
+		if (dynamic_cast<DCSDecoderEmulated*>(decoder.get()) != nullptr)
+			decoder.reset();
+
+		exit(ProfileCycles(zipFileData, cycleProfileFile, terse) ? 0 : 2);
+	}
+
 	// if we're listing tracks or programs, extracting tracks, or generating
 	// ADSP-2105 disassembly, don't enter interactive mode
-	if (listTracks || listPrograms || listStreams || listDITables
+	if (listTracks || listPrograms || listStreams || listDITables || listLevels || peakCacheFile != nullptr
 		|| dasmFile != nullptr || infoOnly
 		|| extractTracksPrefix != nullptr || extractStreamsPrefix != nullptr)
 		exit(0);
@@ -1053,7 +1274,7 @@ int main(int argc, char **argv)
 		}
 
 		// write a preamble to the log file
-		if (validationFp != nullptr)
+		if (validationLog != nullptr)
 		{
 			time_t t;
 			time(&t);
@@ -1064,7 +1285,7 @@ int main(int argc, char **argv)
 			if (auto *p = strchr(timestr, '\n'); p != nullptr)
 				*p = 0;
 
-			fprintf(validationFp, "DCSExplorer - validation mode log, ROM %s, %s\n"
+			validationLog->Printf("DCSExplorer - validation mode log, ROM %s, %s\n"
 				"Listing frames containing differences in PCM output\n"
 				"%s output shown on left | Reference emulator output shown on right\n\n",
 				romZipFileBase.c_str(), timestr, decoder->Name());
@@ -1105,6 +1326,20 @@ int main(int argc, char **argv)
 	// set up the idle task
 	audioPlayer->SetIdleTask(IdleTask, nullptr);
 
+	// Start recording the session, if desired.  The recording has to
+	// start before the decoder boots, since the replay repeats the boot
+	// sequence from the beginning.
+	DCSDecoderSession::Recorder sessionRecorder;
+	if (recordFile != nullptr)
+	{
+		std::string errorMessage;
+		if (!sessionRecorder.Open(recordFile, decoder.get(), initialVolume, errorMessage))
+		{
+			printf("%s\n", errorMessage.c_str());
+			exit(2);
+		}
+	}
+
 	// boot the decoder and set the default volume
 	decoder->HardBoot();
 	decoder->StartSelfTests();
@@ -1145,11 +1380,11 @@ int main(int argc, char **argv)
 			numRecentCmds += numRecentCmds >= _countof(recentCommands) ? 0 : 1;
 		}
 
-		void PrintCommandLog(FILE *fp)
+		void PrintCommandLog(OutputWriter::File *fp)
 		{
 			if (numRecentCmds != 0)
 			{
-				fprintf(fp, "Recent commands: ");
+				fp->Printf("Recent commands: ");
 				uint64_t fn = UINT64_MAX;
 				int idx = static_cast<int>(recentCmdWrite - numRecentCmds);
 				if (idx < 0)
@@ -1159,12 +1394,12 @@ int main(int argc, char **argv)
 					auto &c = recentCommands[idx];
 					if (c.frameNo != fn)
 					{
-						fprintf(fp, "%sFrame %I64u:", fn == UINT64_MAX ? "" : "; ", c.frameNo);
+						fp->Printf("%sFrame %I64u:", fn == UINT64_MAX ? "" : "; ", c.frameNo);
 						fn = c.frameNo;
 					}
-					fprintf(fp, " %02x", c.cmdByte);
+					fp->Printf(" %02x", c.cmdByte);
 				}
-				fprintf(fp, "\n");
+				fp->Printf("\n");
 			}
 		}
 
@@ -1380,9 +1615,9 @@ int main(int argc, char **argv)
 
 			// if there are any PCM or data port diffs, and we're logging to a file,
 			// log the latest host-to-DCS commands for context
-			if ((nSampleDiffs != 0 || dataPortHasDiffs) && validationFp != nullptr)
+			if ((nSampleDiffs != 0 || dataPortHasDiffs) && validationLog != nullptr)
 			{
-				validationData.PrintCommandLog(validationFp);
+				validationData.PrintCommandLog(validationLog.get());
 				validationData.ClearCommandLog();
 			}
 
@@ -1422,15 +1657,15 @@ int main(int argc, char **argv)
 				validationData.nFrameDiffs += 1;
 
 				// log all difference frames to the file
-				if (validationFp != nullptr)
+				if (validationLog != nullptr)
 				{
 					// log PCM sample differences, if any
 					if (nSampleDiffs != 0)
 					{
-						fprintf(validationFp, "--- Frame %I64u - %d sample differences ---\n", frameNo, nSampleDiffs);
+						validationLog->Printf("--- Frame %I64u - %d sample differences ---\n", frameNo, nSampleDiffs);
 						for (int i = 0 ; i < 240 ; i += 16)
 						{
-							fprintf(validationFp,
+							validationLog->Printf(
 								"%6d %6d %6d %6d %6d %6d %6d %6d %6d %6d %6d %6d %6d %6d %6d %6d | "
 								"%6d %6d %6d %6d %6d %6d %6d %6d %6d %6d %6d %6d %6d %6d %6d %6d\n",
 								mainbuf[i + 0], mainbuf[i + 1], mainbuf[i + 2], mainbuf[i + 3],
@@ -1442,7 +1677,7 @@ int main(int argc, char **argv)
 								refbuf[i + 8], refbuf[i + 9], refbuf[i + 10], refbuf[i + 11],
 								refbuf[i + 12], refbuf[i + 13], refbuf[i + 14], refbuf[i + 15]);
 						}
-						fprintf(validationFp, "\n");
+						validationLog->Printf("\n");
 					}
 				}
 			}
@@ -1467,17 +1702,26 @@ int main(int argc, char **argv)
 			}
 
 			// log differences in the data port traffic
-			if (dataPortHasDiffs && validationFp != nullptr)
+			if (dataPortHasDiffs && validationLog != nullptr)
 			{
-				fprintf(validationFp, "--- Frame %I64u - data port traffic was different ---\n", frameNo);
-				hostIfc.LogHistory(validationFp);
-				refHostIfc.LogHistory(validationFp);
-				fprintf(validationFp, "\n");
+				validationLog->Printf("--- Frame %I64u - data port traffic was different ---\n", frameNo);
+				hostIfc.LogHistory(validationLog.get());
+				refHostIfc.LogHistory(validationLog.get());
+				validationLog->Printf("\n");
 			}
 
 			// clear the data port logs
 			hostIfc.ClearHistory();
 			refHostIfc.ClearHistory();
+
+			// If the log file has run into a write error, report it and stop
+			// logging.  The writes happen in the background, so this is where
+			// we find out about errors.
+			if (validationLog != nullptr && !validationLog->IsOK())
+			{
+				WriteConsole("Validation log file error: %s; logging stopped\n", validationLog->GetError().c_str());
+				validationLog.reset();
+			}
 		}
 		else
 		{
@@ -1510,34 +1754,55 @@ int main(int argc, char **argv)
 		}
 	}
 
+	// finish the session recording
+	if (recordFile != nullptr)
+	{
+		std::string errorMessage;
+		uint64_t nBytes = sessionRecorder.GetNumEvents();
+		if (sessionRecorder.Close(&errorMessage))
+			printf("\nSession recorded to %s (%I64u data port bytes)\n", recordFile, nBytes);
+		else
+			printf("\n%s\n", errorMessage.c_str());
+	}
+
 	// report on the validation status
 	if (validationMode)
 	{
-		// generate a report to the given file output
-		auto Report = [&validationData, &decoder, &refDecoder, &romZipFileBase](FILE *fp) 
+		// generate the report text
+		auto Report = [&validationData, &decoder, &refDecoder, &romZipFileBase]() 
 		{
-			fprintf(fp, "***** Validation Test Report *****\n\n"
+			char buf[1024];
+			sprintf_s(buf, "***** Validation Test Report *****\n\n"
 				"ROM file:          %s\n"
 				"Decoder tested:    %s\n"
 				"Reference decoder: %s\n"
 				"Result:            %s\n\n",
 				romZipFileBase.c_str(), decoder->Name(), refDecoder->Name(),
 				validationData.nFrameDiffs == 0 && validationData.nDataPortDiffs == 0 ? "Validation Succeeded" : "Validation Failed");
+			std::string report = buf;
 
 			if (validationData.nFrameDiffs == 0)
-				fprintf(fp, "No PCM sample differences detected - playback from both sources matched exactly\n");
+				report += "No PCM sample differences detected - playback from both sources matched exactly\n";
 			else
-				fprintf(fp, "PCM sample differences were detected:\n"
+			{
+				sprintf_s(buf, "PCM sample differences were detected:\n"
 					"  Total number of non-matching PCM samples: %I64u\n"
 					"  Number of frames containing differences:  %I64u\n",
 					validationData.nSampleErrors, validationData.nFrameDiffs);
+				report += buf;
+			}
 
 			if (validationData.nDataPortDiffs == 0)
-				fprintf(fp, "No data port traffic differences detected\n");
+				report += "No data port traffic differences detected\n";
 			else
-				fprintf(fp, "Data port traffic differences were detected\n"
+			{
+				sprintf_s(buf, "Data port traffic differences were detected\n"
 					"  Number of frames with differing data port bytes: %I64u\n",
 					validationData.nDataPortDiffs);
+				report += buf;
+			}
+
+			return report;
 		};
 
 		// report to the console
@@ -1553,15 +1818,18 @@ int main(int argc, char **argv)
 		else
 		{
 			// not terse mode OR diffs detected -> show a full report
-			printf("\n\n");
-			Report(stdout);
+			printf("\n\n%s", Report().c_str());
 		}
 
-		// if there's a file, report to the file and close it out
-		if (validationFp != nullptr)
+		// If there's a file, report to the file and close it out.  Wait
+		// for the background writer to finish with it, so that we can
+		// report any errors.
+		if (validationLog != nullptr)
 		{
-			Report(validationFp);
-			fclose(validationFp);
+			validationLog->Write(Report());
+			validationLog->Close();
+			if (!validationLog->Wait())
+				printf("Error writing validation report file: %s\n", validationLog->GetError().c_str());
 		}
 	}
 
@@ -1665,42 +1933,51 @@ static void ExtractTracksOrStreams(bool extractStreams, DCSDecoder *decoderBase,
 	// each one once.
 	std::unordered_set<uint32_t> streams;
 
-	// Extract frames to a wave file
+	// Files in progress.  The writes are carried out in the background
+	// by the output writer, so we don't know whether a file succeeded
+	// until the writer is done with it.  We keep the files in order of
+	// creation, and report each one when it's finished, so the status
+	// lines come out in the same order as the files.
 	int nOk = 0, nError = 0;
-	auto ExtractToWAV = [decoder, &nOk, &nError, mode](const char *filename, const char *desc, uint16_t nFrames)
+	std::list<std::pair<std::shared_ptr<OutputWriter::File>, std::string>> pendingFiles;
+	auto ReportFinished = [&pendingFiles, &nOk, &nError](bool wait)
+	{
+		while (pendingFiles.size() != 0 && (wait || pendingFiles.front().first->IsDone()))
+		{
+			auto &pf = pendingFiles.front();
+			if (pf.first->Wait())
+			{
+				printf("OK %s\n", pf.second.c_str());
+				nOk += 1;
+			}
+			else
+			{
+				printf("Error extracting %s: %s\n", pf.second.c_str(), pf.first->GetError().c_str());
+				nError += 1;
+			}
+			pendingFiles.pop_front();
+		}
+	};
+
+	// Extract frames to a wave file
+	auto ExtractToWAV = [decoder, &nError, &pendingFiles, &ReportFinished](const char *filename, const char *desc, uint16_t nFrames)
 	{
 		// Add two extra frames, to ensure that we finish tapering to 
 		// silence at the end of the stream or track
 		nFrames += 2;
 
 		// open a WAV file to store the output
-		FILE *fp = nullptr;
-		bool ok = true;
-		if (fopen_s(&fp, filename, "wb") != 0 || fp == nullptr)
+		std::string errorMessage;
+		auto file = outputWriter.Open(filename, false, errorMessage);
+		if (file == nullptr)
 		{
-			printf("Unable to open extraction output file \"%s\" (system error %d)\n", filename, errno);
+			printf("%s\n", errorMessage.c_str());
 			nError += 1;
 		}
 		else
 		{
-			// construct the WAV file header
-			uint8_t hdr[44];
-			memset(hdr, 0, sizeof(hdr));
-			memcpy(&hdr[0], "RIFF\0\0\0\0WAVEfmt ", 16);   // RIFF, WAVE, fmt tags
-			*reinterpret_cast<uint32_t*>(&hdr[4]) = nFrames * 240 * 2 + 44 - 8;  // overall file size, minus 8 bytes
-			*reinterpret_cast<uint32_t*>(&hdr[16]) = 16;    // fmt chunk length
-			*reinterpret_cast<uint16_t*>(&hdr[20]) = 1;     // type = 1 (PCM)
-			*reinterpret_cast<uint16_t*>(&hdr[22]) = 1;     // number of channels
-			*reinterpret_cast<uint32_t*>(&hdr[24]) = 31250;    // samples per second
-			*reinterpret_cast<uint32_t*>(&hdr[28]) = 31250 * 16 / 8;   // bytes per second
-			*reinterpret_cast<uint16_t*>(&hdr[32]) = 2;     // block align
-			*reinterpret_cast<uint16_t*>(&hdr[34]) = 16;    // bits per sample
-			memcpy(&hdr[36], "data", 4);                    // data chunk tag
-			*reinterpret_cast<uint32_t*>(&hdr[40]) = nFrames * 240 * 2;   // data chunk length in bytes
-
-			// write the header
-			if (fwrite(hdr, 44, 1, fp) != 1)
-				ok = false;
+			// set up the WAV writer - 31250 samples per second, mono
+			WAVOutput wav(file, 31250, 1);
 
 			// decode and capture that number of frames
 			for (uint16_t frame = 0 ; frame < nFrames ; ++frame)
@@ -1711,8 +1988,7 @@ static void ExtractTracksOrStreams(bool extractStreams, DCSDecoder *decoderBase,
 					buf[si] = decoder->GetNextSample();
 
 				// write the frame
-				if (fwrite(buf, sizeof(buf), 1, fp) != 1)
-					ok = false;
+				wav.WriteSamples(buf, 240);
 
 				// one frame before the end, cancel playback, to ensure that we
 				// taper to silence if the track is looping
@@ -1720,21 +1996,10 @@ static void ExtractTracksOrStreams(bool extractStreams, DCSDecoder *decoderBase,
 					decoder->ClearTracks();
 			}
 
-			// close the file
-			if (fclose(fp) != 0)
-				ok = false;
-
-			// report status
-			if (ok)
-			{
-				printf("OK %s\n", desc);
-				nOk += 1;
-			}
-			else
-			{
-				printf("Error extracting %s\n", desc);
-				nError += 1;
-			}
+			// finish the file, and report on any files that have completed
+			wav.Close();
+			pendingFiles.emplace_back(file, desc);
+			ReportFinished(false);
 		}
 	};
 
@@ -1827,9 +2092,9 @@ static void ExtractTracksOrStreams(bool extractStreams, DCSDecoder *decoderBase,
 						// Extract the raw stream data, without decoding.  This uses
 						// our custom-defined DCS container file format, which is just
 						// some header information plus the raw DCS stream data.
-						FILE *fp = nullptr;
+						std::string errorMessage;
 						strcat_s(filename, "dcs");
-						if (fopen_s(&fp, filename, "wb") == 0 && fp != nullptr)
+						if (auto file = outputWriter.Open(filename, false, errorMessage); file != nullptr)
 						{
 							// Build the header:
 							// 
@@ -1866,24 +2131,20 @@ static void ExtractTracksOrStreams(bool extractStreams, DCSDecoder *decoderBase,
 							hdr[34] = static_cast<uint8_t>((info.nBytes >> 8) & 0xFF);
 							hdr[35] = static_cast<uint8_t>((info.nBytes >> 0) & 0xFF);
 
-							// write the header and stream data
-							if (fwrite(hdr, 1, sizeof(hdr), fp) != sizeof(hdr)
-								|| fwrite(streamPtr.p, 1, info.nBytes, fp) != info.nBytes)
-							{
-								printf("Error writing extraction output file \"%s\" (system error %d)\n", filename, errno);
-								nError += 1;
-							}
+							// Write the header and stream data.  The stream data can be
+							// written straight from the ROM image, since the ROM data
+							// stays loaded for the whole session.
+							file->Write(hdr, sizeof(hdr));
+							file->WriteRef(streamPtr.p, info.nBytes);
+							file->Close();
 
-							// close the file
-							fclose(fp);
-
-							// success
-							printf("OK %s\n", desc);
-							++nOk;
+							// report on any files that have completed
+							pendingFiles.emplace_back(file, desc);
+							ReportFinished(false);
 						}
 						else
 						{
-							printf("Unable to open extraction output file \"%s\" (system error %d)\n", filename, errno);
+							printf("%s\n", errorMessage.c_str());
 							nError += 1;
 						}
 					}
@@ -1929,6 +2190,9 @@ static void ExtractTracksOrStreams(bool extractStreams, DCSDecoder *decoderBase,
 		}
 	}
 
+	// wait for the remaining files to finish
+	ReportFinished(true);
+
 	// print a summary
 	printf("\n*** Extraction summary ***\n"
 		"%-24s%d\n"
@@ -1938,6 +2202,300 @@ static void ExtractTracksOrStreams(bool extractStreams, DCSDecoder *decoderBase,
 		nOk + nError, nOk, nError);
 }
 
+// --------------------------------------------------------------------------
+//
+// Session replay.  This plays back a session recorded with --record,
+// feeding the recorded data port bytes to the decoder at the same
+// sample positions where they arrived in the original session, with no
+// audio output, so that the decoder runs as fast as it can.  Each frame
+// is timed individually, since the worst frames matter as much as the
+// average for real-time playback.  The output checksum lets you check
+// that two replays (with different decoders, or different builds of
+// the same decoder) produced identical PCM output.
+//
+static bool ReplaySession(DCSDecoder *decoder, const char *filename, const std::string &romSignature, bool terse)
+{
+	// load the session
+	DCSDecoderSession session;
+	std::string errorMessage;
+	if (!session.Load(filename, errorMessage))
+	{
+		printf("%s\n", errorMessage.c_str());
+		return false;
+	}
+
+	// check that it was recorded with the same ROM
+	if (session.romSignature != romSignature)
+	{
+		printf("Warning: the session was recorded with ROM \"%s\", which doesn't match the loaded ROM; "
+			"the replay won't reproduce the original session\n", session.romSignature.c_str());
+	}
+	if (session.truncated)
+		printf("Warning: the session file is incomplete (the recording didn't end normally); replaying through the frame with the last byte recorded\n");
+
+	const uint64_t nFrames = (session.endSample + DCSDecoderSession::SamplesPerFrame - 1) / DCSDecoderSession::SamplesPerFrame;
+	if (!terse)
+	{
+		printf("\nReplaying session %s: %I64u data port bytes, %I64u frames (%.2f seconds), recorded with %s\n"
+			"Replay decoder: %s\n",
+			filename, static_cast<uint64_t>(session.events.size()), nFrames,
+			static_cast<double>(session.endSample) / 31250.0, session.decoderName.c_str(), decoder->Name());
+	}
+
+	// Run the replay.  Time each frame, and keep a running FNV-1a hash
+	// of the PCM output (outside of the timed section).
+	std::vector<int64_t> frameTicks;
+	frameTicks.reserve(static_cast<size_t>(nFrames));
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	int64_t tFrame = 0;
+	session.Replay(decoder,
+		[&tFrame]() { tFrame = hrt.GetTime_ticks(); },
+		[&tFrame, &frameTicks, &hash, decoder](const int16_t *buf, int n)
+	{
+		frameTicks.push_back(hrt.GetTime_ticks() - tFrame);
+		for (int i = 0 ; i < n ; ++i)
+		{
+			hash = (hash ^ static_cast<uint8_t>(buf[i] & 0xFF)) * 0x100000001b3ULL;
+			hash = (hash ^ static_cast<uint8_t>((buf[i] >> 8) & 0xFF)) * 0x100000001b3ULL;
+		}
+		return decoder->IsOK();
+	});
+
+	// check for decoder errors
+	if (!decoder->IsOK())
+	{
+		printf("Decoder error at frame %I64u: %s\n",
+			static_cast<uint64_t>(frameTicks.size() - 1), decoder->GetErrorMessage().c_str());
+		return false;
+	}
+	if (frameTicks.size() == 0)
+	{
+		printf("The session is empty\n");
+		return true;
+	}
+
+	// Figure the statistics.  Frames over 7.68ms are the ones that would
+	// have underrun in real-time playback, since that's how long it takes
+	// to play a frame.
+	int64_t totalTicks = 0;
+	size_t worstFrame = 0;
+	uint64_t nOverBudget = 0;
+	const double frameBudget_us = 7680.0;
+	for (size_t i = 0 ; i < frameTicks.size() ; ++i)
+	{
+		totalTicks += frameTicks[i];
+		if (frameTicks[i] > frameTicks[worstFrame])
+			worstFrame = i;
+		if (hrt.TicksToUs(frameTicks[i]) > frameBudget_us)
+			++nOverBudget;
+	}
+	double total_us = hrt.TicksToUs(totalTicks);
+	double audio_us = static_cast<double>(session.endSample) * 32.0;
+
+	// get the percentiles, using the nearest-rank method
+	std::vector<int64_t> sorted = frameTicks;
+	std::sort(sorted.begin(), sorted.end());
+	auto Percentile = [&sorted](double pct) {
+		size_t rank = static_cast<size_t>(ceil(pct / 100.0 * static_cast<double>(sorted.size())));
+		return hrt.TicksToUs(sorted[rank == 0 ? 0 : rank - 1]);
+	};
+
+	// report the results
+	printf("\n*** Replay results ***\n"
+		"Frames decoded:     %I64u (%.2f seconds of audio)\n"
+		"Decoding time:      %.1f ms\n"
+		"Throughput:         %.0f frames/second (%.1fx real time)\n"
+		"Frame time (us):    avg %.1f, p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f (frame %I64u)\n"
+		"Frames over 7.68ms: %I64u\n"
+		"Output checksum:    %016I64x\n",
+		static_cast<uint64_t>(frameTicks.size()), audio_us / 1000000.0,
+		total_us / 1000.0,
+		static_cast<double>(frameTicks.size()) / (total_us / 1000000.0), total_us > 0.0 ? audio_us / total_us : 0.0,
+		total_us / static_cast<double>(frameTicks.size()),
+		Percentile(50.0), Percentile(90.0), Percentile(99.0), Percentile(99.9),
+		hrt.TicksToUs(frameTicks[worstFrame]), static_cast<uint64_t>(worstFrame),
+		nOverBudget, hash);
+
+	return true;
+}
+
+// --------------------------------------------------------------------------
+//
+// ADSP-2105 cycle profile.  This plays each track through the emulator,
+// in strict mode and again with the speedup patch, counting the
+// ADSP-2105 instruction cycles for each frame, and writes a CSV file
+// with a histogram of the frame cycle counts for each track.  Tracks
+// whose worst frame comes close to the original hardware's budget are
+// listed on the console, since those are the code paths most likely to
+// show up as hot spots in the native decoder as well.
+//
+static bool ProfileCycles(const std::list<DCSDecoder::ZipFileData> &zipFileData, const char *filename, bool terse)
+{
+	using CycleProfile = DCSDecoderEmulated::CycleProfile;
+
+	// Flag tracks whose worst frame is at 90% of the budget or above.
+	// Play each track for one iteration, as in autoplay mode, up to a
+	// maximum of 5 minutes.
+	const double nearBudget = 0.90;
+	const uint32_t maxFrames = 39063;
+
+	// open the output file
+	std::string errorMessage;
+	auto file = outputWriter.Open(filename, true, errorMessage);
+	if (file == nullptr)
+	{
+		printf("%s\n", errorMessage.c_str());
+		return false;
+	}
+
+	// track results
+	struct TrackProfile
+	{
+		uint16_t trackNum;
+		uint32_t nFrames;
+		CycleProfile profile[2];   // [0] = strict mode, [1] = speedup enabled
+	};
+	std::vector<TrackProfile> tracks;
+
+	// Run the tracks through the strict emulator, then through the fast
+	// emulator.  The emulator can only be instantiated once at a time,
+	// so the two runs have to be sequential.
+	static const char *const modeName[] ={ "strict", "speedup" };
+	for (int mode = 0 ; mode < 2 ; ++mode)
+	{
+		double t0 = hrt.GetTime_seconds();
+		if (!terse)
+			printf("Profiling ADSP-2105 cycles per frame, %s mode...", modeName[mode]);
+
+		// create the emulator, and load the ROMs
+		DCSDecoder::MinHost host;
+		std::unique_ptr<DCSDecoderEmulated> emu(new DCSDecoderEmulated(&host, mode == 1));
+		for (auto &rd : zipFileData)
+			emu->AddROM(rd.chipNum, rd.data.get(), rd.dataSize);
+		emu->SetDefaultVolume(255);
+		emu->SoftBoot();
+		if (!emu->IsOK())
+		{
+			printf("\nEmulator error: %s\n", emu->GetErrorMessage().c_str());
+			return false;
+		}
+
+		// build the track list on the first pass
+		if (mode == 0)
+		{
+			for (int trackNum = 0 ; trackNum <= emu->GetMaxTrackNumber() ; ++trackNum)
+			{
+				// only profile immediate tracks; deferred tracks don't play on their own
+				DCSDecoder::TrackInfo ti;
+				if (emu->GetTrackInfo(static_cast<uint16_t>(trackNum), ti) && ti.type == 1)
+					tracks.push_back({ static_cast<uint16_t>(trackNum), std::min(ti.time + 1, maxFrames) });
+			}
+		}
+
+		// play each track from a fresh soft boot
+		for (auto &t : tracks)
+		{
+			emu->SoftBoot();
+			emu->EnableCycleProfile(true);
+			emu->GetCycleProfile().Clear();
+			emu->WriteDataPort(static_cast<uint8_t>((t.trackNum >> 8) & 0xFF));
+			emu->WriteDataPort(static_cast<uint8_t>(t.trackNum & 0xFF));
+			for (uint32_t frame = 0 ; frame < t.nFrames && emu->IsOK() ; ++frame)
+			{
+				for (int i = 0 ; i < 240 ; ++i)
+					emu->GetNextSample();
+			}
+
+			if (!emu->IsOK())
+			{
+				printf("\nEmulator error in track %04x: %s\n", t.trackNum, emu->GetErrorMessage().c_str());
+				return false;
+			}
+
+			t.profile[mode] = emu->GetCycleProfile();
+		}
+
+		if (!terse)
+			printf(" %.1f seconds\n", hrt.GetTime_seconds() - t0);
+	}
+
+	// write the CSV header
+	file->Printf("Track,Mode,Frames,MinCycles,AvgCycles,MaxCycles,MaxLoadPct,Status");
+	for (int i = 0 ; i < CycleProfile::NumBuckets ; ++i)
+		file->Printf(",%d%%%s", i * 5, i + 1 == CycleProfile::NumBuckets ? "+" : "");
+	file->Printf("\n");
+
+	// write the tracks
+	auto Status = [nearBudget](const CycleProfile &p) {
+		return p.MaxLoad() > 1.0 ? "OVER" : p.MaxLoad() >= nearBudget ? "NEAR" : "OK";
+	};
+	for (auto &t : tracks)
+	{
+		for (int mode = 0 ; mode < 2 ; ++mode)
+		{
+			auto &p = t.profile[mode];
+			if (p.nFrames == 0)
+				continue;
+
+			file->Printf("%04X,%s,%I64u,%u,%.0f,%u,%.1f,%s", t.trackNum, modeName[mode], p.nFrames,
+				p.minCycles, static_cast<double>(p.totalCycles) / static_cast<double>(p.nFrames),
+				p.maxCycles, p.MaxLoad() * 100.0, Status(p));
+			for (int i = 0 ; i < CycleProfile::NumBuckets ; ++i)
+				file->Printf(",%I64u", p.buckets[i]);
+			file->Printf("\n");
+		}
+	}
+
+	// finish the file
+	file->Close();
+	if (!file->Wait())
+	{
+		printf("%s\n", file->GetError().c_str());
+		return false;
+	}
+
+	// Summarize on the console.  The strict mode figures are the ones
+	// that correspond to the original hardware.
+	const TrackProfile *worst = nullptr;
+	std::vector<const TrackProfile*> flagged;
+	for (auto &t : tracks)
+	{
+		if (t.profile[0].nFrames == 0)
+			continue;
+		if (worst == nullptr || t.profile[0].maxCycles > worst->profile[0].maxCycles)
+			worst = &t;
+		if (t.profile[0].MaxLoad() >= nearBudget)
+			flagged.push_back(&t);
+	}
+
+	printf("\n*** ADSP-2105 cycle profile ***\n"
+		"Frame budget:    %u cycles (7.68ms at 10 MHz)\n"
+		"Tracks profiled: %d\n",
+		DCSDecoderEmulated::FrameCycleBudget, static_cast<int>(tracks.size()));
+	if (worst != nullptr)
+	{
+		printf("Worst frame:     track %04X, %u cycles (%.1f%% of budget; %u cycles with speedup)\n",
+			worst->trackNum, worst->profile[0].maxCycles, worst->profile[0].MaxLoad() * 100.0, worst->profile[1].maxCycles);
+	}
+	if (flagged.size() != 0)
+	{
+		printf("\nTracks with frames at %.0f%% of the budget or more:\n", nearBudget * 100.0);
+		for (auto t : flagged)
+		{
+			auto &p = t->profile[0];
+			printf("  %04X  max %u cycles (%.1f%%)%s, avg %.0f; with speedup max %u (%.1f%%)\n",
+				t->trackNum, p.maxCycles, p.MaxLoad() * 100.0, p.MaxLoad() > 1.0 ? " OVER BUDGET" : "",
+				static_cast<double>(p.totalCycles) / static_cast<double>(p.nFrames),
+				t->profile[1].maxCycles, t->profile[1].MaxLoad() * 100.0);
+		}
+	}
+	else
+		printf("No tracks came within %.0f%% of the budget\n", (1.0 - nearBudget) * 100.0);
+	printf("Histograms written to %s\n", filename);
+
+	return true;
+}
+
 // --------------------------------------------------------------------------
 // 
 // Disassembly
@@ -0,0 +1,380 @@
+// Copyright 2023 Michael J Roberts
+// BSD 3-clause license - NO WARRANTY
+//
+// DCS Explorer - asynchronous file output
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
+#include "OutputWriter.h"
+
+// pooled data buffer
+struct OutputWriter::Buffer
+{
+	Buffer(size_t size) : data(new uint8_t[size]), size(size) { }
+
+	std::unique_ptr<uint8_t[]> data;
+	size_t size;
+	size_t len = 0;
+};
+
+OutputWriter::OutputWriter(size_t bufferSize, size_t maxBuffers) :
+	bufferSize(bufferSize), maxBuffers(maxBuffers)
+{
+	thread = std::thread([this]() { ThreadMain(); });
+}
+
+OutputWriter::~OutputWriter()
+{
+	// close any files that the producer left open
+	for (auto &w : files)
+	{
+		if (auto f = w.lock(); f != nullptr && !f->closed)
+			f->Close();
+	}
+
+	// let the thread finish the queue, and wait for it to exit
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		quit = true;
+	}
+	workCv.notify_all();
+	thread.join();
+
+	// free the pool
+	for (auto b : pool)
+		delete b;
+}
+
+std::shared_ptr<OutputWriter::File> OutputWriter::Open(const char *filename, bool text, std::string &errorMessage)
+{
+	// open the file
+	FILE *fp = nullptr;
+	if (fopen_s(&fp, filename, text ? "w" : "wb") != 0 || fp == nullptr)
+	{
+		errorMessage = std::string("Unable to open output file \"") + filename
+			+ "\" (system error " + std::to_string(errno) + ")";
+		return nullptr;
+	}
+
+	// Turn off stdio buffering.  We hand the data to stdio in large
+	// chunks anyway, so a stdio buffer would only add an extra copy.
+	setvbuf(fp, nullptr, _IONBF, 0);
+
+	// create the file object
+	std::shared_ptr<File> file(new File(this, filename, fp));
+
+	// add it to our list of open files, dropping any expired entries
+	files.erase(std::remove_if(files.begin(), files.end(), [](const std::weak_ptr<File> &w) { return w.expired(); }), files.end());
+	files.emplace_back(file);
+
+	// return the new file
+	return file;
+}
+
+OutputWriter::Buffer *OutputWriter::GetBuffer()
+{
+	// If the pool is empty and at its size limit, wait for the writer
+	// thread to return a buffer.  Otherwise use a buffer from the pool if
+	// there is one, or allocate a new one.
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		doneCv.wait(lock, [this]() { return pool.size() != 0 || nBuffers < maxBuffers; });
+		if (pool.size() != 0)
+		{
+			auto b = pool.back();
+			pool.pop_back();
+			b->len = 0;
+			return b;
+		}
+		++nBuffers;
+	}
+	return new Buffer(bufferSize);
+}
+
+void OutputWriter::Enqueue(Op &&op)
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		queue.emplace_back(std::move(op));
+	}
+	workCv.notify_one();
+}
+
+void OutputWriter::Flush()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	doneCv.wait(lock, [this]() { return queue.size() == 0 && nBusy == 0; });
+}
+
+void OutputWriter::ThreadMain()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;)
+	{
+		// wait for work
+		workCv.wait(lock, [this]() { return queue.size() != 0 || quit; });
+		if (queue.size() == 0)
+			break;
+
+		// take the next operation off the queue
+		Op op = std::move(queue.front());
+		queue.pop_front();
+		++nBusy;
+
+		// carry it out with the queue unlocked
+		lock.unlock();
+		Execute(op);
+		op.file.reset();
+		lock.lock();
+
+		// return the buffer to the pool
+		if (op.buf != nullptr)
+			pool.push_back(op.buf);
+
+		// let waiters know that an operation has completed
+		--nBusy;
+		doneCv.notify_all();
+	}
+}
+
+void OutputWriter::Execute(Op &op)
+{
+	File *f = op.file.get();
+	switch (op.type)
+	{
+	case Op::Type::Data:
+		// Write a buffer.  Once a write has failed, skip any further
+		// writes, since the first error is the one worth reporting.
+		if (f->ok && fwrite(op.buf->data.get(), 1, op.buf->len, f->fp) != op.buf->len)
+			f->SetError("writing");
+		break;
+
+	case Op::Type::Ref:
+		// write the caller's data directly
+		if (f->ok && fwrite(op.ref, 1, op.len, f->fp) != op.len)
+			f->SetError("writing");
+		break;
+
+	case Op::Type::Patch:
+		// overwrite earlier data, then go back to the end of the file
+		if (f->ok)
+		{
+			if (_fseeki64(f->fp, static_cast<int64_t>(op.offset), SEEK_SET) != 0
+				|| fwrite(op.patch.data(), 1, op.patch.size(), f->fp) != op.patch.size()
+				|| _fseeki64(f->fp, 0, SEEK_END) != 0)
+				f->SetError("updating");
+		}
+		break;
+
+	case Op::Type::Close:
+		// close the file
+		if (fclose(f->fp) != 0 && f->ok)
+			f->SetError("closing");
+		f->fp = nullptr;
+		f->done = true;
+		break;
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Output file
+//
+
+OutputWriter::File::~File()
+{
+	// if the file was never closed, close it now, discarding any buffered data
+	if (fp != nullptr)
+		fclose(fp);
+	delete cur;
+}
+
+void OutputWriter::File::Write(const void *data, size_t len)
+{
+	const uint8_t *p = static_cast<const uint8_t*>(data);
+	while (len != 0)
+	{
+		// get a buffer if we don't have one
+		if (cur == nullptr)
+			cur = writer->GetBuffer();
+
+		// copy as much as will fit
+		size_t copy = std::min(len, cur->size - cur->len);
+		memcpy(cur->data.get() + cur->len, p, copy);
+		cur->len += copy;
+		size += copy;
+		p += copy;
+		len -= copy;
+
+		// if the buffer is full, send it to the writer
+		if (cur->len == cur->size)
+			FlushBuffer();
+	}
+}
+
+void OutputWriter::File::WriteRef(const void *data, size_t len)
+{
+	// send any buffered data first, to keep everything in order
+	FlushBuffer();
+
+	// queue the reference
+	Op op{ Op::Type::Ref };
+	op.file = shared_from_this();
+	op.ref = static_cast<const uint8_t*>(data);
+	op.len = len;
+	writer->Enqueue(std::move(op));
+	size += len;
+}
+
+void OutputWriter::File::Printf(const char *fmt, ...)
+{
+	// get a buffer if we don't have one
+	if (cur == nullptr)
+		cur = writer->GetBuffer();
+
+	// try formatting directly into the space left in the current buffer
+	va_list va;
+	va_start(va, fmt);
+	size_t avail = cur->size - cur->len;
+	int n = vsnprintf(reinterpret_cast<char*>(cur->data.get() + cur->len), avail, fmt, va);
+	va_end(va);
+	if (n < 0)
+		return;
+
+	// if it fit, just count it; note that vsnprintf needs room for the null
+	if (static_cast<size_t>(n) < avail)
+	{
+		cur->len += n;
+		size += n;
+		return;
+	}
+
+	// It didn't fit.  Format it into a temporary string instead, and
+	// write that.  This only happens when a line straddles the end of
+	// a buffer, so the extra copy is rare.
+	std::string s(static_cast<size_t>(n) + 1, '\0');
+	va_start(va, fmt);
+	vsnprintf(&s[0], s.size(), fmt, va);
+	va_end(va);
+	Write(s.data(), static_cast<size_t>(n));
+}
+
+void OutputWriter::File::Patch(uint64_t offset, const void *data, size_t len)
+{
+	// send the buffered data first, so that the patched area has been written
+	FlushBuffer();
+
+	// queue the patch, with a private copy of the data
+	Op op{ Op::Type::Patch };
+	op.file = shared_from_this();
+	op.offset = offset;
+	op.patch.assign(static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + len);
+	writer->Enqueue(std::move(op));
+}
+
+void OutputWriter::File::FlushBuffer()
+{
+	if (cur != nullptr)
+	{
+		if (cur->len != 0)
+		{
+			// hand off the buffer to the writer thread
+			Op op{ Op::Type::Data };
+			op.file = shared_from_this();
+			op.buf = cur;
+			writer->Enqueue(std::move(op));
+		}
+		else
+		{
+			// empty buffer - just return it to the pool
+			std::unique_lock<std::mutex> lock(writer->mutex);
+			writer->pool.push_back(cur);
+		}
+		cur = nullptr;
+	}
+}
+
+void OutputWriter::File::Close()
+{
+	if (!closed)
+	{
+		FlushBuffer();
+		Op op{ Op::Type::Close };
+		op.file = shared_from_this();
+		writer->Enqueue(std::move(op));
+		closed = true;
+	}
+}
+
+bool OutputWriter::File::Wait()
+{
+	std::unique_lock<std::mutex> lock(writer->mutex);
+	writer->doneCv.wait(lock, [this]() { return done.load(); });
+	return ok;
+}
+
+void OutputWriter::File::SetError(const char *activity)
+{
+	std::string msg = std::string("Error ") + activity + " output file \"" + filename
+		+ "\" (system error " + std::to_string(errno) + ")";
+
+	std::unique_lock<std::mutex> lock(errorMutex);
+	if (ok)
+	{
+		error = msg;
+		ok = false;
+	}
+}
+
+std::string OutputWriter::File::GetError() const
+{
+	std::unique_lock<std::mutex> lock(errorMutex);
+	return error;
+}
+
+// --------------------------------------------------------------------------
+//
+// WAV file output
+//
+
+WAVOutput::WAVOutput(std::shared_ptr<OutputWriter::File> file, int sampleRate, int nChannels) :
+	file(file)
+{
+	// Write the header.  The RIFF and data chunk sizes are left as zero
+	// for now; we fill them in at Close(), when we know the length.
+	uint8_t hdr[44];
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(&hdr[0], "RIFF\0\0\0\0WAVEfmt ", 16);   // RIFF, WAVE, fmt tags
+	*reinterpret_cast<uint32_t*>(&hdr[16]) = 16;    // fmt chunk length
+	*reinterpret_cast<uint16_t*>(&hdr[20]) = 1;     // type = 1 (PCM)
+	*reinterpret_cast<uint16_t*>(&hdr[22]) = static_cast<uint16_t>(nChannels);   // number of channels
+	*reinterpret_cast<uint32_t*>(&hdr[24]) = sampleRate;    // samples per second
+	*reinterpret_cast<uint32_t*>(&hdr[28]) = sampleRate * nChannels * 16 / 8;   // bytes per second
+	*reinterpret_cast<uint16_t*>(&hdr[32]) = static_cast<uint16_t>(nChannels * 2);   // block align
+	*reinterpret_cast<uint16_t*>(&hdr[34]) = 16;    // bits per sample
+	memcpy(&hdr[36], "data", 4);                    // data chunk tag
+	file->Write(hdr, sizeof(hdr));
+}
+
+void WAVOutput::WriteSamples(const int16_t *samples, size_t n)
+{
+	file->Write(samples, n * sizeof(int16_t));
+}
+
+void WAVOutput::Close()
+{
+	// fill in the RIFF chunk size (the overall file size, minus 8 bytes
+	// for the RIFF chunk header) and the data chunk size
+	uint32_t fileSize = static_cast<uint32_t>(file->Size());
+	uint32_t riffSize = fileSize - 8;
+	uint32_t dataSize = fileSize - 44;
+	file->Patch(4, &riffSize, 4);
+	file->Patch(40, &dataSize, 4);
+
+	// close the file
+	file->Close();
+}
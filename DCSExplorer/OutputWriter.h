@@ -0,0 +1,232 @@
+// Copyright 2023 Michael J Roberts
+// BSD 3-clause license - NO WARRANTY
+//
+// DCS Explorer - asynchronous file output
+//
+// DCS Explorer's file outputs - extracted WAV and raw stream files, and
+// the validation log - are all generated on the decoder thread, a frame
+// or a line at a time.  Writing them directly through stdio makes the
+// decoder wait on the disk every time the stdio buffer fills.  This
+// module moves the disk writes to a background thread.  The producer
+// fills large buffers drawn from a pool, and hands each full buffer to
+// the writer thread by pointer, so the data is never copied a second
+// time.  The writer thread returns each buffer to the pool after
+// writing it out.  The pool grows as needed, so the producer doesn't
+// have to wait for the writer to catch up, up to a memory limit: if
+// the disk falls so far behind that the pool reaches its limit, the
+// producer waits for a buffer to come back, rather than letting the
+// backlog grow without bound.
+//
+// Write errors are recorded on the file object, where the producer can
+// check them at any time.  The final status of a file is known after
+// it's closed and the writer thread has finished with it.
+//
+
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+
+class OutputWriter
+{
+protected:
+	// pooled data buffer
+	struct Buffer;
+
+public:
+	// Create the writer.  'bufferSize' is the size of each pooled buffer,
+	// which is the unit of work handed to the writer thread, and
+	// 'maxBuffers' is the limit on the number of buffers in the pool.
+	OutputWriter(size_t bufferSize = 256*1024, size_t maxBuffers = 64);
+
+	// Destruction waits for all pending writes to complete, and closes
+	// any files that are still open.
+	~OutputWriter();
+
+	// Output file.  All of the write operations are queued for the
+	// writer thread, and carried out in the order they're issued.  A
+	// file object must only be used from one producer thread.
+	class File : public std::enable_shared_from_this<File>
+	{
+		friend class OutputWriter;
+
+	public:
+		// Files should always be closed explicitly.  If a file is dropped
+		// without closing it, any data still in its current buffer is lost.
+		~File();
+
+		// Append data to the file.  The data is copied into the current
+		// buffer, so the caller's memory can be reused immediately.
+		void Write(const void *data, size_t len);
+		void Write(const std::string &s) { Write(s.data(), s.size()); }
+
+		// Append data to the file by reference, without copying it.  The
+		// memory must stay valid until the file has been closed and the
+		// writer thread is done with it (see IsDone()).  This is useful
+		// for data that lives for the whole session anyway, such as the
+		// ROM images.
+		void WriteRef(const void *data, size_t len);
+
+		// Append formatted text
+		void Printf(const char *fmt, ...);
+
+		// Overwrite bytes previously written, at the given offset from
+		// the start of the file.  This is for filling in a header whose
+		// contents weren't known until the rest of the file was written.
+		// The new data is copied.
+		void Patch(uint64_t offset, const void *data, size_t len);
+
+		// Number of bytes written to the file so far (including bytes
+		// still in the queue)
+		uint64_t Size() const { return size; }
+
+		// Close the file.  This queues the close and returns immediately.
+		// The file can't be written after closing.
+		void Close();
+
+		// Is the writer thread done with the file?  This becomes true once
+		// the file has been closed and all of its writes have completed.
+		bool IsDone() const { return done; }
+
+		// Wait until the writer thread is done with the file, and return
+		// the final status: true if all of the writes succeeded.
+		bool Wait();
+
+		// Get the error status.  IsOK() returns false once any write has
+		// failed, and GetError() returns a description of the first error.
+		bool IsOK() const { return ok; }
+		std::string GetError() const;
+
+		// get the filename
+		const std::string &GetFilename() const { return filename; }
+
+	protected:
+		File(OutputWriter *writer, const char *filename, FILE *fp) :
+			writer(writer), filename(filename), fp(fp) { }
+
+		// hand the current buffer off to the writer thread
+		void FlushBuffer();
+
+		// record an error
+		void SetError(const char *activity);
+
+		// writer that owns the file
+		OutputWriter *writer;
+
+		// filename, for error messages
+		std::string filename;
+
+		// stdio file handle; only touched by the writer thread after opening
+		FILE *fp;
+
+		// current buffer, being filled by the producer
+		Buffer *cur = nullptr;
+
+		// bytes written so far, as seen by the producer
+		uint64_t size = 0;
+
+		// has the producer closed the file?
+		bool closed = false;
+
+		// status, as updated by the writer thread
+		std::atomic<bool> ok{ true };
+		std::atomic<bool> done{ false };
+		mutable std::mutex errorMutex;
+		std::string error;
+	};
+
+	// Open a file for writing.  The file is opened immediately, so that
+	// the caller can find out right away if the file can't be created.
+	// Returns null on failure, with an error message in 'errorMessage'.
+	// 'text' selects text mode (for newline translation).
+	std::shared_ptr<File> Open(const char *filename, bool text, std::string &errorMessage);
+
+	// Wait for all queued writes, for all files, to complete
+	void Flush();
+
+	// Get the number of buffers allocated to the pool, for diagnostics.
+	// This is the high-water mark of buffers in use at one time.
+	size_t GetBufferCount() const { return nBuffers; }
+
+protected:
+	// Get a buffer from the pool.  If the pool is empty, this allocates
+	// a new buffer, or waits for one to be returned if the pool is at its
+	// size limit.
+	Buffer *GetBuffer();
+
+	// Queued operation
+	struct Op
+	{
+		enum class Type { Data, Ref, Patch, Close };
+		Type type;
+		std::shared_ptr<File> file;
+		Buffer *buf = nullptr;            // buffer for Data; returned to the pool after writing
+		const uint8_t *ref = nullptr;     // data for Ref
+		size_t len = 0;                   // length for Ref
+		uint64_t offset = 0;              // file offset for Patch
+		std::vector<uint8_t> patch;       // data for Patch
+	};
+
+	// queue an operation
+	void Enqueue(Op &&op);
+
+	// carry out an operation on the writer thread
+	void Execute(Op &op);
+
+	// writer thread main loop
+	void ThreadMain();
+
+	// buffer size, and the maximum number of buffers to allocate
+	size_t bufferSize;
+	size_t maxBuffers;
+
+	// buffer pool, and the number of buffers allocated
+	std::vector<Buffer*> pool;
+	std::atomic<size_t> nBuffers{ 0 };
+
+	// open files, so that we can close any left open at destruction
+	std::vector<std::weak_ptr<File>> files;
+
+	// operation queue, and the number of operations in progress
+	std::deque<Op> queue;
+	int nBusy = 0;
+	bool quit = false;
+
+	// queue lock, and signals for new work and completed work
+	std::mutex mutex;
+	std::condition_variable workCv;
+	std::condition_variable doneCv;
+
+	// writer thread
+	std::thread thread;
+};
+
+// WAV file output.  This writes 16-bit PCM samples to an output file,
+// with a RIFF WAVE header.  The total length doesn't have to be known
+// in advance: the header is written as a placeholder at the start, and
+// filled in with the final sizes when the file is closed.
+class WAVOutput
+{
+public:
+	WAVOutput(std::shared_ptr<OutputWriter::File> file, int sampleRate, int nChannels);
+
+	// write samples; for multi-channel output, the samples are interleaved
+	void WriteSamples(const int16_t *samples, size_t n);
+
+	// finish the header, and close the file
+	void Close();
+
+	// get the underlying file
+	const std::shared_ptr<OutputWriter::File> &GetFile() const { return file; }
+
+protected:
+	std::shared_ptr<OutputWriter::File> file;
+};
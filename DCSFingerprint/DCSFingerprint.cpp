@@ -0,0 +1,425 @@
+// Copyright 2023 Michael J Roberts
+// BSD 3-clause license - NO WARRANTY
+//
+// DCS Fingerprint - main program entrypoint
+//
+// This program builds a fingerprint index over a library of DCS ROM
+// sets, and searches the index for the source of an audio clip.  The
+// index is built directly from the compressed streams, by decompressing
+// each frame to its frequency-domain coefficients and skipping the
+// inverse transform and PCM rendering, which is most of the work of
+// actually playing a stream.  Query clips go through the DCS encoder's
+// analysis pass, which produces frames in the same frequency-domain
+// layout, so both sides of the search work with the same frame
+// structure.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include "Fingerprint.h"
+#include "../DCSDecoder/DCSDecoderNative.h"
+#include "../DCSEncoder/DCSEncoder.h"
+#include "../Utilities/BuildDate.h"
+#include "../libnyquist/include/libnyquist/Decoders.h"
+
+#pragma comment(lib, "DCSDecoder")
+#pragma comment(lib, "libnyquist")
+
+
+// --------------------------------------------------------------------------
+//
+// Query analyzer.  This runs the encoder's analysis pass over a clip
+// to get its frequency-domain frames, without going on to compress
+// them.
+//
+class QueryAnalyzer : public DCSEncoder
+{
+public:
+	// Analyze a mono PCM clip, with 'shift' samples (at the DCS rate) of
+	// silence inserted ahead of the clip, and figure the band energies
+	// for each frame.  The shift lets the caller try different phases
+	// of the clip relative to the 240-sample frame grid, since the clip
+	// won't usually start on a frame boundary of the original stream.
+	bool Analyze(const std::vector<float> &pcm, int sampleRate, int shift,
+		std::vector<Fingerprint::BandEnergy> &frames, std::string &errorMessage)
+	{
+		std::unique_ptr<Stream> stream(OpenStream(sampleRate, errorMessage));
+		if (stream == nullptr)
+			return false;
+
+		// write the leading silence, at the input rate
+		std::vector<float> zeroes(static_cast<size_t>(static_cast<double>(shift) * sampleRate / 31250.0 + 0.5), 0.0f);
+		if (zeroes.size() != 0)
+			WriteStream(stream.get(), zeroes.data(), zeroes.size());
+
+		// write the clip, and flush the resampler
+		WriteStream(stream.get(), pcm.data(), pcm.size());
+		WriteStream(stream.get(), static_cast<const float*>(nullptr), 0, true);
+
+		// pad out and transform the final partial frame, as CloseStream() does
+		if (stream->nInputBuf != 16)
+		{
+			while (stream->nInputBuf < 256)
+				stream->inputBuf[stream->nInputBuf++] = 0;
+			TransformFrame(stream.get());
+		}
+
+		// figure the band energies
+		frames.clear();
+		frames.reserve(stream->frames.size());
+		for (auto &frame : stream->frames)
+			Fingerprint::GetBandEnergy(frame.f, frames.emplace_back());
+
+		return true;
+	}
+};
+
+// Load an audio file as mono PCM, averaging the channels of a stereo file
+static bool LoadAudio(const char *filename, std::vector<float> &pcm, int &sampleRate, std::string &errorMessage)
+{
+	nqr::AudioData fileData;
+	nqr::NyquistIO loader;
+	try
+	{
+		loader.Load(&fileData, filename);
+	}
+	catch (std::exception &e)
+	{
+		errorMessage = e.what();
+		return false;
+	}
+
+	if (!(fileData.channelCount == 1 || fileData.channelCount == 2))
+	{
+		errorMessage = "Unsupported channel format (only mono and stereo are supported)";
+		return false;
+	}
+
+	sampleRate = fileData.sampleRate;
+	pcm.clear();
+	if (fileData.channelCount == 1)
+		pcm = std::move(fileData.samples);
+	else
+	{
+		pcm.reserve(fileData.samples.size() / 2);
+		for (size_t i = 0 ; i + 1 < fileData.samples.size() ; i += 2)
+			pcm.emplace_back((fileData.samples[i] + fileData.samples[i+1]) / 2.0f);
+	}
+	return true;
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Commands
+//
+
+// index <index file> <ROM .zip file or directory> ...
+static int IndexCommand(const char *indexFile, const std::vector<std::string> &romArgs, int nThreads, bool quiet)
+{
+	// Expand the ROM list.  A directory adds all of the .zip files it
+	// contains, in name order so that the index layout is repeatable.
+	std::vector<std::string> romFiles;
+	for (auto &arg : romArgs)
+	{
+		std::error_code ec;
+		if (std::filesystem::is_directory(arg, ec))
+		{
+			std::vector<std::string> dirFiles;
+			for (auto &entry : std::filesystem::directory_iterator(arg, ec))
+			{
+				auto ext = entry.path().extension().string();
+				std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+				if (entry.is_regular_file(ec) && ext == ".zip")
+					dirFiles.emplace_back(entry.path().string());
+			}
+			std::sort(dirFiles.begin(), dirFiles.end());
+			romFiles.insert(romFiles.end(), dirFiles.begin(), dirFiles.end());
+		}
+		else
+			romFiles.emplace_back(arg);
+	}
+
+	if (romFiles.size() == 0)
+	{
+		printf("No ROM files to index\n");
+		return 2;
+	}
+
+	// build the index
+	auto t0 = std::chrono::steady_clock::now();
+	FingerprintIndex index;
+	int nErrors = 0;
+	index.Build(romFiles, nThreads, [quiet, &nErrors](const char *filename, int nStreams, const char *errorMessage)
+	{
+		if (errorMessage != nullptr)
+		{
+			printf("%s: %s\n", filename, errorMessage);
+			++nErrors;
+		}
+		else if (!quiet)
+			printf("%s: %d streams\n", filename, nStreams);
+	});
+	auto t1 = std::chrono::steady_clock::now();
+
+	// save it
+	std::string errorMessage;
+	if (!index.Save(indexFile, errorMessage))
+	{
+		printf("Error writing index file %s: %s\n", indexFile, errorMessage.c_str());
+		return 2;
+	}
+
+	double dt = std::chrono::duration<double>(t1 - t0).count();
+	printf("\nIndexed %d ROM sets, %d streams, %.1f minutes of audio in %.2f seconds\n",
+		static_cast<int>(index.roms.size()), static_cast<int>(index.streams.size()),
+		static_cast<double>(index.words.size()) * 240.0 / 31250.0 / 60.0, dt);
+	if (nErrors != 0)
+		printf("%d ROM set(s) couldn't be loaded\n", nErrors);
+
+	return 0;
+}
+
+// query <index file> <audio file> ...
+static int QueryCommand(const char *indexFile, const std::vector<std::string> &audioFiles,
+	int nThreads, int maxMatches, double maxBER)
+{
+	// load the index
+	FingerprintIndex index;
+	std::string errorMessage;
+	if (!index.Load(indexFile, errorMessage))
+	{
+		printf("Error loading index file %s: %s\n", indexFile, errorMessage.c_str());
+		return 2;
+	}
+	index.PrepareQuery();
+
+	// Per-file results.  Each clip is searched at several phase shifts
+	// relative to the frame grid, since a clip cut from the middle of a
+	// stream will rarely start on a frame boundary, and fingerprints
+	// taken at a half-frame misalignment don't match well.
+	static const int shifts[] ={ 0, 60, 120, 180 };
+	struct Result
+	{
+		std::string errorMessage;
+		double clipTime = 0.0;
+		struct Hit
+		{
+			FingerprintIndex::Match match;
+			int shift;
+		};
+		std::vector<Hit> hits;
+	};
+	std::vector<Result> results(audioFiles.size());
+
+	auto ProcessFile = [&audioFiles, &results, &index, maxMatches, maxBER](size_t fileIndex)
+	{
+		auto &result = results[fileIndex];
+		std::vector<float> pcm;
+		int sampleRate = 0;
+		if (!LoadAudio(audioFiles[fileIndex].c_str(), pcm, sampleRate, result.errorMessage))
+			return;
+		result.clipTime = sampleRate != 0 ? static_cast<double>(pcm.size()) / sampleRate : 0.0;
+
+		QueryAnalyzer analyzer;
+		std::vector<Fingerprint::BandEnergy> frames;
+		std::vector<uint16_t> query;
+		std::vector<FingerprintIndex::Match> matches;
+		for (int shift : shifts)
+		{
+			if (!analyzer.Analyze(pcm, sampleRate, shift, frames, result.errorMessage))
+				return;
+			Fingerprint::Compute(frames, query);
+			index.Query(query, matches, maxMatches, maxBER);
+
+			// Merge into the results.  The same stream location usually
+			// turns up at more than one shift, and at the frames on either
+			// side of the best alignment, since the windowed energies
+			// change slowly from frame to frame.  Keep only the best match
+			// for each location, where locations within a smoothing window
+			// of each other count as the same.
+			for (auto &m : matches)
+			{
+				int pos = m.offset * 240 + shift;
+				bool merged = false;
+				for (auto &h : result.hits)
+				{
+					if (h.match.stream == m.stream && abs(h.match.offset * 240 + h.shift - pos) < 240 * Fingerprint::Window)
+					{
+						if (m.bitErrorRate < h.match.bitErrorRate)
+							h = { m, shift };
+						merged = true;
+						break;
+					}
+				}
+				if (!merged)
+					result.hits.emplace_back(Result::Hit{ m, shift });
+			}
+		}
+
+		std::sort(result.hits.begin(), result.hits.end(),
+			[](const Result::Hit &a, const Result::Hit &b) { return a.match.bitErrorRate < b.match.bitErrorRate; });
+		if (static_cast<int>(result.hits.size()) > maxMatches)
+			result.hits.resize(maxMatches);
+	};
+
+	// run the queries
+	if (nThreads <= 0)
+		nThreads = static_cast<int>(std::thread::hardware_concurrency());
+	if (nThreads <= 0)
+		nThreads = 1;
+	std::atomic<size_t> next(0);
+	std::vector<std::thread> workers;
+	for (int i = 0 ; i < nThreads && i < static_cast<int>(audioFiles.size()) ; ++i)
+	{
+		workers.emplace_back([&next, &audioFiles, &ProcessFile]()
+		{
+			for (size_t n ; (n = next++) < audioFiles.size() ; )
+				ProcessFile(n);
+		});
+	}
+	for (auto &t : workers)
+		t.join();
+
+	// show the results
+	int nNotFound = 0;
+	for (size_t i = 0 ; i < audioFiles.size() ; ++i)
+	{
+		auto &result = results[i];
+		printf("%s", audioFiles[i].c_str());
+		if (result.errorMessage.size() != 0)
+		{
+			printf(": %s\n\n", result.errorMessage.c_str());
+			++nNotFound;
+			continue;
+		}
+
+		printf(" (%.2f seconds)\n", result.clipTime);
+		if (result.hits.size() == 0)
+		{
+			printf("  No matches found\n\n");
+			++nNotFound;
+			continue;
+		}
+
+		printf("  ROM set                          Stream     Offset    Frames  Bit errors\n");
+		for (auto &h : result.hits)
+		{
+			auto &s = index.streams[h.match.stream];
+			// Figure the clip's starting time in the stream.  Query frame
+			// n lines up with stream frame offset+n.  The encoder's frame
+			// n takes in the 16 overlap samples ahead of sample n*240,
+			// where the decoder's frame n starts at sample n*240, so the
+			// clip starts at the aligned stream frame, plus the shift,
+			// plus the 16-sample overlap.
+			double offset = static_cast<double>(h.match.offset * 240 + h.shift + 16) / 31250.0;
+			printf("  %-32s $%07X  %7.2fs  %6d  %5.1f%%\n",
+				index.roms[s.rom].filename.c_str(), s.address, offset,
+				h.match.nCompared, h.match.bitErrorRate * 100.0);
+		}
+		printf("\n");
+	}
+
+	return nNotFound == 0 ? 0 : 1;
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Main entrypoint
+//
+int main(int argc, char **argv)
+{
+	int nThreads = 0;
+	int maxMatches = 5;
+	double maxBER = 0.25;
+	bool quiet = false;
+
+	auto Usage = []()
+	{
+		printf("DCS Fingerprint  (build %s)\n"
+			"Usage:\n"
+			"   dcsfingerprint [options] index <index file> <ROM .zip file or folder> ...\n"
+			"   dcsfingerprint [options] query <index file> <audio file> ...\n"
+			"\n"
+			"The index command builds a fingerprint index of all of the audio streams in\n"
+			"a collection of DCS ROM sets, and saves it to <index file>.  Specify a folder\n"
+			"to include all of the .zip files it contains.\n"
+			"\n"
+			"The query command searches an index for the source of each audio clip, and\n"
+			"lists the ROM set, stream, and time offset of the best matches.  Clips can\n"
+			"be in any format that the DCS Encoder accepts (WAV, MP3, Ogg, FLAC).\n"
+			"\n"
+			"Options:\n"
+			"   --threads=<n>      number of worker threads (default is the number of\n"
+			"                      hardware threads)\n"
+			"   --matches=<n>      maximum number of matches to list per clip (default 5)\n"
+			"   --max-ber=<pct>    maximum bit error rate for a match, in percent (default 25)\n"
+			"   -q                 quiet mode; don't list the ROM sets as they're indexed\n",
+			ProgramBuildDate().YYYYMMDD().c_str());
+		exit(1);
+	};
+
+	// parse options
+	int argi = 1;
+	for (; argi < argc && argv[argi][0] == '-' ; ++argi)
+	{
+		const char *argp = argv[argi];
+		if (strcmp(argp, "--") == 0)
+		{
+			// explicit last option
+			++argi;
+			break;
+		}
+		else if (strncmp(argp, "--threads=", 10) == 0)
+		{
+			// worker thread count
+			nThreads = atoi(argp + 10);
+		}
+		else if (strncmp(argp, "--matches=", 10) == 0)
+		{
+			// matches per clip
+			maxMatches = atoi(argp + 10);
+			if (maxMatches < 1)
+				maxMatches = 1;
+		}
+		else if (strncmp(argp, "--max-ber=", 10) == 0)
+		{
+			// maximum bit error rate, as a percentage
+			maxBER = atof(argp + 10) / 100.0;
+		}
+		else if (strcmp(argp, "-q") == 0)
+		{
+			// quiet mode
+			quiet = true;
+		}
+		else
+			Usage();
+	}
+
+	// we need a command, an index file, and at least one file to process
+	if (argi + 3 > argc)
+		Usage();
+
+	const char *cmd = argv[argi];
+	const char *indexFile = argv[argi + 1];
+	std::vector<std::string> files(argv + argi + 2, argv + argc);
+	if (strcmp(cmd, "index") == 0)
+		return IndexCommand(indexFile, files, nThreads, quiet);
+	else if (strcmp(cmd, "query") == 0)
+		return QueryCommand(indexFile, files, nThreads, maxMatches, maxBER);
+	else
+		Usage();
+
+	return 0;
+}
@@ -0,0 +1,475 @@
+// Copyright 2023 Michael J Roberts
+// BSD 3-clause license - NO WARRANTY
+//
+// DCS Fingerprint - spectral fingerprints and the library index
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <memory>
+#include <list>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <unordered_map>
+#include "Fingerprint.h"
+#include "../DCSDecoder/DCSDecoderNative.h"
+
+// --------------------------------------------------------------------------
+//
+// Fingerprint computation
+//
+void Fingerprint::Compute(const std::vector<BandEnergy> &frames, std::vector<uint16_t> &words)
+{
+	words.clear();
+	words.resize(frames.size(), 0);
+	if (frames.size() < static_cast<size_t>(Window + Lag))
+		return;
+
+	// Sum the band energies over a sliding window of Window frames,
+	// ending at each frame.  Single frames are too short for stable
+	// band energies, particularly after the quantization in the
+	// compressed streams, which leaves the weaker bands of each frame
+	// mostly noise.
+	std::vector<BandEnergy> sum(frames.size());
+	BandEnergy acc;
+	for (int b = 0 ; b < NumBands ; ++b)
+		acc.e[b] = 0.0f;
+	for (size_t i = 0 ; i < frames.size() ; ++i)
+	{
+		for (int b = 0 ; b < NumBands ; ++b)
+		{
+			acc.e[b] += frames[i].e[b];
+			if (i >= static_cast<size_t>(Window))
+				acc.e[b] -= frames[i - Window].e[b];
+
+			// the subtraction can leave slightly negative values where
+			// the window passes over large values, so clip at zero
+			sum[i].e[b] = acc.e[b] > 0.0f ? acc.e[b] : 0.0f;
+		}
+	}
+
+	// Figure the window totals, and find the loudest window.  Windows
+	// more than 50 dB below the peak count as silent.  The threshold
+	// has to be relative, since the decoder and encoder work at
+	// different scales.
+	std::vector<float> total(frames.size());
+	float maxTotal = 0.0f;
+	for (size_t i = 0 ; i < frames.size() ; ++i)
+	{
+		float t = 0.0f;
+		for (int b = 0 ; b < NumBands ; ++b)
+			t += sum[i].e[b];
+		total[i] = t;
+		maxTotal = t > maxTotal ? t : maxTotal;
+	}
+	if (maxTotal == 0.0f)
+		return;
+	const float silence = maxTotal * 1.0e-5f;
+
+	// Form the words.  Each band's energy gets a floor 20 dB below the
+	// window's total energy before the comparison, so that bands too
+	// weak to matter (including bands that the encoder dropped from the
+	// stream entirely) compare as unchanged on both sides, rather than
+	// flipping at random on noise.  The floor scales with the window's
+	// level, so the bits don't depend on the overall gain.
+	for (size_t i = Window + Lag - 1 ; i < frames.size() ; ++i)
+	{
+		size_t j = i - Lag;
+		if (total[i] <= silence || total[j] <= silence)
+			continue;
+
+		float floorCur = total[i] * 0.01f, floorPrev = total[j] * 0.01f;
+		uint16_t w = ValidBit;
+		for (int b = 0 ; b < NumBands ; ++b)
+		{
+			if (sum[i].e[b] + floorCur > sum[j].e[b] + floorPrev)
+				w |= (1 << b);
+		}
+		words[i] = w;
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Index builder
+//
+void FingerprintIndex::Build(const std::vector<std::string> &romFiles, int nThreads,
+	std::function<void(const char *filename, int nStreams, const char *errorMessage)> progress)
+{
+	// Per-ROM results.  Each worker fills in the slots for the ROM sets
+	// it processes, and we assemble the index from the slots in order
+	// at the end, so that the index layout doesn't depend on the thread
+	// timing.
+	struct StreamResult
+	{
+		uint32_t address;
+		std::vector<uint16_t> words;
+	};
+	struct ROMResult
+	{
+		bool ok = false;
+		std::list<StreamResult> streams;
+	};
+	std::vector<ROMResult> results(romFiles.size());
+
+	// fingerprint one ROM set
+	std::mutex progressMutex;
+	auto ProcessROM = [&romFiles, &results, &progress, &progressMutex](size_t index)
+	{
+		auto &filename = romFiles[index];
+		auto &result = results[index];
+		auto Progress = [&progress, &progressMutex, &filename](int nStreams, const char *msg)
+		{
+			std::lock_guard<std::mutex> lock(progressMutex);
+			if (progress)
+				progress(filename.c_str(), nStreams, msg);
+		};
+
+		// load the ROMs into a private decoder
+		DCSDecoder::MinHost host;
+		DCSDecoderNative decoder(&host);
+		std::list<DCSDecoder::ZipFileData> zipFileData;
+		std::string errorMessage;
+		if (decoder.LoadROMFromZipFile(filename.c_str(), zipFileData, nullptr, &errorMessage) != DCSDecoder::ZipLoadStatus::Success)
+			return Progress(0, errorMessage.size() != 0 ? errorMessage.c_str() : "Unable to load ROMs");
+
+		// Detect the OS version.  Ignore checksum errors; they're common
+		// in prototype and patched ROM sets, and a bad checksum doesn't
+		// keep us from reading the streams.
+		decoder.CheckROMs();
+		if (decoder.GetCatalogOffset() == 0)
+			return Progress(0, "No DCS catalog found in ROM U2");
+		decoder.SoftBoot();
+
+		// fingerprint each stream
+		std::vector<Fingerprint::BandEnergy> frames;
+		for (auto addr : decoder.ListStreams())
+		{
+			frames.clear();
+			decoder.DecompressStream(decoder.MakeROMPointer(addr), [&frames](int, const int16_t *coefficients)
+			{
+				Fingerprint::GetBandEnergy(coefficients, frames.emplace_back());
+			});
+
+			auto &s = result.streams.emplace_back();
+			s.address = addr;
+			Fingerprint::Compute(frames, s.words);
+		}
+
+		result.ok = true;
+		Progress(static_cast<int>(result.streams.size()), nullptr);
+	};
+
+	// run the workers
+	if (nThreads <= 0)
+		nThreads = static_cast<int>(std::thread::hardware_concurrency());
+	if (nThreads <= 0)
+		nThreads = 1;
+	std::atomic<size_t> next(0);
+	std::vector<std::thread> workers;
+	for (int i = 0 ; i < nThreads ; ++i)
+	{
+		workers.emplace_back([&next, &romFiles, &ProcessROM]()
+		{
+			for (size_t n ; (n = next++) < romFiles.size() ; )
+				ProcessROM(n);
+		});
+	}
+	for (auto &t : workers)
+		t.join();
+
+	// assemble the index
+	roms.clear();
+	streams.clear();
+	words.clear();
+	for (size_t i = 0 ; i < romFiles.size() ; ++i)
+	{
+		if (!results[i].ok)
+			continue;
+
+		uint32_t romIndex = static_cast<uint32_t>(roms.size());
+		roms.emplace_back().filename = romFiles[i];
+		for (auto &s : results[i].streams)
+		{
+			streams.emplace_back(Stream{ romIndex, s.address, static_cast<uint32_t>(s.words.size()), words.size() });
+			words.insert(words.end(), s.words.begin(), s.words.end());
+		}
+	}
+}
+
+// --------------------------------------------------------------------------
+//
+// Index file I/O
+//
+// The index file is a simple binary format, with all integers stored
+// little-endian:
+//
+//   char[8]   "DCSFPIX1"
+//   UINT32    number of ROM sets
+//   UINT32    number of streams
+//   UINT64    number of fingerprint words
+//   ROM sets: UINT16 filename length, filename bytes
+//   streams:  UINT32 ROM index, UINT32 stream address, UINT32 frame count
+//   words:    UINT16 each, concatenated in stream order
+//
+static const char indexFileSignature[] = "DCSFPIX1";
+
+bool FingerprintIndex::Save(const char *filename, std::string &errorMessage) const
+{
+	FILE *fp = nullptr;
+	if (fopen_s(&fp, filename, "wb") != 0 || fp == nullptr)
+	{
+		errorMessage = "Unable to create file";
+		return false;
+	}
+
+	// little-endian integer writers
+	auto U16 = [fp](uint16_t v) { uint8_t b[2] ={ static_cast<uint8_t>(v), static_cast<uint8_t>(v >> 8) }; fwrite(b, 1, 2, fp); };
+	auto U32 = [&U16](uint32_t v) { U16(static_cast<uint16_t>(v)); U16(static_cast<uint16_t>(v >> 16)); };
+	auto U64 = [&U32](uint64_t v) { U32(static_cast<uint32_t>(v)); U32(static_cast<uint32_t>(v >> 32)); };
+
+	fwrite(indexFileSignature, 1, 8, fp);
+	U32(static_cast<uint32_t>(roms.size()));
+	U32(static_cast<uint32_t>(streams.size()));
+	U64(words.size());
+	for (auto &r : roms)
+	{
+		U16(static_cast<uint16_t>(r.filename.size()));
+		fwrite(r.filename.data(), 1, r.filename.size(), fp);
+	}
+	for (auto &s : streams)
+	{
+		U32(s.rom);
+		U32(s.address);
+		U32(s.nFrames);
+	}
+	for (auto w : words)
+		U16(w);
+
+	bool ok = !ferror(fp);
+	if (fclose(fp) != 0)
+		ok = false;
+	if (!ok)
+		errorMessage = "Error writing file";
+	return ok;
+}
+
+bool FingerprintIndex::Load(const char *filename, std::string &errorMessage)
+{
+	FILE *fp = nullptr;
+	if (fopen_s(&fp, filename, "rb") != 0 || fp == nullptr)
+	{
+		errorMessage = "Unable to open file";
+		return false;
+	}
+	std::unique_ptr<FILE, int(*)(FILE*)> fpHolder(fp, &fclose);
+
+	// little-endian integer readers
+	bool eof = false;
+	auto U16 = [fp, &eof]() -> uint16_t
+	{
+		uint8_t b[2];
+		if (fread(b, 1, 2, fp) != 2)
+		{
+			eof = true;
+			return 0;
+		}
+		return static_cast<uint16_t>(b[0] | (b[1] << 8));
+	};
+	auto U32 = [&U16]() -> uint32_t { uint32_t lo = U16(); return lo | (static_cast<uint32_t>(U16()) << 16); };
+	auto U64 = [&U32]() -> uint64_t { uint64_t lo = U32(); return lo | (static_cast<uint64_t>(U32()) << 32); };
+
+	char sig[8];
+	if (fread(sig, 1, 8, fp) != 8 || memcmp(sig, indexFileSignature, 8) != 0)
+	{
+		errorMessage = "Not a DCS fingerprint index file";
+		return false;
+	}
+
+	uint32_t nROMs = U32();
+	uint32_t nStreams = U32();
+	uint64_t nWords = U64();
+
+	roms.clear();
+	roms.resize(nROMs);
+	for (auto &r : roms)
+	{
+		r.filename.resize(U16());
+		if (r.filename.size() != 0 && fread(&r.filename[0], 1, r.filename.size(), fp) != r.filename.size())
+			eof = true;
+	}
+
+	streams.clear();
+	streams.resize(nStreams);
+	uint64_t pos = 0;
+	for (auto &s : streams)
+	{
+		s.rom = U32();
+		s.address = U32();
+		s.nFrames = U32();
+		s.firstWord = pos;
+		pos += s.nFrames;
+		if (s.rom >= nROMs)
+			eof = true;
+	}
+
+	if (eof || pos != nWords)
+	{
+		errorMessage = "Index file is corrupted or truncated";
+		return false;
+	}
+
+	words.resize(nWords);
+	for (auto &w : words)
+		w = U16();
+	if (eof)
+	{
+		errorMessage = "Index file is truncated";
+		return false;
+	}
+
+	return true;
+}
+
+// --------------------------------------------------------------------------
+//
+// Query
+//
+void FingerprintIndex::PrepareQuery()
+{
+	// Build the inverted index with a counting sort: count the words
+	// of each value, turn the counts into bucket starting positions,
+	// then drop each position into its bucket.
+	const size_t nValues = 0x8000;
+	bucket.assign(nValues + 1, 0);
+	for (auto w : words)
+	{
+		if ((w & Fingerprint::ValidBit) != 0)
+			++bucket[(w & ~Fingerprint::ValidBit) + 1];
+	}
+	for (size_t i = 1 ; i <= nValues ; ++i)
+		bucket[i] += bucket[i - 1];
+
+	postings.resize(bucket[nValues]);
+	std::vector<uint32_t> fill(bucket.begin(), bucket.end() - 1);
+	for (size_t i = 0 ; i < words.size() ; ++i)
+	{
+		auto w = words[i];
+		if ((w & Fingerprint::ValidBit) != 0)
+			postings[fill[w & ~Fingerprint::ValidBit]++] = static_cast<uint32_t>(i);
+	}
+}
+
+int FingerprintIndex::StreamForWord(uint64_t pos) const
+{
+	// binary search for the last stream starting at or before pos
+	auto it = std::upper_bound(streams.begin(), streams.end(), pos,
+		[](uint64_t p, const Stream &s) { return p < s.firstWord; });
+	return static_cast<int>(it - streams.begin()) - 1;
+}
+
+void FingerprintIndex::Query(const std::vector<uint16_t> &query, std::vector<Match> &matches,
+	int maxMatches, double maxBER) const
+{
+	matches.clear();
+
+	// Vote for alignments.  Each query word that appears in the index,
+	// exactly or with one bit flipped, votes for the alignment of the
+	// query start with the stream that the hit implies.  The alignment
+	// key packs the global word position of the query start, biased so
+	// that query starts before the start of a stream are still positive.
+	const int64_t bias = static_cast<int64_t>(query.size());
+	std::unordered_map<uint64_t, int> votes;
+	for (size_t i = 0 ; i < query.size() ; ++i)
+	{
+		auto q = query[i];
+		if ((q & Fingerprint::ValidBit) == 0)
+			continue;
+
+		q &= ~Fingerprint::ValidBit;
+		for (int flip = -1 ; flip < Fingerprint::NumBands ; ++flip)
+		{
+			uint16_t w = flip < 0 ? q : static_cast<uint16_t>(q ^ (1 << flip));
+			for (uint32_t p = bucket[w] ; p < bucket[w + 1] ; ++p)
+			{
+				int64_t start = static_cast<int64_t>(postings[p]) - static_cast<int64_t>(i) + bias;
+				votes[static_cast<uint64_t>(start)] += (flip < 0 ? 2 : 1);
+			}
+		}
+	}
+
+	// take the alignments with the most votes as candidates
+	std::vector<std::pair<int, uint64_t>> candidates;
+	candidates.reserve(votes.size());
+	for (auto &v : votes)
+		candidates.emplace_back(v.second, v.first);
+	const size_t maxCandidates = 64;
+	if (candidates.size() > maxCandidates)
+	{
+		std::partial_sort(candidates.begin(), candidates.begin() + maxCandidates, candidates.end(),
+			[](const std::pair<int, uint64_t> &a, const std::pair<int, uint64_t> &b) { return a.first > b.first; });
+		candidates.resize(maxCandidates);
+	}
+
+	// Score each candidate by its bit error rate over the frames where
+	// both the query and the stream have valid words
+	int nQueryValid = 0;
+	for (auto q : query)
+		nQueryValid += (q & Fingerprint::ValidBit) != 0 ? 1 : 0;
+	for (auto &c : candidates)
+	{
+		int64_t start = static_cast<int64_t>(c.second) - bias;
+
+		// find the stream, using the first valid query frame that lands
+		// inside the index to locate it
+		int64_t anchor = start < 0 ? 0 : start;
+		if (anchor >= static_cast<int64_t>(words.size()))
+			continue;
+		int si = StreamForWord(static_cast<uint64_t>(anchor));
+		if (si < 0)
+			continue;
+		auto &s = streams[si];
+		int64_t offset = start - static_cast<int64_t>(s.firstWord);
+
+		// skip duplicate alignments within a stream (which can happen when
+		// the query start is before the stream start)
+		bool dup = false;
+		for (auto &m : matches)
+			dup |= (m.stream == si && m.offset == offset);
+		if (dup)
+			continue;
+
+		int nCompared = 0, nErrors = 0;
+		for (size_t i = 0 ; i < query.size() ; ++i)
+		{
+			int64_t f = offset + static_cast<int64_t>(i);
+			if (f < 0 || f >= static_cast<int64_t>(s.nFrames))
+				continue;
+			auto q = query[i];
+			auto w = words[s.firstWord + f];
+			if ((q & w & Fingerprint::ValidBit) != 0)
+			{
+				++nCompared;
+				nErrors += Fingerprint::BitErrors(q, w);
+			}
+		}
+
+		// Require a reasonable amount of overlap, so that a few chance
+		// matches at the edge of a stream don't count
+		if (nCompared == 0 || nCompared < nQueryValid / 2)
+			continue;
+
+		double ber = static_cast<double>(nErrors) / (nCompared * Fingerprint::NumBands);
+		if (ber <= maxBER)
+			matches.emplace_back(Match{ si, static_cast<int>(offset), nCompared, ber });
+	}
+
+	// sort by bit error rate, and keep the best
+	std::sort(matches.begin(), matches.end(), [](const Match &a, const Match &b) { return a.bitErrorRate < b.bitErrorRate; });
+	if (static_cast<int>(matches.size()) > maxMatches)
+		matches.resize(maxMatches);
+}
@@ -0,0 +1,156 @@
+// Copyright 2023 Michael J Roberts
+// BSD 3-clause license - NO WARRANTY
+//
+// DCS Fingerprint - spectral fingerprints and the library index
+//
+// A fingerprint is a sequence of 16-bit words, one per DCS frame
+// (7.68ms).  The spectrum is divided into 15 bands spanning 0 to about
+// 7.3 kHz, and the band energies are summed over a sliding window of
+// eight frames (about 60ms).  Bit b of a frame's word is set if band
+// b's windowed energy increased from the window eight frames earlier.
+// That's a variation on the Philips (Haitsma-Kalker) audio fingerprint,
+// adapted to the short DCS frames.  (The Philips scheme compares the
+// changes in adjacent bands, which cancels out overall level changes,
+// but the differences between adjacent bands turn out to be too noisy
+// in the heavily quantized DCS streams.)  Comparing each band only
+// with itself makes the bits independent of any fixed gain per band,
+// so a fingerprint computed from the decoder's decompressed frames
+// will match one computed from the encoder's analysis of the original
+// audio, even though the two sides scale their frequency-domain data
+// differently.  The top bit of the word marks it as valid; words for
+// silent frames, and for the frames at the start of a stream before
+// the window fills, are zero, and are ignored when matching.
+//
+// The index holds the fingerprints of every stream in a library of
+// ROM sets.  To search it, we look up each query word in an inverted
+// index (allowing a one-bit error), vote for the (stream, offset)
+// alignments that the hits suggest, and then compare the query
+// against each of the leading alignments bit by bit, keeping the
+// ones with a low enough bit error rate.
+//
+
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <functional>
+
+class Fingerprint
+{
+public:
+	// number of bands in the spectrum, which is also the number of
+	// bits in a word, not counting the valid bit
+	static const int NumBands = 15;
+
+	// Smoothing window and comparison lag, in frames
+	static const int Window = 8;
+	static const int Lag = 8;
+
+	// valid word flag
+	static const uint16_t ValidBit = 0x8000;
+
+	// Band energies for one frame
+	struct BandEnergy
+	{
+		float e[NumBands];
+	};
+
+	// Figure the band energies for a frame, from the 256 frequency-
+	// domain coefficients in the DCS frame layout
+	template<typename T> static void GetBandEnergy(const T *coefficients, BandEnergy &energy)
+	{
+		// the bands are 8 coefficients (4 frequency bins of about 122 Hz)
+		// each, starting at DC
+		for (int band = 0, i = 0 ; band < NumBands ; ++band)
+		{
+			float sum = 0.0f;
+			for (int j = 0 ; j < 8 ; ++j, ++i)
+			{
+				float c = static_cast<float>(coefficients[i]);
+				sum += c*c;
+			}
+			energy.e[band] = sum;
+		}
+	}
+
+	// Compute the fingerprint words for a series of frames
+	static void Compute(const std::vector<BandEnergy> &frames, std::vector<uint16_t> &words);
+
+	// count the bit errors between two words
+	static int BitErrors(uint16_t a, uint16_t b)
+	{
+		int n = 0;
+		for (uint32_t x = (a ^ b) & ~ValidBit ; x != 0 ; x &= x - 1)
+			++n;
+		return n;
+	}
+};
+
+class FingerprintIndex
+{
+public:
+	// ROM set entry
+	struct ROM
+	{
+		std::string filename;
+	};
+	std::vector<ROM> roms;
+
+	// Stream entry.  firstWord is the index in words[] of the stream's
+	// first frame.
+	struct Stream
+	{
+		uint32_t rom;
+		uint32_t address;
+		uint32_t nFrames;
+		uint64_t firstWord;
+	};
+	std::vector<Stream> streams;
+
+	// fingerprint words for all streams, concatenated
+	std::vector<uint16_t> words;
+
+	// Build the index from a list of ROM .zip files, using a pool of
+	// nThreads threads (zero selects the number of hardware threads).
+	// 'progress' is called (from the worker threads, but serialized)
+	// after each ROM set is processed, with an error message if the ROM
+	// set couldn't be loaded, or null on success.  A ROM set that can't
+	// be loaded is skipped.
+	void Build(const std::vector<std::string> &romFiles, int nThreads,
+		std::function<void(const char *filename, int nStreams, const char *errorMessage)> progress);
+
+	// save/load the index file
+	bool Save(const char *filename, std::string &errorMessage) const;
+	bool Load(const char *filename, std::string &errorMessage);
+
+	// Set up the inverted index for queries.  This must be called after
+	// building or loading the index, before running any queries.
+	void PrepareQuery();
+
+	// Match result
+	struct Match
+	{
+		int stream;         // stream index
+		int offset;         // offset in frames of the start of the query within the stream
+		int nCompared;      // number of valid frames compared
+		double bitErrorRate;
+	};
+
+	// Search for a query fingerprint.  Returns up to maxMatches matches
+	// with bit error rates up to maxBER, best match first.  Queries are
+	// read-only, so multiple queries can run in parallel.
+	void Query(const std::vector<uint16_t> &query, std::vector<Match> &matches,
+		int maxMatches, double maxBER) const;
+
+protected:
+	// Inverted index.  postings[] lists the global word positions of
+	// all valid words, grouped by word value; the positions for word
+	// value w are postings[bucket[w]] to postings[bucket[w+1] - 1],
+	// where w is the word with the valid bit removed.
+	std::vector<uint32_t> bucket;
+	std::vector<uint32_t> postings;
+
+	// map from global word position to stream index, via the streams'
+	// firstWord values, which are in ascending order
+	int StreamForWord(uint64_t pos) const;
+};
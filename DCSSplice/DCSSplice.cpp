@@ -0,0 +1,277 @@
+// Copyright 2023 Michael J Roberts
+// BSD 3-clause license - NO WARRANTY
+//
+// DCS Splice - main program entrypoint
+//
+// This program trims and joins raw DCS stream files (".dcs" files)
+// without decoding them to PCM.  The output is a new stream made up of
+// frame ranges taken from the input streams, which the encoder builds
+// by copying the compressed frames, and only re-encoding the frames
+// that can't be copied as they are.  See DCSEncoder::SpliceDCSStreams()
+// for the details.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "../DCSEncoder/DCSEncoder.h"
+#include "../Utilities/BuildDate.h"
+
+#pragma comment(lib, "DCSDecoder")
+
+// DCS frames per second: 240 samples per frame at 31250 samples per second
+static const double FramesPerSecond = 31250.0 / 240.0;
+
+
+// --------------------------------------------------------------------------
+//
+// Segment list
+//
+
+// Segment, as specified on the command line
+struct Segment
+{
+	std::string filename;
+
+	// Frame range.  -1 for the end means through the end of the stream.
+	int startFrame = 0;
+	int endFrame = -1;
+
+	// loaded stream data and format version
+	DCSEncoder::DCSAudio dcs;
+	uint16_t formatVersion = 0;
+};
+
+// Parse a time position: a number of seconds, with an optional
+// fraction, or a frame number with an 'f' suffix.  Returns false if
+// the text isn't in either format.
+static bool ParseTime(const std::string &s, int &frame)
+{
+	if (s.size() == 0)
+		return false;
+
+	char *end = nullptr;
+	if (s.back() == 'f' || s.back() == 'F')
+	{
+		long n = strtol(s.c_str(), &end, 10);
+		if (end != s.c_str() + s.size() - 1 || n < 0)
+			return false;
+		frame = static_cast<int>(n);
+	}
+	else
+	{
+		double t = strtod(s.c_str(), &end);
+		if (end != s.c_str() + s.size() || t < 0.0)
+			return false;
+		frame = static_cast<int>(floor(t * FramesPerSecond + 0.5));
+	}
+	return true;
+}
+
+// Parse a segment argument: <file>[@<start>:<end>], where either time
+// can be omitted, to start at the beginning or run through the end of
+// the stream.  We look for the last '@', so that the filename can
+// contain '@' characters as long as a range is given.
+static bool ParseSegment(const char *arg, Segment &seg)
+{
+	std::string s(arg);
+	size_t at = s.rfind('@');
+	if (at == std::string::npos)
+	{
+		seg.filename = s;
+		return true;
+	}
+
+	seg.filename = s.substr(0, at);
+	std::string range = s.substr(at + 1);
+	size_t colon = range.find(':');
+	if (colon == std::string::npos)
+		return false;
+
+	std::string start = range.substr(0, colon), end = range.substr(colon + 1);
+	if (start.size() != 0 && !ParseTime(start, seg.startFrame))
+		return false;
+	if (end.size() != 0 && !ParseTime(end, seg.endFrame))
+		return false;
+	return seg.filename.size() != 0;
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Main entrypoint
+//
+int main(int argc, char **argv)
+{
+	std::string outFile;
+	int headerSegment = -1;
+	DCSEncoder encoder;
+	auto &params = encoder.compressionParams;
+	bool quiet = false;
+
+	auto Usage = []()
+	{
+		printf("DCS Splice  (build %s)\n"
+			"Usage: dcssplice --out=<file> [options] <segment> ...\n"
+			"\n"
+			"Builds a new raw DCS stream file from frame ranges taken from existing\n"
+			"raw DCS stream files (.dcs files), played back to back.  Each segment is:\n"
+			"\n"
+			"   <file>                the whole stream\n"
+			"   <file>@<start>:<end>  the part of the stream from <start> up to <end>\n"
+			"\n"
+			"Times are in seconds (e.g., 1.5), or in DCS frames with an 'f' suffix (e.g.,\n"
+			"200f).  Either time can be left empty, to start at the beginning or run\n"
+			"through the end of the stream.  Cuts are made at frame boundaries (7.68ms).\n"
+			"\n"
+			"Options:\n"
+			"   --out=<file>       output .dcs file (required)\n"
+			"   --header=<n>       use the stream header from segment <n> (1 = the first\n"
+			"                      segment); the default is the header of the stream that\n"
+			"                      contributes the most frames\n"
+			"   --minrange=<n>     minimum band dynamic range for re-encoded frames\n"
+			"                      (default 10)\n"
+			"   --maxerror=<n>     maximum quantization error for re-encoded frames\n"
+			"                      (default 10)\n"
+			"   -q                 quiet mode; don't list the segments\n",
+			ProgramBuildDate().YYYYMMDD().c_str());
+		exit(1);
+	};
+
+	// parse options
+	int argi = 1;
+	for (; argi < argc && argv[argi][0] == '-' ; ++argi)
+	{
+		const char *argp = argv[argi];
+		if (strcmp(argp, "--") == 0)
+		{
+			// explicit last option
+			++argi;
+			break;
+		}
+		else if (strncmp(argp, "--out=", 6) == 0)
+		{
+			// output file
+			outFile = argp + 6;
+		}
+		else if (strncmp(argp, "--header=", 9) == 0)
+		{
+			// header segment, 1-based on the command line
+			headerSegment = atoi(argp + 9) - 1;
+			if (headerSegment < 0)
+			{
+				printf("Invalid --header value; must be a segment number, starting at 1\n");
+				exit(1);
+			}
+		}
+		else if (strncmp(argp, "--minrange=", 11) == 0)
+		{
+			// minimum dynamic range, in 16-bit sample units
+			float val = static_cast<float>(atof(argp + 11));
+			if (val < 0.0f || val > 65536.0f)
+			{
+				printf("Invalid --minrange value; must be 0 to 65536\n");
+				exit(1);
+			}
+			params.minimumDynamicRange = val / 32768.0f;
+		}
+		else if (strncmp(argp, "--maxerror=", 11) == 0)
+		{
+			// maximum quantization error, in 16-bit sample units
+			float val = static_cast<float>(atof(argp + 11));
+			if (val < 0.0f || val > 65536.0f)
+			{
+				printf("Invalid --maxerror value; must be 0 to 65536\n");
+				exit(1);
+			}
+			params.maximumQuantizationError = val / 32768.0f;
+		}
+		else if (strcmp(argp, "-q") == 0)
+		{
+			// quiet mode
+			quiet = true;
+		}
+		else
+			Usage();
+	}
+
+	// we need an output file and at least one segment
+	if (outFile.size() == 0 || argi >= argc)
+		Usage();
+
+	// parse the segments and load the files
+	std::vector<Segment> segments(argc - argi);
+	for (size_t i = 0 ; i < segments.size() ; ++i)
+	{
+		auto &seg = segments[i];
+		if (!ParseSegment(argv[argi + i], seg))
+		{
+			printf("Invalid segment \"%s\"; the format is <file>@<start>:<end>\n", argv[argi + i]);
+			return 2;
+		}
+
+		std::string errorMessage;
+		if (!DCSEncoder::LoadDCSFile(seg.filename.c_str(), seg.dcs, seg.formatVersion, errorMessage))
+		{
+			printf("%s\n", errorMessage.c_str());
+			return 2;
+		}
+	}
+	if (headerSegment >= static_cast<int>(segments.size()))
+	{
+		printf("Invalid --header value; there are only %d segments\n", static_cast<int>(segments.size()));
+		return 2;
+	}
+
+	// Build the encoder's segment list.  A time past the end of a stream
+	// is taken to mean the end of the stream, since times given in seconds
+	// won't generally match the stream length exactly.
+	std::vector<DCSEncoder::SpliceSegment> splice;
+	for (size_t i = 0 ; i < segments.size() ; ++i)
+	{
+		auto &seg = segments[i];
+		DCSEncoder::SpliceSegment s;
+		s.data = seg.dcs.data.get();
+		s.nBytes = seg.dcs.nBytes;
+		s.formatVersion = seg.formatVersion;
+		s.startFrame = seg.startFrame;
+		s.endFrame = (seg.endFrame < 0 || seg.endFrame > seg.dcs.nFrames) ? seg.dcs.nFrames : seg.endFrame;
+		splice.emplace_back(s);
+
+		if (!quiet)
+		{
+			printf("%2d: %s, frames %d-%d (%.2fs to %.2fs)\n", static_cast<int>(i + 1), seg.filename.c_str(),
+				s.startFrame, s.endFrame - 1, s.startFrame / FramesPerSecond, s.endFrame / FramesPerSecond);
+		}
+	}
+
+	// splice the streams
+	auto t0 = std::chrono::steady_clock::now();
+	DCSEncoder::DCSAudio dcs;
+	DCSEncoder::SpliceStats stats;
+	std::string errorMessage;
+	if (!encoder.SpliceDCSStreams(splice, dcs, errorMessage, &stats, headerSegment))
+	{
+		printf("Error: %s\n", errorMessage.c_str());
+		return 1;
+	}
+	auto t1 = std::chrono::steady_clock::now();
+
+	// save the result
+	if (!DCSEncoder::SaveDCSFile(outFile.c_str(), dcs, 0x9400, errorMessage))
+	{
+		printf("Error: %s\n", errorMessage.c_str());
+		return 1;
+	}
+
+	// show the summary
+	printf("%s: %d frames (%.2fs), %u bytes; %d frames copied, %d re-encoded; %.1f ms\n",
+		outFile.c_str(), stats.nFrames, stats.nFrames / FramesPerSecond, static_cast<unsigned int>(dcs.nBytes),
+		stats.nCopied, stats.nReencoded, std::chrono::duration<double, std::milli>(t1 - t0).count());
+	return 0;
+}
@@ -0,0 +1,586 @@
+// Copyright 2023 Michael J Roberts
+// BSD 3-clause license - NO WARRANTY
+//
+// libdcsdecoder - C API for the DCS Decoder
+//
+// This is a thin layer over the C++ DCSDecoder classes.  The main job
+// here is to keep C++ from leaking across the C boundary: every entry
+// point validates its handles, catches any exceptions the decoder
+// throws, and converts them to status codes plus a last-error message.
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string>
+#include <list>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include "libdcsdecoder.h"
+#include "../DCSDecoder/DCSDecoder.h"
+#include "../DCSDecoder/DCSDecoderNative.h"
+#include "../DCSDecoder/DCSDecoderEmu.h"
+
+
+// --------------------------------------------------------------------------
+//
+// Object definitions
+//
+
+// ROM set
+struct DCSDEC_ROMSET
+{
+	// ROM images, indexed by chip number minus 2 (U2 = [0])
+	std::vector<uint8_t> rom[8];
+
+	// Number of decoders currently using the set.  The ROM data can't
+	// be replaced while a decoder is using it, since the decoder keeps
+	// pointers into our buffers.
+	int refCount = 0;
+
+	// Has the client deleted the set?  If the client deletes the set
+	// while decoders are still using it, we keep it around until the
+	// last decoder is deleted.
+	bool deletePending = false;
+
+	// Lock for refCount and deletePending.  Decoders sharing the set can
+	// be created and deleted on separate threads, so the count and the
+	// pending-delete check have to be updated together, atomically.
+	std::mutex mutex;
+
+	// Add a decoder reference
+	void AddRef()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		++refCount;
+	}
+
+	// Release a decoder reference.  Returns true if this was the last
+	// reference and the client has already deleted the set, in which
+	// case the caller must delete it.
+	bool Release()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return --refCount == 0 && deletePending;
+	}
+
+	// Mark the set as deleted by the client.  Returns true if no
+	// decoders are using it, in which case the caller must delete it
+	// now; otherwise the last decoder's Release() will.
+	bool MarkDeleted()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		deletePending = true;
+		return refCount == 0;
+	}
+
+	// is the set in use by any decoders?
+	bool InUse()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return refCount != 0;
+	}
+};
+
+// Decoder host interface.  The only decoder->host event that a C client
+// can usefully observe is data sent back on the DCS->WPC data port, so
+// we just queue those bytes for dcsdec_decoder_read().
+class CAPIHost : public DCSDecoder::Host
+{
+public:
+	virtual void ReceiveDataPort(uint8_t data) override { received.emplace_back(data); }
+	virtual void ClearDataPort() override { }
+	virtual void BootTimerControl(bool set) override { }
+
+	std::list<uint8_t> received;
+};
+
+// Decoder
+struct DCSDEC_DECODER
+{
+	DCSDEC_DECODER(DCSDEC_ROMSET *romset) : romset(romset) { romset->AddRef(); }
+	~DCSDEC_DECODER()
+	{
+		// delete the decoder before releasing the ROMs it points into
+		decoder.reset();
+
+		// release the ROM set, deleting it if the client already tried to
+		if (romset->Release())
+			delete romset;
+	}
+
+	// host interface and decoder
+	CAPIHost host;
+	std::unique_ptr<DCSDecoder> decoder;
+
+	// ROM set
+	DCSDEC_ROMSET *romset;
+
+	// performance statistics
+	DCSDEC_PERF_STATS stats{ 0, 0, 0, 0, 0 };
+};
+
+
+// --------------------------------------------------------------------------
+//
+// Error handling
+//
+
+// last error message, per thread
+static thread_local std::string lastError;
+
+// set the last error message and return a status code
+static DCSDEC_STATUS Error(DCSDEC_STATUS status, const char *fmt, ...)
+{
+	char buf[512];
+	va_list va;
+	va_start(va, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, va);
+	va_end(va);
+	lastError = buf;
+	return status;
+}
+
+// Set the last error from a caught exception.  The decoder classes throw
+// string literals for fatal conditions (such as a second emulator
+// instance), so pass those through as the message.
+static DCSDEC_STATUS ExceptionError(const char *msg)
+{
+	return Error(DCSDEC_ERR_DECODER, "%s", msg != nullptr ? msg : "Unexpected error in decoder");
+}
+
+// copy a string to a caller buffer, returning the size needed
+static size_t CopyString(const std::string &s, char *buf, size_t bufSize)
+{
+	if (buf != nullptr && bufSize != 0)
+	{
+		size_t n = s.size() < bufSize - 1 ? s.size() : bufSize - 1;
+		memcpy(buf, s.c_str(), n);
+		buf[n] = 0;
+	}
+	return s.size() + 1;
+}
+
+// Wrap a decoder operation, validating the handle and catching exceptions
+template<typename Func>
+static DCSDEC_STATUS DecoderOp(DCSDEC_DECODER *d, Func func)
+{
+	if (d == nullptr || d->decoder == nullptr)
+		return Error(DCSDEC_ERR_INVALID_ARG, "Invalid decoder handle");
+
+	try
+	{
+		return func(d->decoder.get());
+	}
+	catch (const char *msg)
+	{
+		return ExceptionError(msg);
+	}
+	catch (...)
+	{
+		return ExceptionError(nullptr);
+	}
+}
+
+// current steady_clock time in nanoseconds
+static uint64_t Now_ns()
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Library information
+//
+
+int dcsdec_get_api_version(void)
+{
+	return DCSDEC_API_VERSION;
+}
+
+const char *dcsdec_get_last_error(void)
+{
+	return lastError.c_str();
+}
+
+int dcsdec_get_num_decoder_types(void)
+{
+	return static_cast<int>(DCSDecoder::GetRegistrationMap().size());
+}
+
+DCSDEC_STATUS dcsdec_get_decoder_type(int index, const char **name, const char **desc)
+{
+	for (auto &r : DCSDecoder::GetRegistrationMap())
+	{
+		if (index-- == 0)
+		{
+			if (name != nullptr) *name = r.second.name;
+			if (desc != nullptr) *desc = r.second.desc;
+			return DCSDEC_OK;
+		}
+	}
+	return Error(DCSDEC_ERR_NOT_FOUND, "Decoder type index out of range");
+}
+
+
+// --------------------------------------------------------------------------
+//
+// ROM sets
+//
+
+DCSDEC_ROMSET *dcsdec_romset_open_zip(const char *zipFileName, const char *explicitU2)
+{
+	if (zipFileName == nullptr)
+	{
+		Error(DCSDEC_ERR_INVALID_ARG, "Zip file name is null");
+		return nullptr;
+	}
+
+	try
+	{
+		// The Zip loader is a decoder method, since it feeds the ROMs it
+		// identifies to AddROM() as it goes.  Use a scratch native decoder
+		// to run it, and keep the images it identified.
+		DCSDecoder::MinHost host;
+		DCSDecoderNative scratch(&host);
+		std::list<DCSDecoder::ZipFileData> zipFileData;
+		std::string details;
+		if (scratch.LoadROMFromZipFile(zipFileName, zipFileData, explicitU2, &details) != DCSDecoder::ZipLoadStatus::Success)
+		{
+			Error(DCSDEC_ERR_ROM_LOAD, "%s", details.c_str());
+			return nullptr;
+		}
+
+		// copy the identified ROM images into a new ROM set
+		std::unique_ptr<DCSDEC_ROMSET> romset(new DCSDEC_ROMSET());
+		for (auto &zd : zipFileData)
+		{
+			if (zd.chipNum >= 2 && zd.chipNum <= 9)
+				romset->rom[zd.chipNum - 2].assign(zd.data.get(), zd.data.get() + zd.dataSize);
+		}
+		return romset.release();
+	}
+	catch (const char *msg)
+	{
+		ExceptionError(msg);
+		return nullptr;
+	}
+	catch (...)
+	{
+		ExceptionError(nullptr);
+		return nullptr;
+	}
+}
+
+DCSDEC_ROMSET *dcsdec_romset_create(void)
+{
+	return new DCSDEC_ROMSET();
+}
+
+DCSDEC_STATUS dcsdec_romset_add_rom(DCSDEC_ROMSET *romset, int chipNum, const void *data, size_t size)
+{
+	if (romset == nullptr || data == nullptr || size == 0)
+		return Error(DCSDEC_ERR_INVALID_ARG, "Invalid ROM set handle or data buffer");
+	if (chipNum < 2 || chipNum > 9)
+		return Error(DCSDEC_ERR_INVALID_ARG, "Invalid ROM chip number %d (must be 2-9)", chipNum);
+	if (romset->InUse())
+		return Error(DCSDEC_ERR_INVALID_ARG, "ROM set is in use by a decoder");
+
+	auto p = static_cast<const uint8_t*>(data);
+	romset->rom[chipNum - 2].assign(p, p + size);
+	return DCSDEC_OK;
+}
+
+size_t dcsdec_romset_get_rom_size(const DCSDEC_ROMSET *romset, int chipNum)
+{
+	return (romset != nullptr && chipNum >= 2 && chipNum <= 9) ? romset->rom[chipNum - 2].size() : 0;
+}
+
+void dcsdec_romset_delete(DCSDEC_ROMSET *romset)
+{
+	if (romset == nullptr)
+		return;
+
+	// if decoders are still using the set, defer the deletion until the
+	// last one is deleted
+	if (romset->MarkDeleted())
+		delete romset;
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Decoders
+//
+
+DCSDEC_DECODER *dcsdec_decoder_create(DCSDEC_ROMSET *romset, const char *type, uint32_t flags)
+{
+	if (romset == nullptr)
+	{
+		Error(DCSDEC_ERR_INVALID_ARG, "Invalid ROM set handle");
+		return nullptr;
+	}
+	if (romset->rom[0].size() == 0)
+	{
+		Error(DCSDEC_ERR_ROM_LOAD, "ROM set doesn't contain a U2 image");
+		return nullptr;
+	}
+
+	// look up the decoder type
+	if (type == nullptr)
+		type = "native";
+	auto &regMap = DCSDecoder::GetRegistrationMap();
+	auto reg = regMap.find(type);
+	if (reg == regMap.end())
+	{
+		Error(DCSDEC_ERR_NOT_FOUND, "Unknown decoder type \"%s\"", type);
+		return nullptr;
+	}
+
+	try
+	{
+		// create the decoder
+		std::unique_ptr<DCSDEC_DECODER> d(new DCSDEC_DECODER(romset));
+		d->decoder.reset(reg->second.factory(&d->host));
+		if (d->decoder == nullptr)
+		{
+			Error(DCSDEC_ERR_DECODER, "Unable to create decoder of type \"%s\"", type);
+			return nullptr;
+		}
+
+		// add the ROMs
+		for (int i = 0 ; i < 8 ; ++i)
+		{
+			if (auto &r = romset->rom[i]; r.size() != 0)
+				d->decoder->AddROM(i + 2, r.data(), r.size());
+		}
+
+		// check them
+		if (int code = d->decoder->CheckROMs(); code != 1 && (flags & DCSDEC_FLAG_IGNORE_CHECKSUMS) == 0)
+		{
+			Error(DCSDEC_ERR_ROM_CHECKSUM, "ROM checksum failed for ROM image U%d", code);
+			return nullptr;
+		}
+
+		// boot it
+		d->decoder->SetFastBootMode((flags & DCSDEC_FLAG_FAST_BOOT) != 0);
+		d->decoder->HardBoot();
+		d->decoder->StartSelfTests();
+		if (!d->decoder->IsOK())
+		{
+			Error(DCSDEC_ERR_DECODER, "%s", d->decoder->GetErrorMessage().c_str());
+			return nullptr;
+		}
+
+		// success
+		return d.release();
+	}
+	catch (const char *msg)
+	{
+		ExceptionError(msg);
+		return nullptr;
+	}
+	catch (...)
+	{
+		ExceptionError(nullptr);
+		return nullptr;
+	}
+}
+
+void dcsdec_decoder_delete(DCSDEC_DECODER *decoder)
+{
+	delete decoder;
+}
+
+const char *dcsdec_decoder_get_name(const DCSDEC_DECODER *decoder)
+{
+	return (decoder != nullptr && decoder->decoder != nullptr) ? decoder->decoder->Name() : "";
+}
+
+DCSDEC_STATUS dcsdec_decoder_render(DCSDEC_DECODER *decoder, int16_t *buf, size_t n)
+{
+	if (buf == nullptr && n != 0)
+		return Error(DCSDEC_ERR_INVALID_ARG, "Null sample buffer");
+
+	return DecoderOp(decoder, [decoder, buf, n](DCSDecoder *dec)
+	{
+		// Render the block.  This is the one call that a client makes in
+		// bulk, so keep the loop tight: everything else (validation,
+		// exception handling, timing) is amortized over the whole block.
+		uint64_t t0 = Now_ns();
+		for (size_t i = 0 ; i < n ; ++i)
+			buf[i] = dec->GetNextSample();
+		uint64_t dt = Now_ns() - t0;
+
+		// update statistics
+		auto &s = decoder->stats;
+		s.samplesRendered += n;
+		s.renderCalls += 1;
+		s.totalRenderTime_ns += dt;
+		if (dt > s.maxRenderTime_ns)
+			s.maxRenderTime_ns = dt;
+
+		// check for a decoder failure
+		if (!dec->IsOK())
+		{
+			memset(buf, 0, n * sizeof(int16_t));
+			return Error(DCSDEC_ERR_DECODER, "%s", dec->GetErrorMessage().c_str());
+		}
+
+		return DCSDEC_OK;
+	});
+}
+
+DCSDEC_STATUS dcsdec_decoder_write(DCSDEC_DECODER *decoder, const uint8_t *data, size_t n)
+{
+	if (data == nullptr && n != 0)
+		return Error(DCSDEC_ERR_INVALID_ARG, "Null data buffer");
+
+	return DecoderOp(decoder, [decoder, data, n](DCSDecoder *dec)
+	{
+		for (size_t i = 0 ; i < n ; ++i)
+			dec->WriteDataPort(data[i]);
+		decoder->stats.bytesWritten += n;
+		return DCSDEC_OK;
+	});
+}
+
+size_t dcsdec_decoder_read(DCSDEC_DECODER *decoder, uint8_t *buf, size_t bufSize)
+{
+	if (decoder == nullptr || buf == nullptr)
+		return 0;
+
+	size_t n = 0;
+	auto &q = decoder->host.received;
+	for ( ; n < bufSize && q.size() != 0 ; ++n)
+	{
+		buf[n] = q.front();
+		q.pop_front();
+	}
+	return n;
+}
+
+DCSDEC_STATUS dcsdec_decoder_soft_boot(DCSDEC_DECODER *decoder)
+{
+	return DecoderOp(decoder, [](DCSDecoder *dec) { dec->SoftBoot(); return DCSDEC_OK; });
+}
+
+DCSDEC_STATUS dcsdec_decoder_hard_boot(DCSDEC_DECODER *decoder)
+{
+	return DecoderOp(decoder, [](DCSDecoder *dec) { dec->HardBoot(); dec->StartSelfTests(); return DCSDEC_OK; });
+}
+
+DCSDEC_STATUS dcsdec_decoder_set_volume(DCSDEC_DECODER *decoder, int vol)
+{
+	if (vol < 0 || vol > 255)
+		return Error(DCSDEC_ERR_INVALID_ARG, "Volume %d out of range (must be 0-255)", vol);
+	return DecoderOp(decoder, [vol](DCSDecoder *dec) { dec->SetMasterVolume(vol); return DCSDEC_OK; });
+}
+
+DCSDEC_STATUS dcsdec_decoder_set_default_volume(DCSDEC_DECODER *decoder, int vol)
+{
+	if (vol < 0 || vol > 255)
+		return Error(DCSDEC_ERR_INVALID_ARG, "Volume %d out of range (must be 0-255)", vol);
+	return DecoderOp(decoder, [vol](DCSDecoder *dec) { dec->SetDefaultVolume(vol); return DCSDEC_OK; });
+}
+
+int dcsdec_decoder_is_running(const DCSDEC_DECODER *decoder)
+{
+	return (decoder != nullptr && decoder->decoder != nullptr && decoder->decoder->IsRunning()) ? 1 : 0;
+}
+
+size_t dcsdec_decoder_get_signature(DCSDEC_DECODER *decoder, char *buf, size_t bufSize)
+{
+	if (decoder == nullptr || decoder->decoder == nullptr)
+		return CopyString("", buf, bufSize);
+	return CopyString(decoder->decoder->GetSignature(), buf, bufSize);
+}
+
+size_t dcsdec_decoder_get_version_info(const DCSDEC_DECODER *decoder, char *buf, size_t bufSize)
+{
+	if (decoder == nullptr || decoder->decoder == nullptr)
+		return CopyString("", buf, bufSize);
+	return CopyString(decoder->decoder->GetVersionInfo(), buf, bufSize);
+}
+
+int dcsdec_decoder_get_num_channels(const DCSDEC_DECODER *decoder)
+{
+	return (decoder != nullptr && decoder->decoder != nullptr) ? decoder->decoder->GetNumChannels() : 0;
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Track and stream queries
+//
+
+int dcsdec_decoder_get_max_track(const DCSDEC_DECODER *decoder)
+{
+	return (decoder != nullptr && decoder->decoder != nullptr) ? decoder->decoder->GetMaxTrackNumber() : -1;
+}
+
+DCSDEC_STATUS dcsdec_decoder_get_track_info(DCSDEC_DECODER *decoder, int track, DCSDEC_TRACK_INFO *info)
+{
+	if (info == nullptr)
+		return Error(DCSDEC_ERR_INVALID_ARG, "Null track info pointer");
+
+	return DecoderOp(decoder, [track, info](DCSDecoder *dec)
+	{
+		DCSDecoder::TrackInfo ti;
+		if (track < 0 || track > dec->GetMaxTrackNumber() || !dec->GetTrackInfo(static_cast<uint16_t>(track), ti))
+			return Error(DCSDEC_ERR_NOT_FOUND, "Track %04X is not defined", track);
+
+		info->address = ti.address;
+		info->channel = ti.channel;
+		info->type = ti.type;
+		info->deferCode = ti.deferCode;
+		info->reserved = 0;
+		info->time = ti.time;
+		info->looping = ti.looping ? 1 : 0;
+		return DCSDEC_OK;
+	});
+}
+
+size_t dcsdec_decoder_list_streams(DCSDEC_DECODER *decoder, uint32_t *addrs, size_t maxAddrs)
+{
+	size_t total = 0;
+	DecoderOp(decoder, [addrs, maxAddrs, &total](DCSDecoder *dec)
+	{
+		auto streams = dec->ListStreams();
+		total = streams.size();
+		if (addrs != nullptr)
+		{
+			size_t i = 0;
+			for (auto it = streams.begin() ; it != streams.end() && i < maxAddrs ; ++it)
+				addrs[i++] = *it;
+		}
+		return DCSDEC_OK;
+	});
+	return total;
+}
+
+
+// --------------------------------------------------------------------------
+//
+// Performance statistics
+//
+
+DCSDEC_STATUS dcsdec_decoder_get_perf_stats(const DCSDEC_DECODER *decoder, DCSDEC_PERF_STATS *stats)
+{
+	if (decoder == nullptr || stats == nullptr)
+		return Error(DCSDEC_ERR_INVALID_ARG, "Invalid decoder handle or stats pointer");
+	*stats = decoder->stats;
+	return DCSDEC_OK;
+}
+
+DCSDEC_STATUS dcsdec_decoder_reset_perf_stats(DCSDEC_DECODER *decoder)
+{
+	if (decoder == nullptr)
+		return Error(DCSDEC_ERR_INVALID_ARG, "Invalid decoder handle");
+	decoder->stats = DCSDEC_PERF_STATS{ 0, 0, 0, 0, 0 };
+	return DCSDEC_OK;
+}
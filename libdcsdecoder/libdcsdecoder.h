@@ -0,0 +1,257 @@
+// Copyright 2023 Michael J Roberts
+// BSD 3-clause license - NO WARRANTY
+//
+// libdcsdecoder - C API for the DCS Decoder
+//
+// This is a plain C interface to the DCSDecoder classes, packaged as
+// a shared library (a DLL on Windows, a .so on Linux), so that the
+// decoder can be embedded in programs that can't link directly to the
+// C++ classes, or that would rather not compile the decoder sources
+// into every host.  The main intended clients are frontends written in
+// other languages, and scripting environments with a C foreign-function
+// interface, such as Python's ctypes (see python/dcsdecoder.py).
+//
+// The API is organized around two opaque object types:
+//
+// - A ROM set (DCSDEC_ROMSET) holds the ROM images for one game.  You
+//   can load it from a PinMame-style ROM Zip file, or build it from
+//   individual ROM images in memory.  The ROM set owns its own copy of
+//   the ROM data, and it can be shared by any number of decoders, so
+//   you only have to load the ROMs once.  You can delete the ROM set
+//   while decoders created from it still exist; the ROM data stays in
+//   memory until the last of those decoders is deleted.
+//
+// - A decoder (DCSDEC_DECODER) is an instance of one of the decoder
+//   implementations ("native", "emulator-strict", "emulator-fast").
+//   You create it from a ROM set, send it commands via the data port,
+//   and render PCM samples from it in blocks, directly into a buffer
+//   that you provide.
+//
+// All samples are signed 16-bit mono PCM at 31250 samples per second.
+//
+// Errors: functions that create objects return null on failure, and
+// functions that perform operations return a DCSDEC_STATUS code.  In
+// either case, dcsdec_get_last_error() returns a message describing
+// the most recent failure on the calling thread.
+//
+// Threading: the same rules apply as for the underlying C++ classes.
+// A decoder object isn't internally synchronized, so it must only be
+// accessed by one thread at a time, but separate decoders can be used
+// concurrently from separate threads.  The exception is the emulator
+// decoder, which can only be instantiated once at a time per process.
+//
+// ABI stability: the functions and structures declared here form a
+// stable ABI.  New functions might be added in later versions, but
+// existing functions and structure layouts won't change.  Check
+// dcsdec_get_api_version() at run time if you depend on a function
+// added after version 1.
+//
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// API version number.  This is incremented when functions are added.
+#define DCSDEC_API_VERSION  1
+
+// Export/import declarations
+#if defined(_WIN32)
+#  if defined(DCSDEC_BUILDING_DLL)
+#    define DCSDEC_API  __declspec(dllexport)
+#  else
+#    define DCSDEC_API  __declspec(dllimport)
+#  endif
+#elif defined(__GNUC__)
+#  define DCSDEC_API  __attribute__((visibility("default")))
+#else
+#  define DCSDEC_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// opaque object types
+typedef struct DCSDEC_ROMSET DCSDEC_ROMSET;
+typedef struct DCSDEC_DECODER DCSDEC_DECODER;
+
+// status codes
+typedef enum DCSDEC_STATUS
+{
+	DCSDEC_OK = 0,                  // success
+	DCSDEC_ERR_INVALID_ARG = -1,    // invalid argument (null handle, bad buffer, etc)
+	DCSDEC_ERR_ROM_LOAD = -2,       // error loading ROM data
+	DCSDEC_ERR_ROM_CHECKSUM = -3,   // ROM checksum failed
+	DCSDEC_ERR_DECODER = -4,        // decoder error (see dcsdec_get_last_error())
+	DCSDEC_ERR_NOT_FOUND = -5,      // requested object (track, decoder type, etc) not found
+	DCSDEC_ERR_BUFFER_SIZE = -6,    // caller's buffer is too small
+} DCSDEC_STATUS;
+
+// flags for dcsdec_decoder_create()
+#define DCSDEC_FLAG_FAST_BOOT         0x0001   // skip the startup "bong"
+#define DCSDEC_FLAG_IGNORE_CHECKSUMS  0x0002   // proceed even if ROM checksums fail
+
+// Get the API version of the loaded library.  This returns the value of
+// DCSDEC_API_VERSION that the library was built with.
+DCSDEC_API int dcsdec_get_api_version(void);
+
+// Get the message for the most recent error on the calling thread.  The
+// string remains valid until the next call into the library on the same
+// thread.  Returns an empty string if there hasn't been an error.
+DCSDEC_API const char *dcsdec_get_last_error(void);
+
+// Enumerate the available decoder implementations.  'index' runs from
+// 0 to dcsdec_get_num_decoder_types()-1.  The returned name is the string
+// to pass to dcsdec_decoder_create(), and the description is a human-
+// readable explanation.  The strings are static.
+DCSDEC_API int dcsdec_get_num_decoder_types(void);
+DCSDEC_API DCSDEC_STATUS dcsdec_get_decoder_type(int index, const char **name, const char **desc);
+
+
+// --------------------------------------------------------------------------
+//
+// ROM sets
+//
+
+// Load a ROM set from a PinMame-style ROM Zip file.  'explicitU2' can
+// be null, or the name of the file within the Zip to use as the U2 image,
+// for the rare cases where the loader can't identify U2 on its own.
+// Returns null on failure.
+DCSDEC_API DCSDEC_ROMSET *dcsdec_romset_open_zip(const char *zipFileName, const char *explicitU2);
+
+// Create an empty ROM set, to be populated with dcsdec_romset_add_rom().
+DCSDEC_API DCSDEC_ROMSET *dcsdec_romset_create(void);
+
+// Add a ROM image from memory.  'chipNum' is the nominal chip number,
+// 2-9 for U2-U9.  The data is copied, so the caller's buffer doesn't
+// have to remain valid after the call.  Adding a chip number that's
+// already present replaces the old image.  This can't be used after
+// the ROM set has been used to create a decoder.
+DCSDEC_API DCSDEC_STATUS dcsdec_romset_add_rom(DCSDEC_ROMSET *romset, int chipNum, const void *data, size_t size);
+
+// Get the size of a ROM image in the set, in bytes, or 0 if the chip
+// isn't populated.
+DCSDEC_API size_t dcsdec_romset_get_rom_size(const DCSDEC_ROMSET *romset, int chipNum);
+
+// Delete a ROM set.  The handle can't be used after this call.  If any
+// decoders created from the set still exist, the ROM data stays in
+// memory until the last of them is deleted.
+DCSDEC_API void dcsdec_romset_delete(DCSDEC_ROMSET *romset);
+
+
+// --------------------------------------------------------------------------
+//
+// Decoders
+//
+
+// Create a decoder.  'type' is one of the decoder type names from
+// dcsdec_get_decoder_type(), or null for "native".  'flags' is a
+// combination of DCSDEC_FLAG_xxx bits.  This loads the ROMs, checks
+// them, and starts the boot process, so the decoder is ready to render
+// on return.  Returns null on failure.
+DCSDEC_API DCSDEC_DECODER *dcsdec_decoder_create(DCSDEC_ROMSET *romset, const char *type, uint32_t flags);
+
+// Delete a decoder
+DCSDEC_API void dcsdec_decoder_delete(DCSDEC_DECODER *decoder);
+
+// Get the decoder implementation's descriptive name.  The string is static.
+DCSDEC_API const char *dcsdec_decoder_get_name(const DCSDEC_DECODER *decoder);
+
+// Render 'n' samples into 'buf'.  The buffer must have room for 'n'
+// int16_t elements.  Returns DCSDEC_OK on success, or an error code if
+// the decoder has encountered a fatal error, in which case the buffer is
+// filled with silence.
+DCSDEC_API DCSDEC_STATUS dcsdec_decoder_render(DCSDEC_DECODER *decoder, int16_t *buf, size_t n);
+
+// Write bytes to the data port.  This is equivalent to calling the C++
+// WriteDataPort() once for each byte, so a two-byte track command can be
+// sent in a single call.
+DCSDEC_API DCSDEC_STATUS dcsdec_decoder_write(DCSDEC_DECODER *decoder, const uint8_t *data, size_t n);
+
+// Read bytes that the decoder has sent back to the host on the DCS->WPC
+// data port (such as replies to version queries).  Copies up to 'bufSize'
+// bytes, and returns the number of bytes copied.
+DCSDEC_API size_t dcsdec_decoder_read(DCSDEC_DECODER *decoder, uint8_t *buf, size_t bufSize);
+
+// Reboot the decoder.  A soft boot resets the decoder program without
+// the startup "bong"; a hard boot runs the full boot sequence.
+DCSDEC_API DCSDEC_STATUS dcsdec_decoder_soft_boot(DCSDEC_DECODER *decoder);
+DCSDEC_API DCSDEC_STATUS dcsdec_decoder_hard_boot(DCSDEC_DECODER *decoder);
+
+// Set the master volume (0..255), and the default volume applied after
+// each reset
+DCSDEC_API DCSDEC_STATUS dcsdec_decoder_set_volume(DCSDEC_DECODER *decoder, int vol);
+DCSDEC_API DCSDEC_STATUS dcsdec_decoder_set_default_volume(DCSDEC_DECODER *decoder, int vol);
+
+// Is the decoder booted and running?  Returns 1 if so, 0 if it's still
+// booting or has encountered an error.
+DCSDEC_API int dcsdec_decoder_is_running(const DCSDEC_DECODER *decoder);
+
+// Get the ROM signature string and the hardware/software version
+// description.  These copy a null-terminated string into 'buf', and
+// return the buffer size needed (including the terminator), so you can
+// call once with a null buffer to get the size.
+DCSDEC_API size_t dcsdec_decoder_get_signature(DCSDEC_DECODER *decoder, char *buf, size_t bufSize);
+DCSDEC_API size_t dcsdec_decoder_get_version_info(const DCSDEC_DECODER *decoder, char *buf, size_t bufSize);
+
+// Get the number of mixing channels that the ROM's software supports
+DCSDEC_API int dcsdec_decoder_get_num_channels(const DCSDEC_DECODER *decoder);
+
+
+// --------------------------------------------------------------------------
+//
+// Track and stream queries
+//
+
+// Get the highest valid track number
+DCSDEC_API int dcsdec_decoder_get_max_track(const DCSDEC_DECODER *decoder);
+
+// Track information.  The fields have the same meanings as in the C++
+// DCSDecoder::TrackInfo struct.
+typedef struct DCSDEC_TRACK_INFO
+{
+	uint32_t address;      // linear ROM address of the track program
+	int32_t channel;       // channel number, 0..7
+	int32_t type;          // track type code (1 = program, 2 = deferred, 3 = deferred indirect)
+	uint16_t deferCode;    // deferred track link code, for types 2 and 3
+	uint16_t reserved;     // reserved for alignment; always zero
+	uint32_t time;         // playback time in frames (7.68ms units), or 0 if unknown
+	int32_t looping;       // 1 if the track loops forever, 0 if not
+} DCSDEC_TRACK_INFO;
+
+// Get information on a track.  Returns DCSDEC_ERR_NOT_FOUND if the track
+// number is undefined in the ROM catalog.
+DCSDEC_API DCSDEC_STATUS dcsdec_decoder_get_track_info(DCSDEC_DECODER *decoder, int track, DCSDEC_TRACK_INFO *info);
+
+// List the audio streams referenced from the track programs.  Copies up
+// to 'maxAddrs' linear ROM addresses into 'addrs', and returns the total
+// number of streams, so you can call once with a null buffer to get the
+// count.
+DCSDEC_API size_t dcsdec_decoder_list_streams(DCSDEC_DECODER *decoder, uint32_t *addrs, size_t maxAddrs);
+
+
+// --------------------------------------------------------------------------
+//
+// Performance statistics
+//
+typedef struct DCSDEC_PERF_STATS
+{
+	// total samples rendered, and number of render calls
+	uint64_t samplesRendered;
+	uint64_t renderCalls;
+
+	// total and longest wall-clock time spent in render calls, in nanoseconds
+	uint64_t totalRenderTime_ns;
+	uint64_t maxRenderTime_ns;
+
+	// total data port bytes written
+	uint64_t bytesWritten;
+} DCSDEC_PERF_STATS;
+
+// Get and reset the decoder's performance statistics
+DCSDEC_API DCSDEC_STATUS dcsdec_decoder_get_perf_stats(const DCSDEC_DECODER *decoder, DCSDEC_PERF_STATS *stats);
+DCSDEC_API DCSDEC_STATUS dcsdec_decoder_reset_perf_stats(DCSDEC_DECODER *decoder);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,326 @@
+# Copyright 2023 Michael J Roberts
+# BSD 3-clause license - NO WARRANTY
+#
+# Python bindings for libdcsdecoder
+#
+# This is a thin ctypes wrapper over the libdcsdecoder C API.  Samples are
+# rendered in blocks directly into numpy arrays, so there's one foreign
+# function call per block rather than per sample, and no intermediate
+# copies: the library writes straight into the array's memory.
+#
+# Example:
+#
+#   import dcsdecoder
+#   roms = dcsdecoder.RomSet.open_zip("mm_109c.zip")
+#   dec = dcsdecoder.Decoder(roms, fast_boot=True)
+#   dec.write(b"\x00\x01")              # play track 0001
+#   pcm = dec.render(31250 * 10)        # ten seconds, int16 numpy array
+#
+# The library is located by the DCSDECODER_LIB environment variable if
+# set, otherwise by the platform's normal shared library search, under
+# the name libdcsdecoder.so / libdcsdecoder.dll / libdcsdecoder.dylib.
+
+import ctypes
+import os
+import sys
+from collections import namedtuple
+
+import numpy as np
+
+SAMPLE_RATE = 31250
+
+FLAG_FAST_BOOT = 0x0001
+FLAG_IGNORE_CHECKSUMS = 0x0002
+
+
+def _load_library():
+    path = os.environ.get("DCSDECODER_LIB")
+    if path is None:
+        if sys.platform == "win32":
+            path = "libdcsdecoder.dll"
+        elif sys.platform == "darwin":
+            path = "libdcsdecoder.dylib"
+        else:
+            path = "libdcsdecoder.so"
+    return ctypes.CDLL(path)
+
+
+_lib = _load_library()
+
+_c_romset_p = ctypes.c_void_p
+_c_decoder_p = ctypes.c_void_p
+
+
+class _TrackInfo(ctypes.Structure):
+    _fields_ = [
+        ("address", ctypes.c_uint32),
+        ("channel", ctypes.c_int32),
+        ("type", ctypes.c_int32),
+        ("deferCode", ctypes.c_uint16),
+        ("reserved", ctypes.c_uint16),
+        ("time", ctypes.c_uint32),
+        ("looping", ctypes.c_int32),
+    ]
+
+
+class _PerfStats(ctypes.Structure):
+    _fields_ = [
+        ("samplesRendered", ctypes.c_uint64),
+        ("renderCalls", ctypes.c_uint64),
+        ("totalRenderTime_ns", ctypes.c_uint64),
+        ("maxRenderTime_ns", ctypes.c_uint64),
+        ("bytesWritten", ctypes.c_uint64),
+    ]
+
+
+def _proto(name, restype, *argtypes):
+    f = getattr(_lib, name)
+    f.restype = restype
+    f.argtypes = list(argtypes)
+    return f
+
+
+_get_api_version = _proto("dcsdec_get_api_version", ctypes.c_int)
+_get_last_error = _proto("dcsdec_get_last_error", ctypes.c_char_p)
+_get_num_decoder_types = _proto("dcsdec_get_num_decoder_types", ctypes.c_int)
+_get_decoder_type = _proto("dcsdec_get_decoder_type", ctypes.c_int,
+                           ctypes.c_int, ctypes.POINTER(ctypes.c_char_p), ctypes.POINTER(ctypes.c_char_p))
+
+_romset_open_zip = _proto("dcsdec_romset_open_zip", _c_romset_p, ctypes.c_char_p, ctypes.c_char_p)
+_romset_create = _proto("dcsdec_romset_create", _c_romset_p)
+_romset_add_rom = _proto("dcsdec_romset_add_rom", ctypes.c_int,
+                         _c_romset_p, ctypes.c_int, ctypes.c_void_p, ctypes.c_size_t)
+_romset_get_rom_size = _proto("dcsdec_romset_get_rom_size", ctypes.c_size_t, _c_romset_p, ctypes.c_int)
+_romset_delete = _proto("dcsdec_romset_delete", None, _c_romset_p)
+
+_decoder_create = _proto("dcsdec_decoder_create", _c_decoder_p, _c_romset_p, ctypes.c_char_p, ctypes.c_uint32)
+_decoder_delete = _proto("dcsdec_decoder_delete", None, _c_decoder_p)
+_decoder_get_name = _proto("dcsdec_decoder_get_name", ctypes.c_char_p, _c_decoder_p)
+_decoder_render = _proto("dcsdec_decoder_render", ctypes.c_int, _c_decoder_p, ctypes.c_void_p, ctypes.c_size_t)
+_decoder_write = _proto("dcsdec_decoder_write", ctypes.c_int, _c_decoder_p, ctypes.c_char_p, ctypes.c_size_t)
+_decoder_read = _proto("dcsdec_decoder_read", ctypes.c_size_t, _c_decoder_p, ctypes.c_void_p, ctypes.c_size_t)
+_decoder_soft_boot = _proto("dcsdec_decoder_soft_boot", ctypes.c_int, _c_decoder_p)
+_decoder_hard_boot = _proto("dcsdec_decoder_hard_boot", ctypes.c_int, _c_decoder_p)
+_decoder_set_volume = _proto("dcsdec_decoder_set_volume", ctypes.c_int, _c_decoder_p, ctypes.c_int)
+_decoder_set_default_volume = _proto("dcsdec_decoder_set_default_volume", ctypes.c_int, _c_decoder_p, ctypes.c_int)
+_decoder_is_running = _proto("dcsdec_decoder_is_running", ctypes.c_int, _c_decoder_p)
+_decoder_get_signature = _proto("dcsdec_decoder_get_signature", ctypes.c_size_t,
+                                _c_decoder_p, ctypes.c_char_p, ctypes.c_size_t)
+_decoder_get_version_info = _proto("dcsdec_decoder_get_version_info", ctypes.c_size_t,
+                                   _c_decoder_p, ctypes.c_char_p, ctypes.c_size_t)
+_decoder_get_num_channels = _proto("dcsdec_decoder_get_num_channels", ctypes.c_int, _c_decoder_p)
+_decoder_get_max_track = _proto("dcsdec_decoder_get_max_track", ctypes.c_int, _c_decoder_p)
+_decoder_get_track_info = _proto("dcsdec_decoder_get_track_info", ctypes.c_int,
+                                 _c_decoder_p, ctypes.c_int, ctypes.POINTER(_TrackInfo))
+_decoder_list_streams = _proto("dcsdec_decoder_list_streams", ctypes.c_size_t,
+                               _c_decoder_p, ctypes.c_void_p, ctypes.c_size_t)
+_decoder_get_perf_stats = _proto("dcsdec_decoder_get_perf_stats", ctypes.c_int,
+                                 _c_decoder_p, ctypes.POINTER(_PerfStats))
+_decoder_reset_perf_stats = _proto("dcsdec_decoder_reset_perf_stats", ctypes.c_int, _c_decoder_p)
+
+
+class DCSDecoderError(Exception):
+    """Error reported by the decoder library"""
+    def __init__(self, status, message):
+        super().__init__(message)
+        self.status = status
+
+
+def _check(status):
+    if status != 0:
+        raise DCSDecoderError(status, _get_last_error().decode("utf-8", "replace"))
+
+
+def _get_string(func, handle):
+    n = func(handle, None, 0)
+    buf = ctypes.create_string_buffer(n)
+    func(handle, buf, n)
+    return buf.value.decode("latin-1")
+
+
+def api_version():
+    """Get the library's API version number"""
+    return _get_api_version()
+
+
+def decoder_types():
+    """List the available decoder implementations, as (name, description) pairs"""
+    result = []
+    for i in range(_get_num_decoder_types()):
+        name, desc = ctypes.c_char_p(), ctypes.c_char_p()
+        _check(_get_decoder_type(i, ctypes.byref(name), ctypes.byref(desc)))
+        result.append((name.value.decode(), desc.value.decode()))
+    return result
+
+
+TrackInfo = namedtuple("TrackInfo", "address channel type defer_code time looping")
+PerfStats = namedtuple("PerfStats", "samples_rendered render_calls total_render_time_ns "
+                                    "max_render_time_ns bytes_written")
+
+
+class RomSet:
+    """A set of ROM images for one game, shareable among decoders"""
+
+    def __init__(self, handle=None):
+        self._handle = handle if handle is not None else _romset_create()
+        if not self._handle:
+            raise DCSDecoderError(-1, _get_last_error().decode("utf-8", "replace"))
+
+    @classmethod
+    def open_zip(cls, path, explicit_u2=None):
+        """Load a PinMame-style ROM Zip file"""
+        h = _romset_open_zip(os.fsencode(path), explicit_u2.encode() if explicit_u2 else None)
+        if not h:
+            raise DCSDecoderError(-2, _get_last_error().decode("utf-8", "replace"))
+        return cls(h)
+
+    @classmethod
+    def from_images(cls, images):
+        """Build a ROM set from a dict of {chip number: bytes-like image}"""
+        rs = cls()
+        for chip, data in images.items():
+            rs.add_rom(chip, data)
+        return rs
+
+    def add_rom(self, chip_num, data):
+        """Add a ROM image (U2-U9 = chip number 2-9); the data is copied"""
+        buf = (ctypes.c_char * len(data)).from_buffer_copy(data)
+        _check(_romset_add_rom(self._handle, chip_num, buf, len(data)))
+
+    def rom_size(self, chip_num):
+        return _romset_get_rom_size(self._handle, chip_num)
+
+    def close(self):
+        if self._handle:
+            _romset_delete(self._handle)
+            self._handle = None
+
+    def __del__(self):
+        self.close()
+
+
+class Decoder:
+    """A DCS decoder instance"""
+
+    def __init__(self, romset, type="native", fast_boot=False, ignore_checksums=False):
+        flags = (FLAG_FAST_BOOT if fast_boot else 0) | (FLAG_IGNORE_CHECKSUMS if ignore_checksums else 0)
+        self._handle = _decoder_create(romset._handle, type.encode() if type else None, flags)
+        if not self._handle:
+            raise DCSDecoderError(-4, _get_last_error().decode("utf-8", "replace"))
+
+        # keep the ROM set alive as long as we're using it
+        self._romset = romset
+
+    def close(self):
+        if self._handle:
+            _decoder_delete(self._handle)
+            self._handle = None
+            self._romset = None
+
+    def __del__(self):
+        self.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    @property
+    def name(self):
+        return _decoder_get_name(self._handle).decode()
+
+    def render_into(self, out):
+        """Render len(out) samples directly into an existing int16 numpy array.
+
+        The array must be C-contiguous and writable.  This is the zero-copy
+        path: the library writes into the array's own memory."""
+        if out.dtype != np.int16 or not out.flags["C_CONTIGUOUS"] or not out.flags["WRITEABLE"]:
+            raise ValueError("output array must be a writable, C-contiguous int16 array")
+        _check(_decoder_render(self._handle, out.ctypes.data, out.size))
+        return out
+
+    def render(self, n):
+        """Render n samples into a new int16 numpy array"""
+        return self.render_into(np.empty(n, dtype=np.int16))
+
+    def write(self, data):
+        """Write bytes to the data port (e.g. b"\\x00\\x01" to play track 0001)"""
+        data = bytes(data)
+        _check(_decoder_write(self._handle, data, len(data)))
+
+    def play_track(self, track):
+        """Send a track command"""
+        self.write(bytes([(track >> 8) & 0xFF, track & 0xFF]))
+
+    def read(self, max_bytes=256):
+        """Read bytes the decoder sent back on the DCS->WPC data port"""
+        buf = ctypes.create_string_buffer(max_bytes)
+        n = _decoder_read(self._handle, buf, max_bytes)
+        return buf.raw[:n]
+
+    def soft_boot(self):
+        _check(_decoder_soft_boot(self._handle))
+
+    def hard_boot(self):
+        _check(_decoder_hard_boot(self._handle))
+
+    def set_volume(self, vol):
+        _check(_decoder_set_volume(self._handle, vol))
+
+    def set_default_volume(self, vol):
+        _check(_decoder_set_default_volume(self._handle, vol))
+
+    @property
+    def is_running(self):
+        return _decoder_is_running(self._handle) != 0
+
+    @property
+    def signature(self):
+        return _get_string(_decoder_get_signature, self._handle)
+
+    @property
+    def version_info(self):
+        return _get_string(_decoder_get_version_info, self._handle)
+
+    @property
+    def num_channels(self):
+        return _decoder_get_num_channels(self._handle)
+
+    @property
+    def max_track(self):
+        return _decoder_get_max_track(self._handle)
+
+    def track_info(self, track):
+        """Get a TrackInfo tuple for a track, or None if the track is undefined"""
+        ti = _TrackInfo()
+        status = _decoder_get_track_info(self._handle, track, ctypes.byref(ti))
+        if status == -5:
+            return None
+        _check(status)
+        return TrackInfo(ti.address, ti.channel, ti.type, ti.deferCode, ti.time, bool(ti.looping))
+
+    def tracks(self):
+        """Get a dict of {track number: TrackInfo} for all defined tracks"""
+        result = {}
+        for t in range(self.max_track + 1):
+            ti = self.track_info(t)
+            if ti is not None:
+                result[t] = ti
+        return result
+
+    def streams(self):
+        """List the linear ROM addresses of the audio streams, as a uint32 numpy array"""
+        n = _decoder_list_streams(self._handle, None, 0)
+        out = np.empty(n, dtype=np.uint32)
+        _decoder_list_streams(self._handle, out.ctypes.data, n)
+        return out
+
+    def perf_stats(self):
+        s = _PerfStats()
+        _check(_decoder_get_perf_stats(self._handle, ctypes.byref(s)))
+        return PerfStats(s.samplesRendered, s.renderCalls, s.totalRenderTime_ns,
+                         s.maxRenderTime_ns, s.bytesWritten)
+
+    def reset_perf_stats(self):
+        _check(_decoder_reset_perf_stats(self._handle))